@@ -0,0 +1,614 @@
+/***************************************************************************
+ copyright            : (C) 2011 by Andrea Perna
+ email                : perna@math.uu.se
+ ***************************************************************************/
+
+/*******************************************************************************
+ *     This program is free software: you can redistribute it and/or modify     *
+ *     it under the terms of the GNU General Public License as published by     *
+ *     the Free Software Foundation, either version 3 of the License, or        *
+ *     (at your option) any later version.                                      *
+ *                                                                              *
+ *     This program is distributed in the hope that it will be useful,          *
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the            *
+ *     GNU General Public License for more details.                             *
+ *                                                                              *
+ *     You can find a copy of the GNU General Public License at the             *
+ *     following address: <http://www.gnu.org/licenses/>.                       *
+ ********************************************************************************/
+
+#include "benchmark.h"
+#include "graphwidget.h"
+#include "samplerbenchmark.h"
+#include "perfcounters.h"
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QTextStream>
+#include <QElapsedTimer>
+#include <QImage>
+#include <QPainter>
+#include <QBuffer>
+#include <QMap>
+#include <QJsonDocument>
+#include <QJsonArray>
+#include <QDateTime>
+#include <QTemporaryDir>
+#include <QCommandLineParser>
+#include <QtSvg/QSvgGenerator>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+
+using namespace std;
+
+
+static const int benchmarkSeed = 12345; // every repetition simulates the same random sequence
+static const double regressionTolerance = 0.05; // differences of the median smaller than this are ignored
+
+
+
+
+// probability that a binomial(n, 1/2) variable is at most k
+static double binomialHalfCdf(int n, int k)
+{
+	double probability = 0;
+	double term = pow(0.5, n);
+	for (int i = 0; i <= k; i++)
+	{
+		probability += term;
+		term = term * (n - i) / (i + 1);
+	}
+	return probability;
+}
+
+
+/* The interval between the j-th smallest and the j-th largest of n samples
+ contains the true median unless at least n-j+1 samples fall on the same side of
+ it, which has probability 2 P(B <= j-1) with B binomial(n, 1/2). The narrowest
+ interval with at least the requested coverage is returned. With fewer than six
+ samples no interval reaches 95%, the range of the samples is returned and the
+ coverage reported is the actual one. */
+
+BenchmarkStatistics medianWithConfidenceInterval(QVector<double> samples, double confidence)
+{
+	BenchmarkStatistics statistics;
+	statistics.median = 0;
+	statistics.low = 0;
+	statistics.high = 0;
+	statistics.confidence = 0;
+	int n = samples.size();
+	if (n == 0)
+		return statistics;
+	
+	std::sort(samples.begin(), samples.end());
+	if (n % 2 == 1)
+		statistics.median = samples[n/2];
+	else
+		statistics.median = 0.5 * (samples[n/2 - 1] + samples[n/2]);
+	
+	int j = 1;
+	for (int candidate = 2; candidate <= n/2; candidate++)
+	{
+		if (1 - 2 * binomialHalfCdf(n, candidate - 1) < confidence)
+			break;
+		j = candidate;
+	}
+	statistics.low = samples[j - 1];
+	statistics.high = samples[n - j];
+	statistics.confidence = qMax(0.0, 1 - 2 * binomialHalfCdf(n, j - 1));
+	return statistics;
+}
+
+
+QJsonObject statisticsToJson(const QVector<double> &samples)
+{
+	BenchmarkStatistics statistics = medianWithConfidenceInterval(samples);
+	QJsonObject object;
+	object.insert("median", statistics.median);
+	object.insert("low", statistics.low);
+	object.insert("high", statistics.high);
+	object.insert("confidence", statistics.confidence);
+	QJsonArray allSamples;
+	foreach (double sample, samples)
+	{
+		allSamples.append(sample);
+	}
+	object.insert("samples", allSamples);
+	return object;
+}
+
+
+
+
+bool isBenchmarkRequested(const QStringList &arguments)
+{
+	return arguments.contains("--benchmark") || arguments.contains("--benchmark-samplers");
+}
+
+
+// reads and splits the lines of a network file as drawGraph does, without building anything
+static int parseNetworkFile(QString fileName)
+{
+	QFile file(fileName);
+	if (!file.open(QIODevice::ReadOnly | QIODevice::Text))
+		return 0;
+	QTextStream in(&file);
+	int nFields = 0;
+	while (!in.atEnd())
+	{
+		QString line = in.readLine();
+		QStringList fields = line.split(' ', QString::SkipEmptyParts);
+		for (int i = 0; i < fields.size(); i++)
+		{
+			fields[i].toDouble();
+		}
+		nFields += fields.size();
+	}
+	return nFields;
+}
+
+
+static double elapsedMilliseconds(const QElapsedTimer &timer)
+{
+	return timer.nsecsElapsed() / 1e6;
+}
+
+
+// the parameters of a first run of the program, so that results do not depend on the user settings
+void setDefaultParameters(GraphWidget &graph)
+{
+	graph.setChargePerParticle(0.05);
+	graph.setDeltaT(0.001);
+	graph.setMinSigma(0.001);
+	graph.setParticlesAtSource(10);
+	graph.setInitialNParticlesPerNode(10);
+	graph.setExponentEdgeWidthForSigma(2);
+	graph.setMultiplicativeFactorEdgeSigma(10);
+}
+
+
+/* Per step averages of the counters of a phase, with the instructions per cycle
+ and the misses per edge that tell whether a change of the memory layout helped. */
+
+static QJsonObject countersToJson(PerfCounterGroup &counters, int nEdges)
+{
+	QJsonObject object;
+	int nSteps = qMax(1, counters.getNumberOfIntervals());
+	for (int counter = 0; counter < PerfCounterGroup::NumberOfCounters; counter++)
+	{
+		if (counters.isAvailable(counter))
+			object.insert(PerfCounterGroup::counterName(counter) + "_per_step", double(counters.getValue(counter)) / nSteps);
+	}
+	if (counters.isAvailable(PerfCounterGroup::Cycles) && counters.isAvailable(PerfCounterGroup::Instructions)
+		&& counters.getValue(PerfCounterGroup::Cycles) > 0)
+	{
+		object.insert("ipc", double(counters.getValue(PerfCounterGroup::Instructions)) / counters.getValue(PerfCounterGroup::Cycles));
+	}
+	if (nEdges > 0)
+	{
+		if (counters.isAvailable(PerfCounterGroup::CacheMisses))
+			object.insert("llc_misses_per_edge", double(counters.getValue(PerfCounterGroup::CacheMisses)) / nSteps / nEdges);
+		if (counters.isAvailable(PerfCounterGroup::BranchMisses))
+			object.insert("branch_misses_per_edge", double(counters.getValue(PerfCounterGroup::BranchMisses)) / nSteps / nEdges);
+	}
+	return object;
+}
+
+
+/* Steps run apart from the timed ones, with the recolouring on, while the
+ hardware counters are read around the edge loop and the recolouring. */
+
+static QJsonObject countNetworkEvents(GraphWidget &graph, int nSteps)
+{
+	QJsonObject result;
+	PerfCounterGroup edgeLoopCounters;
+	PerfCounterGroup recolourCounters;
+	if (!edgeLoopCounters.open() || !recolourCounters.open())
+	{
+		result.insert("error", QString("perf_event_open failed, see /proc/sys/kernel/perf_event_paranoid"));
+		return result;
+	}
+	
+	qsrand(benchmarkSeed);
+	srand(benchmarkSeed);
+	graph.setSigmaAsFunctionOfFlow(false);
+	graph.setShowUpdate(true);
+	graph.setPerfCounters(&edgeLoopCounters, &recolourCounters);
+	for (int step = 0; step < nSteps; step++)
+	{
+		graph.performOneSimulationStep();
+	}
+	graph.setPerfCounters(NULL, NULL);
+	
+	result.insert("edge_loop", countersToJson(edgeLoopCounters, graph.getNumberOfEdges()));
+	result.insert("recolour", countersToJson(recolourCounters, graph.getNumberOfEdges()));
+	return result;
+}
+
+
+static double relativeDistance(const QVector<double> &a, const QVector<double> &b)
+{
+	double squaredDifference = 0;
+	double squaredNorm = 0;
+	for (int i = 0; i < a.size(); i++)
+	{
+		squaredDifference += (a[i] - b[i]) * (a[i] - b[i]);
+		squaredNorm += b[i] * b[i];
+	}
+	return squaredNorm > 0 ? sqrt(squaredDifference / squaredNorm) : 0;
+}
+
+
+/* Whether the parallel edge loop changes the statistics of a run. Runs of
+ nSteps from the loaded network, each with its own seed, give the mean
+ particles at every node with the sequential and with the parallel loop. Their
+ distance is compared with the one expected from the noise alone, estimated
+ from the two halves of the sequential runs: two means of n/2 runs each differ
+ by sqrt(2) times more than two means of n runs. */
+
+static QJsonObject compareParallelStatistics(GraphWidget &graph, QString fileName, int nRuns, int nSteps, int nThreads)
+{
+	QVector<double> sequentialMean, parallelMean, firstHalfMean, secondHalfMean;
+	int loopThreads[2] = { 1, nThreads };
+	for (int loop = 0; loop < 2; loop++)
+	{
+		int threads = loopThreads[loop];
+		graph.setEdgeLoopThreads(threads);
+		for (int run = 0; run < nRuns; run++)
+		{
+			graph.drawGraph(fileName);
+			qsrand(benchmarkSeed + run);
+			srand(benchmarkSeed + run);
+			for (int step = 0; step < nSteps; step++)
+			{
+				graph.performOneSimulationStep();
+			}
+			QVector<int> nParticles = graph.getParticlesPerNode();
+			QVector<double> &mean = threads == 1 ? sequentialMean : parallelMean;
+			QVector<double> &half = run < nRuns / 2 ? firstHalfMean : secondHalfMean;
+			mean.resize(nParticles.size());
+			half.resize(nParticles.size());
+			for (int i = 0; i < nParticles.size(); i++)
+			{
+				mean[i] += double(nParticles[i]) / nRuns;
+				if (threads == 1)
+					half[i] += nParticles[i];
+			}
+		}
+	}
+	graph.setEdgeLoopThreads(1);
+	
+	QJsonObject result;
+	result.insert("runs", nRuns);
+	result.insert("threads", nThreads);
+	result.insert("relative_difference", relativeDistance(parallelMean, sequentialMean));
+	if (nRuns >= 2)
+	{
+		for (int i = 0; i < firstHalfMean.size(); i++)
+		{
+			firstHalfMean[i] /= nRuns / 2;
+			secondHalfMean[i] /= nRuns - nRuns / 2;
+		}
+		result.insert("expected_noise", relativeDistance(firstHalfMean, secondHalfMean) / sqrt(2.0));
+	}
+	return result;
+}
+
+
+/* Whether the colours of the edges see the idle edges of the active set. With
+ the conductivities fixed, the largest one is the same at every step, and the
+ maxSigma of the recolouring must be equal to it, as with the loops that visit
+ every edge. At the start most edges are idle, their ends have the same
+ number of particles. */
+
+static QJsonObject checkMaxSigma(GraphWidget &graph, QString fileName, int nSteps)
+{
+	graph.drawGraph(fileName);
+	qsrand(benchmarkSeed);
+	srand(benchmarkSeed);
+	graph.setShowUpdate(true);
+	graph.setSigmaAsFunctionOfFlow(false);
+	double largestSigma = 0;
+	foreach (double sigma, graph.getSigmaPerEdge())
+	{
+		largestSigma = qMax(largestSigma, sigma);
+	}
+	int nWrongSteps = 0;
+	for (int step = 0; step < nSteps; step++)
+	{
+		graph.performOneSimulationStep();
+		if (graph.getMaxSigma() != largestSigma)
+			nWrongSteps++;
+	}
+	graph.setShowUpdate(false);
+	
+	QJsonObject result;
+	result.insert("largest_sigma", largestSigma);
+	result.insert("max_sigma", graph.getMaxSigma());
+	result.insert("wrong_steps", nWrongSteps);
+	return result;
+}
+
+
+static QJsonObject benchmarkNetwork(QString fileName, int nRepetitions, int nSteps, QString scratchDirectory, QString nodeOrdering, bool isCountingEvents, int nParallelThreads)
+{
+	QMap<QString, QVector<double> > times;
+	GraphWidget graph(NULL);
+	setDefaultParameters(graph);
+	graph.setNodeOrdering(nodeOrdering);
+	graph.setUsingSidecar(false); // the loads are timed from the file, and the networks directory stays clean
+	QElapsedTimer timer;
+	
+	for (int repetition = 0; repetition < nRepetitions; repetition++)
+	{
+		timer.start();
+		parseNetworkFile(fileName);
+		times["parse"].append(elapsedMilliseconds(timer));
+		
+		timer.start();
+		graph.drawGraph(fileName);
+		times["load"].append(elapsedMilliseconds(timer));
+		
+		qsrand(benchmarkSeed);
+		srand(benchmarkSeed); // for the shuffling of the edges
+		graph.setShowUpdate(false);
+		graph.setSigmaAsFunctionOfFlow(false);
+		timer.start();
+		for (int step = 0; step < nSteps; step++)
+		{
+			graph.performOneSimulationStep();
+		}
+		times["steps_fixed_sigma"].append(elapsedMilliseconds(timer));
+		
+		graph.setSigmaAsFunctionOfFlow(true);
+		timer.start();
+		for (int step = 0; step < nSteps; step++)
+		{
+			graph.performOneSimulationStep();
+		}
+		times["steps_updating_sigma"].append(elapsedMilliseconds(timer));
+		
+		graph.setSeriesReduction(true);
+		timer.start();
+		for (int step = 0; step < nSteps; step++)
+		{
+			graph.performOneSimulationStep();
+		}
+		times["steps_series_reduced"].append(elapsedMilliseconds(timer));
+		graph.setSeriesReduction(false);
+		graph.setSigmaAsFunctionOfFlow(false);
+		
+		if (nParallelThreads > 1)
+		{
+			graph.setEdgeLoopThreads(nParallelThreads);
+			timer.start();
+			for (int step = 0; step < nSteps; step++)
+			{
+				graph.performOneSimulationStep();
+			}
+			times["steps_parallel"].append(elapsedMilliseconds(timer));
+			graph.setEdgeLoopThreads(1);
+		}
+		
+		timer.start();
+		graph.setShowUpdate(true);
+		times["recolour"].append(elapsedMilliseconds(timer));
+		
+		// the same pictures as MainWindow::exportPicture and MainWindow::exportSVG
+		timer.start();
+		QImage image(QSize(1100, 1100), QImage::Format_ARGB32_Premultiplied);
+		QPainter imagePainter;
+		imagePainter.begin(&image);
+		imagePainter.setRenderHint(QPainter::Antialiasing, true);
+		graph.paintPicture(imagePainter);
+		imagePainter.end();
+		times["paint_image"].append(elapsedMilliseconds(timer));
+		
+		timer.start();
+		QBuffer svgBuffer;
+		QSvgGenerator generator;
+		generator.setOutputDevice(&svgBuffer);
+		generator.setSize(QSize(1100, 1100));
+		generator.setViewBox(QRect(0, 0, 1100, 1100));
+		QPainter svgPainter;
+		svgPainter.begin(&generator);
+		svgPainter.setRenderHint(QPainter::Antialiasing, true);
+		graph.paintPicture(svgPainter);
+		svgPainter.end();
+		times["paint_svg"].append(elapsedMilliseconds(timer));
+		
+		timer.start();
+		graph.saveGraph(scratchDirectory + "/benchmark.net");
+		times["save_pajek"].append(elapsedMilliseconds(timer));
+	}
+	
+	QJsonObject operations;
+	QMap<QString, QVector<double> >::const_iterator it;
+	for (it = times.constBegin(); it != times.constEnd(); ++it)
+	{
+		operations.insert(it.key(), statisticsToJson(it.value()));
+	}
+	QJsonObject result;
+	result.insert("nodes", graph.getNumberOfNodes());
+	result.insert("edges", graph.getNumberOfEdges());
+	graph.setSeriesReduction(true);
+	result.insert("seriesReducedEdges", graph.getNumberOfSimulatedEdges());
+	graph.setSeriesReduction(false);
+	result.insert("operations", operations);
+	QJsonObject maxSigmaCheck = checkMaxSigma(graph, fileName, nSteps);
+	if (maxSigmaCheck.value("wrong_steps").toInt() > 0)
+	{
+		cerr << "  maxSigma differs from the largest conductivity in " << maxSigmaCheck.value("wrong_steps").toInt()
+		<< " steps: " << maxSigmaCheck.value("max_sigma").toDouble() << " instead of " << maxSigmaCheck.value("largest_sigma").toDouble() << endl;
+	}
+	result.insert("max_sigma_check", maxSigmaCheck);
+	if (nParallelThreads > 1)
+	{
+		QJsonObject statistics = compareParallelStatistics(graph, fileName, nRepetitions, nSteps, nParallelThreads);
+		cout << "  parallel edges: mean particles differ by " << statistics.value("relative_difference").toDouble()
+		<< ", noise alone " << statistics.value("expected_noise").toDouble() << endl;
+		result.insert("parallel_statistics", statistics);
+	}
+	if (isCountingEvents)
+	{
+		QJsonObject counters = countNetworkEvents(graph, nSteps);
+		if (counters.contains("error"))
+		{
+			cerr << counters.value("error").toString().toStdString() << endl;
+		}
+		else
+		{
+			QJsonObject edgeLoop = counters.value("edge_loop").toObject();
+			cout << "  edge loop: " << edgeLoop.value("ipc").toDouble() << " instructions per cycle, "
+			<< edgeLoop.value("llc_misses_per_edge").toDouble() << " cache misses per edge" << endl;
+		}
+		result.insert("counters", counters);
+	}
+	return result;
+}
+
+
+/* Prints the operations whose median changed by more than the tolerance with
+ intervals that do not overlap, and returns the number of regressions. */
+
+static int compareWithBaseline(const QJsonObject &results, const QJsonObject &baseline)
+{
+	int nRegressions = 0;
+	QJsonObject networks = results.value("networks").toObject();
+	QJsonObject baselineNetworks = baseline.value("networks").toObject();
+	foreach (QString network, networks.keys())
+	{
+		if (!baselineNetworks.contains(network))
+			continue;
+		QJsonObject operations = networks.value(network).toObject().value("operations").toObject();
+		QJsonObject baselineOperations = baselineNetworks.value(network).toObject().value("operations").toObject();
+		foreach (QString operation, operations.keys())
+		{
+			if (!baselineOperations.contains(operation))
+				continue;
+			QJsonObject now = operations.value(operation).toObject();
+			QJsonObject before = baselineOperations.value(operation).toObject();
+			double median = now.value("median").toDouble();
+			double baselineMedian = before.value("median").toDouble();
+			double change = baselineMedian > 0 ? median / baselineMedian - 1 : 0;
+			
+			QString verdict;
+			if (now.value("low").toDouble() > before.value("high").toDouble() && change > regressionTolerance)
+			{
+				verdict = "REGRESSION";
+				nRegressions++;
+			}
+			else if (now.value("high").toDouble() < before.value("low").toDouble() && change < -regressionTolerance)
+			{
+				verdict = "improvement";
+			}
+			else
+			{
+				verdict = "same";
+			}
+			cout << network.toStdString() << " " << operation.toStdString() << ": "
+			<< baselineMedian << " ms -> " << median << " ms ("
+			<< (change >= 0 ? "+" : "") << 100 * change << "%) " << verdict.toStdString() << endl;
+		}
+	}
+	return nRegressions;
+}
+
+
+
+
+int runBenchmarks(const QStringList &arguments)
+{
+	if (arguments.contains("--benchmark-samplers"))
+		return runSamplerBenchmarks(arguments);
+	
+	QCommandLineParser parser;
+	parser.setApplicationDescription("Electric Leaf benchmarks");
+	parser.addHelpOption();
+	QCommandLineOption benchmarkOption("benchmark", "Time the operations on every network of a directory.");
+	QCommandLineOption networksOption("networks", "Directory containing the networks.", "directory", "networks");
+	QCommandLineOption outputOption("output", "File where the results are written.", "file", "benchmark.json");
+	QCommandLineOption baselineOption("baseline", "Results to compare with.", "file");
+	QCommandLineOption repetitionsOption("repetitions", "Times each operation is repeated.", "n", "11");
+	QCommandLineOption stepsOption("steps", "Simulation steps timed together.", "n", "20");
+	QCommandLineOption orderingOption("node-ordering", "Order of the nodes in memory: none, \"reverse Cuthill-McKee\" or \"Hilbert curve\".", "ordering", "none");
+	QCommandLineOption countersOption("perf-counters", "Also read the hardware counters around the edge loop and the recolouring (Linux only).");
+	QCommandLineOption parallelOption("parallel-threads", "Also time the parallel edge loop on n threads, and compare its statistics with the sequential one.", "n", "0");
+	parser.addOption(benchmarkOption);
+	parser.addOption(networksOption);
+	parser.addOption(outputOption);
+	parser.addOption(baselineOption);
+	parser.addOption(repetitionsOption);
+	parser.addOption(stepsOption);
+	parser.addOption(orderingOption);
+	parser.addOption(countersOption);
+	parser.addOption(parallelOption);
+	parser.process(arguments);
+	
+	int nRepetitions = qMax(1, parser.value(repetitionsOption).toInt());
+	int nSteps = qMax(1, parser.value(stepsOption).toInt());
+	
+	QDir networksDirectory(parser.value(networksOption));
+	QStringList networkFiles = networksDirectory.entryList(QStringList() << "*.net" << "*.txt", QDir::Files, QDir::Name);
+	if (networkFiles.isEmpty())
+	{
+		cerr << "no networks found in " << networksDirectory.absolutePath().toStdString() << endl;
+		return 2;
+	}
+	QTemporaryDir scratchDirectory;
+	if (!scratchDirectory.isValid())
+	{
+		cerr << "cannot create a temporary directory" << endl;
+		return 2;
+	}
+	
+	QJsonObject networks;
+	foreach (QString networkFile, networkFiles)
+	{
+		cout << "benchmarking " << networkFile.toStdString() << endl;
+		networks.insert(networkFile, benchmarkNetwork(networksDirectory.filePath(networkFile), nRepetitions, nSteps, scratchDirectory.path(), parser.value(orderingOption), parser.isSet(countersOption), parser.value(parallelOption).toInt()));
+	}
+	
+	QJsonObject results;
+	results.insert("format", 1);
+	results.insert("date", QDateTime::currentDateTime().toString(Qt::ISODate));
+	results.insert("qtVersion", QString(qVersion()));
+	results.insert("repetitions", nRepetitions);
+	results.insert("steps", nSteps);
+	results.insert("seed", benchmarkSeed);
+	results.insert("nodeOrdering", parser.value(orderingOption));
+	results.insert("networks", networks);
+	
+	QFile outputFile(parser.value(outputOption));
+	if (!outputFile.open(QIODevice::WriteOnly | QIODevice::Truncate))
+	{
+		cerr << "cannot write " << outputFile.fileName().toStdString() << endl;
+		return 2;
+	}
+	outputFile.write(QJsonDocument(results).toJson());
+	outputFile.close();
+	cout << "results written to " << outputFile.fileName().toStdString() << endl;
+	
+	if (parser.isSet(baselineOption))
+	{
+		QFile baselineFile(parser.value(baselineOption));
+		if (!baselineFile.open(QIODevice::ReadOnly))
+		{
+			cerr << "cannot read " << baselineFile.fileName().toStdString() << endl;
+			return 2;
+		}
+		QJsonObject baseline = QJsonDocument::fromJson(baselineFile.readAll()).object();
+		int nRegressions = compareWithBaseline(results, baseline);
+		if (nRegressions > 0)
+		{
+			cout << nRegressions << " regressions" << endl;
+			return 1;
+		}
+	}
+	return 0;
+}
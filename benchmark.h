@@ -0,0 +1,78 @@
+/***************************************************************************
+ copyright            : (C) 2011 by Andrea Perna
+ email                : perna@math.uu.se
+ ***************************************************************************/
+
+/*******************************************************************************
+ *     This program is free software: you can redistribute it and/or modify     *
+ *     it under the terms of the GNU General Public License as published by     *
+ *     the Free Software Foundation, either version 3 of the License, or        *
+ *     (at your option) any later version.                                      *
+ *                                                                              *
+ *     This program is distributed in the hope that it will be useful,          *
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the            *
+ *     GNU General Public License for more details.                             *
+ *                                                                              *
+ *     You can find a copy of the GNU General Public License at the             *
+ *     following address: <http://www.gnu.org/licenses/>.                       *
+ ********************************************************************************/
+
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include <QJsonObject>
+
+
+/* Command line benchmarks, run without opening the main window:
+ 
+ my_electric_leaf --benchmark [--networks dir] [--output file.json]
+                  [--baseline file.json] [--repetitions n] [--steps n]
+                  [--node-ordering ordering] [--perf-counters]
+                  [--parallel-threads n]
+ 
+ Every network in the directory is loaded and a fixed list of operations is
+ timed several times. Each operation is reported with the median of its times
+ and a distribution free confidence interval of the median, taken from the
+ order statistics. When a baseline file is given, an operation whose interval
+ lies entirely above the one of the baseline, by more than the tolerance, is
+ reported as a regression and the program exits with status 1.
+ 
+ With --perf-counters, a further run of steps reads the hardware counters of
+ the processor around the edge loop and the recolouring, and reports the
+ instructions per cycle and the cache and branch misses per edge, see
+ perfcounters.h. These runs are not timed.
+ 
+ With --parallel-threads, the steps are also timed with the parallel edge loop
+ of paralleledgeloop.h, and the mean particles per node after the steps, over
+ as many runs as repetitions, are compared with those of the sequential loop
+ and with the difference expected from the noise alone.
+ 
+ my_electric_leaf --benchmark-samplers runs the benchmarks of the random
+ number samplers instead, see samplerbenchmark.h. */
+
+
+class GraphWidget;
+
+
+struct BenchmarkStatistics
+{
+	double median;
+	double low; // bounds of the confidence interval of the median
+	double high;
+	double confidence; // actual coverage of the interval, only a few values are possible with few samples
+};
+
+
+BenchmarkStatistics medianWithConfidenceInterval(QVector<double> samples, double confidence = 0.95);
+QJsonObject statisticsToJson(const QVector<double> &samples);
+
+void setDefaultParameters(GraphWidget &graph);
+
+bool isBenchmarkRequested(const QStringList &arguments);
+int runBenchmarks(const QStringList &arguments);
+
+#endif
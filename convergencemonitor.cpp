@@ -0,0 +1,200 @@
+/***************************************************************************
+ copyright            : (C) 2011 by Andrea Perna
+ email                : perna@math.uu.se
+ ***************************************************************************/
+
+/*******************************************************************************
+ *     This program is free software: you can redistribute it and/or modify     *
+ *     it under the terms of the GNU General Public License as published by     *
+ *     the Free Software Foundation, either version 3 of the License, or        *
+ *     (at your option) any later version.                                      *
+ *                                                                              *
+ *     This program is distributed in the hope that it will be useful,          *
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the            *
+ *     GNU General Public License for more details.                             *
+ *                                                                              *
+ *     You can find a copy of the GNU General Public License at the             *
+ *     following address: <http://www.gnu.org/licenses/>.                       *
+ ********************************************************************************/
+
+#include "convergencemonitor.h"
+
+#include <cmath>
+
+
+static const int convergedWindowsRequired = 2;
+static const double noiseStandardErrors = 2; // a drift of the mean within this many standard errors is noise
+
+
+
+
+ConvergenceMonitor::ConvergenceMonitor()
+{
+	windowLength = 1000;
+	sigmaChangeTolerance = 1e-3;
+	balanceTolerance = 0.02;
+	outflowDriftTolerance = 0.01;
+	reset();
+}
+
+
+void ConvergenceMonitor::reset(double startTime)
+{
+	time = startTime;
+	isFirstStep = true;
+	nSteps = 0;
+	windowTime = 0;
+	particlesAtStart = 0;
+	particlesAtEnd = 0;
+	outflowSum = 0;
+	meanOutflowRate = 0;
+	sumOfSquaredDeviations = 0;
+	hasPreviousWindow = false;
+	previousSigma.clear();
+	previousMeanOutflowRate = 0;
+	previousOutflowRateVariance = 0;
+	previousNSteps = 0;
+	sigmaChange = -1;
+	balance = -1;
+	outflowDrift = -1;
+	nConvergedWindows = 0;
+	streakStartTime = startTime;
+	convergenceTime = -1;
+}
+
+
+void ConvergenceMonitor::setWindowLength(int newWindowLength)
+{
+	windowLength = newWindowLength;
+}
+
+
+void ConvergenceMonitor::setTolerances(double newSigmaChangeTolerance, double newBalanceTolerance, double newOutflowDriftTolerance)
+{
+	sigmaChangeTolerance = newSigmaChangeTolerance;
+	balanceTolerance = newBalanceTolerance;
+	outflowDriftTolerance = newOutflowDriftTolerance;
+}
+
+
+/* The particles in the network before the first step are not known, so the
+ first window starts from the end of the first step. */
+
+bool ConvergenceMonitor::addStep(double deltaT, double outflow, double particlesInNetwork)
+{
+	time += deltaT;
+	particlesAtEnd = particlesInNetwork;
+	if (isFirstStep)
+	{
+		isFirstStep = false;
+		particlesAtStart = particlesInNetwork;
+		return false;
+	}
+	
+	nSteps++;
+	windowTime += deltaT;
+	outflowSum += outflow;
+	double rate = outflow / deltaT;
+	double deviation = rate - meanOutflowRate;
+	meanOutflowRate += deviation / nSteps;
+	sumOfSquaredDeviations += deviation * (rate - meanOutflowRate);
+	return nSteps >= windowLength;
+}
+
+
+void ConvergenceMonitor::endWindow(const QVector<double> &sigma)
+{
+	double variance = nSteps > 1 ? sumOfSquaredDeviations / (nSteps - 1) : 0;
+	
+	double inflow = outflowSum + particlesAtEnd - particlesAtStart;
+	double largestFlow = qMax(qMax(fabs(inflow), outflowSum), 1.0);
+	balance = fabs(inflow - outflowSum) / largestFlow;
+	
+	sigmaChange = -1;
+	outflowDrift = -1;
+	bool isConverged = false;
+	if (hasPreviousWindow && previousSigma.size() == sigma.size())
+	{
+		double squaredChange = 0;
+		double squaredNorm = 0;
+		for (int i = 0; i < sigma.size(); i++)
+		{
+			squaredChange += (sigma[i] - previousSigma[i]) * (sigma[i] - previousSigma[i]);
+			squaredNorm += sigma[i] * sigma[i];
+		}
+		sigmaChange = squaredNorm > 0 ? sqrt(squaredChange / squaredNorm) / windowTime : 0;
+		
+		double drift = fabs(meanOutflowRate - previousMeanOutflowRate);
+		double standardError = sqrt(variance / nSteps + previousOutflowRateVariance / previousNSteps);
+		outflowDrift = drift / qMax(fabs(meanOutflowRate), 1e-12);
+		
+		isConverged = sigmaChange <= sigmaChangeTolerance
+			&& balance <= balanceTolerance
+			&& (outflowDrift <= outflowDriftTolerance || drift <= noiseStandardErrors * standardError);
+	}
+	
+	if (isConverged)
+	{
+		if (nConvergedWindows == 0)
+			streakStartTime = time;
+		nConvergedWindows++;
+		if (nConvergedWindows >= convergedWindowsRequired && convergenceTime < 0)
+			convergenceTime = streakStartTime;
+	}
+	else
+	{
+		nConvergedWindows = 0;
+	}
+	
+	hasPreviousWindow = true;
+	previousSigma = sigma;
+	previousMeanOutflowRate = meanOutflowRate;
+	previousOutflowRateVariance = variance;
+	previousNSteps = nSteps;
+	
+	nSteps = 0;
+	windowTime = 0;
+	particlesAtStart = particlesAtEnd;
+	outflowSum = 0;
+	meanOutflowRate = 0;
+	sumOfSquaredDeviations = 0;
+}
+
+
+bool ConvergenceMonitor::hasConverged()
+{
+	return convergenceTime >= 0;
+}
+
+
+// simulated time since the reset at which the steady state was reached, negative before
+double ConvergenceMonitor::getConvergenceTime()
+{
+	return convergenceTime;
+}
+
+
+double ConvergenceMonitor::getTime()
+{
+	return time;
+}
+
+
+// the values of the criteria at the end of the last window, negative when not known yet
+double ConvergenceMonitor::getSigmaChange()
+{
+	return sigmaChange;
+}
+
+
+double ConvergenceMonitor::getBalance()
+{
+	return balance;
+}
+
+
+double ConvergenceMonitor::getOutflowDrift()
+{
+	return outflowDrift;
+}
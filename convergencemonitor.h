@@ -0,0 +1,96 @@
+/***************************************************************************
+ copyright            : (C) 2011 by Andrea Perna
+ email                : perna@math.uu.se
+ ***************************************************************************/
+
+/*******************************************************************************
+ *     This program is free software: you can redistribute it and/or modify     *
+ *     it under the terms of the GNU General Public License as published by     *
+ *     the Free Software Foundation, either version 3 of the License, or        *
+ *     (at your option) any later version.                                      *
+ *                                                                              *
+ *     This program is distributed in the hope that it will be useful,          *
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the            *
+ *     GNU General Public License for more details.                             *
+ *                                                                              *
+ *     You can find a copy of the GNU General Public License at the             *
+ *     following address: <http://www.gnu.org/licenses/>.                       *
+ ********************************************************************************/
+
+#ifndef CONVERGENCEMONITOR_H
+#define CONVERGENCEMONITOR_H
+
+#include <QVector>
+
+
+/* Online detection of the steady state of a run. The steps are grouped in
+ windows of a fixed number of steps, and at the end of each window three
+ criteria are checked:
+ 
+ - the relative L2 change of the conductivities since the end of the previous
+ window, per unit of time;
+ - the balance between the particles entering from the sources and those
+ leaving from the stomata during the window. The inflow is not measured, it is
+ the outflow plus the change of the particles in the network;
+ - the drift of the mean outflow per unit of time from the previous window,
+ compared both with the mean and with the noise of the outflow, whose variance
+ is computed with Welford's method within each window.
+ 
+ The run has converged when all the criteria hold for two windows in a row,
+ and the convergence time is the end of the first of them. */
+
+class ConvergenceMonitor
+{
+public:
+	ConvergenceMonitor();
+	
+	void reset(double startTime = 0); // the simulated time of the next step, for runs resumed from a trace
+	void setWindowLength(int newWindowLength);
+	void setTolerances(double newSigmaChangeTolerance, double newBalanceTolerance, double newOutflowDriftTolerance);
+	
+	// after every step; returns true when the window ends, and endWindow must be called
+	bool addStep(double deltaT, double outflow, double particlesInNetwork);
+	void endWindow(const QVector<double> &sigma);
+	
+	bool hasConverged();
+	double getConvergenceTime();
+	double getTime();
+	double getSigmaChange();
+	double getBalance();
+	double getOutflowDrift();
+	
+private:
+	int windowLength;
+	double sigmaChangeTolerance;
+	double balanceTolerance;
+	double outflowDriftTolerance;
+	
+	double time;
+	bool isFirstStep;
+	
+	// the current window
+	int nSteps;
+	double windowTime;
+	double particlesAtStart;
+	double particlesAtEnd;
+	double outflowSum;
+	double meanOutflowRate; // Welford
+	double sumOfSquaredDeviations;
+	
+	// the previous window
+	bool hasPreviousWindow;
+	QVector<double> previousSigma;
+	double previousMeanOutflowRate;
+	double previousOutflowRateVariance;
+	int previousNSteps;
+	
+	double sigmaChange;
+	double balance;
+	double outflowDrift;
+	int nConvergedWindows;
+	double streakStartTime;
+	double convergenceTime; // negative until convergence
+};
+
+#endif
@@ -86,7 +86,7 @@ void DialogRecordingParameters::setRecordFileName()
     QFileDialog::Options options;
     QString selectedFilter;
 	
-	QString fileName = QFileDialog::getSaveFileName(this, tr("Record to file"), recordFileNameButton->text(), tr("All Files (*);;Image Files (*.png *.jpeg);; Vectorial files (*.svg);; Network files (*.txt *.net)"));
+	QString fileName = QFileDialog::getSaveFileName(this, tr("Record to file"), recordFileNameButton->text(), tr("All Files (*);;Image Files (*.png *.jpeg);; Vectorial files (*.svg);; Network files (*.txt *.net);; Run trace (*.trace)"));
     if (!fileName.isEmpty())
         recordFileNameButton->setText(fileName);
 }
@@ -0,0 +1,242 @@
+/***************************************************************************
+ copyright            : (C) 2011 by Andrea Perna
+ email                : perna@math.uu.se
+ ***************************************************************************/
+
+/*******************************************************************************
+ *     This program is free software: you can redistribute it and/or modify     *
+ *     it under the terms of the GNU General Public License as published by     *
+ *     the Free Software Foundation, either version 3 of the License, or        *
+ *     (at your option) any later version.                                      *
+ *                                                                              *
+ *     This program is distributed in the hope that it will be useful,          *
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the            *
+ *     GNU General Public License for more details.                             *
+ *                                                                              *
+ *     You can find a copy of the GNU General Public License at the             *
+ *     following address: <http://www.gnu.org/licenses/>.                       *
+ ********************************************************************************/
+
+#include "domaindecomposition.h"
+#include "randomnumbers.h"
+
+#include <QtConcurrent/QtConcurrentRun>
+#include <QFuture>
+#include <QList>
+
+#include <algorithm>
+#include <cstdlib>
+
+
+struct CoordinateLess
+{
+	const QVector<double> *coordinate;
+	bool operator()(int a, int b) const { return (*coordinate)[a] < (*coordinate)[b]; }
+};
+
+
+static void bisect(QVector<int>::iterator begin, QVector<int>::iterator end, const QVector<double> &x, const QVector<double> &y, int nParts, int firstPart, QVector<int> &part)
+{
+	if (nParts <= 1 || end - begin <= 1)
+	{
+		for (QVector<int>::iterator it = begin; it != end; ++it)
+		{
+			part[*it] = firstPart;
+		}
+		return;
+	}
+	
+	double minX = x[*begin], maxX = minX, minY = y[*begin], maxY = minY;
+	for (QVector<int>::iterator it = begin; it != end; ++it)
+	{
+		minX = qMin(minX, x[*it]);
+		maxX = qMax(maxX, x[*it]);
+		minY = qMin(minY, y[*it]);
+		maxY = qMax(maxY, y[*it]);
+	}
+	CoordinateLess less;
+	less.coordinate = maxX - minX >= maxY - minY ? &x : &y;
+	
+	int nLeftParts = nParts / 2;
+	QVector<int>::iterator middle = begin + (end - begin) * nLeftParts / nParts;
+	std::nth_element(begin, middle, end, less);
+	bisect(begin, middle, x, y, nLeftParts, firstPart, part);
+	bisect(middle, end, x, y, nParts - nLeftParts, firstPart + nLeftParts, part);
+}
+
+
+QVector<int> recursiveCoordinateBisection(const QVector<double> &x, const QVector<double> &y, int nParts)
+{
+	QVector<int> part(x.size(), 0);
+	QVector<int> nodes(x.size());
+	for (int i = 0; i < nodes.size(); i++)
+	{
+		nodes[i] = i;
+	}
+	bisect(nodes.begin(), nodes.end(), x, y, qMax(nParts, 1), 0, part);
+	return part;
+}
+
+
+
+
+PartitionedEdgeLoop::PartitionedEdgeLoop()
+{
+}
+
+
+void PartitionedEdgeLoop::setNetwork(const QVector<double> &x, const QVector<double> &y, const QVector<int> &edgeSource, const QVector<int> &edgeDest, int nParts)
+{
+	nParts = qMax(nParts, 1);
+	nodePart = recursiveCoordinateBisection(x, y, nParts);
+	nodePosition.resize(x.size());
+	subdomains.fill(Subdomain(), nParts);
+	for (int node = 0; node < x.size(); node++)
+	{
+		Subdomain &subdomain = subdomains[nodePart[node]];
+		nodePosition[node] = subdomain.nParticles.size();
+		subdomain.nParticles.append(0);
+	}
+	
+	haloEdges.clear();
+	haloSource.clear();
+	haloDest.clear();
+	for (int edge = 0; edge < edgeSource.size(); edge++)
+	{
+		int source = edgeSource[edge];
+		int dest = edgeDest[edge];
+		if (nodePart[source] == nodePart[dest])
+		{
+			Subdomain &subdomain = subdomains[nodePart[source]];
+			subdomain.edges.append(edge);
+			subdomain.edgeSource.append(nodePosition[source]);
+			subdomain.edgeDest.append(nodePosition[dest]);
+			subdomain.order.append(subdomain.order.size());
+		}
+		else
+		{
+			haloEdges.append(edge);
+			haloSource.append(source);
+			haloDest.append(dest);
+		}
+	}
+}
+
+
+int PartitionedEdgeLoop::getNumberOfParts()
+{
+	return subdomains.size();
+}
+
+
+int PartitionedEdgeLoop::getNumberOfHaloEdges()
+{
+	return haloEdges.size();
+}
+
+
+void PartitionedEdgeLoop::setParticles(int node, int nParticles)
+{
+	subdomains[nodePart[node]].nParticles[nodePosition[node]] = nParticles;
+}
+
+
+int PartitionedEdgeLoop::getParticles(int node)
+{
+	return subdomains[nodePart[node]].nParticles[nodePosition[node]];
+}
+
+
+// qrand keeps one seed per thread, each part seeds its thread as in ParallelEdgeLoop::run
+void PartitionedEdgeLoop::run(const QVector<double> &transferProbability, QVector<int> &flow)
+{
+	flow.resize(transferProbability.size());
+	const double *probability = transferProbability.constData();
+	int *flows = flow.data(); // detached here, before the threads write into it
+	
+	bool isHaloFirst = qrand() % 2 == 0;
+	QVector<uint> seeds(subdomains.size());
+	for (int part = 0; part < subdomains.size(); part++)
+	{
+		seeds[part] = qrand();
+	}
+	
+	if (isHaloFirst)
+		exchangeHalo(probability, flows);
+	Subdomain *parts = subdomains.data(); // the threads do not touch the vector itself
+	QList<QFuture<void> > futures;
+	for (int part = 1; part < subdomains.size(); part++)
+	{
+		futures.append(QtConcurrent::run(&PartitionedEdgeLoop::runSubdomain, parts + part, seeds[part], probability, flows));
+	}
+	if (!subdomains.isEmpty())
+		runSubdomain(parts, seeds[0], probability, flows);
+	for (int i = 0; i < futures.size(); i++)
+	{
+		futures[i].waitForFinished();
+	}
+	if (!isHaloFirst)
+		exchangeHalo(probability, flows);
+}
+
+
+void PartitionedEdgeLoop::runSubdomain(Subdomain *subdomain, uint seed, const double *transferProbability, int *flow)
+{
+	qsrand(seed);
+	QVector<int> &order = subdomain->order;
+	for (int i = order.size() - 1; i > 0; i--)
+	{
+		int j = qrand() % (i + 1);
+		int local = order[i];
+		order[i] = order[j];
+		order[j] = local;
+	}
+	
+	int *nParticles = subdomain->nParticles.data();
+	const int *edgeSource = subdomain->edgeSource.constData();
+	const int *edgeDest = subdomain->edgeDest.constData();
+	const int *edges = subdomain->edges.constData();
+	foreach (int local, order)
+	{
+		int source = edgeSource[local];
+		int dest = edgeDest[local];
+		int edge = edges[local];
+		int difference = nParticles[dest] - nParticles[source];
+		int moving = 0;
+		if (difference > 0)
+			moving = -binomDist(difference, transferProbability[edge]);
+		else if (difference < 0)
+			moving = binomDist(-difference, transferProbability[edge]);
+		nParticles[source] -= moving;
+		nParticles[dest] += moving;
+		flow[edge] = moving;
+	}
+}
+
+
+// in the calling thread, when the parts are not running
+void PartitionedEdgeLoop::exchangeHalo(const double *transferProbability, int *flow)
+{
+	QVector<int> order(haloEdges.size());
+	for (int i = 0; i < order.size(); i++)
+	{
+		order[i] = i;
+	}
+	std::random_shuffle(order.begin(), order.end());
+	foreach (int i, order)
+	{
+		int &source = subdomains[nodePart[haloSource[i]]].nParticles[nodePosition[haloSource[i]]];
+		int &dest = subdomains[nodePart[haloDest[i]]].nParticles[nodePosition[haloDest[i]]];
+		int edge = haloEdges[i];
+		int difference = dest - source;
+		int moving = 0;
+		if (difference > 0)
+			moving = -binomDist(difference, transferProbability[edge]);
+		else if (difference < 0)
+			moving = binomDist(-difference, transferProbability[edge]);
+		source -= moving;
+		dest += moving;
+		flow[edge] = moving;
+	}
+}
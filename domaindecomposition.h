@@ -0,0 +1,83 @@
+/***************************************************************************
+ copyright            : (C) 2011 by Andrea Perna
+ email                : perna@math.uu.se
+ ***************************************************************************/
+
+/*******************************************************************************
+ *     This program is free software: you can redistribute it and/or modify     *
+ *     it under the terms of the GNU General Public License as published by     *
+ *     the Free Software Foundation, either version 3 of the License, or        *
+ *     (at your option) any later version.                                      *
+ *                                                                              *
+ *     This program is distributed in the hope that it will be useful,          *
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the            *
+ *     GNU General Public License for more details.                             *
+ *                                                                              *
+ *     You can find a copy of the GNU General Public License at the             *
+ *     following address: <http://www.gnu.org/licenses/>.                       *
+ ********************************************************************************/
+
+#ifndef DOMAINDECOMPOSITION_H
+#define DOMAINDECOMPOSITION_H
+
+#include <QVector>
+
+
+/* Parts of the network by recursive coordinate bisection: the nodes are split
+ at the median of the longer side of their bounding box, in two groups whose
+ sizes are in the ratio of the parts still to make, until there are nParts
+ groups. In a leaf, whose edges are short, few edges join two parts. Returns
+ the part of each node. */
+QVector<int> recursiveCoordinateBisection(const QVector<double> &x, const QVector<double> &y, int nParts);
+
+
+/* The edge loop of the fixed step with one thread per part of the leaf. Each
+ part keeps the particles of its nodes and the ends of its edges in arrays of
+ its own, small enough to stay in the cache of the core that runs it, and
+ moves the particles along its inner edges in random order. The edges between
+ two parts form the halo: once per step, before or after the inner edges at
+ random, they exchange particles between the parts, one edge at a time in
+ random order. So the particles are conserved and never negative, and the
+ only change from the sequential loop is that the halo edges are visited all
+ together.
+ 
+ The nodes and edges are indices from zero, as in networkordering.h. */
+
+class PartitionedEdgeLoop
+{
+public:
+	PartitionedEdgeLoop();
+	
+	void setNetwork(const QVector<double> &x, const QVector<double> &y, const QVector<int> &edgeSource, const QVector<int> &edgeDest, int nParts);
+	int getNumberOfParts();
+	int getNumberOfHaloEdges();
+	
+	void setParticles(int node, int nParticles);
+	int getParticles(int node);
+	
+	// one step: each edge moves Binom(|difference|, transferProbability) particles; flow as in Edge::getFlow
+	void run(const QVector<double> &transferProbability, QVector<int> &flow);
+	
+private:
+	struct Subdomain
+	{
+		QVector<int> nParticles; // of the nodes of the part
+		QVector<int> edges; // numbers of the inner edges in the network
+		QVector<int> edgeSource; // ends of the inner edges, as positions in nParticles
+		QVector<int> edgeDest;
+		QVector<int> order; // visiting order of the inner edges
+	};
+	
+	static void runSubdomain(Subdomain *subdomain, uint seed, const double *transferProbability, int *flow);
+	void exchangeHalo(const double *transferProbability, int *flow);
+	
+	QVector<Subdomain> subdomains;
+	QVector<int> nodePart;
+	QVector<int> nodePosition; // position of each node in the particles of its part
+	QVector<int> haloEdges;
+	QVector<int> haloSource;
+	QVector<int> haloDest;
+};
+
+#endif
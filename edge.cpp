@@ -21,6 +21,7 @@
 
 #include <QPainter>
 #include <QGraphicsSceneMouseEvent>
+#include <QStyleOptionGraphicsItem>
 
 
 
@@ -40,6 +41,9 @@ Edge::Edge(GraphWidget *graphWidget, Node *sourceNode, Node *destNode)
 {
 	source = sourceNode;
     dest = destNode;
+	inActiveSet = false;
+	idleSigmaDecay = 0;
+	flowSum = 0;
 	setVisible(pGraph->getEdgesVisible());
 	// cout << sourceNode->scenePos().y() << endl;
 	orientation = atan2(destNode->pos().y() - sourceNode->pos().y(), destNode->pos().x() - sourceNode->pos().x());
@@ -56,6 +60,7 @@ void Edge::deleteEdge()
 {
 	source->removeEdge(this);
 	dest->removeEdge(this);
+	pGraph->removeEdge(this);
 	delete(this);
 }
 
@@ -141,14 +146,27 @@ void Edge::setLength(double newLength)
 //	weight = newWeight;
 //}
 
+QColor Edge::getColour()
+{
+	return lineColour;
+}
+
+// with the decay of the fixed steps in which the edge was not visited, applied at once when it is read
 double Edge::getSigma()
 {
+	double decay = pGraph->getIdleSigmaDecay() - idleSigmaDecay;
+	if (decay > 0)
+	{
+		sigma = qMax(sigma * exp(-decay), pGraph->getMinSigma());
+		idleSigmaDecay += decay;
+	}
 	return sigma;
 }
 
 void Edge::setSigma(double newSigma)
 {
 	sigma = newSigma;
+	idleSigmaDecay = pGraph->getIdleSigmaDecay();
 }
 
 int Edge::getFlow()
@@ -161,6 +179,32 @@ void Edge::setFlow(int newFlow)
 	flow = newFlow;
 }
 
+bool Edge::isInActiveSet()
+{
+	return inActiveSet;
+}
+
+void Edge::setInActiveSet(bool shouldBeInActiveSet)
+{
+	inActiveSet = shouldBeInActiveSet;
+}
+
+// the fixed step tells a visited edge that its sigma already includes the decay of the step
+void Edge::setIdleSigmaDecay(double newIdleSigmaDecay)
+{
+	idleSigmaDecay = newIdleSigmaDecay;
+}
+
+int Edge::getFlowSum()
+{
+	return flowSum;
+}
+
+void Edge::setFlowSum(int newFlowSum)
+{
+	flowSum = newFlowSum;
+}
+
 
 void Edge::initialize(double initSigma)
 {
@@ -168,10 +212,10 @@ void Edge::initialize(double initSigma)
 	flow = 0;
 	if (initSigma < 0)
 	{
-		sigma = pGraph->getMultiplicativeFactorEdgeSigma() * pow(width, pGraph->getExponentEdgeWidthForSigma())/length;
+		setSigma(pGraph->getMultiplicativeFactorEdgeSigma() * pow(width, pGraph->getExponentEdgeWidthForSigma())/length);
 	}
 	else {
-		sigma = initSigma;
+		setSigma(initSigma);
 	}
 
 }
@@ -270,7 +314,7 @@ void Edge::reColour(QString colouringEdgesParameter, QString edgesColourScale)
 	else if (colouringEdgesParameter == "Sigma")
 	{
 		lineColour = pGraph->colourMap(
-											  double(sigma - pGraph->getMinSigma())/
+											  double(getSigma() - pGraph->getMinSigma())/
 											  (pGraph->getMaxSigma() - pGraph->getMinSigma())
 											  );
 	}
@@ -367,14 +411,23 @@ QPainterPath Edge::shape() const
 
 
 
-void Edge::paint(QPainter *painter, const QStyleOptionGraphicsItem *, QWidget *)
+void Edge::paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *)
 {
     if (!source || !dest)
         return;
+	// when zoomed out the graph widget draws a coarser network instead of the edges
+	if (pGraph->getDisplayedLevel() > 0)
+		return;
 	
     // Draw the line itself
     QLineF line(sourcePoint, destPoint);
-    painter->setPen(QPen(lineColour, 1, Qt::SolidLine, Qt::RoundCap, Qt::RoundJoin));
+	// an edge shorter than half a pixel on screen is covered by its nodes anyway
+	if (line.length() * option->levelOfDetailFromTransform(painter->worldTransform()) < 0.5)
+		return;
+	// the pen is cosmetic so that the edges stay one pixel wide at any zoom
+	QPen pen(lineColour, 1, Qt::SolidLine, Qt::RoundCap, Qt::RoundJoin);
+	pen.setCosmetic(true);
+    painter->setPen(pen);
     painter->drawLine(line);
 	
 	
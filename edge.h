@@ -48,6 +48,7 @@ public:
 	
     void adjust();
 	void reColour(QString colouringEdgesParameter, QString edgesColourScale);
+	QColor getColour();
 	void paintPicture(QPainter &painter);
 	
 	double getLength();
@@ -65,6 +66,15 @@ public:
 	int getFlow();
 	void setFlow(int newFlow);
 	
+	// bookkeeping of the active edges of GraphWidget::performFixedStep
+	bool isInActiveSet();
+	void setInActiveSet(bool shouldBeInActiveSet);
+	void setIdleSigmaDecay(double newIdleSigmaDecay);
+	
+	// sum of |flow| over the steps since the last update of sigma, when the update is multirate
+	int getFlowSum();
+	void setFlowSum(int newFlowSum);
+	
 	double getOrientation();
 	void setOrientation(double newOrientation);
 	
@@ -104,6 +114,9 @@ private:
 	double width;
 	double orientation;
 	int flow;
+	bool inActiveSet;
+	double idleSigmaDecay; // the value of GraphWidget::getIdleSigmaDecay that sigma already includes
+	int flowSum;
 	
 	
 };
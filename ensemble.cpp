@@ -0,0 +1,1043 @@
+/***************************************************************************
+ copyright            : (C) 2011 by Andrea Perna
+ email                : perna@math.uu.se
+ ***************************************************************************/
+
+/*******************************************************************************
+ *     This program is free software: you can redistribute it and/or modify     *
+ *     it under the terms of the GNU General Public License as published by     *
+ *     the Free Software Foundation, either version 3 of the License, or        *
+ *     (at your option) any later version.                                      *
+ *                                                                              *
+ *     This program is distributed in the hope that it will be useful,          *
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the            *
+ *     GNU General Public License for more details.                             *
+ *                                                                              *
+ *     You can find a copy of the GNU General Public License at the             *
+ *     following address: <http://www.gnu.org/licenses/>.                       *
+ ********************************************************************************/
+
+#include "ensemble.h"
+#include "graphwidget.h"
+#include "benchmark.h"
+#include "sharedtopology.h"
+#include "resultscache.h"
+#include "stochasticengines.h"
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QDir>
+#include <QFileInfo>
+#include <QTemporaryDir>
+#include <QElapsedTimer>
+#include <QThread>
+#include <QTextStream>
+#include <QJsonDocument>
+#include <QJsonArray>
+#include <QTimer>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QHostAddress>
+#include <QHostInfo>
+#include <QCryptographicHash>
+
+#include <cstdlib>
+#include <iostream>
+
+using namespace std;
+
+
+static const int connectionTimeout = 5000; // milliseconds for each attempt to reach the coordinator
+static const int heartbeatInterval = 30000; // milliseconds between two pings of the coordinator
+static const int coordinatorSilenceTimeout = 4 * heartbeatInterval; // milliseconds without messages before a worker connects again
+
+
+
+
+// host:port or a port alone; anything else names a local socket
+static bool parseTcpAddress(QString address, QString &host, quint16 &port)
+{
+	int colon = address.lastIndexOf(':');
+	bool isNumber;
+	port = address.mid(colon + 1).toUShort(&isNumber);
+	if (!isNumber)
+		return false;
+	host = colon >= 0 ? address.left(colon) : QString();
+	return true;
+}
+
+
+static void sendMessage(QIODevice *device, const QJsonObject &message)
+{
+	device->write(QJsonDocument(message).toJson(QJsonDocument::Compact));
+	device->write("\n");
+}
+
+
+static QJsonObject parseMessage(const QByteArray &line)
+{
+	return QJsonDocument::fromJson(line).object();
+}
+
+
+static void applyParameters(GraphWidget &graph, const QJsonObject &parameters);
+static bool isReplicaSupported(const QJsonObject &parameters);
+
+
+/* The parameters of a job with the missing ones set to the values used by the
+ workers, read from a graph that applyParameters set up without parameters, for
+ the keys of the results cache. */
+
+static QJsonObject completeParameters(const QJsonObject &parameters)
+{
+	static QJsonObject defaults;
+	if (defaults.isEmpty())
+	{
+		GraphWidget graph(NULL);
+		applyParameters(graph, QJsonObject());
+		defaults.insert("chargePerParticle", graph.getChargePerParticle());
+		defaults.insert("deltaT", graph.getDeltaT());
+		defaults.insert("minSigma", graph.getMinSigma());
+		defaults.insert("particlesAtSource", graph.getParticlesAtSource());
+		defaults.insert("initialNParticlesPerNode", graph.getInitialNParticlesPerNode());
+		defaults.insert("exponentEdgeWidthForSigma", graph.getExponentEdgeWidthForSigma());
+		defaults.insert("multiplicativeFactorEdgeSigma", graph.getMultiplicativeFactorEdgeSigma());
+		defaults.insert("sigmaAsFunctionOfFlow", graph.getSigmaAsFunctionOfFlow());
+		defaults.insert("simulationEngine", graph.getSimulationEngine());
+		defaults.insert("adaptiveDeltaT", graph.getAdaptiveDeltaT());
+		defaults.insert("sigmaUpdateInterval", graph.getSigmaUpdateInterval());
+		defaults.insert("seriesReduction", graph.getSeriesReduction());
+		defaults.insert("stopAtSteadyState", false); // read by the workers, not by the graph
+	}
+	QJsonObject complete = defaults;
+	foreach (QString key, parameters.keys())
+	{
+		complete.insert(key, parameters.value(key));
+	}
+	return complete;
+}
+
+
+// the path the workers take for a job, which is also in the key of its results
+static QString executionPath(const QJsonObject &parameters)
+{
+	return isReplicaSupported(parameters) ? QString("topology replica") : QString("graph");
+}
+
+
+/* Short runs with a fixed seed on a small grid: the fixed step of fixedstep.h on
+ a TopologyReplica, the same grid loaded in a GraphWidget as the workers do,
+ with the default parameters and with the multirate update, the series
+ reduction and the adaptive step, and the engines of stochasticengines.h. A
+ change of them that changes the results changes the fingerprint, see
+ ResultsCache::checkFingerprint. Empty when the grid cannot be written. */
+
+static QByteArray simulationFingerprint()
+{
+	const int side = 8;
+	NetworkTopology grid;
+	for (int i = 0; i < side * side; i++)
+	{
+		grid.nodeX.append(i % side);
+		grid.nodeY.append(i / side);
+		grid.isSource.append(i == 0 ? 1 : 0);
+		grid.initialParticles.append(i == 0 ? 100 : 0);
+	}
+	for (int i = 0; i < side * side; i++)
+	{
+		int neighbours[2] = { i % side + 1 < side ? i + 1 : -1, i + side < side * side ? i + side : -1 };
+		for (int k = 0; k < 2; k++)
+		{
+			if (neighbours[k] < 0)
+				continue;
+			grid.edgeSource.append(i);
+			grid.edgeDest.append(neighbours[k]);
+			grid.edgeWidth.append(1);
+			grid.edgeLength.append(1);
+			grid.initialSigma.append(1);
+		}
+	}
+	grid.stomaNode.append(side * side - 1);
+	grid.stomaSigma.append(1);
+	
+	QTemporaryDir directory;
+	QString topologyFileName = directory.path() + "/grid.topology";
+	SharedTopology topology;
+	if (!directory.isValid() || !writeSharedTopology(topologyFileName, grid) || !topology.attach(topologyFileName))
+		return QByteArray();
+	QCryptographicHash hash(QCryptographicHash::Sha1);
+	TopologyReplica replica(&topology);
+	replica.setParameters(0.01, 0.05, 0.001, 100, true);
+	qsrand(1);
+	for (int step = 0; step < 1000; step++)
+	{
+		replica.performOneSimulationStep();
+	}
+	hash.addData(reinterpret_cast<const char *>(replica.getParticlesPerNode().constData()), replica.getParticlesPerNode().size() * sizeof(int));
+	hash.addData(reinterpret_cast<const char *>(replica.getSigmaPerEdge().constData()), replica.getSigmaPerEdge().size() * sizeof(double));
+	
+	QString networkFileName = directory.path() + "/grid.net";
+	QFile networkFile(networkFileName);
+	if (!networkFile.open(QIODevice::WriteOnly | QIODevice::Text))
+		return QByteArray();
+	QTextStream out(&networkFile);
+	out << "*Vertices " << side * side << "\n";
+	for (int i = 0; i < side * side; i++)
+	{
+		out << i + 1 << " \"grid\" " << grid.nodeX[i] << " " << grid.nodeY[i] << " " << grid.initialParticles[i];
+		if (grid.isSource[i])
+			out << " Source\n";
+		else if (grid.stomaNode.contains(i))
+			out << " Sink " << grid.stomaSigma[grid.stomaNode.indexOf(i)] << "\n";
+		else
+			out << " Neither\n";
+	}
+	out << "*Arcs\n";
+	for (int i = 0; i < grid.edgeSource.size(); i++)
+	{
+		out << grid.edgeSource[i] + 1 << " " << grid.edgeDest[i] + 1 << " " << grid.edgeLength[i] << " " << grid.edgeWidth[i] << " " << grid.initialSigma[i] << "\n";
+	}
+	out.flush();
+	networkFile.close();
+	QJsonObject graphParameters[2];
+	graphParameters[1].insert("sigmaUpdateInterval", 0);
+	graphParameters[1].insert("seriesReduction", true);
+	graphParameters[1].insert("adaptiveDeltaT", true);
+	for (int run = 0; run < 2; run++)
+	{
+		GraphWidget graph(NULL);
+		applyParameters(graph, graphParameters[run]);
+		graph.setSigmaAsFunctionOfFlow(true);
+		qsrand(1);
+		srand(1);
+		graph.drawGraph(networkFileName);
+		if (graph.getNumberOfNodes() != side * side)
+			return QByteArray();
+		graph.setShowUpdate(false);
+		for (int step = 0; step < 200; step++)
+		{
+			graph.performOneSimulationStep();
+		}
+		QVector<int> nParticles = graph.getParticlesPerNode();
+		QVector<double> sigma = graph.getSigmaPerEdge();
+		hash.addData(reinterpret_cast<const char *>(nParticles.constData()), nParticles.size() * sizeof(int));
+		hash.addData(reinterpret_cast<const char *>(sigma.constData()), sigma.size() * sizeof(double));
+	}
+	
+	for (int engine = 0; engine < 2; engine++)
+	{
+		ReactionNetwork network;
+		network.nParticles = grid.initialParticles;
+		foreach (int isSource, grid.isSource)
+		{
+			network.isSource.append(isSource != 0);
+		}
+		network.edgeSource = grid.edgeSource;
+		network.edgeDest = grid.edgeDest;
+		network.edgeSigma = grid.initialSigma;
+		network.stomaNode = grid.stomaNode;
+		network.stomaSigma = grid.stomaSigma;
+		qsrand(1);
+		if (engine == 0)
+			simulateGillespie(network, 1.0);
+		else
+			simulateTauLeaping(network, 1.0);
+		hash.addData(reinterpret_cast<const char *>(network.nParticles.constData()), network.nParticles.size() * sizeof(int));
+		hash.addData(reinterpret_cast<const char *>(network.edgeFlow.constData()), network.edgeFlow.size() * sizeof(int));
+	}
+	return hash.result().toHex();
+}
+
+
+
+
+// the result was stored for this very job, see storeResult, and can be kept
+static bool isResultOfJob(const QJsonObject &result, const QJsonObject &job)
+{
+	if (result.contains("error"))
+		return false;
+	foreach (QString key, job.keys())
+	{
+		if (result.value(key) != job.value(key))
+			return false;
+	}
+	return true;
+}
+
+
+EnsembleCoordinator::EnsembleCoordinator(const QList<QJsonObject> &ensembleJobs, QString resultsFileName)
+: jobs(ensembleJobs), jobTimeout(0), resultsFile(resultsFileName), resultsCache(NULL), tcpServer(NULL), localServer(NULL)
+{
+	// the results of an earlier run of the same jobs, which was stopped before the end
+	if (resultsFile.open(QIODevice::ReadOnly | QIODevice::Text))
+	{
+		while (!resultsFile.atEnd())
+		{
+			QJsonObject result = parseMessage(resultsFile.readLine());
+			int id = result.value("id").toInt(-1);
+			if (id >= 0 && id < jobs.size() && isResultOfJob(result, jobs[id]))
+				doneJobs.insert(id);
+		}
+		resultsFile.close();
+	}
+	for (int id = 0; id < jobs.size(); id++)
+	{
+		if (!doneJobs.contains(id))
+			pendingJobs.append(id);
+	}
+	resultsFile.open(QIODevice::WriteOnly | QIODevice::Append | QIODevice::Text);
+	
+	heartbeatTimer = new QTimer(this);
+	connect(heartbeatTimer, SIGNAL(timeout()), this, SLOT(checkWorkers()));
+	heartbeatTimer->start(heartbeatInterval);
+}
+
+
+EnsembleCoordinator::~EnsembleCoordinator()
+{
+	resultsFile.close();
+	delete resultsCache;
+}
+
+
+/* The pending jobs found in the cache are done at once. The others ask the
+ workers for their final state, which is stored with their summary. The cache
+ is not used when the simulation changed without a new simulationVersion. */
+
+void EnsembleCoordinator::setResultsCache(QString cacheDirectory)
+{
+	delete resultsCache;
+	resultsCache = new ResultsCache(cacheDirectory);
+	QByteArray fingerprint = simulationFingerprint();
+	if (fingerprint.isEmpty() || !resultsCache->checkFingerprint(fingerprint))
+	{
+		cerr << "the simulation does not give the results of version " << simulationVersion
+			 << " in the cache, see simulationVersion in resultscache.h; the cache is not used" << endl;
+		delete resultsCache;
+		resultsCache = NULL;
+		return;
+	}
+	int nCachedJobs = 0;
+	foreach (int id, pendingJobs)
+	{
+		QString network = jobs[id].value("network").toString();
+		if (!loadNetworkText(network))
+			continue; // the error is reported when the job is assigned
+		QJsonObject result;
+		if (resultsCache->load(cacheKey(id, executionPath(jobs[id].value("parameters").toObject())), result))
+		{
+			pendingJobs.removeOne(id);
+			result.insert("cached", true);
+			storeResult(id, result);
+			nCachedJobs++;
+		}
+	}
+	cout << nCachedJobs << " jobs found in the cache" << endl;
+}
+
+
+void EnsembleCoordinator::setJobTimeout(int seconds)
+{
+	jobTimeout = qMax(seconds, 0);
+}
+
+
+QString EnsembleCoordinator::cacheKey(int id, QString jobExecutionPath)
+{
+	return ResultsCache::key(networkTexts.value(jobs[id].value("network").toString()), completeParameters(jobs[id].value("parameters").toObject()),
+							 jobs[id].value("seed").toInt(), jobs[id].value("steps").toInt(), jobExecutionPath);
+}
+
+
+bool EnsembleCoordinator::loadNetworkText(QString network)
+{
+	if (!networkTexts.contains(network))
+	{
+		QFile networkFile(network);
+		if (networkFile.open(QIODevice::ReadOnly))
+			networkTexts.insert(network, networkFile.readAll());
+	}
+	return networkTexts.contains(network);
+}
+
+
+bool EnsembleCoordinator::listen(QString address)
+{
+	QString host;
+	quint16 port;
+	if (parseTcpAddress(address, host, port))
+	{
+		tcpServer = new QTcpServer(this);
+		connect(tcpServer, SIGNAL(newConnection()), this, SLOT(acceptConnection()));
+		QHostAddress hostAddress(host);
+		if (host == "localhost")
+			hostAddress = QHostAddress::LocalHost;
+		return tcpServer->listen(hostAddress.isNull() ? QHostAddress(QHostAddress::Any) : hostAddress, port);
+	}
+	localServer = new QLocalServer(this);
+	connect(localServer, SIGNAL(newConnection()), this, SLOT(acceptConnection()));
+	QLocalServer::removeServer(address); // the socket file left by a coordinator that was killed
+	return localServer->listen(address);
+}
+
+
+bool EnsembleCoordinator::isFinished()
+{
+	return doneJobs.size() == jobs.size();
+}
+
+
+void EnsembleCoordinator::acceptConnection()
+{
+	while (tcpServer && tcpServer->hasPendingConnections())
+	{
+		QTcpSocket *socket = tcpServer->nextPendingConnection();
+		socket->setSocketOption(QAbstractSocket::KeepAliveOption, 1);
+		addWorker(socket);
+	}
+	while (localServer && localServer->hasPendingConnections())
+	{
+		addWorker(localServer->nextPendingConnection());
+	}
+}
+
+
+void EnsembleCoordinator::addWorker(QIODevice *worker)
+{
+	runningJob.insert(worker, -1);
+	connect(worker, SIGNAL(readyRead()), this, SLOT(readMessages()));
+	connect(worker, SIGNAL(disconnected()), this, SLOT(dropWorker()));
+}
+
+
+void EnsembleCoordinator::readMessages()
+{
+	QIODevice *worker = qobject_cast<QIODevice *>(sender());
+	while (worker && runningJob.contains(worker) && worker->canReadLine())
+	{
+		QJsonObject message = parseMessage(worker->readLine());
+		QString type = message.value("type").toString();
+		if (type == "result")
+		{
+			int id = message.value("id").toInt(-1);
+			if (id < 0 || runningJob.value(worker) != id)
+				continue; // not the job this worker was given
+			runningJob.insert(worker, -1);
+			message.remove("type");
+			storeResult(id, message);
+			if (!isFinished())
+				assignJob(worker);
+		}
+		else if (type == "ready")
+		{
+			assignJob(worker);
+		}
+	}
+}
+
+
+void EnsembleCoordinator::dropWorker()
+{
+	QIODevice *worker = qobject_cast<QIODevice *>(sender());
+	if (worker)
+		removeWorker(worker);
+}
+
+
+// the job of a worker that is gone goes back to the queue, to the first worker that waits
+void EnsembleCoordinator::removeWorker(QIODevice *worker)
+{
+	if (!runningJob.contains(worker))
+		return;
+	int id = runningJob.take(worker);
+	jobTimers.remove(worker);
+	sentNetworks.remove(worker);
+	worker->deleteLater();
+	if (id < 0 || doneJobs.contains(id))
+		return;
+	cout << "job " << id << " given back to the queue" << endl;
+	pendingJobs.prepend(id);
+	foreach (QIODevice *waitingWorker, runningJob.keys())
+	{
+		if (runningJob.value(waitingWorker) < 0)
+		{
+			assignJob(waitingWorker);
+			break;
+		}
+	}
+}
+
+
+/* Every heartbeat interval: the waiting workers hear from the coordinator, see
+ receiveMessage, and the workers whose job is over the timeout are dropped,
+ which gives their job back to the queue. */
+
+void EnsembleCoordinator::checkWorkers()
+{
+	QJsonObject ping;
+	ping.insert("type", QString("ping"));
+	foreach (QIODevice *worker, runningJob.keys())
+	{
+		int id = runningJob.value(worker);
+		if (id < 0)
+		{
+			sendMessage(worker, ping);
+		}
+		else if (jobTimeout > 0 && jobTimers.value(worker).hasExpired(1000 * qint64(jobTimeout)))
+		{
+			cout << "job " << id << " over the timeout" << endl;
+			removeWorker(worker);
+			worker->close();
+		}
+	}
+}
+
+
+void EnsembleCoordinator::assignJob(QIODevice *worker)
+{
+	while (!pendingJobs.isEmpty())
+	{
+		int id = pendingJobs.takeFirst();
+		QJsonObject message = jobs[id];
+		QString network = message.value("network").toString();
+		if (!sentNetworks[worker].contains(network))
+		{
+			if (!loadNetworkText(network))
+			{
+				QJsonObject result;
+				result.insert("error", QString("cannot read the network"));
+				storeResult(id, result);
+				continue;
+			}
+			message.insert("text", QString::fromUtf8(networkTexts.value(network)));
+			sentNetworks[worker].insert(network);
+		}
+		message.insert("type", QString("job"));
+		message.insert("id", id);
+		if (resultsCache)
+			message.insert("finalState", true);
+		runningJob.insert(worker, id);
+		jobTimers[worker].start();
+		sendMessage(worker, message);
+		return;
+	}
+	// nothing to do until a job comes back from a worker that disconnects
+	runningJob.insert(worker, -1);
+}
+
+
+void EnsembleCoordinator::storeResult(int id, QJsonObject result)
+{
+	if (doneJobs.contains(id))
+		return;
+	doneJobs.insert(id);
+	/* Under the key the lookups use. A worker with --no-shared-topology runs every
+	 job on a graph, and those of its results that a replica would have given are
+	 not kept. */
+	QString jobExecutionPath = executionPath(jobs[id].value("parameters").toObject());
+	if (resultsCache && networkTexts.contains(jobs[id].value("network").toString()) && !result.contains("cached") && !result.contains("error")
+		&& result.value("executionPath").toString() == jobExecutionPath)
+	{
+		resultsCache->store(cacheKey(id, jobExecutionPath), result);
+	}
+	result.remove("finalParticles"); // only in the cache
+	result.remove("finalSigma");
+	QJsonObject job = jobs[id];
+	foreach (QString key, job.keys())
+	{
+		result.insert(key, job.value(key));
+	}
+	result.insert("id", id);
+	resultsFile.write(QJsonDocument(result).toJson(QJsonDocument::Compact));
+	resultsFile.write("\n");
+	resultsFile.flush();
+	cout << doneJobs.size() << "/" << jobs.size() << " jobs done" << endl;
+	if (isFinished())
+		finish();
+}
+
+
+void EnsembleCoordinator::finish()
+{
+	QJsonObject done;
+	done.insert("type", QString("done"));
+	foreach (QIODevice *worker, runningJob.keys())
+	{
+		sendMessage(worker, done);
+		worker->waitForBytesWritten(connectionTimeout);
+	}
+	emit finished();
+}
+
+
+
+
+/* The jobs of the jobs file, or one job per seed for each network of the
+ directory, with the networks as absolute paths. */
+
+static bool readJobs(const QCommandLineParser &parser, QList<QJsonObject> &jobs)
+{
+	if (parser.isSet("jobs"))
+	{
+		QFile jobsFile(parser.value("jobs"));
+		if (!jobsFile.open(QIODevice::ReadOnly))
+			return false;
+		QDir jobsDirectory = QFileInfo(jobsFile).absoluteDir();
+		QJsonArray array = QJsonDocument::fromJson(jobsFile.readAll()).array();
+		foreach (QJsonValue value, array)
+		{
+			QJsonObject job = value.toObject();
+			job.insert("network", jobsDirectory.absoluteFilePath(job.value("network").toString()));
+			jobs.append(job);
+		}
+		return true;
+	}
+	
+	QDir networksDirectory(parser.value("networks"));
+	QStringList networkFiles = networksDirectory.entryList(QStringList() << "*.net" << "*.txt", QDir::Files, QDir::Name);
+	int nRuns = qMax(1, parser.value("runs").toInt());
+	foreach (QString networkFile, networkFiles)
+	{
+		for (int seed = 1; seed <= nRuns; seed++)
+		{
+			QJsonObject job;
+			job.insert("network", networksDirectory.absoluteFilePath(networkFile));
+			job.insert("seed", seed);
+			job.insert("steps", parser.value("steps").toInt());
+			jobs.append(job);
+		}
+	}
+	return true;
+}
+
+
+static int runEnsembleCoordinator(const QCommandLineParser &parser)
+{
+	QList<QJsonObject> jobs;
+	if (!readJobs(parser, jobs) || jobs.isEmpty())
+	{
+		cerr << "no jobs to run" << endl;
+		return 2;
+	}
+	EnsembleCoordinator coordinator(jobs, parser.value("output"));
+	coordinator.setJobTimeout(parser.value("job-timeout").toInt());
+	if (parser.isSet("cache"))
+		coordinator.setResultsCache(parser.value("cache"));
+	if (coordinator.isFinished())
+	{
+		cout << "all the jobs are already in " << parser.value("output").toStdString() << endl;
+		return 0;
+	}
+	if (!coordinator.listen(parser.value("listen")))
+	{
+		cerr << "cannot listen on " << parser.value("listen").toStdString() << endl;
+		return 2;
+	}
+	QObject::connect(&coordinator, SIGNAL(finished()), QCoreApplication::instance(), SLOT(quit()));
+	cout << "waiting for workers on " << parser.value("listen").toStdString() << endl;
+	return QCoreApplication::exec();
+}
+
+
+
+
+static QIODevice *connectToCoordinator(QString address, int retrySeconds)
+{
+	QElapsedTimer timer;
+	timer.start();
+	QString host;
+	quint16 port;
+	bool isTcp = parseTcpAddress(address, host, port);
+	forever
+	{
+		if (isTcp)
+		{
+			QTcpSocket *socket = new QTcpSocket;
+			socket->connectToHost(host.isEmpty() ? QString("localhost") : host, port);
+			if (socket->waitForConnected(connectionTimeout))
+			{
+				socket->setSocketOption(QAbstractSocket::KeepAliveOption, 1);
+				return socket;
+			}
+			delete socket;
+		}
+		else
+		{
+			QLocalSocket *socket = new QLocalSocket;
+			socket->connectToServer(address);
+			if (socket->waitForConnected(connectionTimeout))
+				return socket;
+			delete socket;
+		}
+		if (timer.elapsed() > 1000 * qint64(retrySeconds))
+			return NULL;
+		QThread::sleep(1);
+	}
+}
+
+
+/* Blocks until a whole message arrives, false when the coordinator is gone or
+ silent for longer than its heartbeat allows, see EnsembleCoordinator::checkWorkers. */
+static bool receiveMessage(QIODevice *coordinator, QJsonObject &message)
+{
+	while (!coordinator->canReadLine())
+	{
+		if (!coordinator->waitForReadyRead(coordinatorSilenceTimeout))
+			return false;
+	}
+	message = parseMessage(coordinator->readLine());
+	return true;
+}
+
+
+static bool deliverMessage(QIODevice *coordinator, const QJsonObject &message)
+{
+	sendMessage(coordinator, message);
+	return coordinator->waitForBytesWritten(coordinatorSilenceTimeout);
+}
+
+
+/* The parameters missing from the job take the values of a new graph, so that
+ nothing is left from the job before. */
+
+static void applyParameters(GraphWidget &graph, const QJsonObject &parameters)
+{
+	setDefaultParameters(graph);
+	if (parameters.contains("chargePerParticle"))
+		graph.setChargePerParticle(parameters.value("chargePerParticle").toDouble());
+	if (parameters.contains("deltaT"))
+		graph.setDeltaT(parameters.value("deltaT").toDouble());
+	if (parameters.contains("minSigma"))
+		graph.setMinSigma(parameters.value("minSigma").toDouble());
+	if (parameters.contains("particlesAtSource"))
+		graph.setParticlesAtSource(parameters.value("particlesAtSource").toInt());
+	if (parameters.contains("initialNParticlesPerNode"))
+		graph.setInitialNParticlesPerNode(parameters.value("initialNParticlesPerNode").toInt());
+	if (parameters.contains("exponentEdgeWidthForSigma"))
+		graph.setExponentEdgeWidthForSigma(parameters.value("exponentEdgeWidthForSigma").toDouble());
+	if (parameters.contains("multiplicativeFactorEdgeSigma"))
+		graph.setMultiplicativeFactorEdgeSigma(parameters.value("multiplicativeFactorEdgeSigma").toDouble());
+	graph.setSigmaAsFunctionOfFlow(parameters.value("sigmaAsFunctionOfFlow").toBool(false));
+	graph.setSimulationEngine(parameters.value("simulationEngine").toString("fixed step"));
+	graph.setAdaptiveDeltaT(parameters.value("adaptiveDeltaT").toBool(false));
+	graph.setSigmaUpdateInterval(parameters.value("sigmaUpdateInterval").toInt(1));
+	graph.setSeriesReduction(parameters.value("seriesReduction").toBool(false));
+}
+
+
+// a few numbers per run, the networks themselves stay with the workers
+static void addSummary(QJsonObject &result, const QVector<int> &nParticles, const QVector<double> &sigma, int nEdges, bool shouldAddFinalState)
+{
+	qint64 totalParticles = 0;
+	foreach (int n, nParticles)
+	{
+		totalParticles += n;
+	}
+	double sumSigma = 0;
+	double maxSigma = 0;
+	foreach (double s, sigma)
+	{
+		sumSigma += s;
+		maxSigma = qMax(maxSigma, s);
+	}
+	result.insert("nodes", nParticles.size());
+	result.insert("edges", nEdges);
+	result.insert("totalParticles", double(totalParticles));
+	result.insert("meanSigma", sigma.isEmpty() ? 0.0 : sumSigma / sigma.size());
+	result.insert("maxSigma", maxSigma);
+	if (shouldAddFinalState)
+	{
+		QJsonArray finalParticles;
+		foreach (int n, nParticles)
+		{
+			finalParticles.append(n);
+		}
+		QJsonArray finalSigma;
+		foreach (double s, sigma)
+		{
+			finalSigma.append(s);
+		}
+		result.insert("finalParticles", finalParticles);
+		result.insert("finalSigma", finalSigma);
+	}
+}
+
+
+static QJsonObject runJobOnGraph(const QJsonObject &job, QString networkFileName)
+{
+	QJsonObject result;
+	GraphWidget graph(NULL);
+	QJsonObject parameters = job.value("parameters").toObject();
+	applyParameters(graph, parameters);
+	int seed = job.value("seed").toInt();
+	qsrand(seed);
+	srand(seed); // for the shuffling of the edges
+	graph.drawGraph(networkFileName);
+	if (graph.getNumberOfNodes() == 0)
+	{
+		result.insert("error", QString("cannot load the network"));
+		return result;
+	}
+	graph.setShowUpdate(false);
+	graph.setConvergenceMonitoring(true);
+	graph.resetConvergenceMonitor();
+	
+	QElapsedTimer timer;
+	timer.start();
+	int nSteps = job.value("steps").toInt();
+	bool shouldStopAtSteadyState = parameters.value("stopAtSteadyState").toBool(false);
+	double simulatedTime = 0;
+	int step = 0;
+	while (step < nSteps && !(shouldStopAtSteadyState && graph.hasConverged()))
+	{
+		simulatedTime += graph.getDeltaT();
+		graph.performOneSimulationStep();
+		step++;
+	}
+	
+	result.insert("seconds", timer.nsecsElapsed() / 1e9);
+	result.insert("stepsDone", step);
+	result.insert("simulatedTime", simulatedTime);
+	addSummary(result, graph.getParticlesPerNode(), graph.getSigmaPerEdge(), graph.getNumberOfEdges(), job.value("finalState").toBool(false));
+	result.insert("converged", graph.hasConverged());
+	if (graph.hasConverged())
+		result.insert("convergenceTime", graph.getConvergenceTime());
+	return result;
+}
+
+
+// what TopologyReplica simulates: the plain fixed step
+static bool isReplicaSupported(const QJsonObject &parameters)
+{
+	return parameters.value("simulationEngine").toString("fixed step") == "fixed step"
+		&& !parameters.value("adaptiveDeltaT").toBool(false)
+		&& parameters.value("sigmaUpdateInterval").toInt(1) == 1
+		&& !parameters.value("seriesReduction").toBool(false);
+}
+
+
+/* The topology file of a network with the parameters that change its starting
+ state. The first worker of the machine that needs it loads the network and
+ writes it, the others only map it. The files written are added to
+ writtenTopologies, for the worker to remove them at the end. */
+
+static bool attachTopology(SharedTopology &topology, QString topologyDirectory, const QByteArray &networkHash, QString networkFileName, const QJsonObject &parameters, QStringList &writtenTopologies)
+{
+	QJsonObject startingParameters = parameters;
+	QStringList runParameters;
+	runParameters << "deltaT" << "chargePerParticle" << "particlesAtSource" << "sigmaAsFunctionOfFlow" << "stopAtSteadyState";
+	foreach (QString key, runParameters)
+	{
+		startingParameters.remove(key);
+	}
+	QCryptographicHash hash(QCryptographicHash::Sha1);
+	hash.addData(networkHash);
+	hash.addData(QJsonDocument(startingParameters).toJson(QJsonDocument::Compact));
+	QString topologyFileName = topologyDirectory + "/electric-leaf-" + QString(hash.result().toHex()) + ".topology";
+	if (topology.attach(topologyFileName))
+		return true;
+	
+	NetworkTopology networkTopology;
+	{
+		GraphWidget graph(NULL);
+		applyParameters(graph, parameters);
+		graph.drawGraph(networkFileName);
+		if (graph.getNumberOfNodes() == 0)
+			return false;
+		graph.getTopology(networkTopology);
+	}
+	if (!writeSharedTopology(topologyFileName, networkTopology))
+		return false;
+	writtenTopologies.append(topologyFileName);
+	return topology.attach(topologyFileName);
+}
+
+
+/* Once the coordinator is done. The other workers of the machine that still map
+ a file keep their copy, and one that needs it again writes it again. */
+
+static void removeTopologies(const QStringList &writtenTopologies)
+{
+	foreach (QString fileName, writtenTopologies)
+	{
+		QFile::remove(fileName);
+	}
+}
+
+
+static QJsonObject runJobOnReplica(const QJsonObject &job, SharedTopology &topology)
+{
+	QJsonObject result;
+	QJsonObject parameters = completeParameters(job.value("parameters").toObject()); // the defaults of runJobOnGraph
+	TopologyReplica replica(&topology);
+	replica.setParameters(parameters.value("deltaT").toDouble(),
+						  parameters.value("chargePerParticle").toDouble(),
+						  parameters.value("minSigma").toDouble(),
+						  parameters.value("particlesAtSource").toInt(),
+						  parameters.value("sigmaAsFunctionOfFlow").toBool());
+	qsrand(job.value("seed").toInt()); // the replica draws the same numbers as the graph
+	
+	QElapsedTimer timer;
+	timer.start();
+	int nSteps = job.value("steps").toInt();
+	bool shouldStopAtSteadyState = parameters.value("stopAtSteadyState").toBool();
+	double deltaT = parameters.value("deltaT").toDouble();
+	double simulatedTime = 0; // summed as in runJobOnGraph
+	int step = 0;
+	while (step < nSteps && !(shouldStopAtSteadyState && replica.hasConverged()))
+	{
+		simulatedTime += deltaT;
+		replica.performOneSimulationStep();
+		step++;
+	}
+	
+	result.insert("seconds", timer.nsecsElapsed() / 1e9);
+	result.insert("stepsDone", step);
+	result.insert("simulatedTime", simulatedTime);
+	addSummary(result, replica.getParticlesPerNode(), replica.getSigmaPerEdge(), topology.getNumberOfEdges(), job.value("finalState").toBool(false));
+	result.insert("converged", replica.hasConverged());
+	if (replica.hasConverged())
+		result.insert("convergenceTime", replica.getConvergenceTime());
+	result.insert("sharedTopology", true);
+	return result;
+}
+
+
+static QJsonObject runJob(const QJsonObject &job, QString networkFileName, const QByteArray &networkHash, QString topologyDirectory, QStringList &writtenTopologies)
+{
+	QJsonObject result;
+	QJsonObject parameters = job.value("parameters").toObject();
+	SharedTopology topology;
+	if (!topologyDirectory.isEmpty() && isReplicaSupported(parameters)
+		&& attachTopology(topology, topologyDirectory, networkHash, networkFileName, parameters, writtenTopologies))
+	{
+		result = runJobOnReplica(job, topology);
+		result.insert("executionPath", QString("topology replica"));
+	}
+	else
+	{
+		result = runJobOnGraph(job, networkFileName);
+		result.insert("executionPath", QString("graph"));
+	}
+	result.insert("type", QString("result"));
+	result.insert("id", job.value("id"));
+	result.insert("worker", QString("%1:%2").arg(QHostInfo::localHostName()).arg(QCoreApplication::applicationPid()));
+	return result;
+}
+
+
+/* Jobs until the coordinator says done. The networks received are kept in a
+ temporary directory for the jobs that follow, also across reconnections. The
+ jobs that TopologyReplica can run share the topology of their network with
+ the other workers of the machine, through the topology directory, where each
+ worker removes the files it wrote when the coordinator is done. */
+
+static int runEnsembleWorker(const QCommandLineParser &parser)
+{
+	QTemporaryDir networksDirectory;
+	if (!networksDirectory.isValid())
+	{
+		cerr << "cannot create a temporary directory" << endl;
+		return 2;
+	}
+	QHash<QString, QString> networkFiles; // network of the coordinator -> its local copy
+	QHash<QString, QByteArray> networkHashes;
+	QString topologyDirectory = parser.isSet("no-shared-topology") ? QString() : parser.value("topology-directory");
+	QStringList writtenTopologies;
+	QString address = parser.value("connect");
+	
+	forever
+	{
+		QIODevice *coordinator = connectToCoordinator(address, parser.value("retry").toInt());
+		if (!coordinator)
+		{
+			cerr << "cannot reach the coordinator on " << address.toStdString() << endl;
+			removeTopologies(writtenTopologies);
+			return 1;
+		}
+		QJsonObject ready;
+		ready.insert("type", QString("ready"));
+		bool isDone = false;
+		bool isConnected = deliverMessage(coordinator, ready);
+		QJsonObject message;
+		while (isConnected && receiveMessage(coordinator, message))
+		{
+			QString type = message.value("type").toString();
+			if (type == "done")
+			{
+				isDone = true;
+				break;
+			}
+			if (type != "job")
+				continue;
+			
+			QString network = message.value("network").toString();
+			if (message.contains("text"))
+			{
+				QString localFileName = networksDirectory.path() + QString("/%1_").arg(networkFiles.size()) + QFileInfo(network).fileName();
+				QFile localFile(localFileName);
+				if (localFile.open(QIODevice::WriteOnly | QIODevice::Truncate))
+				{
+					QByteArray text = message.value("text").toString().toUtf8();
+					localFile.write(text);
+					localFile.close();
+					networkFiles.insert(network, localFileName);
+					networkHashes.insert(network, QCryptographicHash::hash(text, QCryptographicHash::Sha1));
+				}
+			}
+			isConnected = deliverMessage(coordinator, runJob(message, networkFiles.value(network), networkHashes.value(network), topologyDirectory, writtenTopologies));
+		}
+		delete coordinator;
+		if (isDone)
+		{
+			removeTopologies(writtenTopologies);
+			return 0;
+		}
+		cerr << "lost the coordinator, connecting again" << endl;
+	}
+}
+
+
+
+
+// in memory on Linux, where it exists
+static QString defaultTopologyDirectory()
+{
+	return QDir("/dev/shm").exists() ? QString("/dev/shm") : QDir::tempPath();
+}
+
+
+bool isEnsembleRequested(const QStringList &arguments)
+{
+	return arguments.contains("--ensemble-coordinator") || arguments.contains("--ensemble-worker");
+}
+
+
+int runEnsemble(const QStringList &arguments)
+{
+	QCommandLineParser parser;
+	parser.setApplicationDescription("Electric Leaf ensembles");
+	parser.addHelpOption();
+	parser.addOption(QCommandLineOption("ensemble-coordinator", "Hand out the jobs to the workers and collect their results."));
+	parser.addOption(QCommandLineOption("ensemble-worker", "Run the jobs of a coordinator."));
+	parser.addOption(QCommandLineOption("listen", "Address of the coordinator: host:port, port, or the name of a local socket.", "address", "electric-leaf-ensemble"));
+	parser.addOption(QCommandLineOption("connect", "Address of the coordinator to work for.", "address", "electric-leaf-ensemble"));
+	parser.addOption(QCommandLineOption("retry", "Seconds to keep trying to reach the coordinator.", "seconds", "60"));
+	parser.addOption(QCommandLineOption("output", "File where the results are appended, one per line.", "file", "ensemble.jsonl"));
+	parser.addOption(QCommandLineOption("jobs", "JSON array of the jobs.", "file"));
+	parser.addOption(QCommandLineOption("job-timeout", "Seconds after which a job still running goes back to the queue, 0 for none.", "seconds", "86400"));
+	parser.addOption(QCommandLineOption("cache", "Directory of the results of the runs already simulated, see resultscache.h.", "directory"));
+	parser.addOption(QCommandLineOption("networks", "Directory containing the networks, when there is no jobs file.", "directory", "networks"));
+	parser.addOption(QCommandLineOption("runs", "Seeds of every network, when there is no jobs file.", "n", "10"));
+	parser.addOption(QCommandLineOption("steps", "Simulation steps of every run, when there is no jobs file.", "n", "10000"));
+	parser.addOption(QCommandLineOption("topology-directory", "Where the workers of a machine share the topologies of the networks.", "directory", defaultTopologyDirectory()));
+	parser.addOption(QCommandLineOption("no-shared-topology", "Load a private copy of the network for every job."));
+	parser.process(arguments);
+	
+	if (parser.isSet("ensemble-coordinator"))
+		return runEnsembleCoordinator(parser);
+	return runEnsembleWorker(parser);
+}
@@ -0,0 +1,139 @@
+/***************************************************************************
+ copyright            : (C) 2011 by Andrea Perna
+ email                : perna@math.uu.se
+ ***************************************************************************/
+
+/*******************************************************************************
+ *     This program is free software: you can redistribute it and/or modify     *
+ *     it under the terms of the GNU General Public License as published by     *
+ *     the Free Software Foundation, either version 3 of the License, or        *
+ *     (at your option) any later version.                                      *
+ *                                                                              *
+ *     This program is distributed in the hope that it will be useful,          *
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the            *
+ *     GNU General Public License for more details.                             *
+ *                                                                              *
+ *     You can find a copy of the GNU General Public License at the             *
+ *     following address: <http://www.gnu.org/licenses/>.                       *
+ ********************************************************************************/
+
+#ifndef ENSEMBLE_H
+#define ENSEMBLE_H
+
+#include <QObject>
+#include <QStringList>
+#include <QList>
+#include <QHash>
+#include <QSet>
+#include <QByteArray>
+#include <QJsonObject>
+#include <QFile>
+#include <QElapsedTimer>
+
+class QIODevice;
+class QTimer;
+class QTcpServer;
+class QLocalServer;
+class ResultsCache;
+
+
+/* Ensembles of runs spread over several processes, without the main window:
+ 
+ my_electric_leaf --ensemble-coordinator --listen address --output results.jsonl
+                  (--jobs jobs.json | --networks dir --runs n --steps n)
+                  [--cache dir] [--job-timeout seconds]
+ my_electric_leaf --ensemble-worker --connect address [--retry seconds]
+                  [--topology-directory dir] [--no-shared-topology]
+ 
+ The address is host:port or a port for TCP, anything else is the name of a
+ local (Unix) socket. On one machine, start the coordinator and as many workers
+ as processors on localhost; on the cluster, start the coordinator on one node
+ with a TCP address and the workers anywhere. On machines without a display
+ add -platform offscreen.
+ 
+ The jobs file is a JSON array of objects such as
+   {"network": "leaf.net", "seed": 3, "steps": 100000,
+    "parameters": {"deltaT": 0.002, "simulationEngine": "tau leaping"}}
+ with the network relative to the jobs file. The parameters not given are those
+ of the benchmarks, see setDefaultParameters. --networks makes a job with seeds
+ 1..n for every network of a directory.
+ 
+ The messages are JSON objects, one per line. A worker says "ready", receives
+ a "job" and answers with its "result", which also means ready again, until it
+ receives "done". The text of a network is sent only the first time a worker
+ needs it. The coordinator appends every result to the output file as soon as
+ it arrives; when it is started again with the same jobs, the jobs already in
+ the output with the same fields and without error are skipped. A worker that
+ disconnects, because it was killed or lost the network, gives its job back to
+ the queue, and a worker that cannot reach the coordinator tries again for the
+ retry time, so workers can be stopped and restarted at any moment.
+ 
+ The TCP connections have the keepalive of the system on. The coordinator
+ sends a "ping" to the waiting workers every heartbeat interval, and a worker
+ that hears nothing for a few intervals connects again. A job still running
+ after the job timeout goes back to the queue, and its worker is disconnected.
+ 
+ With --cache, the runs already simulated by any sweep, with the same network
+ text, parameters, seed, steps and execution path, are taken from the results
+ cache instead, and the new ones are added to it with the final particles and
+ conductivities sent by the workers, see resultscache.h.
+ 
+ The jobs of the plain fixed step run on a TopologyReplica: the workers of a
+ machine map the same read-only topology file of the network from the topology
+ directory, /dev/shm by default, and keep only the particles, conductivities
+ and flows of their run, see sharedtopology.h. The other jobs load the network
+ in a GraphWidget of their own. */
+
+
+class EnsembleCoordinator : public QObject
+{
+	Q_OBJECT
+	
+public:
+	EnsembleCoordinator(const QList<QJsonObject> &ensembleJobs, QString resultsFileName);
+	~EnsembleCoordinator();
+	
+	void setResultsCache(QString cacheDirectory);
+	void setJobTimeout(int seconds);
+	bool listen(QString address);
+	bool isFinished();
+	
+signals:
+	void finished();
+	
+private slots:
+	void acceptConnection();
+	void readMessages();
+	void dropWorker();
+	void checkWorkers();
+	
+private:
+	void addWorker(QIODevice *worker);
+	void removeWorker(QIODevice *worker);
+	void assignJob(QIODevice *worker);
+	void storeResult(int id, QJsonObject result);
+	void finish();
+	bool loadNetworkText(QString network);
+	QString cacheKey(int id, QString jobExecutionPath);
+	
+	QList<QJsonObject> jobs; // in the order of the jobs file, the id of a job is its position
+	QList<int> pendingJobs;
+	QSet<int> doneJobs;
+	QHash<QIODevice *, int> runningJob; // -1 while the worker waits for a job
+	QHash<QIODevice *, QElapsedTimer> jobTimers; // since the job was given
+	int jobTimeout; // seconds, 0 for none
+	QTimer *heartbeatTimer;
+	QHash<QIODevice *, QSet<QString> > sentNetworks;
+	QHash<QString, QByteArray> networkTexts;
+	QFile resultsFile;
+	ResultsCache *resultsCache; // NULL without --cache
+	QTcpServer *tcpServer;
+	QLocalServer *localServer;
+};
+
+
+bool isEnsembleRequested(const QStringList &arguments);
+int runEnsemble(const QStringList &arguments);
+
+#endif
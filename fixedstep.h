@@ -0,0 +1,230 @@
+/***************************************************************************
+ copyright            : (C) 2011 by Andrea Perna
+ email                : perna@math.uu.se
+ ***************************************************************************/
+
+/*******************************************************************************
+ *     This program is free software: you can redistribute it and/or modify     *
+ *     it under the terms of the GNU General Public License as published by     *
+ *     the Free Software Foundation, either version 3 of the License, or        *
+ *     (at your option) any later version.                                      *
+ *                                                                              *
+ *     This program is distributed in the hope that it will be useful,          *
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the            *
+ *     GNU General Public License for more details.                             *
+ *                                                                              *
+ *     You can find a copy of the GNU General Public License at the             *
+ *     following address: <http://www.gnu.org/licenses/>.                       *
+ ********************************************************************************/
+
+#ifndef FIXEDSTEP_H
+#define FIXEDSTEP_H
+
+#include <QList>
+
+#include <queue>
+#include <vector>
+#include <functional>
+
+#include "randomnumbers.h"
+
+
+/* The fixed step of the model, written once for the two places where it runs:
+ GraphWidget, on its Node and Edge items, and TopologyReplica, on the arrays of
+ a shared topology. Both go through the same random draws in the same order, so
+ that a seed gives the same run on both. A network gives the types NodeHandle,
+ EdgeHandle and EdgeList and the functions called below. Its setNParticles,
+ addParticles and subtractParticles keep the number of particles at least zero,
+ and call activateEdgesOf of the active set when the number changes. */
+
+
+// the sources refilled and the stomata drained, in the order of the nodes
+template <class Network>
+void refillSourcesAndDrainStomata(Network &network, int particlesAtSource, double deltaT)
+{
+	int nNodes = network.getNumberOfNodes();
+	for (int i = 0; i < nNodes; i++)
+	{
+		typename Network::NodeHandle node = network.getNode(i);
+		if (network.isSourceNode(node))
+		{
+			network.setNParticles(node, particlesAtSource);
+		}
+		else if (network.hasStoma(node))
+		{
+			int diffNParticles = network.getNParticles(node); // atmospheric potential is zero
+			int stomaFlow = binomDist(diffNParticles, network.getStomaSigma(node) * deltaT);
+			network.setStomaFlow(node, stomaFlow);
+			network.subtractParticles(node, stomaFlow);
+		}
+	}
+}
+
+
+// the particles moved along one edge by the difference at its ends, then its conductivity
+template <class Network>
+void drawEdgeFlow(Network &network, typename Network::EdgeHandle edge, double deltaT)
+{
+	typename Network::NodeHandle source = network.getSourceNode(edge);
+	typename Network::NodeHandle dest = network.getDestNode(edge);
+	int diffNParticles = network.getNParticles(dest) - network.getNParticles(source);
+	int flow = 0;
+	// if there are more particles in dest than in source, the flow is from dest to source, i.e. negative
+	if (diffNParticles > 0)
+		flow = - binomDist(diffNParticles, network.getSigma(edge) * deltaT);
+	else if (diffNParticles < 0)
+		flow = binomDist(-diffNParticles, network.getSigma(edge) * deltaT);
+	network.setFlow(edge, flow);
+	network.subtractParticles(source, flow);
+	network.addParticles(dest, flow);
+	network.updateSigma(edge);
+}
+
+
+/* An edge can only move particles when the numbers of particles at its ends
+ differ, and they can only become different when one of them changes: the
+ nodes call activateEdgesOf whenever their particles change. Visiting the
+ edges in the order of independent uniform keys is visiting them in random
+ order, so the key of an edge is drawn only when it becomes active, and an
+ edge that becomes active during the step is visited in the same step if its
+ key is after the one of the edge being visited, as it would be in a shuffle
+ of all the edges. */
+
+template <class Network>
+class ActiveEdgeSet
+{
+public:
+	typedef typename Network::NodeHandle NodeHandle;
+	typedef typename Network::EdgeHandle EdgeHandle;
+	
+	ActiveEdgeSet()
+	{
+		isValid = false;
+		isVisiting = false;
+		currentKey = 0;
+		nDraws = 0;
+	}
+	
+	// after the topology changed: the next update starts again from all the edges
+	void invalidate()
+	{
+		isValid = false;
+		edges.clear();
+		queue = VisitQueue();
+	}
+	
+	void activateEdgesOf(Network &network, NodeHandle node)
+	{
+		if (!isValid)
+			return;
+		typename Network::EdgeList edgesOfNode = network.getEdgesOf(node);
+		for (int i = 0; i < edgesOfNode.size(); i++)
+		{
+			EdgeHandle edge = edgesOfNode[i];
+			if (network.isInActiveSet(edge))
+				continue;
+			network.setInActiveSet(edge, true);
+			edges.append(edge);
+			if (isVisiting)
+			{
+				double key = uniformRandomNumber();
+				if (key > currentKey)
+					push(key, edge);
+			}
+		}
+	}
+	
+	// drops the edges without difference of particles, and draws the visiting order of the others
+	void update(Network &network)
+	{
+		if (!isValid)
+		{
+			edges.clear();
+			int nEdges = network.getNumberOfEdges();
+			for (int i = 0; i < nEdges; i++)
+			{
+				EdgeHandle edge = network.getEdge(i);
+				network.setInActiveSet(edge, true);
+				edges.append(edge);
+			}
+			isValid = true;
+		}
+		
+		QList<EdgeHandle> stillActiveEdges;
+		for (int i = 0; i < edges.size(); i++)
+		{
+			EdgeHandle edge = edges[i];
+			if (network.getNParticles(network.getSourceNode(edge)) == network.getNParticles(network.getDestNode(edge)))
+			{
+				network.setInActiveSet(edge, false);
+				network.setFlow(edge, 0);
+			}
+			else
+			{
+				stillActiveEdges.append(edge);
+			}
+		}
+		edges = stillActiveEdges;
+		
+		queue = VisitQueue();
+		nDraws = 0;
+		for (int i = 0; i < edges.size(); i++)
+		{
+			push(uniformRandomNumber(), edges[i]);
+		}
+	}
+	
+	/* The edges in the order of their keys, with those that become active on the
+	 way. The visited edges have their conductivity up to date with the idle decay
+	 given, see GraphWidget::performFixedStep. Returns the number of edges visited. */
+	int visit(Network &network, double deltaT, double visitedIdleSigmaDecay)
+	{
+		int nVisitedEdges = 0;
+		isVisiting = true;
+		while (!queue.empty())
+		{
+			currentKey = queue.top().key;
+			EdgeHandle edge = queue.top().edge;
+			queue.pop();
+			drawEdgeFlow(network, edge, deltaT);
+			network.setIdleSigmaDecay(edge, visitedIdleSigmaDecay);
+			nVisitedEdges++;
+		}
+		isVisiting = false;
+		return nVisitedEdges;
+	}
+	
+private:
+	// the keys are multiples of 1 / RAND_MAX, and the rare ties go in the order of the draws
+	struct Visit
+	{
+		double key;
+		int draw;
+		EdgeHandle edge;
+		
+		bool operator>(const Visit &other) const
+		{
+			return key > other.key || (key == other.key && draw > other.draw);
+		}
+	};
+	typedef std::priority_queue<Visit, std::vector<Visit>, std::greater<Visit> > VisitQueue;
+	
+	void push(double key, EdgeHandle edge)
+	{
+		Visit visit;
+		visit.key = key;
+		visit.draw = nDraws++;
+		visit.edge = edge;
+		queue.push(visit);
+	}
+	
+	bool isValid;
+	QList<EdgeHandle> edges; // the edges with isInActiveSet
+	VisitQueue queue;
+	bool isVisiting;
+	double currentKey;
+	int nDraws;
+};
+
+#endif
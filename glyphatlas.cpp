@@ -0,0 +1,158 @@
+/***************************************************************************
+ copyright            : (C) 2011 by Andrea Perna
+ email                : perna@math.uu.se
+ ***************************************************************************/
+
+/*******************************************************************************
+ *     This program is free software: you can redistribute it and/or modify     *
+ *     it under the terms of the GNU General Public License as published by     *
+ *     the Free Software Foundation, either version 3 of the License, or        *
+ *     (at your option) any later version.                                      *
+ *                                                                              *
+ *     This program is distributed in the hope that it will be useful,          *
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the            *
+ *     GNU General Public License for more details.                             *
+ *                                                                              *
+ *     You can find a copy of the GNU General Public License at the             *
+ *     following address: <http://www.gnu.org/licenses/>.                       *
+ ********************************************************************************/
+
+#include "glyphatlas.h"
+
+#include <QRadialGradient>
+
+#include <cmath>
+
+
+static const int atlasSize = 1024;
+static const double maxGlyphLevelOfDetail = 16; // larger glyphs are drawn directly, there are few of them on screen
+
+
+
+// the glyph of nodes and stomata, in item coordinates
+void paintGlyph(QPainter *painter, const QColor &colourLight, const QColor &colourDark)
+{
+	painter->setPen(Qt::NoPen);
+	painter->setBrush(Qt::darkGray);
+	painter->drawEllipse(QRectF(-1, -1, 3, 3));
+	
+	QRadialGradient gradient(-0.5, -0.5, 1.5);
+	gradient.setColorAt(0, colourLight);
+	gradient.setColorAt(1, colourDark);
+	
+	painter->setBrush(gradient);
+	painter->setPen(QPen(Qt::black, 0));
+	painter->drawEllipse(QRectF(-1.5, -1.5, 3, 3));
+}
+
+
+
+
+GlyphAtlas::GlyphAtlas()
+{
+	shelfX = 0;
+	shelfY = 0;
+	shelfHeight = 0;
+	isFull = false;
+}
+
+
+const QPixmap &GlyphAtlas::getPixmap()
+{
+	return pixmap;
+}
+
+
+// called before drawing a frame, so that the glyphs of a frame are never removed while it is drawn
+void GlyphAtlas::clearIfFull()
+{
+	if (!isFull)
+		return;
+	glyphs.clear();
+	pixmap.fill(Qt::transparent); // the new glyphs are antialiased over the pixmap, which must not keep the old ones
+	shelfX = 0;
+	shelfY = 0;
+	shelfHeight = 0;
+	isFull = false;
+}
+
+
+static quint64 quantizedColour(const QColor &colour)
+{
+	QRgb rgb = colour.rgb();
+	return ((qRed(rgb) >> 3) << 10) | ((qGreen(rgb) >> 3) << 5) | (qBlue(rgb) >> 3);
+}
+
+
+/* Appends the fragment drawing a glyph centred at devicePos, in device
+ coordinates. Returns false if the glyph is too large for the atlas or the atlas
+ is full, the caller then draws the glyph itself with paintGlyph. */
+
+bool GlyphAtlas::addFragment(QVector<QPainter::PixmapFragment> &fragments, QPointF devicePos, const QColor &colourLight, const QColor &colourDark, double levelOfDetail)
+{
+	if (levelOfDetail > maxGlyphLevelOfDetail)
+		return false;
+	
+	int zoomStep = qRound(4 * log(levelOfDetail) / log(2.0));
+	quint64 key = (quint64(zoomStep + 128) << 30) | (quantizedColour(colourLight) << 15) | quantizedColour(colourDark);
+	
+	QHash<quint64, Glyph>::const_iterator found = glyphs.constFind(key);
+	Glyph glyph;
+	if (found != glyphs.constEnd())
+	{
+		glyph = found.value();
+	}
+	else
+	{
+		if (!renderGlyph(colourLight, colourDark, pow(2.0, zoomStep / 4.0), glyph))
+			return false;
+		glyphs.insert(key, glyph);
+	}
+	
+	double scale = levelOfDetail * glyph.scale;
+	QPointF centre = devicePos + (glyph.sourceRect.center() - glyph.sourceRect.topLeft() - glyph.anchor) * scale;
+	fragments.append(QPainter::PixmapFragment::create(centre, glyph.sourceRect, scale, scale));
+	return true;
+}
+
+
+bool GlyphAtlas::renderGlyph(const QColor &colourLight, const QColor &colourDark, double glyphLevelOfDetail, Glyph &glyph)
+{
+	if (isFull)
+		return false;
+	if (pixmap.isNull())
+	{
+		pixmap = QPixmap(atlasSize, atlasSize);
+		pixmap.fill(Qt::transparent);
+	}
+	
+	// the glyph goes from -1.5 to 2 in item coordinates, plus one pixel for the outline and the antialiasing
+	int size = int(ceil(3.5 * glyphLevelOfDetail)) + 2;
+	if (shelfX + size > atlasSize)
+	{
+		shelfX = 0;
+		shelfY += shelfHeight;
+		shelfHeight = 0;
+	}
+	if (shelfY + size > atlasSize)
+	{
+		isFull = true;
+		return false;
+	}
+	
+	glyph.sourceRect = QRectF(shelfX, shelfY, size, size);
+	glyph.anchor = QPointF(1 + 1.5 * glyphLevelOfDetail, 1 + 1.5 * glyphLevelOfDetail);
+	glyph.scale = 1.0 / glyphLevelOfDetail;
+	
+	QPainter painter(&pixmap);
+	painter.setRenderHint(QPainter::Antialiasing, true);
+	painter.translate(glyph.sourceRect.topLeft() + glyph.anchor);
+	painter.scale(glyphLevelOfDetail, glyphLevelOfDetail);
+	paintGlyph(&painter, colourLight, colourDark);
+	painter.end();
+	
+	shelfX += size;
+	shelfHeight = qMax(shelfHeight, size);
+	return true;
+}
@@ -0,0 +1,69 @@
+/***************************************************************************
+ copyright            : (C) 2011 by Andrea Perna
+ email                : perna@math.uu.se
+ ***************************************************************************/
+
+/*******************************************************************************
+ *     This program is free software: you can redistribute it and/or modify     *
+ *     it under the terms of the GNU General Public License as published by     *
+ *     the Free Software Foundation, either version 3 of the License, or        *
+ *     (at your option) any later version.                                      *
+ *                                                                              *
+ *     This program is distributed in the hope that it will be useful,          *
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the            *
+ *     GNU General Public License for more details.                             *
+ *                                                                              *
+ *     You can find a copy of the GNU General Public License at the             *
+ *     following address: <http://www.gnu.org/licenses/>.                       *
+ ********************************************************************************/
+
+#ifndef GLYPHATLAS_H
+#define GLYPHATLAS_H
+
+#include <QPixmap>
+#include <QHash>
+#include <QColor>
+#include <QRectF>
+#include <QPointF>
+#include <QPainter>
+
+
+/* Nodes and stomata are all drawn with the same glyph, a disc with a radial
+ gradient, differing only by their colours and by the zoom. The atlas renders
+ each combination of colours and zoom once into a shared pixmap, so that the
+ graph widget can draw all the glyphs with a few drawPixmapFragments calls.
+ Colours are rounded to 5 bits per channel and zoom levels to quarters of an
+ octave, which keeps the number of glyphs small without visible differences. */
+
+class GlyphAtlas
+{
+public:
+	GlyphAtlas();
+	
+	bool addFragment(QVector<QPainter::PixmapFragment> &fragments, QPointF devicePos, const QColor &colourLight, const QColor &colourDark, double levelOfDetail);
+	const QPixmap &getPixmap();
+	void clearIfFull();
+	
+private:
+	struct Glyph
+	{
+		QRectF sourceRect;
+		QPointF anchor; // position of the centre of the glyph in sourceRect
+		double scale; // the glyph is rendered at its zoom level rounded, and stretched by this much
+	};
+	
+	bool renderGlyph(const QColor &colourLight, const QColor &colourDark, double glyphLevelOfDetail, Glyph &glyph);
+	
+	QPixmap pixmap;
+	QHash<quint64, Glyph> glyphs;
+	int shelfX; // glyphs are placed left to right on shelves as high as the tallest glyph on them
+	int shelfY;
+	int shelfHeight;
+	bool isFull;
+};
+
+
+void paintGlyph(QPainter *painter, const QColor &colourLight, const QColor &colourDark);
+
+#endif
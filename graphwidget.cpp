@@ -27,6 +27,15 @@
 #include "node.h"
 #include "stoma.h"
 #include "randomnumbers.h"
+#include "runtrace.h"
+#include "textwriter.h"
+#include "glyphatlas.h"
+#include "profiler.h"
+#include "perfcounters.h"
+#include "networkordering.h"
+#include "seriesreduction.h"
+#include "stochasticengines.h"
+#include "networkloader.h"
 
 
 
@@ -42,6 +51,13 @@
 #include <QInputDialog>
 #include <QtAlgorithms> // for qsort
 #include <QRubberBand>
+#include <QHash>
+#include <QStyleOptionGraphicsItem>
+#include <QtConcurrent/QtConcurrentRun>
+#include <QDataStream>
+#include <QCryptographicHash>
+#include <QGraphicsPathItem>
+#include <QPainterPath>
 
 #include <cmath>
 #include <climits>
@@ -49,11 +65,14 @@
 
 
 static const double PI = 3.14159265358979323846264338327950288419717;
+static const double minimumGlyphPixels = 1.0; // diameter on screen below which nodes and stomata are not drawn
+static const double minimumCoarseEdgePixels = 2.0; // a coarser level is drawn when the typical edge gets shorter than this on screen
+static const int maxSigmaUpdateInterval = 100; // steps between two updates of the conductivities when the interval is automatic
 
 
 
 GraphWidget::GraphWidget(MainWindow *mainWindow)
-: pMainWindow(mainWindow)
+: pMainWindow(mainWindow), itemNetwork(this)
 {
 	
 //	setContextMenuPolicy(Qt::CustomContextMenu);
@@ -68,6 +87,8 @@ GraphWidget::GraphWidget(MainWindow *mainWindow)
 	edgesColourScale = "Linear";
 	stomataColourScale = "Linear";
 	currentColourMap = "rainbow";
+	nodeOrdering = "none"; // the orderings of networkordering.h are chosen in the menu
+	simulationEngine = "fixed step";
 	areNodesVisible = true;
 	areEdgesVisible = true;
 	areStomataVisible = true;
@@ -83,6 +104,33 @@ GraphWidget::GraphWidget(MainWindow *mainWindow)
 	rubberBand = NULL;
 	isRegionSelected = false;
 	currentSelection = NULL;
+	traceWriter = NULL;
+	traceReader = NULL;
+	edgeLoopCounters = NULL;
+	recolourCounters = NULL;
+	isSpatialIndexValid = false;
+	isHierarchyValid = false;
+	displayedLevel = 0;
+	isReducingSeries = false;
+	areSeriesChainsValid = false;
+	areSeriesChainsReconstructed = false;
+	isAdaptingDeltaT = false;
+	sigmaTolerance = 0.01;
+	sigmaUpdateInterval = 1;
+	currentSigmaUpdateInterval = 1;
+	isDeferringSigmaUpdate = false;
+	stepsSinceSigmaUpdate = 0;
+	timeSinceSigmaUpdate = 0;
+	sigmaDecaySinceUpdate = 1;
+	isMonitoringConvergence = false;
+	edgeLoopThreads = 1;
+	isPartitioningEdges = false;
+	isUsingSidecar = true;
+	isParallelEdgeLoopValid = false;
+	isPartitionedEdgeLoopValid = false;
+	maxTransferProbability = 0.2;
+	idleSigmaDecay = 0;
+	isIdleSigmaDecayPending = false;
 		
 	sc = new QGraphicsScene(this);
 	sc->setItemIndexMethod(QGraphicsScene::NoIndex);
@@ -111,6 +159,13 @@ GraphWidget::GraphWidget(MainWindow *mainWindow)
 }
 
 
+GraphWidget::~GraphWidget()
+{
+	stopTrace();
+	closeTrace();
+}
+
+
 void GraphWidget::setCurrentColourMap(QString chosenColourMap)
 {
 	currentColourMap = chosenColourMap;
@@ -142,6 +197,31 @@ QString GraphWidget::getCurrentColourMap()
 }
 
 
+// takes effect from the next network loaded
+void GraphWidget::setNodeOrdering(QString chosenNodeOrdering)
+{
+	nodeOrdering = chosenNodeOrdering;
+}
+
+
+QString GraphWidget::getNodeOrdering()
+{
+	return nodeOrdering;
+}
+
+
+void GraphWidget::setSimulationEngine(QString chosenSimulationEngine)
+{
+	simulationEngine = chosenSimulationEngine;
+}
+
+
+QString GraphWidget::getSimulationEngine()
+{
+	return simulationEngine;
+}
+
+
 
 void GraphWidget::setSelecting(QString whatIsGoingToBeSelecting)
 {
@@ -160,77 +240,92 @@ void GraphWidget::setShowUpdate(bool shouldShowUpdate)
 	
 	if (isShowingUpdate)
 	{
-		
-		minFlow = INT_MAX;
-		maxFlow = 0;
-		maxSigma = 0;
-		minNParticles = INT_MAX;
-		maxNParticles = 0;
-		
-		
-		
-		foreach (QGraphicsItem *item, sc->items())
+		reColourAll();
+	}
+}
+
+
+
+// the counters are not owned by the graph, pass NULL to stop measuring
+void GraphWidget::setPerfCounters(PerfCounterGroup *newEdgeLoopCounters, PerfCounterGroup *newRecolourCounters)
+{
+	edgeLoopCounters = newEdgeLoopCounters;
+	recolourCounters = newRecolourCounters;
+}
+
+
+
+// finds the ranges of the coloured quantities again and recolours every item
+void GraphWidget::reColourAll()
+{
+	reconstructSeriesChains();
+	minFlow = INT_MAX;
+	maxFlow = 0;
+	maxSigma = 0;
+	minNParticles = INT_MAX;
+	maxNParticles = 0;
+	
+	
+	
+	foreach (QGraphicsItem *item, sc->items())
+	{
+		Node *pNode = qgraphicsitem_cast<Node *>(item);
+		if (!pNode)
 		{
-			Node *pNode = qgraphicsitem_cast<Node *>(item);
-			if (!pNode)
+			Edge *pEdge = qgraphicsitem_cast<Edge *>(item);
+			if (!pEdge)
+				continue;
+			if (pEdge->getSigma() > maxSigma)
 			{
-				Edge *pEdge = qgraphicsitem_cast<Edge *>(item);
-				if (!pEdge)
-					continue;
-				if (pEdge->getSigma() > maxSigma)
-				{
-					maxSigma = pEdge->getSigma();
-				}
-				if (pEdge->getFlow() > maxFlow)
-				{
-					maxFlow = pEdge->getFlow();
-				}
-				if (pEdge->getFlow() < minFlow)
-				{
-					minFlow = pEdge->getFlow();
-				}
+				maxSigma = pEdge->getSigma();
 			}
-			else
+			if (pEdge->getFlow() > maxFlow)
 			{
-				if (pNode->getNParticles() > maxNParticles)
-				{
-					maxNParticles = pNode->getNParticles();
-				}
-				if (pNode->getNParticles() < minNParticles)
-				{
-					minNParticles = pNode->getNParticles();
-				}
+				maxFlow = pEdge->getFlow();
+			}
+			if (pEdge->getFlow() < minFlow)
+			{
+				minFlow = pEdge->getFlow();
 			}
 		}
-	
-	
-		foreach (QGraphicsItem *item, sc->items())
+		else
 		{
-			Node *pNode = qgraphicsitem_cast<Node *>(item);
-			if (!pNode)
+			if (pNode->getNParticles() > maxNParticles)
 			{
-				Edge *pEdge = qgraphicsitem_cast<Edge *>(item);
-				if (!pEdge)
-					continue;
-				pEdge->reColour(colouringEdgesParameter, edgesColourScale);
+				maxNParticles = pNode->getNParticles();
 			}
-			else
+			if (pNode->getNParticles() < minNParticles)
 			{
-				pNode->reColour(colouringNodesParameter, nodesColourScale);
+				minNParticles = pNode->getNParticles();
 			}
 		}
-		
-		
-		foreach (QGraphicsItem *item, sc->items())
+	}
+
+
+	foreach (QGraphicsItem *item, sc->items())
+	{
+		Node *pNode = qgraphicsitem_cast<Node *>(item);
+		if (!pNode)
 		{
-			Stoma *pStoma = qgraphicsitem_cast<Stoma *>(item);
-			if (!pStoma)
+			Edge *pEdge = qgraphicsitem_cast<Edge *>(item);
+			if (!pEdge)
 				continue;
-			pStoma->reColour(colouringStomataParameter, stomataColourScale);
+			pEdge->reColour(colouringEdgesParameter, edgesColourScale);
+		}
+		else
+		{
+			pNode->reColour(colouringNodesParameter, nodesColourScale);
 		}
 	}
 	
 	
+	foreach (QGraphicsItem *item, sc->items())
+	{
+		Stoma *pStoma = qgraphicsitem_cast<Stoma *>(item);
+		if (!pStoma)
+			continue;
+		pStoma->reColour(colouringStomataParameter, stomataColourScale);
+	}
 }
 
 
@@ -246,6 +341,7 @@ void GraphWidget::setNodesVisible(bool nodesBecomeVisible)
 			pNode->setVisible(nodesBecomeVisible);
 		}
 		areNodesVisible = nodesBecomeVisible;
+		viewport()->update(); // the glyphs are not items of the scene, see drawForeground
 	}
 }
 
@@ -266,6 +362,7 @@ void GraphWidget::setStomataVisible(bool stomataBecomeVisible)
 			// cout << "now visible " << i << endl;
 		}
 		areStomataVisible = stomataBecomeVisible;
+		viewport()->update();
 	}
 }
 
@@ -386,135 +483,160 @@ void GraphWidget::setInitialNParticlesPerNode(int newNParticlesPerNode)
 //	return n1.getNumber() < n2.getNumber();
 //}
 
+static bool nodeNumberLessThan(Node *n1, Node *n2)
+{
+	return n1->getNumber() < n2->getNumber();
+}
+
+
 
+/* The five files of the Eleni format are independent, so they are written in
+ parallel. The values are first copied out of the items, in the GUI thread, then
+ each file is formatted and written by its own thread from these copies. */
 
-void GraphWidget::saveEleni(QString fileName)
+struct EleniColumns
 {
+	QVector<double> nodeX;
+	QVector<double> nodeY;
+	QVector<int> nodeDegree;
+	QVector<int> edgeFirstNode; // the node with the smaller number
+	QVector<int> edgeSecondNode;
+	QVector<double> edgeSigma;
+	QVector<double> edgeLength;
+	QVector<double> edgeWidth;
+};
+
+
+static bool writeEleniNodes(QString fileName, EleniColumns columns)
+{
+	TextWriter out;
+	if (!out.open(fileName))
+		return false;
+	for (int i = 0; i < columns.nodeX.size(); i++)
+	{
+		out << columns.nodeX[i] << ' ' << columns.nodeY[i] << '\n';
+	}
+	return out.close();
+}
+
+
+static bool writeEleniNeighbours(QString fileName, EleniColumns columns)
+{
+	TextWriter out;
+	if (!out.open(fileName))
+		return false;
+	for (int i = 0; i < columns.nodeDegree.size(); i++)
+	{
+		out << columns.nodeDegree[i] << '\n';
+	}
+	return out.close();
+}
+
+
+static bool writeEleniEdges(QString fileName, EleniColumns columns)
+{
+	TextWriter out;
+	if (!out.open(fileName))
+		return false;
+	for (int i = 0; i < columns.edgeFirstNode.size(); i++)
+	{
+		out << columns.edgeFirstNode[i] << ' ' << columns.edgeSecondNode[i] << '\n';
+	}
+	return out.close();
+}
+
+
+static bool writeEleniConductivities(QString fileName, EleniColumns columns)
+{
+	TextWriter out;
+	if (!out.open(fileName))
+		return false;
+	for (int i = 0; i < columns.edgeSigma.size(); i++)
+	{
+		out << columns.edgeSigma[i] << '\n';
+	}
+	return out.close();
+}
+
+
+static bool writeEleniLengthAndWidth(QString fileName, EleniColumns columns)
+{
+	TextWriter out;
+	if (!out.open(fileName))
+		return false;
+	for (int i = 0; i < columns.edgeLength.size(); i++)
+	{
+		out << columns.edgeLength[i] << ' ' << columns.edgeWidth[i] << '\n';
+	}
+	return out.close();
+}
+
+
+
+// false if any of the files could not be written
+bool GraphWidget::saveEleni(QString fileName)
+{
+	QString baseName = fileName;
+	baseName.truncate(fileName.lastIndexOf(".eln"));
 	
-	QString firstFileName = fileName; // the first file is for the nodes
-	QString secondFileName = fileName;
-	int indexOfFileExtension = firstFileName.lastIndexOf(".eln");
-	firstFileName.truncate(indexOfFileExtension);
-	secondFileName.truncate(indexOfFileExtension);
-	firstFileName = firstFileName.append("_nodes").append(".eln");
-	secondFileName = secondFileName.append("_neigh").append(".eln");
-	
-	QFile file1(firstFileName);
-	QFile file2(secondFileName);
-	if (!file1.open(QIODevice::WriteOnly | QIODevice::Text))
-		return;
-	if (!file2.open(QIODevice::WriteOnly | QIODevice::Text))
-		return;
-	QTextStream out1(&file1);
-	QTextStream out2(&file2);
-	
-	
-	// First renumber nodes to start from source nodes
-	int counter = 1;
-	foreach (QGraphicsItem *item, sc->items()) 
+	// First renumber nodes to start from source nodes, the others keep the order of their numbers.
+	// Only the numbers change, networkNodes stays in the order chosen by orderNetwork
+	QList<Node *> nodesByNumber = networkNodes;
+	qSort(nodesByNumber.begin(), nodesByNumber.end(), nodeNumberLessThan);
+	QList<Node *> renumberedNodes;
+	foreach (Node *pNode, nodesByNumber)
 	{
-		Node *pNode = qgraphicsitem_cast<Node *>(item);
-		if (!pNode)
-			continue;
-			if (pNode->isSourceNode())
-		{
-			pNode->setNumber(counter);
-			out1 << pNode->pos().x()/scaleFactor << " " << pNode->pos().y()/scaleFactor << endl;
-			out2 << (int)pNode->degree() << endl;
-			counter+=1;
-		}
+		if (pNode->isSourceNode())
+			renumberedNodes.append(pNode);
 	}
-	foreach (QGraphicsItem *item, sc->items()) 
+	foreach (Node *pNode, nodesByNumber)
 	{
-		Node *pNode = qgraphicsitem_cast<Node *>(item);
-		if (!pNode)
-			continue;
 		if (!pNode->isSourceNode())
-		{
-			pNode->setNumber(counter);
-			out1 << pNode->pos().x()/scaleFactor << " " << pNode->pos().y()/scaleFactor << endl;
-			out2 << (int)pNode->degree() << endl;
-			counter+=1;
-		}
+			renumberedNodes.append(pNode);
 	}
-	file1.close();
-	file2.close();
-	
-	
-	//	// write all nodes in a list
-	//	QList<Node *> nodeList;
-	//	foreach (QGraphicsItem *item, sc->items())
-	//	{
-	//		Node *pNode = qgraphicsitem_cast<Node *>(item);
-	//		if (!pNode)
-	//			continue;
-	//		nodeList.append(pNode);
-	//	}
-	//	// sort again according to node number
-	//	qSort(nodeList.begin(), nodeList.end(), int (*) (const void*, const void*));
-	//	
-	//	
-	//	
-	//	foreach (Node *pNode, nodeList)
-	//	{	
-	//		out <<  pNode->getNumber() << " " << pNode->getLabel() << " "<< pNode->pos().x()/scaleFactor << " " << pNode->pos().y()/scaleFactor << " " << pNode->getNParticles();
-	//	}
-	
-	
-	
-
-	
-	// Now write the edges
-	QString thirdFileName = fileName; // the second file is for the edges
-	QString fourthFileName = fileName;
-	QString fifthFileName = fileName;
-	// int indexOfFileExtension = firstFileName.lastIndexOf(".eln");
-	thirdFileName.truncate(indexOfFileExtension);
-	fourthFileName.truncate(indexOfFileExtension);
-	fifthFileName.truncate(indexOfFileExtension);
-	thirdFileName = thirdFileName.append("_edges").append(".eln");
-	fourthFileName = fourthFileName.append("_conductivities").append(".eln");
-	fifthFileName = fifthFileName.append("_edge_length_and_width").append(".eln");
-	
-	// file.setFileName(secondFileName);
-	QFile file3(thirdFileName);
-	QFile file4(fourthFileName);
-	QFile file5(fifthFileName);
-	if (!file3.open(QIODevice::WriteOnly | QIODevice::Text))
-		return;
-	if (!file4.open(QIODevice::WriteOnly | QIODevice::Text))
-		return;
-	if (!file5.open(QIODevice::WriteOnly | QIODevice::Text))
-		return;
-	QTextStream out3(&file3);
-	QTextStream out4(&file4);
-	QTextStream out5(&file5);
-	
-	
-	
-//	out << "*Edges" << endl;
 	
+	EleniColumns columns;
+	columns.nodeX.reserve(renumberedNodes.size());
+	columns.nodeY.reserve(renumberedNodes.size());
+	columns.nodeDegree.reserve(renumberedNodes.size());
+	int counter = 1;
+	foreach (Node *pNode, renumberedNodes)
+	{
+		pNode->setNumber(counter);
+		columns.nodeX.append(pNode->pos().x()/scaleFactor);
+		columns.nodeY.append(pNode->pos().y()/scaleFactor);
+		columns.nodeDegree.append((int)pNode->degree());
+		counter+=1;
+	}
 	
-	foreach (QGraphicsItem *item, sc->items()) 
+	columns.edgeFirstNode.reserve(networkEdges.size());
+	columns.edgeSecondNode.reserve(networkEdges.size());
+	columns.edgeSigma.reserve(networkEdges.size());
+	columns.edgeLength.reserve(networkEdges.size());
+	columns.edgeWidth.reserve(networkEdges.size());
+	foreach (Edge *pEdge, networkEdges)
 	{
-		Edge *pEdge = qgraphicsitem_cast<Edge *>(item);
-		if (!pEdge)
-			continue;
-		if ((pEdge->getSourceNode()->getNumber() < pEdge->getDestNode()->getNumber()))
-		{
-			out3 << pEdge->getSourceNode()->getNumber() << " " << pEdge->getDestNode()->getNumber() << endl;
-			out4 << pEdge->getSigma() << endl;
-			out5 << pEdge->getLength() << " " << pEdge->getWidth() << endl;
-		}
-		else
-		{
-			out3 << pEdge->getDestNode()->getNumber() << " " << pEdge->getSourceNode()->getNumber() << endl;
-			out4 << pEdge->getSigma() << endl;
-			out5 << pEdge->getLength() << " " << pEdge->getWidth() << endl;		}
+		int sourceNumber = pEdge->getSourceNode()->getNumber();
+		int destNumber = pEdge->getDestNode()->getNumber();
+		columns.edgeFirstNode.append(qMin(sourceNumber, destNumber));
+		columns.edgeSecondNode.append(qMax(sourceNumber, destNumber));
+		columns.edgeSigma.append(pEdge->getSigma());
+		columns.edgeLength.append(pEdge->getLength());
+		columns.edgeWidth.append(pEdge->getWidth());
 	}
-	file3.close();
-	file4.close();
-	file5.close();
+	
+	QFuture<bool> nodesWritten = QtConcurrent::run(writeEleniNodes, baseName + "_nodes.eln", columns);
+	QFuture<bool> neighboursWritten = QtConcurrent::run(writeEleniNeighbours, baseName + "_neigh.eln", columns);
+	QFuture<bool> edgesWritten = QtConcurrent::run(writeEleniEdges, baseName + "_edges.eln", columns);
+	QFuture<bool> conductivitiesWritten = QtConcurrent::run(writeEleniConductivities, baseName + "_conductivities.eln", columns);
+	QFuture<bool> lengthAndWidthWritten = QtConcurrent::run(writeEleniLengthAndWidth, baseName + "_edge_length_and_width.eln", columns);
+	// result() waits for each writer, all of them are waited for before returning
+	bool isWritten = nodesWritten.result();
+	isWritten = neighboursWritten.result() && isWritten;
+	isWritten = edgesWritten.result() && isWritten;
+	isWritten = conductivitiesWritten.result() && isWritten;
+	isWritten = lengthAndWidthWritten.result() && isWritten;
+	return isWritten;
 }
 
 
@@ -524,23 +646,22 @@ void GraphWidget::saveEleni(QString fileName)
 
 
 
-void GraphWidget::savePajek(QString fileName)
+bool GraphWidget::savePajek(QString fileName)
 {
-	QFile file(fileName);
-	if (!file.open(QIODevice::WriteOnly | QIODevice::Text))
-		return;
-	QTextStream out(&file);
+	TextWriter out;
+	if (!out.open(fileName))
+		return false;
 	
 	
-	out << "*Vertices " << numberOfNodes << endl;
+	out << "*Vertices " << numberOfNodes << '\n';
 	
 	
-	foreach (QGraphicsItem *item, sc->items()) 
+	// the nodes are written by number, whatever their order in memory
+	QList<Node *> nodesByNumber = networkNodes;
+	qSort(nodesByNumber.begin(), nodesByNumber.end(), nodeNumberLessThan);
+	foreach (Node *pNode, nodesByNumber)
 	{
-		Node *pNode = qgraphicsitem_cast<Node *>(item);
-		if (!pNode)
-			continue;
-		out <<  pNode->getNumber() << " " << pNode->getLabel() << " "<< pNode->pos().x()/scaleFactor << " " << pNode->pos().y()/scaleFactor << " " << pNode->getNParticles();
+		out << pNode->getNumber() << ' ' << pNode->getLabel() << ' ' << pNode->pos().x()/scaleFactor << ' ' << pNode->pos().y()/scaleFactor << ' ' << pNode->getNParticles();
 		if (pNode->isSourceNode())
 		{
 			out << " Source";
@@ -554,26 +675,22 @@ void GraphWidget::savePajek(QString fileName)
 		}
 		if (pNode->getStoma() != NULL)
 		{
-			out << " " << pNode->getStoma()->getSigma();
+			out << ' ' << pNode->getStoma()->getSigma();
 		}
-		out << endl;
+		out << '\n';
 	}
 	
 	
-	out << "*Edges" << endl;
+	out << "*Edges" << '\n';
 	
 	
-	foreach (QGraphicsItem *item, sc->items()) 
+	foreach (Edge *pEdge, networkEdges)
 	{
-		Edge *pEdge = qgraphicsitem_cast<Edge *>(item);
-		if (!pEdge)
-			continue;
-		
-		out << pEdge->getSourceNode()->getNumber() << " " << pEdge->getDestNode()->getNumber() << " " << pEdge->getLength() << " " << pEdge->getWidth() << " " << pEdge->getSigma() << endl;
+		out << pEdge->getSourceNode()->getNumber() << ' ' << pEdge->getDestNode()->getNumber() << ' ' << pEdge->getLength() << ' ' << pEdge->getWidth() << ' ' << pEdge->getSigma() << '\n';
 	}
 	
 	
-	file.close();
+	return out.close();
 
 }
 
@@ -582,16 +699,147 @@ void GraphWidget::savePajek(QString fileName)
 
 
 
-void    GraphWidget::saveGraph(QString fileName)
+// false if the file could not be written, or if its extension is none of the formats
+bool    GraphWidget::saveGraph(QString fileName)
 {
+	reconstructSeriesChains();
 	if (fileName.endsWith(".txt", Qt::CaseInsensitive) || fileName.endsWith(".net", Qt::CaseInsensitive))
 	{
-		savePajek(fileName);
+		return savePajek(fileName);
 	}
 	else if (fileName.endsWith(".eln", Qt::CaseInsensitive))
 	{
-		saveEleni(fileName);
+		return saveEleni(fileName);
+	}
+	return false;
+}
+
+
+
+
+/* A trace records the whole run in a single file: the topology is written once
+ by startTrace, then recordTraceFrame only appends the values that change from
+ one step to the next. See runtrace.h for the format. */
+
+bool GraphWidget::startTrace(QString fileName)
+{
+	stopTrace();
+	
+	RunTraceTopology traceTopology;
+	QHash<Node *, int> nodePosition;
+	traceStomaNodes.clear();
+	traceNodes = networkNodes;
+	for (int i = 0; i < traceNodes.size(); i++)
+	{
+		Node *pNode = traceNodes[i];
+		nodePosition.insert(pNode, i);
+		traceTopology.nodeX.append(pNode->pos().x()/scaleFactor);
+		traceTopology.nodeY.append(pNode->pos().y()/scaleFactor);
+		traceTopology.nodeLabel.append(pNode->getLabel());
+		traceTopology.nodeNumber.append(pNode->getNumber());
+		if (pNode->isSourceNode())
+		{
+			traceTopology.nodeKind.append(TraceSource);
+		}
+		else if (pNode->isSinkNode())
+		{
+			traceTopology.nodeKind.append(TraceSink);
+		}
+		else
+		{
+			traceTopology.nodeKind.append(TraceNeither);
+		}
+		if (pNode->getStoma() != NULL)
+		{
+			traceStomaNodes.append(pNode);
+			traceTopology.stomaNode.append(i);
+			traceTopology.stomaSigma.append(pNode->getStoma()->getSigma());
+		}
+	}
+	foreach (Edge *pEdge, networkEdges)
+	{
+		traceTopology.edgeSource.append(nodePosition.value(pEdge->getSourceNode()));
+		traceTopology.edgeDest.append(nodePosition.value(pEdge->getDestNode()));
+		traceTopology.edgeLength.append(pEdge->getLength());
+		traceTopology.edgeWidth.append(pEdge->getWidth());
+	}
+	
+	traceWriter = new RunTraceWriter();
+	if (!traceWriter->open(fileName, traceTopology))
+	{
+		delete traceWriter;
+		traceWriter = NULL;
+		traceNodes.clear();
+		traceStomaNodes.clear();
+		return false;
 	}
+	return true;
+}
+
+
+
+// false when the frame could not be written, the trace is then closed
+bool GraphWidget::recordTraceFrame(int step, double time)
+{
+	if (!traceWriter)
+		return false;
+	
+	reconstructSeriesChains();
+	RunTraceFrame frame;
+	frame.step = step;
+	frame.time = time;
+	frame.nParticles.reserve(traceNodes.size());
+	foreach (Node *pNode, traceNodes)
+	{
+		frame.nParticles.append(pNode->getNParticles());
+	}
+	frame.edgeFlow.reserve(networkEdges.size());
+	frame.edgeSigma.reserve(networkEdges.size());
+	foreach (Edge *pEdge, networkEdges)
+	{
+		frame.edgeFlow.append(pEdge->getFlow());
+		frame.edgeSigma.append(pEdge->getSigma());
+	}
+	frame.stomaFlow.reserve(traceStomaNodes.size());
+	foreach (Node *pNode, traceStomaNodes)
+	{
+		// a node that was turned into a source after the trace started has lost its stoma
+		if (pNode->getStoma() != NULL)
+		{
+			frame.stomaFlow.append(pNode->getStoma()->getFlow());
+		}
+		else
+		{
+			frame.stomaFlow.append(0);
+		}
+	}
+	
+	if (!traceWriter->appendFrame(frame))
+	{
+		// the topology is no longer the one in the trace header, or the disk is full
+		stopTrace();
+		return false;
+	}
+	return true;
+}
+
+
+
+void GraphWidget::stopTrace()
+{
+	if (!traceWriter)
+		return;
+	traceWriter->close();
+	delete traceWriter;
+	traceWriter = NULL;
+	traceNodes.clear();
+	traceStomaNodes.clear();
+}
+
+
+bool GraphWidget::isTracing()
+{
+	return traceWriter != NULL;
 }
 
 
@@ -762,7 +1010,7 @@ void GraphWidget::getSelectedGraphicItems()
 	{
 //		cout << currentSelection->normalized().top() << " " << currentSelection->normalized().left() << " " << currentSelection->normalized().width() << " " << currentSelection->normalized().height() << endl;
 
-		selectedGraphicItems=this->items(currentSelection->normalized().left(), currentSelection->normalized().top(), currentSelection->normalized().width(),currentSelection->normalized().height(), Qt::IntersectsItemShape);
+		selectedGraphicItems = itemsInViewRect(currentSelection->normalized());
 	}
 	else
 	{
@@ -773,10 +1021,214 @@ void GraphWidget::getSelectedGraphicItems()
 
 
 
+// the items whose shape intersects a rectangle given in viewport coordinates
+QList<QGraphicsItem *> GraphWidget::itemsInViewRect(const QRectF &viewRect)
+{
+	updateSpatialIndex();
+	return spatialIndex.items(viewportTransform().inverted().mapRect(viewRect));
+}
+
+
+void GraphWidget::updateSpatialIndex()
+{
+	if (!isSpatialIndexValid)
+	{
+		QString key = "spatial index/" + nodeOrdering;
+		bool isRestored = false;
+		if (sidecar.contains(key))
+		{
+			QByteArray data = sidecar.value(key);
+			QDataStream in(data);
+			in.setVersion(QDataStream::Qt_5_2);
+			isRestored = spatialIndex.restore(networkNodes, networkEdges, in);
+		}
+		if (!isRestored)
+		{
+			spatialIndex.build(networkNodes, networkEdges);
+			if (sidecar.isOpen())
+			{
+				QByteArray data;
+				QDataStream out(&data, QIODevice::WriteOnly);
+				out.setVersion(QDataStream::Qt_5_2);
+				spatialIndex.save(out);
+				sidecar.insert(key, data);
+			}
+		}
+		isSpatialIndexValid = true;
+	}
+}
+
+
+// a node moved, the structures of the file no longer describe the network
+void GraphWidget::invalidateSpatialIndex()
+{
+	isSpatialIndexValid = false;
+	isHierarchyValid = false;
+	sidecar.close();
+}
+
+
+// the edges are weighted by their conductivity when the hierarchy is built
+void GraphWidget::updateHierarchy()
+{
+	if (isHierarchyValid)
+		return;
+	QHash<Node *, int> nodeIndex;
+	QVector<QPointF> positions;
+	positions.reserve(networkNodes.size());
+	for (int i = 0; i < networkNodes.size(); i++)
+	{
+		nodeIndex.insert(networkNodes[i], i);
+		positions.append(networkNodes[i]->pos());
+	}
+	QVector<int> edgeSource;
+	QVector<int> edgeDest;
+	QVector<double> edgeWeight;
+	edgeSource.reserve(networkEdges.size());
+	edgeDest.reserve(networkEdges.size());
+	edgeWeight.reserve(networkEdges.size());
+	foreach (Edge *pEdge, networkEdges)
+	{
+		edgeSource.append(nodeIndex.value(pEdge->getSourceNode()));
+		edgeDest.append(nodeIndex.value(pEdge->getDestNode()));
+		edgeWeight.append(pEdge->getSigma());
+	}
+	
+	/* The sidecar keeps the first hierarchy built after the file is opened, with
+	 the conductivities of the file, and it is only used with the same ones. */
+	QByteArray weights = QByteArray::fromRawData(reinterpret_cast<const char *>(edgeWeight.constData()), edgeWeight.size() * sizeof(double));
+	QByteArray weightsHash = QCryptographicHash::hash(weights, QCryptographicHash::Sha1);
+	QString key = "hierarchy/" + nodeOrdering;
+	bool isLoaded = false;
+	if (sidecar.contains(key))
+	{
+		QByteArray data = sidecar.value(key);
+		QDataStream in(data);
+		in.setVersion(QDataStream::Qt_5_2);
+		QByteArray storedWeightsHash;
+		in >> storedWeightsHash;
+		isLoaded = storedWeightsHash == weightsHash && hierarchy.load(in, networkNodes.size());
+	}
+	if (!isLoaded)
+	{
+		hierarchy.build(positions, edgeSource, edgeDest, edgeWeight);
+		if (sidecar.isOpen() && !sidecar.contains(key))
+		{
+			QByteArray data;
+			QDataStream out(&data, QIODevice::WriteOnly);
+			out.setVersion(QDataStream::Qt_5_2);
+			out << weightsHash;
+			hierarchy.save(out);
+			sidecar.insert(key, data);
+		}
+	}
+	isHierarchyValid = true;
+	displayedLevel = 0;
+	displayedLevelEdges.clear();
+}
+
+
+/* The potentials of the steady state of the current conductivities: the sources
+ keep particlesAtSource particles, each sink loses particles through its stoma
+ to the atmosphere at zero, and at every other node the flows balance. The
+ particles and the flows are set to their expected values in that state. The
+ system is solved by conjugate gradients with the multigrid preconditioner of
+ the hierarchy. Returns the number of iterations, or -1 if it did not converge. */
+
+int GraphWidget::solveSteadyState()
+{
+	updateHierarchy();
+	int n = networkNodes.size();
+	QHash<Node *, int> nodeIndex;
+	for (int i = 0; i < n; i++)
+	{
+		nodeIndex.insert(networkNodes[i], i);
+	}
+	
+	// the rows of the sources are fixed values, so their columns move to the right hand side and the matrix stays symmetric
+	QVector<QVector<QPair<int, double> > > offDiagonal(n);
+	QVector<double> diagonal(n, 0);
+	QVector<double> rightHandSide(n, 0);
+	foreach (Edge *pEdge, networkEdges)
+	{
+		int a = nodeIndex.value(pEdge->getSourceNode());
+		int b = nodeIndex.value(pEdge->getDestNode());
+		double sigma = pEdge->getSigma();
+		int ends[2] = { a, b };
+		for (int k = 0; k < 2; k++)
+		{
+			int row = ends[k];
+			int other = ends[1 - k];
+			if (networkNodes[row]->isSourceNode() || row == other)
+				continue;
+			diagonal[row] += sigma;
+			if (networkNodes[other]->isSourceNode())
+				rightHandSide[row] += sigma * particlesAtSource;
+			else
+				offDiagonal[row].append(qMakePair(other, -sigma));
+		}
+	}
+	SparseMatrix matrix;
+	matrix.nRows = n;
+	matrix.rowStart.append(0);
+	for (int i = 0; i < n; i++)
+	{
+		Node *pNode = networkNodes[i];
+		if (pNode->isSourceNode())
+		{
+			diagonal[i] = 1;
+			rightHandSide[i] = particlesAtSource;
+		}
+		else if (pNode->isSinkNode() && pNode->getStoma() != NULL)
+		{
+			diagonal[i] += pNode->getStoma()->getSigma();
+		}
+		matrix.column.append(i);
+		matrix.value.append(diagonal[i]);
+		for (int k = 0; k < offDiagonal[i].size(); k++)
+		{
+			matrix.column.append(offDiagonal[i][k].first);
+			matrix.value.append(offDiagonal[i][k].second);
+		}
+		matrix.rowStart.append(matrix.column.size());
+	}
+	
+	MultigridSolver solver;
+	solver.setup(matrix, hierarchy);
+	QVector<double> potential(n, 0);
+	for (int i = 0; i < n; i++)
+	{
+		potential[i] = networkNodes[i]->getNParticles(); // the current state is a good first guess
+	}
+	int iterations = solver.solve(rightHandSide, potential);
+	if (iterations < 0)
+		return iterations;
+	invalidateActiveEdges(); // the flows are set below for every edge
+	
+	for (int i = 0; i < n; i++)
+	{
+		Node *pNode = networkNodes[i];
+		pNode->setNParticles(qRound(potential[i]));
+		if (pNode->isSinkNode() && pNode->getStoma() != NULL)
+			pNode->getStoma()->setFlow(qRound(pNode->getStoma()->getSigma() * deltaT * potential[i]));
+	}
+	foreach (Edge *pEdge, networkEdges)
+	{
+		double difference = potential[nodeIndex.value(pEdge->getSourceNode())] - potential[nodeIndex.value(pEdge->getDestNode())];
+		pEdge->setFlow(qRound(pEdge->getSigma() * deltaT * difference));
+	}
+	areSeriesChainsReconstructed = true; // the inner nodes of the chains have just been solved for
+	if (isShowingUpdate)
+		reColourAll();
+	return iterations;
+}
+
+
+
+
 
 
 
-
 void GraphWidget::setSourceOrSinkForAllNodes()
 {	
 	getSelectedGraphicItems();
@@ -949,6 +1401,11 @@ void GraphWidget::setSigmaAsFunctionOfFlow(bool willUpdateEdgeSigma)
 	isUpdatingEdgeSigma = willUpdateEdgeSigma;
 }
 
+bool GraphWidget::getSigmaAsFunctionOfFlow()
+{
+	return isUpdatingEdgeSigma;
+}
+
 
 void GraphWidget::setSigmaForAllStomata()
 {
@@ -975,50 +1432,42 @@ void GraphWidget::setSigmaForAllStomata()
 
 
 /* drawGraph reads the graph from file, 
- displays the edges in the scene */
+ displays the edges in the scene. The main window reads the file on a
+ NetworkLoader thread instead, and calls buildGraph with what was read. */
 
 void    GraphWidget::drawGraph(QString fileName)
 {
-	int isReadingEdges=0; // First it will be reading the list of nodes, then the list of edges
-	int nodeCounter=0;
-	QString label;
-	float x, y;
-	int numberSourceNode, numberDestNode;
-	double edgeWidth, edgeLength;
-	double edgeSigma = -1;
 	QFile file(fileName);
-	int num_edges=0;
-	numberOfNodes = 0;
-	
-	//areNodesVisible=true;
-	//areEdgesVisible=true;
-	//areStomataVisible = true;
-
-	
-	
 	if (!file.open(QIODevice::ReadOnly | QIODevice::Text))
 		return;
+	file.close();
 	
-	if (sc) 
-		delete sc;
-	sc = new QGraphicsScene(this);
-	sc->setItemIndexMethod(QGraphicsScene::NoIndex);
-	sc->setSceneRect(0, 0, 1100, 1100);
-	// sc->setSceneRect(QRectF ());
-	setScene(sc);
-	
-	QTextStream in(&file);
-	QString line = in.readLine();
-	QStringList fields = line.split(' ', QString::SkipEmptyParts);
-	if (fields.size() == 2)
+	NetworkFileData data;
+	readNetworkFile(fileName, data);
+	buildGraph(data, fileName);
+}
+
+
+
+
+/* buildGraph makes the nodes, stomata and edges of a network read from file.
+ The items are added to a scene that is not shown by the view yet, so that
+ adding them does not schedule any repaint or update of the view, and the
+ scene is shown once when it is complete. The scene of resetScene keeps no
+ index of its items (NoIndex), the view finds them through the SpatialIndex,
+ so adding them does not build a BSP tree either. */
+
+void GraphWidget::buildGraph(const NetworkFileData &data, QString fileName)
+{
+	numberOfNodes = 0;
+	resetScene();
+	setScene(NULL);
+	if (!data.isValid)
 	{
-		QString intestazione = fields.takeFirst();
-		numberOfNodes = fields.takeFirst().toInt();
-	}
-	else{
+		setScene(sc);
 		return;
 	}
-	Node *nodo[numberOfNodes];
+	numberOfNodes = data.numberOfNodes;
 	
 	
 	minNParticles = 0;
@@ -1028,300 +1477,700 @@ void    GraphWidget::drawGraph(QString fileName)
 	maxFlow = 0;
 	
 	maxSigma = minSigma;
+	maxEdgeWidth = 0;
 	
-
-	
+	// the nodes by number, as the orders of the sidecar expect them, and the edges between them in the order of the file
+	QVector<int> recordOfNumber(numberOfNodes, -1);
+	for (int i = 0; i < data.nodes.size(); i++)
+	{
+		// IMPORTANT! the node numbers must be consecutive and start at one
+		int number = data.nodes[i].number;
+		if (number >= 1 && number <= numberOfNodes && recordOfNumber[number-1] < 0)
+			recordOfNumber[number-1] = i;
+	}
+	QVector<int> nodeIndexOfNumber(numberOfNodes, -1);
+	QVector<int> nodeRecords;
+	QVector<QPointF> positions;
+	for (int number = 1; number <= numberOfNodes; number++)
+	{
+		if (recordOfNumber[number-1] < 0)
+			continue;
+		const NodeRecord &record = data.nodes[recordOfNumber[number-1]];
+		nodeIndexOfNumber[number-1] = nodeRecords.size();
+		nodeRecords.append(recordOfNumber[number-1]);
+		positions.append(QPointF(record.x*scaleFactor, record.y*scaleFactor));
+	}
+	QVector<int> edgeRecords;
+	QVector<int> edgeSource;
+	QVector<int> edgeDest;
+	for (int i = 0; i < data.edges.size(); i++)
+	{
+		const EdgeRecord &record = data.edges[i];
+		if (record.sourceNumber < 1 || record.sourceNumber > numberOfNodes || nodeIndexOfNumber[record.sourceNumber-1] < 0
+			|| record.destNumber < 1 || record.destNumber > numberOfNodes || nodeIndexOfNumber[record.destNumber-1] < 0)
+			continue;
+		edgeRecords.append(i);
+		edgeSource.append(nodeIndexOfNumber[record.sourceNumber-1]);
+		edgeDest.append(nodeIndexOfNumber[record.destNumber-1]);
+	}
 	
-	while (!in.atEnd()) {
-		QString line = in.readLine();
-		if (line[0] == QChar('*'))
-		{
-			isReadingEdges =1;
-			
-			
-		}
-		else
+	NetworkSidecar fileSidecar; // only given to the graph at the end, since createNewEdge closes the sidecar
+	if (isUsingSidecar)
+		fileSidecar.open(fileName);
+	QVector<int> nodeOrder;
+	QVector<int> edgeOrder;
+	orderNetwork(fileSidecar, positions, edgeSource, edgeDest, nodeOrder, edgeOrder);
+	
+	// the items are allocated in the order they are simulated and painted, so that neighbours are also close in memory
+	QVector<Node *> nodeOfIndex(nodeRecords.size(), NULL);
+	networkNodes.reserve(nodeRecords.size());
+	foreach (int k, nodeOrder)
+	{
+		const NodeRecord &record = data.nodes[nodeRecords[k]];
+		Node *pNode = new Node(this);
+		nodeOfIndex[k] = pNode;
+		pNode->setPos(positions[k]);
+		pNode->setLabel(record.label);
+		pNode->setNumber(record.number);
+		
+		if (record.nParticles >= 0) // if there are additional fields with nParticles, sourceAndSink
 		{
-			if (isReadingEdges==0)
+			pNode->setNParticles(record.nParticles);
+			if (record.sourceOrSink == "Source")
 			{
-				QStringList fields = line.split(' ', QString::SkipEmptyParts);
-				// cout << fields.size() << endl;
-				if (fields.size() >= 4) // I accept that the nodes could have more than four fields, 
-					// but ignore the fields after the fourth
-				{
-					nodeCounter = fields.takeFirst().toInt();
-					label = fields.takeFirst();
-					x = fields.takeFirst().toFloat();
-					y = fields.takeFirst().toFloat();
-
-					// cout << fields.size() << endl;
-					
-					// IMPORTANT! as you can see below the node numbers must be consecutive and start at one
-					nodo[nodeCounter-1]=new Node(this);
-					nodo[nodeCounter-1]->setPos(QPointF(x*scaleFactor,y*scaleFactor));
-					nodo[nodeCounter-1]->setLabel(label);
-					nodo[nodeCounter-1]->setNumber(nodeCounter);
-					
-					if (fields.size() >= 2) // if there are additional fields with nParticles, sourceAndSink
-					{
-						int nParticles = fields.takeFirst().toInt();
-						// cout << nParticles << endl << endl;
-						nodo[nodeCounter-1]->setNParticles(nParticles);
-						QString sourceOrSink = fields.takeFirst();
-						// cout << sourceOrSink.toStdString() << endl;
-						if (sourceOrSink == "Source")
-						{
-							nodo[nodeCounter-1]->setAsSource();
-						}
-						else if (sourceOrSink == "Sink")
-						{
-							nodo[nodeCounter-1]->setAsSink();
-							if (fields.size()>=1) // if there is additional information about the stomatic sigma
-							{
-									// get stomatic sigma
-								double stomaticSigma = fields.takeFirst().toDouble();
-								nodo[nodeCounter-1]->getStoma()->setSigma(stomaticSigma);
-							}
-						}
-						else if (sourceOrSink == "Neither")
-						{
-							nodo[nodeCounter-1]->setAsNeitherSourceNorSink();
-						}
-					}
-					else
-					{
-						nodo[nodeCounter-1]->setAsSink();
-						nodo[nodeCounter-1]->setNParticles(initialNParticlesPerNode);
-					}
-					nodo[nodeCounter-1]->reColour(colouringNodesParameter, nodesColourScale);
-					sc->addItem(nodo[nodeCounter-1]);
-
-					
-//					// Add the stoma to every node (commented, because I only add stomata to sink nodes)
-					// createNewStoma(nodo[nodeCounter-1]);
-				}
+				pNode->setAsSource();
 			}
-			else // if (isReadingEdges==1)
-			{ 
-				QStringList fields = line.split(' ', QString::SkipEmptyParts);
-				switch (fields.size())
-				{
-					case 2:
-						numberSourceNode = fields.takeFirst().toInt();
-						numberDestNode = fields.takeFirst().toInt();
-						edgeLength = 1.0;
-						edgeWidth = 1.0;
-						break;
-					case 3:
-						numberSourceNode = fields.takeFirst().toInt();
-						numberDestNode = fields.takeFirst().toInt();
-						edgeLength = fields.takeFirst().toDouble();
-						edgeWidth = 1.0;
-						break;
-					case 14: // this is the number of fields in my files
-						double dontCare;
-						numberSourceNode = fields.takeFirst().toInt();
-						numberDestNode = fields.takeFirst().toInt();
-						edgeLength = fields.takeFirst().toDouble();
-						dontCare = fields.takeFirst().toDouble();//4
-						dontCare = fields.takeFirst().toDouble();//5
-						dontCare = fields.takeFirst().toDouble();//6
-						dontCare = fields.takeFirst().toDouble();//7
-						dontCare = fields.takeFirst().toDouble();//8
-						dontCare = fields.takeFirst().toDouble();//9
-						dontCare = fields.takeFirst().toDouble();//10
-						dontCare = fields.takeFirst().toDouble();//11
-						dontCare = fields.takeFirst().toDouble();//12
-						edgeWidth = fields.takeFirst().toDouble();
-						break;
-					case 5:
-						numberSourceNode = fields.takeFirst().toInt();
-						numberDestNode = fields.takeFirst().toInt();
-						edgeLength = fields.takeFirst().toDouble();
-						edgeWidth = fields.takeFirst().toDouble();
-						edgeSigma = fields.takeFirst().toDouble();
-						break;
-					case 4:
-					default: // I accept that the edges can have more than four fields, 
-						// but ignore the fields after the fourth
-						numberSourceNode = fields.takeFirst().toInt();
-						numberDestNode = fields.takeFirst().toInt();
-						edgeLength = fields.takeFirst().toDouble();
-						edgeWidth = fields.takeFirst().toDouble();
-						break;
-				}
-				if (edgeWidth > maxEdgeWidth)
-				{
-					maxEdgeWidth = edgeWidth;
-				}
-				Edge *pMyEdge = createNewEdge(nodo[numberSourceNode-1], nodo[numberDestNode-1], edgeLength, edgeWidth, edgeSigma);
-				if (pMyEdge->getSigma() > maxSigma)
+			else if (record.sourceOrSink == "Sink")
+			{
+				pNode->setAsSink();
+				if (record.stomaticSigma >= 0) // if there is additional information about the stomatic sigma
 				{
-					maxSigma = pMyEdge->getSigma();
+					pNode->getStoma()->setSigma(record.stomaticSigma);
 				}
-				num_edges+=1;
+			}
+			else if (record.sourceOrSink == "Neither")
+			{
+				pNode->setAsNeitherSourceNorSink();
 			}
 		}
-		
+		else
+		{
+			pNode->setAsSink();
+			pNode->setNParticles(initialNParticlesPerNode);
+		}
+		pNode->reColour(colouringNodesParameter, nodesColourScale);
+		sc->addItem(pNode);
+		networkNodes.append(pNode);
 	}
 	
-//	foreach (QGraphicsItem *item, sc->items()) 
-//	{
-//		if (Node *pMyNode = qgraphicsitem_cast<Node *>(item))
-//		{
-//
-//			pMyNode->reColour(colouringNodesParameter, nodesColourScale);
-//		}
-//		else if (Stoma *pMyStoma = qgraphicsitem_cast<Stoma *>(item))
-//		{
-//			pMyStoma->reColour(colouringStomataParameter, stomataColourScale);
-//		}
-//		else if (Edge *pMyEdge = qgraphicsitem_cast<Edge *>(item))
-//		{
-//			pMyEdge->reColour(colouringEdgesParameter, edgesColourScale);
-//		}
-//	}
-//	
-
+	networkEdges.reserve(edgeRecords.size());
+	foreach (int e, edgeOrder)
+	{
+		const EdgeRecord &record = data.edges[edgeRecords[e]];
+		if (record.width > maxEdgeWidth)
+		{
+			maxEdgeWidth = record.width;
+		}
+		Edge *pMyEdge = createNewEdge(nodeOfIndex[edgeSource[e]], nodeOfIndex[edgeDest[e]], record.length, record.width, record.sigma);
+		if (pMyEdge->getSigma() > maxSigma)
+		{
+			maxSigma = pMyEdge->getSigma();
+		}
+	}
+	sidecar = fileSidecar;
 	
-	file.close();
+	setScene(sc);
 	// sc->update();
 }
-	
 
 
 
-Edge *GraphWidget::createNewEdge(Node *sourceNode, Node *destNode, double edgeLength, double edgeWidth, double edgeSigma)
+
+/* While the main window reads a network, the nodes read so far are drawn as
+ dots, one path item per chunk, over the network shown until then. buildGraph
+ deletes them with the scene of that network, and a loading that is cancelled
+ or fails removes only them, so that the network stays as it was. */
+
+void GraphWidget::showLoadingPreview(const QVector<QPointF> &positions)
 {
-	Edge *pMyEdge = new Edge(this,sourceNode, destNode);
-	pMyEdge->setLength(edgeLength);
-	pMyEdge->setWidth(edgeWidth);
-	pMyEdge->initialize(edgeSigma);
-	pMyEdge->reColour(colouringEdgesParameter, edgesColourScale);
-	sc->addItem(pMyEdge);
-	return pMyEdge;
+	QPainterPath dots;
+	foreach (const QPointF &position, positions)
+	{
+		dots.addEllipse(position*scaleFactor, 2, 2);
+	}
+	QGraphicsPathItem *pPreview = sc->addPath(dots, QPen(Qt::NoPen), QBrush(Qt::darkGray));
+	pPreview->setAcceptedMouseButtons(Qt::NoButton);
+	loadingPreview.append(pPreview);
 }
 
 
-Stoma *GraphWidget::createNewStoma(Node *sourceNode)
-{
 
-	Stoma *pMyStoma = new Stoma(this, sourceNode);
-	pMyStoma->initialize();
-//	pMyStoma->setLength(1);
-//	pMyStoma->setWidth(1);
-	//pMyStoma->setVisible(false);
-	if (pMyStoma->getSigma() > maxSigma)
+void GraphWidget::removeLoadingPreview()
+{
+	foreach (QGraphicsPathItem *pPreview, loadingPreview)
 	{
-		maxSigma = pMyStoma->getSigma();
+		sc->removeItem(pPreview);
+		delete pPreview;
 	}
-	pMyStoma->reColour(colouringStomataParameter, stomataColourScale);
-	sc->addItem(pMyStoma);
-
-	return pMyStoma;
+	loadingPreview.clear();
 }
+	
 
 
 
+// the orders read from a sidecar are checked before they are used
+static bool isPermutation(const QVector<int> &order, int n)
+{
+	if (order.size() != n)
+		return false;
+	QVector<bool> isSeen(n, false);
+	foreach (int i, order)
+	{
+		if (i < 0 || i >= n || isSeen[i])
+			return false;
+		isSeen[i] = true;
+	}
+	return true;
+}
 
 
+/* The order in which buildGraph makes the nodes and the edges: the nodes that
+ are neighbours in the network, or in the plane, next to each other, and the
+ edges in the order of their lower end, so that the simulation step and the
+ painting go through the network in an order that keeps using the same part
+ of the memory. The items themselves are allocated in this order, not only
+ the lists of pointers. The visit of the edges in the step stays a random
+ shuffle, as the model wants, but the two ends of an edge are then close to
+ each other, and the passes over the whole lists read the memory in order.
+ The numbers of the nodes are not changed, the files are written with the
+ numbers they were read with. The nodes are given by their index in the order
+ of their numbers, the edges by the indices of their ends. */
 
-
-void GraphWidget::zoom(qreal scaleFactor)
+void GraphWidget::orderNetwork(NetworkSidecar &fileSidecar, const QVector<QPointF> &positions, const QVector<int> &edgeSource, const QVector<int> &edgeDest, QVector<int> &nodeOrder, QVector<int> &edgeOrder)
 {
-	foreach (QGraphicsItem *item, sc->items()) 
+	nodeOrder.clear();
+	edgeOrder.clear();
+	if (nodeOrdering == "none")
 	{
-		if (Node *node = qgraphicsitem_cast<Node *>(item))
+		for (int i = 0; i < positions.size(); i++)
 		{
-			node->setPos(node->pos()*scaleFactor);
+			nodeOrder.append(i);
 		}
-		else if (Stoma *stoma = qgraphicsitem_cast<Stoma *>(item))
+		for (int i = 0; i < edgeSource.size(); i++)
 		{
-			stoma->setPos(stoma->pos()*scaleFactor);
+			edgeOrder.append(i);
 		}
+		return;
 	}
 	
-	
-	
-	foreach (QGraphicsItem *item, sc->items()) {
-		if (Edge *pEdge = qgraphicsitem_cast<Edge *>(item)){
-			pEdge->adjust();
-		}
+	// the orders of the file, when it was opened before
+	QString key = "order/" + nodeOrdering;
+	if (fileSidecar.contains(key))
+	{
+		QByteArray data = fileSidecar.value(key);
+		QDataStream in(data);
+		in.setVersion(QDataStream::Qt_5_2);
+		in >> nodeOrder >> edgeOrder;
+		if (in.status() == QDataStream::Ok && isPermutation(nodeOrder, positions.size()) && isPermutation(edgeOrder, edgeSource.size()))
+			return;
+		nodeOrder.clear();
+		edgeOrder.clear();
 	}
 	
+	if (nodeOrdering == "Hilbert curve")
+	{
+		nodeOrder = hilbertCurveOrder(positions);
+	}
+	else
+	{
+		nodeOrder = reverseCuthillMcKeeOrder(positions.size(), edgeSource, edgeDest);
+	}
+	edgeOrder = edgeOrderByLowerEndpoint(nodeOrder, edgeSource, edgeDest);
+	if (fileSidecar.isOpen() && !positions.isEmpty())
+	{
+		QByteArray data;
+		QDataStream out(&data, QIODevice::WriteOnly);
+		out.setVersion(QDataStream::Qt_5_2);
+		out << nodeOrder << edgeOrder;
+		fileSidecar.insert(key, data);
+	}
 }
 
 
 
 
-
-
-
-
-
-
-
-void GraphWidget::wheelEvent(QWheelEvent *event)
-{
-    scaleView(pow((double)2, -event->delta() / 500.0));
-}
-
-
-
-
-
-
-
-
-
-void GraphWidget::scaleView(qreal scaleFactor)
+// removes the current network, and the trace being recorded or played back with it
+void GraphWidget::resetScene()
 {
-    qreal factor = matrix().scale(scaleFactor, scaleFactor).mapRect(QRectF(0, 0, 1, 1)).width();
-    if (factor < 0.07 || factor > 100)
-        return;
-	
-    scale(scaleFactor, scaleFactor);
+	stopTrace();
+	closeTrace();
+	sidecar.close();
+	networkNodes.clear();
+	networkEdges.clear();
+	spatialIndex.clear();
+	isSpatialIndexValid = false;
+	hierarchy.clear();
+	isHierarchyValid = false;
+	displayedLevel = 0;
+	seriesChains.clear();
+	unreducedEdges.clear();
+	areSeriesChainsValid = false;
+	invalidateActiveEdges();
+	isParallelEdgeLoopValid = false;
+	isPartitionedEdgeLoopValid = false;
+	convergenceMonitor.reset();
+	loadingPreview.clear(); // deleted with the scene
+	if (sc) 
+		delete sc;
+	sc = new QGraphicsScene(this);
+	sc->setItemIndexMethod(QGraphicsScene::NoIndex);
+	sc->setSceneRect(0, 0, 1100, 1100);
+	// sc->setSceneRect(QRectF ());
+	setScene(sc);
 }
 
 
 
 
+/* Playing back a trace rebuilds the network from the topology stored in the
+ trace, then showTraceFrame copies the values of a frame into the items. The
+ network can still be edited or simulated from the frame being shown, but the
+ trace itself is not modified. */
 
-
-
-/* I reimplement mousePressEvent so that we can select an edge more precisely. On the other hand, this way 
- we are no longer able to select nodes. */
-void GraphWidget::mousePressEvent ( QMouseEvent *event )
+bool GraphWidget::openTrace(QString fileName)
 {
-	currentSelection = NULL;
-	if (isRegionSelected)
+	RunTraceReader *reader = new RunTraceReader();
+	if (!reader->open(fileName))
 	{
-		isRegionSelected = false;
-		return;
+		delete reader;
+		return false;
 	}
 	
-    int x=event->pos().x();
-    int y=event->pos().y();
+	resetScene();
+	traceReader = reader;
 	
-    QList<QGraphicsItem *>items=this->items(x-2.5,y-2.5,5,5,Qt::IntersectsItemShape);
+	const RunTraceTopology &traceTopology = traceReader->getTopology();
+	numberOfNodes = traceTopology.nodeX.size();
+	minNParticles = 0;
+	maxNParticles = 0;
+	minFlow = 0;
+	maxFlow = 0;
+	maxSigma = minSigma;
+	maxEdgeWidth = 0;
 	
-	if (whatIsSelecting == "Nodes")
+	for (int i = 0; i < numberOfNodes; i++)
 	{
-		for(int i=items.size()-1;i>=0;i--)
+		Node *pNode = new Node(this);
+		pNode->setPos(QPointF(traceTopology.nodeX[i]*scaleFactor, traceTopology.nodeY[i]*scaleFactor));
+		pNode->setLabel(traceTopology.nodeLabel[i]);
+		pNode->setNumber(traceTopology.nodeNumber[i]);
+		if (traceTopology.nodeKind[i] == TraceSource)
 		{
-			QGraphicsItem *item=items.at(i);
-			if (Node *pNode = qgraphicsitem_cast<Node *>(item))
-			{
-				nodePropertiesMenu(event, pNode);
-				return; //one node has been selected
-			}
+			pNode->setAsSource();
 		}
-    }
-	else if (whatIsSelecting == "Edges")
-	{
-		for(int i=items.size()-1;i>=0;i--)
+		else if (traceTopology.nodeKind[i] == TraceSink)
 		{
-			QGraphicsItem *item=items.at(i);
+			pNode->setAsSink();
+		}
+		else
+		{
+			pNode->setAsNeitherSourceNorSink();
+		}
+		sc->addItem(pNode);
+		networkNodes.append(pNode);
+	}
+	
+	// the stomata in the trace are the ones that existed when the recording started
+	playbackStomaNodes.clear();
+	for (int i = 0; i < traceTopology.stomaNode.size(); i++)
+	{
+		Node *pNode = networkNodes[traceTopology.stomaNode[i]];
+		if (pNode->getStoma() == NULL)
+		{
+			pNode->addStoma(createNewStoma(pNode));
+		}
+		pNode->getStoma()->setSigma(traceTopology.stomaSigma[i]);
+		playbackStomaNodes.append(pNode);
+	}
+	
+	for (int i = 0; i < traceTopology.edgeSource.size(); i++)
+	{
+		double edgeWidth = traceTopology.edgeWidth[i];
+		if (edgeWidth > maxEdgeWidth)
+		{
+			maxEdgeWidth = edgeWidth;
+		}
+		createNewEdge(networkNodes[traceTopology.edgeSource[i]], networkNodes[traceTopology.edgeDest[i]], traceTopology.edgeLength[i], edgeWidth, -1);
+	}
+	
+	showTraceFrame(0);
+	return true;
+}
+
+
+
+void GraphWidget::showTraceFrame(int frameNumber)
+{
+	if (!traceReader)
+		return;
+	
+	RunTraceFrame frame;
+	if (!traceReader->readFrame(frameNumber, frame))
+		return;
+	
+	// the items can only be missing if the network was edited during playback
+	for (int i = 0; i < frame.nParticles.size() && i < networkNodes.size(); i++)
+	{
+		networkNodes[i]->setNParticles(frame.nParticles[i]);
+	}
+	for (int i = 0; i < frame.edgeFlow.size() && i < networkEdges.size(); i++)
+	{
+		networkEdges[i]->setFlow(frame.edgeFlow[i]);
+		networkEdges[i]->setSigma(frame.edgeSigma[i]);
+	}
+	for (int i = 0; i < frame.stomaFlow.size() && i < playbackStomaNodes.size(); i++)
+	{
+		if (playbackStomaNodes[i]->getStoma() != NULL)
+		{
+			playbackStomaNodes[i]->getStoma()->setFlow(frame.stomaFlow[i]);
+		}
+	}
+	
+	reColourAll();
+}
+
+
+
+void GraphWidget::closeTrace()
+{
+	if (!traceReader)
+		return;
+	delete traceReader;
+	traceReader = NULL;
+	playbackStomaNodes.clear();
+}
+
+
+bool GraphWidget::isPlayingTrace()
+{
+	return traceReader != NULL;
+}
+
+
+int GraphWidget::getNumberOfTraceFrames()
+{
+	if (!traceReader)
+		return 0;
+	return traceReader->getNumberOfFrames();
+}
+
+
+int GraphWidget::getTraceFrameStep(int frameNumber)
+{
+	if (!traceReader)
+		return 0;
+	return traceReader->getFrameStep(frameNumber);
+}
+
+
+// the simulated time of a frame, the traces written before version 3 only have the steps
+double GraphWidget::getTraceFrameTime(int frameNumber)
+{
+	RunTraceFrame frame;
+	if (!traceReader || !traceReader->readFrame(frameNumber, frame))
+		return 0;
+	if (frame.time < 0)
+		return frame.step * configuredDeltaT;
+	return frame.time;
+}
+
+
+
+Edge *GraphWidget::createNewEdge(Node *sourceNode, Node *destNode, double edgeLength, double edgeWidth, double edgeSigma)
+{
+	Edge *pMyEdge = new Edge(this,sourceNode, destNode);
+	pMyEdge->setLength(edgeLength);
+	pMyEdge->setWidth(edgeWidth);
+	pMyEdge->initialize(edgeSigma);
+	pMyEdge->reColour(colouringEdgesParameter, edgesColourScale);
+	sc->addItem(pMyEdge);
+	networkEdges.append(pMyEdge);
+	isSpatialIndexValid = false;
+	isHierarchyValid = false;
+	areSeriesChainsValid = false;
+	invalidateActiveEdges();
+	isParallelEdgeLoopValid = false;
+	isPartitionedEdgeLoopValid = false;
+	sidecar.close();
+	return pMyEdge;
+}
+
+
+void GraphWidget::removeEdge(Edge *pEdge)
+{
+	networkEdges.removeOne(pEdge);
+	sidecar.close();
+	isSpatialIndexValid = false;
+	isHierarchyValid = false;
+	areSeriesChainsValid = false;
+	invalidateActiveEdges();
+	isParallelEdgeLoopValid = false;
+	isPartitionedEdgeLoopValid = false;
+}
+
+
+Stoma *GraphWidget::createNewStoma(Node *sourceNode)
+{
+
+	Stoma *pMyStoma = new Stoma(this, sourceNode);
+	pMyStoma->initialize();
+//	pMyStoma->setLength(1);
+//	pMyStoma->setWidth(1);
+	//pMyStoma->setVisible(false);
+	if (pMyStoma->getSigma() > maxSigma)
+	{
+		maxSigma = pMyStoma->getSigma();
+	}
+	pMyStoma->reColour(colouringStomataParameter, stomataColourScale);
+	sc->addItem(pMyStoma);
+
+	return pMyStoma;
+}
+
+
+
+
+
+
+
+/* Zooming only changes the transformation of the view: the items keep their
+ positions, so zooming costs the same whatever the size of the network, and
+ the coordinates that are saved or exported do not depend on the zoom. */
+void GraphWidget::zoom(qreal scaleFactor)
+{
+	scaleView(scaleFactor);
+}
+
+
+
+
+
+
+
+
+
+
+
+// only overridden to time the repaints of the view
+void GraphWidget::paintEvent(QPaintEvent *event)
+{
+	EL_PROFILE_SCOPE("repaint");
+	QGraphicsView::paintEvent(event);
+}
+
+
+
+
+/* When the view is zoomed out so far that the typical edge is shorter than
+ minimumCoarseEdgePixels on screen, the edges are not drawn one by one: the
+ first level of the hierarchy whose edges are long enough is drawn here, below
+ the items, and Edge::paint draws nothing. Each coarse edge has the mean colour
+ of the edges merged into it. */
+
+void GraphWidget::drawBackground(QPainter *painter, const QRectF &rect)
+{
+	QGraphicsView::drawBackground(painter, rect);
+	
+	double levelOfDetail = QStyleOptionGraphicsItem::levelOfDetailFromTransform(painter->worldTransform());
+	int level = 0;
+	if (!networkEdges.isEmpty())
+	{
+		updateHierarchy();
+		while (level + 1 < hierarchy.getNumberOfLevels()
+			   && hierarchy.level(level).typicalEdgeLength * levelOfDetail < minimumCoarseEdgePixels)
+		{
+			level++;
+		}
+	}
+	if (level != displayedLevel)
+	{
+		displayedLevel = level;
+		displayedLevelEdges = hierarchy.edgesAtLevel(level);
+	}
+	if (displayedLevel == 0 || !areEdgesVisible)
+		return;
+	
+	EL_PROFILE_SCOPE("coarse edges");
+	const GraphLevel &coarse = hierarchy.level(displayedLevel);
+	int nCoarseEdges = coarse.edgeSource.size();
+	QVector<int> red(nCoarseEdges, 0), green(nCoarseEdges, 0), blue(nCoarseEdges, 0), count(nCoarseEdges, 0);
+	for (int i = 0; i < networkEdges.size() && i < displayedLevelEdges.size(); i++)
+	{
+		int edge = displayedLevelEdges[i];
+		if (edge < 0)
+			continue;
+		QColor colour = networkEdges[i]->getColour();
+		red[edge] += colour.red();
+		green[edge] += colour.green();
+		blue[edge] += colour.blue();
+		count[edge]++;
+	}
+	
+	painter->save();
+	QPen pen(Qt::black, 1, Qt::SolidLine, Qt::RoundCap, Qt::RoundJoin);
+	pen.setCosmetic(true);
+	for (int edge = 0; edge < nCoarseEdges; edge++)
+	{
+		if (count[edge] == 0)
+			continue;
+		QLineF line(coarse.positions[coarse.edgeSource[edge]], coarse.positions[coarse.edgeDest[edge]]);
+		if (!rect.intersects(QRectF(line.p1(), line.p2()).normalized().adjusted(-1, -1, 1, 1)))
+			continue;
+		pen.setColor(QColor(red[edge] / count[edge], green[edge] / count[edge], blue[edge] / count[edge]));
+		painter->setPen(pen);
+		painter->drawLine(line);
+	}
+	painter->restore();
+}
+
+
+
+
+/* Nodes and stomata have no contents for Qt: their glyphs are drawn here, above
+ the edges, as pixmap fragments copied from the glyph atlas. A stoma sits exactly
+ on its node and covers it, so only the glyph on top is drawn. The fragments are
+ placed in device coordinates, so that the glyphs are copied pixel for pixel. */
+void GraphWidget::drawForeground(QPainter *painter, const QRectF &rect)
+{
+	EL_PROFILE_SCOPE("glyphs");
+	if (!areNodesVisible && !areStomataVisible)
+		return;
+	
+	double levelOfDetail = QStyleOptionGraphicsItem::levelOfDetailFromTransform(painter->worldTransform());
+	// when the network is zoomed out the glyphs become smaller than a pixel, and are not drawn at all
+	if (3 * levelOfDetail < minimumGlyphPixels)
+		return;
+	
+	updateSpatialIndex();
+	glyphAtlas.clearIfFull();
+	
+	QTransform toDevice = painter->worldTransform();
+	QVector<QPainter::PixmapFragment> fragments;
+	QList<QGraphicsItem *> largeGlyphs; // drawn directly, when the atlas cannot hold them
+	// the glyph extends half a unit beyond the shape of the node, on the bottom right
+	foreach (Node *pNode, spatialIndex.nodes(rect.adjusted(-1, -1, 1, 1)))
+	{
+		QGraphicsItem *item;
+		QColor colourLight, colourDark;
+		Stoma *pStoma = pNode->getStoma();
+		if (pStoma != NULL && pStoma->isVisible())
+		{
+			item = pStoma;
+			colourLight = pStoma->getColourLight();
+			colourDark = pStoma->getColourDark();
+		}
+		else if (pNode->isVisible())
+		{
+			item = pNode;
+			colourLight = pNode->getColourLight();
+			colourDark = pNode->getColourDark();
+		}
+		else
+		{
+			continue;
+		}
+		if (!glyphAtlas.addFragment(fragments, toDevice.map(item->pos()), colourLight, colourDark, levelOfDetail))
+		{
+			largeGlyphs.append(item);
+		}
+	}
+	
+	painter->save();
+	painter->resetTransform();
+	painter->drawPixmapFragments(fragments.constData(), fragments.size(), glyphAtlas.getPixmap());
+	painter->restore();
+	
+	foreach (QGraphicsItem *item, largeGlyphs)
+	{
+		painter->save();
+		painter->translate(item->pos());
+		if (Stoma *pStoma = qgraphicsitem_cast<Stoma *>(item))
+		{
+			paintGlyph(painter, pStoma->getColourLight(), pStoma->getColourDark());
+		}
+		else if (Node *pNode = qgraphicsitem_cast<Node *>(item))
+		{
+			paintGlyph(painter, pNode->getColourLight(), pNode->getColourDark());
+		}
+		painter->restore();
+	}
+}
+
+
+
+
+
+void GraphWidget::wheelEvent(QWheelEvent *event)
+{
+    scaleView(pow((double)2, -event->delta() / 500.0));
+}
+
+
+
+
+
+
+
+
+
+void GraphWidget::scaleView(qreal scaleFactor)
+{
+    qreal factor = matrix().scale(scaleFactor, scaleFactor).mapRect(QRectF(0, 0, 1, 1)).width();
+    if (factor < 0.07 || factor > 100)
+        return;
+	
+    scale(scaleFactor, scaleFactor);
+}
+
+
+
+
+
+
+
+/* I reimplement mousePressEvent so that we can select an edge more precisely. On the other hand, this way 
+ we are no longer able to select nodes. */
+void GraphWidget::mousePressEvent ( QMouseEvent *event )
+{
+	currentSelection = NULL;
+	if (isRegionSelected)
+	{
+		isRegionSelected = false;
+		return;
+	}
+	
+    int x=event->pos().x();
+    int y=event->pos().y();
+	
+    QList<QGraphicsItem *>items=itemsInViewRect(QRectF(x-2.5,y-2.5,5,5));
+	
+	if (whatIsSelecting == "Nodes")
+	{
+		for(int i=items.size()-1;i>=0;i--)
+		{
+			QGraphicsItem *item=items.at(i);
+			if (Node *pNode = qgraphicsitem_cast<Node *>(item))
+			{
+				nodePropertiesMenu(event, pNode);
+				return; //one node has been selected
+			}
+		}
+    }
+	else if (whatIsSelecting == "Edges")
+	{
+		for(int i=items.size()-1;i>=0;i--)
+		{
+			QGraphicsItem *item=items.at(i);
 			if (Edge *pEdge = qgraphicsitem_cast<Edge *>(item))
 			{
 				edgePropertiesMenu(event, pEdge);
@@ -1424,31 +2273,177 @@ void GraphWidget::setChargePerParticle(double newChargePerParticle)
 void GraphWidget::setDeltaT(double newDeltaT)
 {
 	deltaT = newDeltaT;
+	configuredDeltaT = newDeltaT;
+	minDeltaT = newDeltaT / 100;
+	maxDeltaT = min(newDeltaT * 100, 0.5); // the conductivities decay by a factor 1 - deltaT at each step
 }
 
-void GraphWidget::setMinSigma(double newMinSigma)
+// back to the step given with setDeltaT, which the adaptive step moves away from
+void GraphWidget::resetDeltaT()
 {
-	minSigma = newMinSigma;
+	setDeltaT(configuredDeltaT);
 }
 
-void GraphWidget::setParticlesAtSource(int newParticlesAtSource)
+void GraphWidget::setAdaptiveDeltaT(bool shouldAdaptDeltaT)
 {
-	particlesAtSource = newParticlesAtSource;
+	isAdaptingDeltaT = shouldAdaptDeltaT;
 }
 
+bool GraphWidget::getAdaptiveDeltaT()
+{
+	return isAdaptingDeltaT;
+}
 
+void GraphWidget::setSigmaTolerance(double newSigmaTolerance)
+{
+	sigmaTolerance = newSigmaTolerance;
+}
 
+void GraphWidget::setMaxTransferProbability(double newMaxTransferProbability)
+{
+	maxTransferProbability = newMaxTransferProbability;
+}
+
+void GraphWidget::setSigmaUpdateInterval(int newSigmaUpdateInterval)
+{
+	if (stepsSinceSigmaUpdate > 0)
+		updateSigmaOverInterval(); // the flows added up so far are not lost
+	sigmaUpdateInterval = newSigmaUpdateInterval;
+	currentSigmaUpdateInterval = max(newSigmaUpdateInterval, 1);
+}
+
+int GraphWidget::getSigmaUpdateInterval()
+{
+	return sigmaUpdateInterval;
+}
+
+void GraphWidget::setEdgeLoopThreads(int newEdgeLoopThreads)
+{
+	edgeLoopThreads = max(newEdgeLoopThreads, 1);
+}
+
+int GraphWidget::getEdgeLoopThreads()
+{
+	return edgeLoopThreads;
+}
+
+// with more than one thread, each thread moves the particles of one part of the leaf
+void GraphWidget::setEdgePartitioning(bool shouldPartitionEdges)
+{
+	isPartitioningEdges = shouldPartitionEdges;
+}
+
+bool GraphWidget::getEdgePartitioning()
+{
+	return isPartitioningEdges;
+}
+
+// the benchmarks turn the sidecar off, so that every load does the whole work and leaves no file behind
+void GraphWidget::setUsingSidecar(bool shouldUseSidecar)
+{
+	isUsingSidecar = shouldUseSidecar;
+}
+
+bool GraphWidget::getUsingSidecar()
+{
+	return isUsingSidecar;
+}
+
+// in the order of the nodes in memory, to compare runs of the same network
+QVector<int> GraphWidget::getParticlesPerNode()
+{
+	QVector<int> nParticles(networkNodes.size());
+	for (int i = 0; i < networkNodes.size(); i++)
+	{
+		nParticles[i] = networkNodes[i]->getNParticles();
+	}
+	return nParticles;
+}
+
+QVector<double> GraphWidget::getSigmaPerEdge()
+{
+	QVector<double> sigma(networkEdges.size());
+	for (int i = 0; i < networkEdges.size(); i++)
+	{
+		sigma[i] = networkEdges[i]->getSigma();
+	}
+	return sigma;
+}
+
+// the network as it is now, for the replicas of the ensemble workers, see sharedtopology.h
+void GraphWidget::getTopology(NetworkTopology &topology)
+{
+	QHash<Node *, int> nodeIndex;
+	topology = NetworkTopology();
+	for (int i = 0; i < networkNodes.size(); i++)
+	{
+		Node *pNode = networkNodes[i];
+		nodeIndex.insert(pNode, i);
+		topology.nodeX.append(pNode->pos().x());
+		topology.nodeY.append(pNode->pos().y());
+		topology.isSource.append(pNode->isSourceNode() ? 1 : 0);
+		topology.initialParticles.append(pNode->getNParticles());
+		if (pNode->isSinkNode() && pNode->getStoma() != NULL)
+		{
+			topology.stomaNode.append(i);
+			topology.stomaSigma.append(pNode->getStoma()->getSigma());
+		}
+	}
+	foreach (Edge *pEdge, networkEdges)
+	{
+		topology.edgeSource.append(nodeIndex.value(pEdge->getSourceNode()));
+		topology.edgeDest.append(nodeIndex.value(pEdge->getDestNode()));
+		topology.edgeWidth.append(pEdge->getWidth());
+		topology.edgeLength.append(pEdge->getLength());
+		topology.initialSigma.append(pEdge->getSigma());
+	}
+}
+
+void GraphWidget::setConvergenceMonitoring(bool shouldMonitorConvergence)
+{
+	isMonitoringConvergence = shouldMonitorConvergence;
+	convergenceMonitor.reset();
+}
+
+// from the next step, the simulated time of the monitor starts again from startTime
+void GraphWidget::resetConvergenceMonitor(double startTime)
+{
+	convergenceMonitor.reset(startTime);
+}
+
+bool GraphWidget::hasConverged()
+{
+	return convergenceMonitor.hasConverged();
+}
+
+double GraphWidget::getConvergenceTime()
+{
+	return convergenceMonitor.getConvergenceTime();
+}
+
+void GraphWidget::setMinSigma(double newMinSigma)
+{
+	minSigma = newMinSigma;
+}
+
+void GraphWidget::setParticlesAtSource(int newParticlesAtSource)
+{
+	particlesAtSource = newParticlesAtSource;
+}
+
+
+
+//
+//
+//void GraphWidget::setCurrentNodeAsSource() 
+//{
+//	if (currentNode == NULL)
+//		return;
+//	currentNode->setAsSource();
+//	currentNode = NULL;
+//}
+//
 //
-//
-//void GraphWidget::setCurrentNodeAsSource() 
-//{
-//	if (currentNode == NULL)
-//		return;
-//	currentNode->setAsSource();
-//	currentNode = NULL;
-//}
-//
-//
 //void GraphWidget::setCurrentNodeAsSink() 
 //{
 //	if (currentNode == NULL)
@@ -1950,132 +2945,777 @@ void GraphWidget::stomaPropertiesMenu(QMouseEvent *event, Stoma* pStoma)
 
 
 
-void GraphWidget::performOneSimulationStep()
+// moves the particles along one edge, and updates its conductivity
+void GraphWidget::moveParticlesAlongEdge(Edge *pEdge)
 {
+//		printf("edge %d--%d\n", pEdge->getSourceNode()->getNumber(), pEdge->getDestNode()->getNumber());
+	drawEdgeFlow(itemNetwork, pEdge, deltaT);
+}
+
+
+// the conductivity of the edge and the maxima, once the flow of the step is known
+void GraphWidget::updateEdgeSigma(Edge *pEdge)
+{
+	if (isDeferringSigmaUpdate)
+	{
+		pEdge->setFlowSum(pEdge->getFlowSum() + abs(pEdge->getFlow()));
+		return;
+	}
 	
-	// I normalize the colours of the edges and nodes on the maximum and minimum property (sigma, flow, n particles)
-	// These maxima and minima can change from one step to the next, but I don't like the flickering produced by their
-	// rapid change. In order to reduce the flickering, I keep trace of the maximum and minimum at the previous step
-	// and take some sort of average
-	
-	int previousMinFlow = minFlow;
-	int previousMaxFlow = maxFlow;
-	double previousMaxSigma = maxSigma;
-	int previousMinNParticles = minNParticles;
-	int previousMaxNParticles = maxNParticles;
+	// update conductivity (sigma_ij) for each edge
+//		printf("minSigma %f, sigma %f, flow %d\n", minSigma, pEdge->getSigma(), pEdge->getFlow());
+	if (isUpdatingEdgeSigma)
+	{
+		pEdge->setSigma(
+					max(
+						pEdge->getSigma() * (1.0 - deltaT) + 
+						abs(pEdge->getFlow()) * chargePerParticle,
+						minSigma
+						)
+					);
+	}
 	
+	if (pEdge->getSigma() > maxSigma)
+	{
+		maxSigma = pEdge->getSigma();
+	}
+	if (pEdge->getFlow() > maxFlow)
+	{
+		maxFlow = pEdge->getFlow();
+	}
+	if (pEdge->getFlow() < minFlow)
+	{
+		minFlow = pEdge->getFlow();
+	}
+}
+
+
+/* The same for a chain of edges taken as one edge, whose conductivity is the
+ one of its segments in series. Every segment carries the whole flow, so the
+ conductivity of every segment is updated with it. The particles of the inner
+ nodes do not move, reconstructSeriesChains sets them when they are shown. */
+
+void GraphWidget::moveParticlesAlongChain(const SeriesChain &chain)
+{
+	QVector<double> conductances;
+	conductances.reserve(chain.segments.size());
+	foreach (Edge *pEdge, chain.segments)
+	{
+		conductances.append(pEdge->getSigma());
+	}
+	double sigma = seriesConductance(conductances);
 	
-	minFlow = INT_MAX;
-	maxFlow = 0;
-	maxSigma = 0;
-	minNParticles = INT_MAX;
-	maxNParticles = 0;
+	int flow = 0;
+	int diffNParticles = chain.last->getNParticles() - chain.first->getNParticles();
+	if (diffNParticles > 0)
+	{
+		flow = - binomDist(diffNParticles, sigma*deltaT);
+	}
+	else if (diffNParticles < 0)
+	{
+		flow = binomDist(-diffNParticles, sigma*deltaT);
+	}
+	chain.first->subtractParticles(flow);
+	chain.last->addParticles(flow);
 	
+	for (int i = 0; i < chain.segments.size(); i++)
+	{
+		Edge *pEdge = chain.segments[i];
+		pEdge->setFlow(chain.isSegmentReversed[i] ? -flow : flow);
+		updateEdgeSigma(pEdge);
+	}
+}
+
+
+
+
+void GraphWidget::setSeriesReduction(bool shouldReduceSeries)
+{
+	if (isReducingSeries && !shouldReduceSeries)
+		reconstructSeriesChains(); // the inner nodes go back to the simulation with the state of the chain
+	isReducingSeries = shouldReduceSeries;
+}
+
+
+bool GraphWidget::getSeriesReduction()
+{
+	return isReducingSeries;
+}
 
+
+// edges and chains moved one by one in a simulation step
+int GraphWidget::getNumberOfSimulatedEdges()
+{
+	if (!isReducingSeries)
+		return networkEdges.size();
+	updateSeriesChains();
+	return unreducedEdges.size() + seriesChains.size();
+}
+
+
+/* Finds the chains again when the topology changed, or when an inner node of a
+ chain became a source or a sink, which the properties menus can do at any
+ time. */
+
+void GraphWidget::updateSeriesChains()
+{
+	if (areSeriesChainsValid)
+	{
+		foreach (const SeriesChain &chain, seriesChains)
+		{
+			foreach (Node *pNode, chain.innerNodes)
+			{
+				if (pNode->isSourceNode() || pNode->isSinkNode())
+					areSeriesChainsValid = false;
+			}
+		}
+		if (areSeriesChainsValid)
+			return;
+	}
 	
+	QHash<Node *, int> nodeIndex;
+	QVector<bool> isTerminal(networkNodes.size());
+	for (int i = 0; i < networkNodes.size(); i++)
+	{
+		nodeIndex.insert(networkNodes[i], i);
+		isTerminal[i] = networkNodes[i]->isSourceNode() || networkNodes[i]->isSinkNode();
+	}
+	QVector<int> edgeSource;
+	QVector<int> edgeDest;
+	edgeSource.reserve(networkEdges.size());
+	edgeDest.reserve(networkEdges.size());
+	foreach (Edge *pEdge, networkEdges)
+	{
+		edgeSource.append(nodeIndex.value(pEdge->getSourceNode()));
+		edgeDest.append(nodeIndex.value(pEdge->getDestNode()));
+	}
 	
-	pMainWindow->increaseSimulationTime(1);
-//	printf("simulation step\n");
-	// update source and sink nodes
-	foreach (QGraphicsItem *item, sc->items()) 
+	QVector<SeriesChainIndices> chainIndices = findSeriesChains(networkNodes.size(), edgeSource, edgeDest, isTerminal);
+	QVector<bool> isInChain(networkEdges.size(), false);
+	seriesChains.clear();
+	foreach (const SeriesChainIndices &indices, chainIndices)
 	{
-		Node *pNode = qgraphicsitem_cast<Node *>(item);
-		if (!pNode)
-			continue;
-		if (pNode->isSourceNode())
+		SeriesChain chain;
+		chain.first = networkNodes[indices.nodes.first()];
+		chain.last = networkNodes[indices.nodes.last()];
+		for (int i = 1; i < indices.nodes.size() - 1; i++)
 		{
-			pNode->setNParticles(particlesAtSource);
+			chain.innerNodes.append(networkNodes[indices.nodes[i]]);
 		}
-		else if (pNode->isSinkNode())
+		for (int i = 0; i < indices.edges.size(); i++)
 		{
-			Stoma *pStoma = pNode->getStoma();
-			int diffNParticles = pNode->getNParticles(); // atmospheric potential is zero
-			pStoma->setFlow(binomDist(diffNParticles, pStoma->getSigma()*deltaT));
-			pNode->subtractParticles(pStoma->getFlow());
-			
-			
-			
-			// y = 1 / (1+exp(slope*(-x+center)));
-			// y=tanh({({x-1})|_cdot_2})|_cdot_0.5+0.5
-			// update stomatic conductivity based on node potential
-			// remember diffNParticles* chargePerParticle
-			
-			// double slope = 0.1;
-			// double flexPoint = 500;
-			// pStoma->setSigma(tanh(slope*(double(diffNParticles) - flexPoint))*0.1 + 0.1);
+			int edge = indices.edges[i];
+			chain.segments.append(networkEdges[edge]);
+			chain.isSegmentReversed.append(edgeSource[edge] != indices.nodes[i]);
+			isInChain[edge] = true;
+		}
+		seriesChains.append(chain);
+	}
+	unreducedEdges.clear();
+	for (int i = 0; i < networkEdges.size(); i++)
+	{
+		if (!isInChain[i])
+			unreducedEdges.append(networkEdges[i]);
+	}
+	areSeriesChainsValid = true;
+	areSeriesChainsReconstructed = false;
+}
+
+
+// gives the inner nodes of the chains the particles of the steady state between the two ends
+void GraphWidget::reconstructSeriesChains()
+{
+	if (!isReducingSeries || areSeriesChainsReconstructed)
+		return;
+	updateSeriesChains();
+	foreach (const SeriesChain &chain, seriesChains)
+	{
+		QVector<double> conductances;
+		conductances.reserve(chain.segments.size());
+		foreach (Edge *pEdge, chain.segments)
+		{
+			conductances.append(pEdge->getSigma());
+		}
+		QVector<double> nParticles = interpolateAlongChain(conductances, chain.first->getNParticles(), chain.last->getNParticles());
+		for (int i = 0; i < chain.innerNodes.size(); i++)
+		{
+			chain.innerNodes[i]->setNParticles(qRound(nParticles[i + 1]));
 		}
+	}
+	areSeriesChainsReconstructed = true;
+}
+
+
+
+
+// the nodes call it whenever their particles change, see ActiveEdgeSet in fixedstep.h
+void GraphWidget::activateEdgesOf(Node *pNode)
+{
+	activeEdges.activateEdgesOf(itemNetwork, pNode);
+}
+
+
+// the total decay of the conductivities of the edges left idle by the fixed step, -log of the product of the 1 - deltaT
+double GraphWidget::getIdleSigmaDecay()
+{
+	return idleSigmaDecay;
+}
+
+
+// brings all the conductivities up to date, before they are read from several threads
+void GraphWidget::applyIdleSigmaDecay()
+{
+	if (!isIdleSigmaDecayPending)
+		return;
+	foreach (Edge *pEdge, networkEdges)
+	{
+		pEdge->getSigma();
+	}
+	isIdleSigmaDecayPending = false;
+}
+
+
+void GraphWidget::invalidateActiveEdges()
+{
+	activeEdges.invalidate();
+}
+
+
+
+
+GraphWidget::ItemNetwork::ItemNetwork(GraphWidget *graphWidget)
+: graph(graphWidget)
+{
+}
+
+int GraphWidget::ItemNetwork::getNumberOfNodes()
+{
+	return graph->networkNodes.size();
+}
+
+Node *GraphWidget::ItemNetwork::getNode(int i)
+{
+	return graph->networkNodes[i];
+}
+
+bool GraphWidget::ItemNetwork::isSourceNode(Node *pNode)
+{
+	return pNode->isSourceNode();
+}
+
+bool GraphWidget::ItemNetwork::hasStoma(Node *pNode)
+{
+	return pNode->isSinkNode() && pNode->getStoma() != NULL;
+}
+
+double GraphWidget::ItemNetwork::getStomaSigma(Node *pNode)
+{
+	return pNode->getStoma()->getSigma();
+}
+
+void GraphWidget::ItemNetwork::setStomaFlow(Node *pNode, int flow)
+{
+	pNode->getStoma()->setFlow(flow);
+}
+
+int GraphWidget::ItemNetwork::getNParticles(Node *pNode)
+{
+	return pNode->getNParticles();
+}
+
+// the nodes activate their edges themselves
+void GraphWidget::ItemNetwork::setNParticles(Node *pNode, int nParticles)
+{
+	pNode->setNParticles(nParticles);
+}
+
+void GraphWidget::ItemNetwork::addParticles(Node *pNode, int nParticles)
+{
+	pNode->addParticles(nParticles);
+}
+
+void GraphWidget::ItemNetwork::subtractParticles(Node *pNode, int nParticles)
+{
+	pNode->subtractParticles(nParticles);
+}
+
+QList<Edge *> GraphWidget::ItemNetwork::getEdgesOf(Node *pNode)
+{
+	return pNode->edges();
+}
+
+int GraphWidget::ItemNetwork::getNumberOfEdges()
+{
+	return graph->networkEdges.size();
+}
+
+Edge *GraphWidget::ItemNetwork::getEdge(int i)
+{
+	return graph->networkEdges[i];
+}
+
+Node *GraphWidget::ItemNetwork::getSourceNode(Edge *pEdge)
+{
+	return pEdge->getSourceNode();
+}
+
+Node *GraphWidget::ItemNetwork::getDestNode(Edge *pEdge)
+{
+	return pEdge->getDestNode();
+}
+
+double GraphWidget::ItemNetwork::getSigma(Edge *pEdge)
+{
+	return pEdge->getSigma();
+}
+
+void GraphWidget::ItemNetwork::setFlow(Edge *pEdge, int flow)
+{
+	pEdge->setFlow(flow);
+}
 
-				
+// with the maxima and the multirate update
+void GraphWidget::ItemNetwork::updateSigma(Edge *pEdge)
+{
+	graph->updateEdgeSigma(pEdge);
+}
+
+void GraphWidget::ItemNetwork::setIdleSigmaDecay(Edge *pEdge, double idleSigmaDecay)
+{
+	pEdge->setIdleSigmaDecay(idleSigmaDecay);
+}
+
+bool GraphWidget::ItemNetwork::isInActiveSet(Edge *pEdge)
+{
+	return pEdge->isInActiveSet();
+}
+
+void GraphWidget::ItemNetwork::setInActiveSet(Edge *pEdge, bool shouldBeInActiveSet)
+{
+	pEdge->setInActiveSet(shouldBeInActiveSet);
+}
+
+
+/* The update of the conductivities of the last few steps, with the mean of
+ their flows. For steps of constant length, n Euler steps with a constant flow
+ give sigma * (1 - deltaT)^n + q * (1 - (1 - deltaT)^n) / deltaT, q being
+ |flow| * chargePerParticle per step; the same written with the product of the
+ 1 - deltaT and the total time also holds when deltaT changes. With
+ sigmaUpdateInterval 0 the next interval is chosen so that the conductivities
+ change by about 1% between two updates. The range of the flows in the colours
+ is the one of the mean flows of the interval, in the direction of the last
+ flow of each edge, since only the size of the flow is summed. */
+
+void GraphWidget::updateSigmaOverInterval()
+{
+	EL_PROFILE_SCOPE("sigma update");
+	double totalSigma = 0;
+	double totalChange = 0;
+	foreach (Edge *pEdge, networkEdges)
+	{
+		double sigma = pEdge->getSigma();
+		if (isUpdatingEdgeSigma)
+		{
+			double gain = pEdge->getFlowSum() * chargePerParticle * (1.0 - sigmaDecaySinceUpdate) / timeSinceSigmaUpdate;
+			pEdge->setSigma(max(sigma * sigmaDecaySinceUpdate + gain, minSigma));
+		}
+		int meanFlow = qRound(double(pEdge->getFlowSum()) / stepsSinceSigmaUpdate);
+		if (pEdge->getFlow() < 0)
+			meanFlow = -meanFlow;
+		pEdge->setFlowSum(0);
+		totalSigma += sigma;
+		totalChange += fabs(pEdge->getSigma() - sigma);
+		
+		if (pEdge->getSigma() > maxSigma)
+		{
+			maxSigma = pEdge->getSigma();
+		}
+		if (meanFlow > maxFlow)
+		{
+			maxFlow = meanFlow;
+		}
+		if (meanFlow < minFlow)
+		{
+			minFlow = meanFlow;
+		}
 	}
 	
-	// compute potential difference across edges. Read the edges in random sequence
-	// and update the flow and the particles at the two adjacent nodes
-	QList <Edge *> edgeList;
-	foreach (QGraphicsItem *item, sc->items())
+	if (sigmaUpdateInterval == 0)
 	{
-		Edge *pEdge = qgraphicsitem_cast<Edge *>(item);
-		if (!pEdge)
+		double changePerStep = totalSigma > 0 ? totalChange / totalSigma / stepsSinceSigmaUpdate : 0;
+		int newInterval = currentSigmaUpdateInterval * 2;
+		if (changePerStep > 0)
+			newInterval = min(newInterval, int(0.01 / changePerStep) + 1);
+		currentSigmaUpdateInterval = min(max(newInterval, 1), maxSigmaUpdateInterval);
+	}
+	stepsSinceSigmaUpdate = 0;
+	timeSinceSigmaUpdate = 0;
+	sigmaDecaySinceUpdate = 1;
+}
+
+
+// the sources are not counted in the particles in the network, what they give is the inflow
+void GraphWidget::monitorConvergence(double stepDeltaT)
+{
+	reconstructSeriesChains(); // the particles of the inner nodes of the chains are counted too
+	double outflow = 0;
+	double particlesInNetwork = 0;
+	foreach (Node *pNode, networkNodes)
+	{
+		if (pNode->isSourceNode())
 			continue;
-		edgeList.append(pEdge);
+		particlesInNetwork += pNode->getNParticles();
+		if (pNode->isSinkNode() && pNode->getStoma() != NULL)
+			outflow += pNode->getStoma()->getFlow();
+	}
+	if (convergenceMonitor.addStep(stepDeltaT, outflow, particlesInNetwork))
+	{
+		QVector<double> sigma(networkEdges.size());
+		for (int i = 0; i < networkEdges.size(); i++)
+		{
+			sigma[i] = networkEdges[i]->getSigma();
+		}
+		convergenceMonitor.endWindow(sigma);
+	}
+}
+
+
+/* The conductivities follow dsigma/dt = q - sigma, q being |flow| *
+ chargePerParticle per unit time, and each step is one Euler step of it.
+ Two half steps instead of one would give a result different by
+ (sigma - q) * deltaT^2 / 4, which is taken as the local error. The next step
+ is made longer or shorter so that the largest relative error gets close to
+ sigmaTolerance. A step is never taken again: the flows are random, and
+ drawing them again until the error is small would bias them. With the fixed
+ step, sigma * deltaT is the probability that a particle in excess moves along
+ an edge, and it is kept below maxTransferProbability. */
+
+void GraphWidget::adaptDeltaT()
+{
+	double maxRelativeError = 0;
+	double largestSigma = 0;
+	foreach (Edge *pEdge, networkEdges)
+	{
+		double sigma = pEdge->getSigma();
+		largestSigma = max(largestSigma, sigma);
+		if (!isUpdatingEdgeSigma)
+			continue;
+		double inflow = abs(pEdge->getFlow()) * chargePerParticle / deltaT;
+		double error = fabs(sigma - inflow) * deltaT * deltaT / 4;
+		maxRelativeError = max(maxRelativeError, error / max(sigma, minSigma));
+	}
+	foreach (Node *pNode, networkNodes)
+	{
+		if (pNode->isSinkNode() && pNode->getStoma() != NULL)
+			largestSigma = max(largestSigma, pNode->getStoma()->getSigma());
 	}
-	std::random_shuffle( edgeList.begin(), edgeList.end() ); // shuffle the edgeList
-	
 	
-	foreach (Edge *pEdge, edgeList) 
+	double factor = 2;
+	if (maxRelativeError > 0)
+		factor = min(max(0.9 * sqrt(sigmaTolerance / maxRelativeError), 0.5), 2.0);
+	double newDeltaT = deltaT * factor;
+	if (simulationEngine == "fixed step" && largestSigma > 0)
+		newDeltaT = min(newDeltaT, maxTransferProbability / largestSigma);
+	deltaT = min(max(newDeltaT, minDeltaT), maxDeltaT);
+}
+
+
+// the edge loop of the fixed step on edgeLoopThreads threads, see paralleledgeloop.h and domaindecomposition.h
+void GraphWidget::moveParticlesInParallel()
+{
+	bool isLoopValid = isPartitioningEdges
+		? isPartitionedEdgeLoopValid && partitionedEdgeLoop.getNumberOfParts() == edgeLoopThreads
+		: isParallelEdgeLoopValid && parallelEdgeLoop.getNumberOfThreads() == edgeLoopThreads;
+	if (!isLoopValid)
 	{
-//		printf("edge %d--%d\n", item->getSourceNode()->getNumber(), item->getDestNode()->getNumber());
-//		Edge *pEdge = qgraphicsitem_cast<Edge *>(item);
-//		if (!pEdge)
-//			continue;
-		int diffNParticles = pEdge->getDestNode()->getNParticles() - 
-		pEdge->getSourceNode()->getNParticles();
-		if (diffNParticles == 0)
+		QHash<Node *, int> nodeIndex;
+		QVector<double> x(networkNodes.size());
+		QVector<double> y(networkNodes.size());
+		for (int i = 0; i < networkNodes.size(); i++)
 		{
-			pEdge->setFlow(0);
+			nodeIndex.insert(networkNodes[i], i);
+			x[i] = networkNodes[i]->pos().x();
+			y[i] = networkNodes[i]->pos().y();
 		}
-		else if (diffNParticles > 0)
-		{ // if there are more particles in dest than in source, the flow is 
-			// from dest to source, i.e. negative
-			pEdge->setFlow(- binomDist(diffNParticles, pEdge->getSigma()*deltaT));// * diffNParticles/abs(diffNParticles));
+		QVector<int> edgeSource(networkEdges.size());
+		QVector<int> edgeDest(networkEdges.size());
+		for (int i = 0; i < networkEdges.size(); i++)
+		{
+			edgeSource[i] = nodeIndex.value(networkEdges[i]->getSourceNode());
+			edgeDest[i] = nodeIndex.value(networkEdges[i]->getDestNode());
 		}
-		else if (diffNParticles < 0)
+		if (isPartitioningEdges)
 		{
-			pEdge->setFlow(binomDist(-diffNParticles, pEdge->getSigma()*deltaT));// * diffNParticles/abs(diffNParticles));
-
+			partitionedEdgeLoop.setNetwork(x, y, edgeSource, edgeDest, edgeLoopThreads);
+			isPartitionedEdgeLoopValid = true;
 		}
-		// move particles
+		else
+		{
+			parallelEdgeLoop.setNetwork(networkNodes.size(), edgeSource, edgeDest, edgeLoopThreads);
+			isParallelEdgeLoopValid = true;
+		}
+	}
+	
+	for (int i = 0; i < networkNodes.size(); i++)
+	{
+		if (isPartitioningEdges)
+			partitionedEdgeLoop.setParticles(i, networkNodes[i]->getNParticles());
+		else
+			parallelEdgeLoop.setParticles(i, networkNodes[i]->getNParticles());
+	}
+	QVector<double> transferProbability(networkEdges.size());
+	for (int i = 0; i < networkEdges.size(); i++)
+	{
+		transferProbability[i] = networkEdges[i]->getSigma() * deltaT;
+	}
+	QVector<int> flow;
+	if (isPartitioningEdges)
+		partitionedEdgeLoop.run(transferProbability, flow);
+	else
+		parallelEdgeLoop.run(transferProbability, flow);
+	
+	for (int i = 0; i < networkNodes.size(); i++)
+	{
+		networkNodes[i]->setNParticles(isPartitioningEdges ? partitionedEdgeLoop.getParticles(i) : parallelEdgeLoop.getParticles(i));
+	}
+	for (int i = 0; i < networkEdges.size(); i++)
+	{
+		networkEdges[i]->setFlow(flow[i]);
+		updateEdgeSigma(networkEdges[i]);
+	}
+}
+
+
+/* One step of length deltaT of the original scheme: every edge, in random
+ order, moves a binomial number of the particles in excess on one side. */
+
+void GraphWidget::performFixedStep()
+{
+	// update source and sink nodes
+	{
+	EL_PROFILE_SCOPE("sources and sinks");
+	refillSourcesAndDrainStomata(itemNetwork, particlesAtSource, deltaT);
+	
+	// y = 1 / (1+exp(slope*(-x+center)));
+	// y=tanh({({x-1})|_cdot_2})|_cdot_0.5+0.5
+	// update stomatic conductivity based on node potential
+	// remember diffNParticles* chargePerParticle
+	
+	// double slope = 0.1;
+	// double flexPoint = 500;
+	// pStoma->setSigma(tanh(slope*(double(diffNParticles) - flexPoint))*0.1 + 0.1);
+	}
+	
+	// compute potential difference across edges. Read the edges in random sequence
+	// and update the flow and the particles at the two adjacent nodes
+	{
+	EL_PROFILE_SCOPE("edge shuffle");
+	if (isReducingSeries)
+	{
+		updateSeriesChains(); // shuffled below, with the chains
+		invalidateActiveEdges();
+	}
+	else if (edgeLoopThreads > 1)
+	{
+		invalidateActiveEdges(); // the threads visit all the edges, in their own order
+	}
+	else
+	{
+		activeEdges.update(itemNetwork);
+	}
+	}
+	
+	
+	{
+	EL_PROFILE_SCOPE("edge flows");
+	if (edgeLoopCounters)
+		edgeLoopCounters->start();
+	if (!isReducingSeries && edgeLoopThreads > 1)
+	{
+		applyIdleSigmaDecay(); // the threads must not update the conductivities they only read
+		moveParticlesInParallel();
+	}
+	else if (!isReducingSeries)
+	{
+		/* The edges not visited would have had no flow, only their conductivity
+		 decays, and it decays when it is next read, see Edge::getSigma: since
+		 max(max(s*a, m)*b, m) = max(s*a*b, m), the decays of all the idle steps
+		 are applied at once. The visited edges are already up to date with this
+		 step. The idle edges keep their conductivity in the colours: when the
+		 colours are shown, their decay is applied and maxSigma is taken over all
+		 the edges. With the multirate update the idle edges decay with the others
+		 in updateSigmaOverInterval. */
+		double stepSigmaDecay = isUpdatingEdgeSigma && !isDeferringSigmaUpdate ? -log(1.0 - deltaT) : 0;
 		
-		pEdge->getSourceNode()->subtractParticles(pEdge->getFlow());
-		pEdge->getDestNode()->addParticles(pEdge->getFlow());
+		// the edges that become active during the step join it if their key comes later
+		int nVisitedEdges = activeEdges.visit(itemNetwork, deltaT, idleSigmaDecay + stepSigmaDecay);
 		
-		// update conductivity (sigma_ij) for each edge
-//		printf("minSigma %f, sigma %f, flow %d\n", minSigma, pEdge->getSigma(), pEdge->getFlow());
-		if (isUpdatingEdgeSigma)
+		if (stepSigmaDecay > 0)
 		{
-			pEdge->setSigma(
-						max(
-							pEdge->getSigma() * (1.0 - deltaT) + 
-							abs(pEdge->getFlow()) * chargePerParticle,
-							minSigma
-							)
-						);
+			idleSigmaDecay += stepSigmaDecay;
+			isIdleSigmaDecayPending = true;
 		}
-		
-		if (pEdge->getSigma() > maxSigma)
+		if (!isDeferringSigmaUpdate && nVisitedEdges < networkEdges.size())
 		{
-			maxSigma = pEdge->getSigma();
+			maxFlow = max(maxFlow, 0);
+			minFlow = min(minFlow, 0);
+			if (isShowingUpdate)
+			{
+				foreach (Edge *pEdge, networkEdges)
+				{
+					maxSigma = max(maxSigma, pEdge->getSigma()); // getSigma applies the pending decay
+				}
+				isIdleSigmaDecayPending = false;
+			}
 		}
-		if (pEdge->getFlow() > maxFlow)
+	}
+	else
+	{
+		// the chains are visited in random sequence together with the other edges
+		QVector<int> visitingOrder(unreducedEdges.size() + seriesChains.size());
+		for (int i = 0; i < visitingOrder.size(); i++)
 		{
-			maxFlow = pEdge->getFlow();
+			visitingOrder[i] = i;
 		}
-		if (pEdge->getFlow() < minFlow)
+		std::random_shuffle(visitingOrder.begin(), visitingOrder.end());
+		foreach (int i, visitingOrder)
 		{
-			minFlow = pEdge->getFlow();
+			if (i < unreducedEdges.size())
+				moveParticlesAlongEdge(unreducedEdges[i]);
+			else
+				moveParticlesAlongChain(seriesChains[i - unreducedEdges.size()]);
 		}
-		
+		areSeriesChainsReconstructed = false;
+	}
+	if (edgeLoopCounters)
+		edgeLoopCounters->stop();
+	}
+}
+
+
+/* The same interval deltaT simulated in continuous time, with the engines of
+ stochasticengines.h. The flows are the particles moved during the whole
+ interval, and the conductivities are updated once with them. The series
+ reduction is not used by these engines. */
+
+void GraphWidget::performContinuousTimeStep()
+{
+	ReactionNetwork network;
+	QHash<Node *, int> nodeIndex;
+	QList<Stoma *> stomata;
+	invalidateActiveEdges(); // every edge gets a flow
+	reconstructSeriesChains(); // after reduced fixed steps, the inner nodes of the chains start from the state of their chain
+	{
+	EL_PROFILE_SCOPE("sources and sinks");
+	network.nParticles.resize(networkNodes.size());
+	network.isSource.resize(networkNodes.size());
+	for (int i = 0; i < networkNodes.size(); i++)
+	{
+		Node *pNode = networkNodes[i];
+		nodeIndex.insert(pNode, i);
+		if (pNode->isSourceNode())
+			pNode->setNParticles(particlesAtSource);
+		network.nParticles[i] = pNode->getNParticles();
+		network.isSource[i] = pNode->isSourceNode();
+		if (pNode->isSinkNode() && pNode->getStoma() != NULL)
+		{
+			stomata.append(pNode->getStoma());
+			network.stomaNode.append(i);
+			network.stomaSigma.append(pNode->getStoma()->getSigma());
+		}
+	}
+	foreach (Edge *pEdge, networkEdges)
+	{
+		network.edgeSource.append(nodeIndex.value(pEdge->getSourceNode()));
+		network.edgeDest.append(nodeIndex.value(pEdge->getDestNode()));
+		network.edgeSigma.append(pEdge->getSigma());
+	}
 	}
 	
+	{
+	EL_PROFILE_SCOPE("edge flows");
+	if (edgeLoopCounters)
+		edgeLoopCounters->start();
+	if (simulationEngine == "Gillespie")
+		simulateGillespie(network, deltaT);
+	else
+		simulateTauLeaping(network, deltaT);
+	if (edgeLoopCounters)
+		edgeLoopCounters->stop();
+	}
+	
+	for (int i = 0; i < networkNodes.size(); i++)
+	{
+		networkNodes[i]->setNParticles(network.nParticles[i]);
+	}
+	areSeriesChainsReconstructed = true; // every node was simulated
+	for (int i = 0; i < stomata.size(); i++)
+	{
+		stomata[i]->setFlow(network.stomaFlow[i]);
+	}
+	for (int i = 0; i < networkEdges.size(); i++)
+	{
+		Edge *pEdge = networkEdges[i];
+		pEdge->setFlow(network.edgeFlow[i]);
+		updateEdgeSigma(pEdge);
+	}
+}
+
+
+
+
+void GraphWidget::performOneSimulationStep()
+{
+	EL_PROFILE_SCOPE("simulation step");
+	
+	// I normalize the colours of the edges and nodes on the maximum and minimum property (sigma, flow, n particles)
+	// These maxima and minima can change from one step to the next, but I don't like the flickering produced by their
+	// rapid change. In order to reduce the flickering, I keep trace of the maximum and minimum at the previous step
+	// and take some sort of average
+	
+	int previousMinFlow = minFlow;
+	int previousMaxFlow = maxFlow;
+	double previousMaxSigma = maxSigma;
+	int previousMinNParticles = minNParticles;
+	int previousMaxNParticles = maxNParticles;
+	
+	// with the multirate update, the maxima and the colours only change with the conductivities
+	isDeferringSigmaUpdate = sigmaUpdateInterval != 1;
+	bool isSigmaUpdateStep = !isDeferringSigmaUpdate || stepsSinceSigmaUpdate + 1 >= currentSigmaUpdateInterval;
+	
+	if (isSigmaUpdateStep)
+	{
+		minFlow = INT_MAX;
+		maxFlow = 0;
+		maxSigma = 0;
+		minNParticles = INT_MAX;
+		maxNParticles = 0;
+	}
+	
+
+	
+	
+	if (pMainWindow) // there is no main window when running the benchmarks
+		pMainWindow->increaseSimulationTime(1, deltaT);
+//	printf("simulation step\n");
+	double stepDeltaT = deltaT;
+	if (simulationEngine == "fixed step")
+		performFixedStep();
+	else
+		performContinuousTimeStep();
+	if (isDeferringSigmaUpdate)
+	{
+		stepsSinceSigmaUpdate++;
+		timeSinceSigmaUpdate += deltaT;
+		sigmaDecaySinceUpdate *= 1.0 - deltaT;
+		if (isSigmaUpdateStep)
+			updateSigmaOverInterval();
+	}
+	if (isAdaptingDeltaT)
+		adaptDeltaT();
+	if (isMonitoringConvergence)
+		monitorConvergence(stepDeltaT);
+	
 	
 	
 	// if the max changed fast I retain most of the previous max and min
@@ -2098,52 +3738,48 @@ void GraphWidget::performOneSimulationStep()
 	
 	
 	// recolour edges and nodes
-	if (isShowingUpdate)
+	if (isShowingUpdate && isSigmaUpdateStep)
 	{
-	foreach (QGraphicsItem *item, sc->items())
+	EL_PROFILE_SCOPE("recolour");
+	reconstructSeriesChains();
+	if (recolourCounters)
+		recolourCounters->start();
+	foreach (Edge *pEdge, networkEdges)
 	{
-		Node *pNode = qgraphicsitem_cast<Node *>(item);
-		if (!pNode)
+		pEdge->reColour(colouringEdgesParameter, edgesColourScale);
+	}
+	foreach (Node *pNode, networkNodes)
+	{
+		if (Stoma *pStoma = pNode->getStoma())
 		{
-			if (Edge *pEdge = qgraphicsitem_cast<Edge *>(item))
-			{
-				pEdge->reColour(colouringEdgesParameter, edgesColourScale);
-			}
-			else if (Stoma *pStoma = qgraphicsitem_cast<Stoma *>(item)) {
-				pStoma->reColour(colouringStomataParameter, stomataColourScale);
-			}
-
+			pStoma->reColour(colouringStomataParameter, stomataColourScale);
 		}
-		else
+		if (pNode->getNParticles() > maxNParticles)
 		{
-			if (pNode->getNParticles() > maxNParticles)
-			{
-				maxNParticles = pNode->getNParticles();
-			}
+			maxNParticles = pNode->getNParticles();
+		}
 		
-			if (pNode->getNParticles() < minNParticles)
-			{
-				minNParticles = pNode->getNParticles();
-			}
-			if (maxNParticles < previousMaxNParticles)
-			{
-				maxNParticles = (maxNParticles + previousMaxNParticles*9)/10;
-			}
-			if (minNParticles > previousMinNParticles)
-			{
-				minNParticles = (minNParticles + previousMinNParticles*9)/10;
-			}
+		if (pNode->getNParticles() < minNParticles)
+		{
+			minNParticles = pNode->getNParticles();
+		}
+		if (maxNParticles < previousMaxNParticles)
+		{
+			maxNParticles = (maxNParticles + previousMaxNParticles*9)/10;
+		}
+		if (minNParticles > previousMinNParticles)
+		{
+			minNParticles = (minNParticles + previousMinNParticles*9)/10;
 		}
 	}
 	
 	
-	foreach (QGraphicsItem *item, sc->items())
+	foreach (Node *pNode, networkNodes)
 	{
-		Node *pNode = qgraphicsitem_cast<Node *>(item);
-		if (!pNode)
-			continue;
 		pNode->reColour(colouringNodesParameter, nodesColourScale);
 	}
+	if (recolourCounters)
+		recolourCounters->stop();
 }
 	
 	
@@ -2158,29 +3794,25 @@ void GraphWidget::performOneSimulationStep()
 
 void GraphWidget::paintPicture(QPainter &painter)
 {
+	reconstructSeriesChains();
 	
 	//sc->update();
-	foreach (QGraphicsItem *item, sc->items())
+	// in the order of the network, which is also the order of the items in memory
+	foreach (Edge *pEdge, networkEdges)
 	{
-		Edge *pEdge = qgraphicsitem_cast<Edge *>(item);
-		if (!pEdge)
-			continue;
 		pEdge->reColour(colouringEdgesParameter, edgesColourScale);
 		pEdge->paintPicture(painter);	
 		
 	}
 	
-	foreach (QGraphicsItem *item, sc->items())
+	foreach (Node *pNode, networkNodes)
 	{
-		Node *pNode = qgraphicsitem_cast<Node *>(item);
-		if (!pNode)
-			continue;
 		pNode->reColour(colouringNodesParameter, nodesColourScale);
 		pNode->paintPicture(painter);
 	}
-	foreach (QGraphicsItem *item, sc->items())
+	foreach (Node *pNode, networkNodes)
 	{
-		Stoma *pStoma = qgraphicsitem_cast<Stoma *>(item);
+		Stoma *pStoma = pNode->getStoma();
 		if (!pStoma)
 			continue;
 		pStoma->reColour(colouringStomataParameter, stomataColourScale);
@@ -32,8 +32,20 @@
 
 #include <cstdio>
 #include <cstdlib>
+#include <queue>
+#include <vector>
+#include <functional>
 
 #include "mainwindow.h"
+#include "spatialindex.h"
+#include "glyphatlas.h"
+#include "multilevel.h"
+#include "convergencemonitor.h"
+#include "paralleledgeloop.h"
+#include "domaindecomposition.h"
+#include "sharedtopology.h"
+#include "fixedstep.h"
+#include "networksidecar.h"
 
 using std::string;
 using namespace std;
@@ -44,16 +56,51 @@ class Edge;
 class Stoma;
 class MainWindow;
 class QInputDialog;
+class QGraphicsPathItem;
+class RunTraceWriter;
+class RunTraceReader;
+class PerfCounterGroup;
+struct NetworkFileData;
+
+
+// a chain of nodes of degree two, simulated as one edge when the series reduction is on, see seriesreduction.h
+struct SeriesChain
+{
+	Node *first;
+	Node *last;
+	QList<Node *> innerNodes;
+	QList<Edge *> segments; // from first to last
+	QList<bool> isSegmentReversed; // the segment goes from its destination to its source when walking from first to last
+};
+
+
 class GraphWidget : public QGraphicsView
 {
     Q_OBJECT
 	
 public:
     GraphWidget(MainWindow *pMainWindow);
+	~GraphWidget();
 	
 	
 	void drawGraph(QString fileName);
-	void saveGraph(QString fileName);
+	void buildGraph(const NetworkFileData &data, QString fileName);
+	void showLoadingPreview(const QVector<QPointF> &positions);
+	void removeLoadingPreview();
+	bool saveGraph(QString fileName);
+	
+	bool startTrace(QString fileName);
+	bool recordTraceFrame(int step, double time);
+	void stopTrace();
+	bool isTracing();
+	
+	bool openTrace(QString fileName);
+	void showTraceFrame(int frameNumber);
+	void closeTrace();
+	bool isPlayingTrace();
+	int getNumberOfTraceFrames();
+	int getTraceFrameStep(int frameNumber);
+	double getTraceFrameTime(int frameNumber);
 	void zoom(qreal scaleFactor);
 
 	void setSelecting(QString whatIsGoingToBeSelecting);
@@ -62,6 +109,12 @@ public:
 	void setCurrentColourMap(QString chosenColourMap);
 	QString getCurrentColourMap();
 	
+	void setNodeOrdering(QString chosenNodeOrdering);
+	QString getNodeOrdering();
+	
+	void setSimulationEngine(QString chosenSimulationEngine);
+	QString getSimulationEngine();
+	
 	void setNodesVisible(bool nodesBecomeVisible);
 	bool getNodesVisible();
 	
@@ -78,6 +131,9 @@ public:
 	
 	void paintPicture(QPainter &painter);
 	void performOneSimulationStep();
+	void setSeriesReduction(bool shouldReduceSeries);
+	bool getSeriesReduction();
+	int getNumberOfSimulatedEdges();
 	void setInitialNParticlesPerNode(int newNParticlesPerNode);
 	int getInitialNParticlesPerNode();
 	
@@ -94,6 +150,11 @@ public:
 	QString getNodesColourScale();
 	
 	Stoma *createNewStoma(Node *sourceNode);
+	void removeEdge(Edge *pEdge);
+	void invalidateSpatialIndex();
+	void activateEdgesOf(Node *pNode);
+	int getDisplayedLevel() { return displayedLevel; }
+	int solveSteadyState();
 	
 	int getNumberOfNodes();
 	int getNumberOfEdges();
@@ -108,6 +169,7 @@ public:
 	double getChargePerParticle();
 	double getDeltaT();
 	double getMinSigma();
+	double getIdleSigmaDecay();
 	double getMaxSigma();
 	double getMaxEdgeWidth();
 	int getParticlesAtSource();
@@ -119,10 +181,33 @@ public:
 	
 	void setChargePerParticle(double newChargePerParticle);
 	void setDeltaT(double newDeltaT);
+	void resetDeltaT();
+	void setAdaptiveDeltaT(bool shouldAdaptDeltaT);
+	bool getAdaptiveDeltaT();
+	void setSigmaTolerance(double newSigmaTolerance);
+	void setMaxTransferProbability(double newMaxTransferProbability);
+	void setSigmaUpdateInterval(int newSigmaUpdateInterval);
+	int getSigmaUpdateInterval();
+	
+	void setEdgeLoopThreads(int newEdgeLoopThreads);
+	int getEdgeLoopThreads();
+	void setEdgePartitioning(bool shouldPartitionEdges);
+	bool getEdgePartitioning();
+	void setUsingSidecar(bool shouldUseSidecar);
+	bool getUsingSidecar();
+	QVector<int> getParticlesPerNode();
+	QVector<double> getSigmaPerEdge();
+	void getTopology(NetworkTopology &topology);
+	
+	void setConvergenceMonitoring(bool shouldMonitorConvergence);
+	void resetConvergenceMonitor(double startTime = 0);
+	bool hasConverged();
+	double getConvergenceTime();
 	void setMinSigma(double newMinSigma);
 	void setParticlesAtSource(int newParticlesAtSource);
 	QRgb colourMap(double value);
 	void setShowUpdate(bool shouldShowUpdate);
+	void setPerfCounters(PerfCounterGroup *newEdgeLoopCounters, PerfCounterGroup *newRecolourCounters);
 	
 public slots:
 	void setSourceOrSinkForAllNodes();
@@ -132,20 +217,43 @@ public slots:
 	void setLengthForAllEdges();
 	void setSigmaForAllStomata();
 	void setSigmaAsFunctionOfFlow(bool willUpdateEdgeSigma);
+	bool getSigmaAsFunctionOfFlow();
 	void setStomaticSigmaAsFunctionOfPotential(bool willUpdateStomaticSigma);
 	
 protected:
     void wheelEvent(QWheelEvent *event);
     void scaleView(qreal scaleFactor);
+	void paintEvent(QPaintEvent *event);
+	void drawBackground(QPainter *painter, const QRectF &rect);
+	void drawForeground(QPainter *painter, const QRectF &rect);
 	void mousePressEvent ( QMouseEvent *event );
 	void mouseMoveEvent(QMouseEvent *event);
 	void mouseReleaseEvent(QMouseEvent *event);
 	
 private:
-	void savePajek(QString fileName);
-	void saveEleni(QString fileName);
+	bool savePajek(QString fileName);
+	bool saveEleni(QString fileName);
 //	void selectItems(QRect *region);
 	void getSelectedGraphicItems();
+	QList<QGraphicsItem *> itemsInViewRect(const QRectF &viewRect);
+	void updateSpatialIndex();
+	void updateHierarchy();
+	void resetScene();
+	void reColourAll();
+	void orderNetwork(NetworkSidecar &fileSidecar, const QVector<QPointF> &positions, const QVector<int> &edgeSource, const QVector<int> &edgeDest, QVector<int> &nodeOrder, QVector<int> &edgeOrder);
+	void performFixedStep();
+	void adaptDeltaT();
+	void updateSigmaOverInterval();
+	void monitorConvergence(double stepDeltaT);
+	void invalidateActiveEdges();
+	void applyIdleSigmaDecay();
+	void performContinuousTimeStep();
+	void moveParticlesAlongEdge(Edge *pEdge);
+	void moveParticlesInParallel();
+	void updateEdgeSigma(Edge *pEdge);
+	void moveParticlesAlongChain(const SeriesChain &chain);
+	void updateSeriesChains();
+	void reconstructSeriesChains();
 	
 	QRgb rainbowColourMap(double value);
 	QRgb grayColourMap(double value);
@@ -170,6 +278,11 @@ private:
 	
 	
 	QGraphicsScene *sc;
+	QList<QGraphicsPathItem *> loadingPreview; // the dots of the network being read, see showLoadingPreview
+	QList<Node *> networkNodes; // in the order set by nodeOrdering, the node numbers are kept for the files
+	QList<Edge *> networkEdges; // sorted by their lower end in networkNodes, in reading order if nodeOrdering is "none"
+	QString nodeOrdering; // "none", "reverse Cuthill-McKee" or "Hilbert curve"
+	QString simulationEngine; // "fixed step", "Gillespie" or "tau leaping", see stochasticengines.h
 	Node *currentNode;
 	int scaleFactor;
 	int numberOfNodes;
@@ -190,7 +303,33 @@ private:
 	QString stomataColourScale;
 	
 	double chargePerParticle;
-	double deltaT;
+	double deltaT; // the length of the next step, changed after every step when isAdaptingDeltaT
+	bool isAdaptingDeltaT;
+	double configuredDeltaT; // the value given with setDeltaT, restored by resetDeltaT
+	double minDeltaT; // bounds of the adaptive step, around the value given with setDeltaT
+	double maxDeltaT;
+	double sigmaTolerance; // relative local error allowed in the update of the conductivities
+	double maxTransferProbability; // bound on sigma * deltaT in the binomial draws of the fixed step
+	
+	/* Multirate update: the particles move at every step, and the conductivities,
+	 the maxima and the colours are updated every few steps with the mean flow,
+	 see updateSigmaOverInterval. */
+	int sigmaUpdateInterval; // 1 updates at every step, 0 chooses the interval from the rate of change of sigma
+	int currentSigmaUpdateInterval;
+	bool isDeferringSigmaUpdate; // the edges only add up their flows
+	int stepsSinceSigmaUpdate;
+	double timeSinceSigmaUpdate;
+	double sigmaDecaySinceUpdate; // product of 1 - deltaT over the steps since the last update
+	
+	int edgeLoopThreads; // 1 for the sequential random order of the edges
+	bool isPartitioningEdges; // the threads own parts of the leaf instead of sharing the nodes
+	ParallelEdgeLoop parallelEdgeLoop;
+	bool isParallelEdgeLoopValid; // false after the topology changed
+	PartitionedEdgeLoop partitionedEdgeLoop;
+	bool isPartitionedEdgeLoopValid;
+	
+	bool isMonitoringConvergence;
+	ConvergenceMonitor convergenceMonitor;
 	double minSigma;
 	double exponentEdgeWidthForSigma;
 	double multiplicativeFactorEdgeSigma;
@@ -217,6 +356,76 @@ private:
 	QRectF *currentSelection;
 	QList<QGraphicsItem *>selectedGraphicItems;
 	bool isRegionSelected;
+	SpatialIndex spatialIndex; // rebuilt on the first query after the geometry of the network changes
+	NetworkSidecar sidecar; // the derived structures of the file opened, closed when the network is edited
+	bool isUsingSidecar;
+	bool isSpatialIndexValid;
+	
+	bool isReducingSeries;
+	bool areSeriesChainsValid; // false after the topology changed
+	bool areSeriesChainsReconstructed; // false when the inner nodes of the chains are out of date
+	QList<SeriesChain> seriesChains;
+	QList<Edge *> unreducedEdges; // the edges of networkEdges that are not in any chain
+	
+	// the items as the fixed step of fixedstep.h sees them
+	class ItemNetwork
+	{
+	public:
+		typedef Node *NodeHandle;
+		typedef Edge *EdgeHandle;
+		typedef QList<Edge *> EdgeList;
+		
+		ItemNetwork(GraphWidget *graphWidget);
+		
+		int getNumberOfNodes();
+		Node *getNode(int i);
+		bool isSourceNode(Node *pNode);
+		bool hasStoma(Node *pNode);
+		double getStomaSigma(Node *pNode);
+		void setStomaFlow(Node *pNode, int flow);
+		int getNParticles(Node *pNode);
+		void setNParticles(Node *pNode, int nParticles);
+		void addParticles(Node *pNode, int nParticles);
+		void subtractParticles(Node *pNode, int nParticles);
+		QList<Edge *> getEdgesOf(Node *pNode);
+		
+		int getNumberOfEdges();
+		Edge *getEdge(int i);
+		Node *getSourceNode(Edge *pEdge);
+		Node *getDestNode(Edge *pEdge);
+		double getSigma(Edge *pEdge);
+		void setFlow(Edge *pEdge, int flow);
+		void updateSigma(Edge *pEdge);
+		void setIdleSigmaDecay(Edge *pEdge, double idleSigmaDecay);
+		bool isInActiveSet(Edge *pEdge);
+		void setInActiveSet(Edge *pEdge, bool shouldBeInActiveSet);
+		
+	private:
+		GraphWidget *graph;
+	};
+	
+	/* The fixed step only visits the edges whose ends may have different numbers
+	 of particles. The visiting order is the one of random keys, drawn for an
+	 edge only when it becomes active, see fixedstep.h. */
+	ItemNetwork itemNetwork;
+	ActiveEdgeSet<ItemNetwork> activeEdges;
+	double idleSigmaDecay; // see getIdleSigmaDecay
+	bool isIdleSigmaDecayPending; // some edges have not applied it yet
+	GlyphAtlas glyphAtlas;
+	GraphHierarchy hierarchy; // coarser versions of the network, rebuilt when needed as the spatial index
+	bool isHierarchyValid;
+	int displayedLevel; // level of the hierarchy drawn instead of the edges, 0 when the edges are drawn
+	QVector<int> displayedLevelEdges; // the edge of the displayed level containing each edge of networkEdges
+	
+	RunTraceWriter *traceWriter;
+	QList<Node *> traceNodes; // the order of the node columns in the trace, saving may renumber the nodes
+	QList<Node *> traceStomaNodes; // the nodes whose stomata are recorded in the trace
+	RunTraceReader *traceReader;
+	QList<Node *> playbackStomaNodes; // the nodes whose stomata are in the trace being played back
+	
+	// hardware counters read around the edge loop and the recolouring, NULL when not measuring
+	PerfCounterGroup *edgeLoopCounters;
+	PerfCounterGroup *recolourCounters;
 };
 
 #endif
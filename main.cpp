@@ -23,11 +23,18 @@
 #include <QTime>
 
 #include "mainwindow.h"
+#include "benchmark.h"
+#include "ensemble.h"
+
 int main(int argc, char **argv)
 {
 	// initialize the random numbers generator
 	qsrand(QTime::currentTime().msec());
     QApplication app(argc, argv);
+	if (isBenchmarkRequested(app.arguments()))
+		return runBenchmarks(app.arguments());
+	if (isEnsembleRequested(app.arguments()))
+		return runEnsemble(app.arguments());
 	MainWindow window;
 	window.show();
     return app.exec();
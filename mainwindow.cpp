@@ -22,12 +22,15 @@
 #include <QtWidgets>
 #include <QtSvg/QSvgGenerator>
 #include <QPainter>
+#include <QtConcurrent/QtConcurrentRun>
 
 #include "mainwindow.h"
 #include "graphwidget.h"
 #include "parameterdialog.h"
 #include "sigmaequationdialog.h"
 #include "dialogrecordingparameters.h"
+#include "profiler.h"
+#include "networkloader.h"
 
 MainWindow::MainWindow()
 {
@@ -39,14 +42,28 @@ MainWindow::MainWindow()
 	sigmaEquationDialog = 0;
 	dialogRecordingParameters = 0;
 	currentSimulationTime = 0;
+	currentSimulatedTime = 0;
+	isSteadyStateReported = false;
 	isRunningSimulation = false;
 	isRecordingSimulation = false;
+	networkLoader = NULL;
 	
 	
     createActions();
     createMenus();   
 	createToolBars();
 	
+	// shown in the status bar while a network is read, see startLoading
+	loadingProgressBar = new QProgressBar;
+	loadingProgressBar->setRange(0, 100);
+	loadingProgressBar->setMaximumWidth(200);
+	loadingProgressBar->setVisible(false);
+	statusBar()->addPermanentWidget(loadingProgressBar);
+	cancelLoadingButton = new QPushButton(tr("Cancel"));
+	cancelLoadingButton->setVisible(false);
+	connect(cancelLoadingButton, SIGNAL(clicked()), this, SLOT(cancelLoading()));
+	statusBar()->addPermanentWidget(cancelLoadingButton);
+	
     setWindowTitle(tr("Electric Leaf"));
     setMinimumSize(400, 400);
     resize(1000, 600);
@@ -63,6 +80,13 @@ MainWindow::MainWindow()
 	w->setExponentEdgeWidthForSigma(settings.value("exponentEdgeWidthForSigma", QVariant(2)).toDouble());
 	w->setMultiplicativeFactorEdgeSigma(settings.value("multiplicativeFactorEdgeSigma", QVariant(10)).toDouble());	
 	curFileName = settings.value("curFileName", QVariant(QDir::homePath())).toString();
+	setNodeOrdering(settings.value("nodeOrdering", QVariant("none")).toString());
+	setSimulationEngine(settings.value("simulationEngine", QVariant("fixed step")).toString());
+	adaptDeltaTAct->setChecked(settings.value("adaptiveDeltaT", QVariant(false)).toBool());
+	w->setAdaptiveDeltaT(adaptDeltaTAct->isChecked());
+	w->setSigmaUpdateInterval(settings.value("sigmaUpdateInterval", QVariant(1)).toInt());
+	setEdgeLoop(settings.value("edgeLoop", QVariant("sequential")).toString());
+	setSteadyStateAction(settings.value("steadyStateAction", QVariant("ignore")).toString());
 
 	myTimerID = 0;
 }
@@ -103,6 +127,8 @@ void MainWindow::quit()
 {
 //	if (true)
 //		writeSettings();
+	stopLoading();
+	w->stopTrace(); // write the index of a trace that is still being recorded
 	exit(EXIT_SUCCESS);
 }
 
@@ -110,20 +136,208 @@ void MainWindow::quit()
 
 void MainWindow::open()
 {
-    QString fileName = QFileDialog::getOpenFileName(this, tr("Open File"), curFileName);
+    QString fileName = QFileDialog::getOpenFileName(this, tr("Open File"), curFileName, tr("Networks and run traces (*.txt *.net *.eln *.trace);;All files (*)"));
     if (!fileName.isEmpty())
 	{
 		QSettings settings("Andrea Perna", "Electric Leaf Program");
 		settings.setValue("curFileName", fileName);
 
-        w->drawGraph(fileName);
-		setCurrentFile(fileName);
-		
-		// enable all the actions on the open network
-		enableActionsAndMenus();
-		statusBar()->showMessage(tr("File loaded"), 2000);
-		resetSimulationTime();
+		loadFile(fileName);
+	}
+}
+
+
+
+// a run trace is opened for playback, any other file is read as a network, in the background
+bool MainWindow::loadFile(QString fileName)
+{
+	stopLoading();
+	if (fileName.endsWith(".trace", Qt::CaseInsensitive))
+	{
+		if (!w->openTrace(fileName))
+		{
+			statusBar()->showMessage(tr("Could not read the run trace %1").arg(strippedName(fileName)), 2000);
+			return false;
+		}
+		showOpenedFile(fileName);
+	}
+	else
+	{
+		startLoading(fileName);
+	}
+	return true;
+}
+
+
+
+/* The network is read by a NetworkLoader on a thread of the pool, the window
+ stays responsive and draws the nodes as they are read. The items are made
+ by finishLoading, on this thread, once the whole file has been read. */
+
+void MainWindow::startLoading(QString fileName)
+{
+	// the network being run is going away
+	runAct->setChecked(false);
+	runSimulation(false);
+	runAct->setEnabled(false);
+	saveAct->setEnabled(false);
+	saveAsAct->setEnabled(false);
+	exportAct->setEnabled(false);
+	playbackToolBar->setVisible(false);
+	w->removeLoadingPreview(); // of a loading that was stopped
+	
+	networkLoader = new NetworkLoader(fileName);
+	connect(networkLoader, SIGNAL(progressChanged(int)), loadingProgressBar, SLOT(setValue(int)));
+	connect(networkLoader, SIGNAL(nodesRead(QVector<QPointF>)), this, SLOT(showLoadedNodes(QVector<QPointF>)));
+	connect(networkLoader, SIGNAL(finished()), this, SLOT(finishLoading()));
+	
+	loadingProgressBar->setValue(0);
+	loadingProgressBar->setVisible(true);
+	cancelLoadingButton->setVisible(true);
+	statusBar()->showMessage(tr("Reading %1").arg(strippedName(fileName)));
+	loadingFuture = QtConcurrent::run(networkLoader, &NetworkLoader::load);
+}
+
+
+
+// abandons the network being read, if any, without waiting for its signals
+void MainWindow::stopLoading()
+{
+	if (!networkLoader)
+		return;
+	networkLoader->cancel();
+	loadingFuture.waitForFinished(); // it stops at the next chunk of lines
+	networkLoader->disconnect(this);
+	networkLoader->deleteLater(); // the signals it already sent are still queued
+	networkLoader = NULL;
+	loadingProgressBar->setVisible(false);
+	cancelLoadingButton->setVisible(false);
+}
+
+
+
+void MainWindow::cancelLoading()
+{
+	if (networkLoader)
+		networkLoader->cancel(); // finishLoading follows
+}
+
+
+
+void MainWindow::showLoadedNodes(QVector<QPointF> positions)
+{
+	if (sender() == networkLoader)
+		w->showLoadingPreview(positions);
+}
+
+
+
+void MainWindow::finishLoading()
+{
+	if (!networkLoader || sender() != networkLoader)
+		return; // a loading that was stopped by the next one
+	
+	NetworkLoader *pLoader = networkLoader;
+	loadingFuture.waitForFinished();
+	networkLoader = NULL;
+	loadingProgressBar->setVisible(false);
+	cancelLoadingButton->setVisible(false);
+	
+	if (pLoader->isLoaded())
+	{
+		w->buildGraph(pLoader->getData(), pLoader->getFileName());
+		showOpenedFile(pLoader->getFileName());
+	}
+	else if (pLoader->isCancelled())
+	{
+		keepOpenedNetwork();
+		statusBar()->showMessage(tr("Loading cancelled"), 2000);
+	}
+	else
+	{
+		keepOpenedNetwork();
+		statusBar()->showMessage(tr("Could not read the network %1").arg(strippedName(pLoader->getFileName())), 2000);
+	}
+	pLoader->deleteLater();
+}
+
+
+
+// the network shown before a loading that did not succeed, as it was
+void MainWindow::keepOpenedNetwork()
+{
+	w->removeLoadingPreview();
+	if (w->getNumberOfNodes() > 0)
+	{
+		runAct->setEnabled(true);
+		saveAct->setEnabled(true);
+		saveAsAct->setEnabled(true);
+		exportAct->setEnabled(true);
+	}
+	playbackToolBar->setVisible(w->isPlayingTrace());
+}
+
+
+
+// what follows the opening of a network or of a trace
+void MainWindow::showOpenedFile(QString fileName)
+{
+	setCurrentFile(fileName);
+	
+	// enable all the actions on the open network
+	enableActionsAndMenus();
+	resetSimulationTime();
+	
+	if (w->isPlayingTrace())
+	{
+		// the slider signal is blocked so that frame 0, already shown by openTrace, is not decoded twice
+		timelineSlider->blockSignals(true);
+		timelineSlider->setRange(0, qMax(w->getNumberOfTraceFrames() - 1, 0));
+		timelineSlider->setValue(0);
+		timelineSlider->blockSignals(false);
+		playbackToolBar->setVisible(true);
+		showTraceTimeline(0);
+	}
+	else
+	{
+		playbackToolBar->setVisible(false);
+	}
+	statusBar()->showMessage(tr("File loaded"), 2000);
+}
+
+
+
+void MainWindow::showTraceFrame(int frameNumber)
+{
+	if (!w->isPlayingTrace() || w->getNumberOfTraceFrames() == 0)
+	{
+		timelineLabel->setText(tr("No frames"));
+		return;
 	}
+	
+	w->showTraceFrame(frameNumber);
+	showTraceTimeline(frameNumber);
+}
+
+
+
+// the time and the timeline of a frame that the graph already shows
+void MainWindow::showTraceTimeline(int frameNumber)
+{
+	if (!w->isPlayingTrace() || w->getNumberOfTraceFrames() == 0)
+	{
+		timelineLabel->setText(tr("No frames"));
+		return;
+	}
+	
+	// running the simulation from here continues from the step that is shown
+	currentSimulationTime = w->getTraceFrameStep(frameNumber);
+	currentSimulatedTime = w->getTraceFrameTime(frameNumber);
+	w->resetConvergenceMonitor(currentSimulatedTime); // the convergence time follows the simulated time of the trace
+	isSteadyStateReported = false;
+	timelineLabel->setText(tr("Frame %1/%2, step %3").arg(frameNumber + 1).arg(w->getNumberOfTraceFrames()).arg(currentSimulationTime));
+	lcdNumber->display(currentSimulatedTime);
+	lcdNumber->update();
 }
 
 
@@ -136,11 +350,14 @@ void MainWindow::save()
 	{
         saveAs();
 	}
-    else
+    else if (w->saveGraph(curFileName))
 	{
-        w->saveGraph(curFileName);
 		statusBar()->showMessage(tr("File saved"), 2000);
 	}
+	else
+	{
+		statusBar()->showMessage(tr("Cannot write %1").arg(curFileName), 2000);
+	}
 }
 
 
@@ -156,7 +373,11 @@ void MainWindow::saveAs()
 	QSettings settings("Andrea Perna", "Electric Leaf Program");
 	settings.setValue("curFileName", fileName);
 	
-    w->saveGraph(fileName);
+    if (!w->saveGraph(fileName))
+	{
+		statusBar()->showMessage(tr("Cannot write %1").arg(fileName), 2000);
+		return;
+	}
 	setCurrentFile(fileName);
 	statusBar()->showMessage(tr("File saved"), 2000);
 }
@@ -198,7 +419,10 @@ void MainWindow::selectExportingFormat()
 	}
 	else if (exportFileName.endsWith(".txt", Qt::CaseInsensitive) || exportFileName.endsWith(".net", Qt::CaseInsensitive) || exportFileName.endsWith(".eln", Qt::CaseInsensitive))
 	{
-		w->saveGraph(exportFileName);
+		if (!w->saveGraph(exportFileName))
+		{
+			statusBar()->showMessage(tr("Cannot write %1").arg(exportFileName), 2000);
+		}
 	}
 }
 
@@ -279,10 +503,7 @@ void MainWindow::openRecentFile()
     if (action)
 	{
 		QString fileName=action->data().toString();
-		w->drawGraph(fileName);
-		setCurrentFile(fileName);
-		enableActionsAndMenus();
-		resetSimulationTime();
+		loadFile(fileName);
 	}
 }
 
@@ -351,9 +572,58 @@ void MainWindow::runSimulation(bool isRunning)
 }
 
 
+void MainWindow::reduceSeries(bool shouldReduceSeries)
+{
+	w->setSeriesReduction(shouldReduceSeries);
+	if (shouldReduceSeries)
+		statusBar()->showMessage(tr("%1 edges simulated instead of %2").arg(w->getNumberOfSimulatedEdges()).arg(w->getNumberOfEdges()), 2000);
+}
+
+
+
+// deltaT set in the parameters is the first step, the following ones change within a factor 100 of it
+void MainWindow::adaptDeltaT(bool shouldAdaptDeltaT)
+{
+	QSettings settings("Andrea Perna", "Electric Leaf Program");
+	w->setAdaptiveDeltaT(shouldAdaptDeltaT);
+	if (!shouldAdaptDeltaT)
+		w->resetDeltaT(); // back to the fixed value
+	settings.setValue("adaptiveDeltaT", shouldAdaptDeltaT);
+}
+
+
+
+void MainWindow::setSigmaUpdateInterval()
+{
+	bool ok;
+	int interval = QInputDialog::getInt(this, tr("Conductivity update interval"),
+										tr("Steps between two updates of the conductivities (0 chooses them from their rate of change):"),
+										w->getSigmaUpdateInterval(), 0, 1000, 1, &ok);
+	if (!ok)
+		return;
+	w->setSigmaUpdateInterval(interval);
+	QSettings settings("Andrea Perna", "Electric Leaf Program");
+	settings.setValue("sigmaUpdateInterval", interval);
+}
+
+
+
+void MainWindow::solveSteadyState()
+{
+	int iterations = w->solveSteadyState();
+	if (iterations < 0)
+		statusBar()->showMessage(tr("The steady state could not be found"), 2000);
+	else
+		statusBar()->showMessage(tr("Steady state found in %1 iterations").arg(iterations), 2000);
+	w->viewport()->update();
+}
+
+
+
 void MainWindow::record(bool shouldRecord)
 {
 	isRecordingSimulation = shouldRecord;
+	w->stopTrace(); // a new recording always starts a new trace file
 	if (shouldRecord)
 	{
 		if (!dialogRecordingParameters)                                  
@@ -378,6 +648,19 @@ void MainWindow::record(bool shouldRecord)
 
 
 
+void MainWindow::saveProfileTrace()
+{
+	QString fileName = QFileDialog::getSaveFileName(this, tr("Save profile trace"), "profile.json", tr("Chrome trace (*.json)"));
+	if (fileName.isEmpty())
+		return;
+	if (writeChromeTrace(fileName))
+		statusBar()->showMessage(tr("Profile trace saved"), 2000);
+	else
+		statusBar()->showMessage(tr("Cannot write %1").arg(fileName), 2000);
+}
+
+
+
 void MainWindow::startRunning()
 {
 	isRunningSimulation = true;
@@ -415,16 +698,23 @@ void MainWindow::showUpdate(bool shouldShowUpdate)
 
 
 
-void MainWindow::increaseSimulationTime(int timeIncrement)
+void MainWindow::increaseSimulationTime(int timeIncrement, double simulatedTimeIncrement)
 {
 	currentSimulationTime += timeIncrement;
+	currentSimulatedTime += simulatedTimeIncrement;
 }
 
 
 void MainWindow::resetSimulationTime()
 {
 	currentSimulationTime = 0;
-	lcdNumber->display(currentSimulationTime * w->getDeltaT());
+	currentSimulatedTime = 0;
+	w->resetDeltaT(); // the next run starts again from the configured step
+	w->resetConvergenceMonitor();
+	if (isSteadyStateReported && steadyStateAction == "record less often")
+		recordingTimeInterval /= 10;
+	isSteadyStateReported = false;
+	lcdNumber->display(currentSimulatedTime);
 	lcdNumber->update();
 }
 
@@ -433,17 +723,22 @@ void MainWindow::timerEvent(QTimerEvent *event)
 	if (event->timerId() == myTimerID)
 	{
 		// printf("timer event\n");
-		while (currentSimulationTime <= (totRunningTime/w->getDeltaT()) && isRunningSimulation)
+		while (currentSimulatedTime <= totRunningTime && isRunningSimulation)
 				{
-					lcdNumber->display(currentSimulationTime * w->getDeltaT());
+					lcdNumber->display(currentSimulatedTime);
 					lcdNumber->update();
 					w->performOneSimulationStep();
 					// printf("simulation running at %d\n", currentSimulationTime);
+					if (!isSteadyStateReported && w->hasConverged())
+					{
+						reachSteadyState(); // may stop the run, after recording this step
+					}
 					
 					if (isRecordingSimulation)
 					{
 						if (currentSimulationTime % recordingTimeInterval == 0)
 						{
+							EL_PROFILE_SCOPE("recording");
 							if (recordFileName.endsWith(".svg", Qt::CaseInsensitive))
 							{
 
@@ -482,13 +777,43 @@ void MainWindow::timerEvent(QTimerEvent *event)
 								QString number = QString("%1").arg(currentSimulationTime, 8, 10, QChar('0')).toUpper();
 								currRecordFileName.append(number).append(".txt");
 								// cout << currRecordFileName.toStdString() << endl;
-								w->saveGraph(currRecordFileName);
+								if (!w->saveGraph(currRecordFileName))
+								{
+									statusBar()->showMessage(tr("Cannot write %1").arg(currRecordFileName), 2000);
+									isRecordingSimulation = false;
+									recordAct->setChecked(false);
+								}
+							}
+							else if (recordFileName.endsWith(".trace", Qt::CaseInsensitive))
+							{
+								// all the steps go to the same file, the topology is only written once
+								// stopping the recording on a failed frame, so that the next interval does not start the trace again over it
+								if ((!w->isTracing() && !w->startTrace(recordFileName)) || !w->recordTraceFrame(currentSimulationTime, currentSimulatedTime))
+								{
+									statusBar()->showMessage(tr("Cannot write %1").arg(recordFileName), 2000);
+									isRecordingSimulation = false;
+									recordAct->setChecked(false);
+								}
 							}
 						}
 					}
+#ifdef ELECTRIC_LEAF_PROFILING
+					// about once a second, show where the time of the last second went
+					if (!profileBreakdownTimer.isValid() || profileBreakdownTimer.elapsed() > 1000)
+					{
+						statusBar()->showMessage(profileBreakdown());
+						profileBreakdownTimer.start();
+					}
+#endif
 					qApp->processEvents();
 //					stopRunning(); // run a step at a time, for debugging
 				}
+		if (isRunningSimulation && currentSimulatedTime > totRunningTime)
+		{
+			runAct->setChecked(false);
+			runSimulation(false);
+			writeRunSummary();
+		}
 
 	}
 }
@@ -881,6 +1206,156 @@ void MainWindow::setColourMapDaltonicFriendly()
 }
 
 
+void MainWindow::setNodeOrderingNone()
+{
+	setNodeOrdering("none");
+}
+
+void MainWindow::setNodeOrderingReverseCuthillMcKee()
+{
+	setNodeOrdering("reverse Cuthill-McKee");
+}
+
+void MainWindow::setNodeOrderingHilbertCurve()
+{
+	setNodeOrdering("Hilbert curve");
+}
+
+// the order of the nodes in memory, used from the next network opened
+void MainWindow::setNodeOrdering(QString chosenNodeOrdering)
+{
+	setNodeOrderingNoneAct->setChecked(chosenNodeOrdering == "none");
+	setNodeOrderingReverseCuthillMcKeeAct->setChecked(chosenNodeOrdering == "reverse Cuthill-McKee");
+	setNodeOrderingHilbertCurveAct->setChecked(chosenNodeOrdering == "Hilbert curve");
+	w->setNodeOrdering(chosenNodeOrdering);
+	QSettings settings("Andrea Perna", "Electric Leaf Program");
+	settings.setValue("nodeOrdering", chosenNodeOrdering);
+}
+
+
+void MainWindow::setSimulationEngineFixedStep()
+{
+	setSimulationEngine("fixed step");
+}
+
+void MainWindow::setSimulationEngineGillespie()
+{
+	setSimulationEngine("Gillespie");
+}
+
+void MainWindow::setSimulationEngineTauLeaping()
+{
+	setSimulationEngine("tau leaping");
+}
+
+void MainWindow::setEdgeLoopSequential()
+{
+	setEdgeLoop("sequential");
+}
+
+void MainWindow::setEdgeLoopLockFree()
+{
+	setEdgeLoop("lock-free");
+}
+
+void MainWindow::setEdgeLoopBySubdomains()
+{
+	setEdgeLoop("by subdomains");
+}
+
+void MainWindow::setSteadyStateActionIgnore()
+{
+	setSteadyStateAction("ignore");
+}
+
+void MainWindow::setSteadyStateActionContinue()
+{
+	setSteadyStateAction("continue");
+}
+
+void MainWindow::setSteadyStateActionRecordLessOften()
+{
+	setSteadyStateAction("record less often");
+}
+
+void MainWindow::setSteadyStateActionStop()
+{
+	setSteadyStateAction("stop");
+}
+
+// the steady state is detected by the convergence monitor of the graph, see convergencemonitor.h,
+// which only runs when something is done at the steady state
+void MainWindow::setSteadyStateAction(QString chosenSteadyStateAction)
+{
+	if (chosenSteadyStateAction != steadyStateAction)
+		w->setConvergenceMonitoring(chosenSteadyStateAction != "ignore");
+	steadyStateAction = chosenSteadyStateAction;
+	setSteadyStateActionIgnoreAct->setChecked(chosenSteadyStateAction == "ignore");
+	setSteadyStateActionContinueAct->setChecked(chosenSteadyStateAction == "continue");
+	setSteadyStateActionRecordLessOftenAct->setChecked(chosenSteadyStateAction == "record less often");
+	setSteadyStateActionStopAct->setChecked(chosenSteadyStateAction == "stop");
+	QSettings settings("Andrea Perna", "Electric Leaf Program");
+	settings.setValue("steadyStateAction", chosenSteadyStateAction);
+}
+
+
+void MainWindow::reachSteadyState()
+{
+	isSteadyStateReported = true;
+	statusBar()->showMessage(tr("Steady state reached at time %1").arg(w->getConvergenceTime()), 5000);
+	if (steadyStateAction == "record less often")
+	{
+		recordingTimeInterval *= 10;
+	}
+	else if (steadyStateAction == "stop")
+	{
+		runAct->setChecked(false);
+		runSimulation(false);
+		writeRunSummary();
+	}
+}
+
+
+// on the standard output, where the batch runs collect it
+void MainWindow::writeRunSummary()
+{
+	cout << "run summary: file " << curFileName.toStdString()
+		 << ", steps " << currentSimulationTime
+		 << ", simulated time " << currentSimulatedTime;
+	if (steadyStateAction == "ignore")
+		cout << endl;
+	else if (w->hasConverged())
+		cout << ", steady state at time " << w->getConvergenceTime() << endl;
+	else
+		cout << ", no steady state detected" << endl;
+}
+
+
+// only for the fixed step without the series reduction, see paralleledgeloop.h and domaindecomposition.h
+void MainWindow::setEdgeLoop(QString chosenEdgeLoop)
+{
+	setEdgeLoopSequentialAct->setChecked(chosenEdgeLoop == "sequential");
+	setEdgeLoopLockFreeAct->setChecked(chosenEdgeLoop == "lock-free");
+	setEdgeLoopBySubdomainsAct->setChecked(chosenEdgeLoop == "by subdomains");
+	w->setEdgeLoopThreads(chosenEdgeLoop == "sequential" ? 1 : QThread::idealThreadCount());
+	w->setEdgePartitioning(chosenEdgeLoop == "by subdomains");
+	QSettings settings("Andrea Perna", "Electric Leaf Program");
+	settings.setValue("edgeLoop", chosenEdgeLoop);
+}
+
+
+// how each interval deltaT is simulated, see stochasticengines.h
+void MainWindow::setSimulationEngine(QString chosenSimulationEngine)
+{
+	setSimulationEngineFixedStepAct->setChecked(chosenSimulationEngine == "fixed step");
+	setSimulationEngineGillespieAct->setChecked(chosenSimulationEngine == "Gillespie");
+	setSimulationEngineTauLeapingAct->setChecked(chosenSimulationEngine == "tau leaping");
+	w->setSimulationEngine(chosenSimulationEngine);
+	QSettings settings("Andrea Perna", "Electric Leaf Program");
+	settings.setValue("simulationEngine", chosenSimulationEngine);
+}
+
+
 void MainWindow::changeSelectionMethod(QString selectingThis)
 {
 	
@@ -1007,6 +1482,95 @@ void MainWindow::createActions()
     recordAct->setChecked(false);
     connect(recordAct, SIGNAL(triggered(bool)), this, SLOT(record(bool)));
 	
+	reduceSeriesAct = new QAction(tr("Contract vein chains"), this);
+	reduceSeriesAct->setStatusTip(tr("simulate each chain of nodes with two edges as a single edge"));
+	reduceSeriesAct->setCheckable(true);
+	reduceSeriesAct->setChecked(false);
+	connect(reduceSeriesAct, SIGNAL(triggered(bool)), this, SLOT(reduceSeries(bool)));
+	
+	adaptDeltaTAct = new QAction(tr("Adaptive time step"), this);
+	adaptDeltaTAct->setStatusTip(tr("change deltaT during the run to keep the error on the conductivities small"));
+	adaptDeltaTAct->setCheckable(true);
+	adaptDeltaTAct->setChecked(false);
+	connect(adaptDeltaTAct, SIGNAL(triggered(bool)), this, SLOT(adaptDeltaT(bool)));
+	
+	setSigmaUpdateIntervalAct = new QAction(tr("Conductivity update interval..."), this);
+	setSigmaUpdateIntervalAct->setStatusTip(tr("update the conductivities and the colours every few steps, with the mean flow"));
+	connect(setSigmaUpdateIntervalAct, SIGNAL(triggered()), this, SLOT(setSigmaUpdateInterval()));
+	
+	setEdgeLoopSequentialAct = new QAction(tr("sequential"), this);
+	setEdgeLoopSequentialAct->setStatusTip(tr("move the particles along the edges one edge at a time"));
+	setEdgeLoopSequentialAct->setCheckable(true);
+	connect(setEdgeLoopSequentialAct, SIGNAL(triggered()), this, SLOT(setEdgeLoopSequential()));
+	
+	setEdgeLoopLockFreeAct = new QAction(tr("lock-free"), this);
+	setEdgeLoopLockFreeAct->setStatusTip(tr("move the particles along the edges on all the processors, in a slightly different random order"));
+	setEdgeLoopLockFreeAct->setCheckable(true);
+	connect(setEdgeLoopLockFreeAct, SIGNAL(triggered()), this, SLOT(setEdgeLoopLockFree()));
+	
+	setEdgeLoopBySubdomainsAct = new QAction(tr("by subdomains"), this);
+	setEdgeLoopBySubdomainsAct->setStatusTip(tr("give each processor a part of the leaf, and exchange the particles at the borders once per step"));
+	setEdgeLoopBySubdomainsAct->setCheckable(true);
+	connect(setEdgeLoopBySubdomainsAct, SIGNAL(triggered()), this, SLOT(setEdgeLoopBySubdomains()));
+	
+	solveSteadyStateAct = new QAction(tr("Jump to steady state"), this);
+	solveSteadyStateAct->setStatusTip(tr("set the particles and the flows of the steady state of the current conductivities"));
+	connect(solveSteadyStateAct, SIGNAL(triggered()), this, SLOT(solveSteadyState()));
+	
+	setNodeOrderingNoneAct = new QAction(tr("file order"), this);
+	setNodeOrderingNoneAct->setStatusTip(tr("keep the nodes in the order of the network file"));
+	setNodeOrderingNoneAct->setCheckable(true);
+	connect(setNodeOrderingNoneAct, SIGNAL(triggered()), this, SLOT(setNodeOrderingNone()));
+	
+	setNodeOrderingReverseCuthillMcKeeAct = new QAction(tr("reverse Cuthill-McKee"), this);
+	setNodeOrderingReverseCuthillMcKeeAct->setStatusTip(tr("put the nodes connected by an edge close to each other in memory"));
+	setNodeOrderingReverseCuthillMcKeeAct->setCheckable(true);
+	connect(setNodeOrderingReverseCuthillMcKeeAct, SIGNAL(triggered()), this, SLOT(setNodeOrderingReverseCuthillMcKee()));
+	
+	setNodeOrderingHilbertCurveAct = new QAction(tr("Hilbert curve"), this);
+	setNodeOrderingHilbertCurveAct->setStatusTip(tr("put the nodes close in the leaf close to each other in memory"));
+	setNodeOrderingHilbertCurveAct->setCheckable(true);
+	connect(setNodeOrderingHilbertCurveAct, SIGNAL(triggered()), this, SLOT(setNodeOrderingHilbertCurve()));
+	
+	setSimulationEngineFixedStepAct = new QAction(tr("fixed step"), this);
+	setSimulationEngineFixedStepAct->setStatusTip(tr("move a binomial number of particles along every edge at each step"));
+	setSimulationEngineFixedStepAct->setCheckable(true);
+	connect(setSimulationEngineFixedStepAct, SIGNAL(triggered()), this, SLOT(setSimulationEngineFixedStep()));
+	
+	setSimulationEngineGillespieAct = new QAction(tr("Gillespie"), this);
+	setSimulationEngineGillespieAct->setStatusTip(tr("move the particles one at a time, in continuous time"));
+	setSimulationEngineGillespieAct->setCheckable(true);
+	connect(setSimulationEngineGillespieAct, SIGNAL(triggered()), this, SLOT(setSimulationEngineGillespie()));
+	
+	setSimulationEngineTauLeapingAct = new QAction(tr("tau leaping"), this);
+	setSimulationEngineTauLeapingAct->setStatusTip(tr("move the particles in leaps as long as the accuracy allows"));
+	setSimulationEngineTauLeapingAct->setCheckable(true);
+	connect(setSimulationEngineTauLeapingAct, SIGNAL(triggered()), this, SLOT(setSimulationEngineTauLeaping()));
+	
+	setSteadyStateActionIgnoreAct = new QAction(tr("do not look for it"), this);
+	setSteadyStateActionIgnoreAct->setStatusTip(tr("run without the convergence monitor, which costs a little time at every step"));
+	setSteadyStateActionIgnoreAct->setCheckable(true);
+	connect(setSteadyStateActionIgnoreAct, SIGNAL(triggered()), this, SLOT(setSteadyStateActionIgnore()));
+
+	setSteadyStateActionContinueAct = new QAction(tr("continue"), this);
+	setSteadyStateActionContinueAct->setStatusTip(tr("only report when the run reaches the steady state"));
+	setSteadyStateActionContinueAct->setCheckable(true);
+	connect(setSteadyStateActionContinueAct, SIGNAL(triggered()), this, SLOT(setSteadyStateActionContinue()));
+	
+	setSteadyStateActionRecordLessOftenAct = new QAction(tr("record less often"), this);
+	setSteadyStateActionRecordLessOftenAct->setStatusTip(tr("record one step in ten of those recorded before the steady state"));
+	setSteadyStateActionRecordLessOftenAct->setCheckable(true);
+	connect(setSteadyStateActionRecordLessOftenAct, SIGNAL(triggered()), this, SLOT(setSteadyStateActionRecordLessOften()));
+	
+	setSteadyStateActionStopAct = new QAction(tr("stop"), this);
+	setSteadyStateActionStopAct->setStatusTip(tr("stop the run when it reaches the steady state"));
+	setSteadyStateActionStopAct->setCheckable(true);
+	connect(setSteadyStateActionStopAct, SIGNAL(triggered()), this, SLOT(setSteadyStateActionStop()));
+	
+	saveProfileTraceAct = new QAction(tr("Save profile trace..."), this);
+	saveProfileTraceAct->setStatusTip(tr("save the timings of the simulation phases, to open in chrome://tracing"));
+	connect(saveProfileTraceAct, SIGNAL(triggered()), this, SLOT(saveProfileTrace()));
+	
 	
     zoomInAct = new QAction(QIcon(":/images/zoom_in.svgz"), tr("&Zoom in..."), this);
     zoomInAct->setShortcut(tr("Ctrl++"));
@@ -1292,7 +1856,7 @@ void MainWindow::createActions()
 	lcdNumber = new QLCDNumber(this);
 	lcdNumber->setSegmentStyle(QLCDNumber::Filled);
     //lcdNumber->setNumDigits(6);
-	lcdNumber->display(currentSimulationTime * w->getDeltaT());
+	lcdNumber->display(currentSimulatedTime);
 	
 }
 
@@ -1316,6 +1880,39 @@ void MainWindow::createMenus()
 	algorithmMenu->addAction(runAct);
 	algorithmMenu->addAction(showUpdateAct);
 	algorithmMenu->addAction(recordAct);
+	algorithmMenu->addAction(reduceSeriesAct);
+	algorithmMenu->addAction(adaptDeltaTAct);
+	algorithmMenu->addAction(setSigmaUpdateIntervalAct);
+	algorithmMenu->addAction(solveSteadyStateAct);
+	
+	edgeLoopMenu = new QMenu(tr("Parallel edges"), this);
+	edgeLoopMenu->addAction(setEdgeLoopSequentialAct);
+	edgeLoopMenu->addAction(setEdgeLoopLockFreeAct);
+	edgeLoopMenu->addAction(setEdgeLoopBySubdomainsAct);
+	algorithmMenu->addMenu(edgeLoopMenu);
+	
+	nodeOrderingMenu = new QMenu(tr("Node ordering"), this);
+	nodeOrderingMenu->addAction(setNodeOrderingNoneAct);
+	nodeOrderingMenu->addAction(setNodeOrderingReverseCuthillMcKeeAct);
+	nodeOrderingMenu->addAction(setNodeOrderingHilbertCurveAct);
+	algorithmMenu->addMenu(nodeOrderingMenu);
+	
+	simulationEngineMenu = new QMenu(tr("Engine"), this);
+	simulationEngineMenu->addAction(setSimulationEngineFixedStepAct);
+	simulationEngineMenu->addAction(setSimulationEngineGillespieAct);
+	simulationEngineMenu->addAction(setSimulationEngineTauLeapingAct);
+	algorithmMenu->addMenu(simulationEngineMenu);
+	
+	steadyStateMenu = new QMenu(tr("At steady state"), this);
+	steadyStateMenu->addAction(setSteadyStateActionIgnoreAct);
+	steadyStateMenu->addAction(setSteadyStateActionContinueAct);
+	steadyStateMenu->addAction(setSteadyStateActionRecordLessOftenAct);
+	steadyStateMenu->addAction(setSteadyStateActionStopAct);
+	algorithmMenu->addMenu(steadyStateMenu);
+#ifdef ELECTRIC_LEAF_PROFILING
+	algorithmMenu->addSeparator();
+	algorithmMenu->addAction(saveProfileTraceAct); // the timings are only recorded by a build with CONFIG+=profiling
+#endif
 	
 	
 	visibilityMenu = new QMenu(tr("Set visible"), this);
@@ -1459,6 +2056,20 @@ void MainWindow::createToolBars()
 	
 	helpToolBar = addToolBar(tr("Help"));
 	helpToolBar->addAction(infoAct);
+	
+	// the timeline is only shown while a run trace is open
+	addToolBarBreak(Qt::BottomToolBarArea);
+	playbackToolBar = new QToolBar(tr("Playback"), this);
+	addToolBar(Qt::BottomToolBarArea, playbackToolBar);
+	timelineSlider = new QSlider(Qt::Horizontal, this);
+	timelineSlider->setRange(0, 0);
+	timelineSlider->setToolTip(tr("Step of the run trace shown in the network"));
+	connect(timelineSlider, SIGNAL(valueChanged(int)), this, SLOT(showTraceFrame(int)));
+	timelineLabel = new QLabel(this);
+	timelineLabel->setMinimumWidth(200);
+	playbackToolBar->addWidget(timelineSlider);
+	playbackToolBar->addWidget(timelineLabel);
+	playbackToolBar->setVisible(false);
 }
 
 
@@ -30,6 +30,10 @@
 #include <QMessageBox>
 #include <QMenuBar>
 #include <QToolBar>
+#include <QElapsedTimer>
+#include <QFuture>
+#include <QVector>
+#include <QPointF>
 
 #include "graphwidget.h"
 #include "parameterdialog.h"
@@ -44,7 +48,10 @@ class GraphWidget;
 class QComboBox;
 class QPushButton;
 class QLCDNumber;
+class QSlider;
 class QPainter;
+class QProgressBar;
+class NetworkLoader;
 
 class MainWindow : public QMainWindow
 {
@@ -53,7 +60,7 @@ class MainWindow : public QMainWindow
 	
 public:
     MainWindow();
-	void increaseSimulationTime(int timeIncrement);
+	void increaseSimulationTime(int timeIncrement, double simulatedTimeIncrement);
 	
 private slots:
     void open();
@@ -93,6 +100,19 @@ private slots:
 	void setColourMapGray();
 	void setColourMapPM3D();
 	void setColourMapDaltonicFriendly();
+	void setNodeOrderingNone();
+	void setNodeOrderingReverseCuthillMcKee();
+	void setNodeOrderingHilbertCurve();
+	void setSimulationEngineFixedStep();
+	void setSimulationEngineGillespie();
+	void setSimulationEngineTauLeaping();
+	void setEdgeLoopSequential();
+	void setEdgeLoopLockFree();
+	void setEdgeLoopBySubdomains();
+	void setSteadyStateActionIgnore();
+	void setSteadyStateActionContinue();
+	void setSteadyStateActionRecordLessOften();
+	void setSteadyStateActionStop();
 	
 	void setSigmaAsFunctionOfWidthAndLength();
 	void toggleNodesVisible();
@@ -102,7 +122,16 @@ private slots:
 	void runSimulation(bool isRunning);
 	void showUpdate(bool shouldShowUpdate);
 	void record(bool shouldRecord);
+	void reduceSeries(bool shouldReduceSeries);
+	void adaptDeltaT(bool shouldAdaptDeltaT);
+	void setSigmaUpdateInterval();
+	void solveSteadyState();
 	void resetSimulationTime();
+	void showTraceFrame(int frameNumber);
+	void saveProfileTrace();
+	void showLoadedNodes(QVector<QPointF> positions);
+	void finishLoading();
+	void cancelLoading();
 	
 	
 protected:
@@ -113,6 +142,12 @@ private:
     void createMenus();
     void createToolBars();
 	void enableActionsAndMenus();
+	bool loadFile(QString fileName);
+	void startLoading(QString fileName);
+	void stopLoading();
+	void keepOpenedNetwork();
+	void showOpenedFile(QString fileName);
+	void showTraceTimeline(int frameNumber);
 	
     void setCurrentFile(const QString &fileName);
     void updateRecentFileActions();
@@ -120,6 +155,12 @@ private:
 	
 	void exportSVG(QString exportFileName);
 	void exportPicture(QString exportFileName);
+	void setNodeOrdering(QString chosenNodeOrdering);
+	void setSimulationEngine(QString chosenSimulationEngine);
+	void setEdgeLoop(QString chosenEdgeLoop);
+	void setSteadyStateAction(QString chosenSteadyStateAction);
+	void reachSteadyState();
+	void writeRunSummary();
 	
 
 	void startRunning();
@@ -150,12 +191,17 @@ private:
 	QMenu *setAllEdgesSigmaMenu;
 	QMenu *setAllStomataSigmaMenu;
 	QMenu *setColourMapMenu;
+	QMenu *nodeOrderingMenu;
+	QMenu *simulationEngineMenu;
+	QMenu *edgeLoopMenu;
+	QMenu *steadyStateMenu;
 	
     QToolBar *fileToolBar;
     QToolBar *viewToolBar;
     QToolBar *editToolBar;
 	QToolBar *algorithmToolBar;
 	QToolBar *helpToolBar;
+	QToolBar *playbackToolBar;
 	
 	
 	// file menu
@@ -174,6 +220,24 @@ private:
 	QAction *runAct;
 	QAction *showUpdateAct;
 	QAction *recordAct;
+	QAction *reduceSeriesAct;
+	QAction *adaptDeltaTAct;
+	QAction *setSigmaUpdateIntervalAct;
+	QAction *solveSteadyStateAct;
+	QAction *setNodeOrderingNoneAct;
+	QAction *setNodeOrderingReverseCuthillMcKeeAct;
+	QAction *setNodeOrderingHilbertCurveAct;
+	QAction *setSimulationEngineFixedStepAct;
+	QAction *setSimulationEngineGillespieAct;
+	QAction *setSimulationEngineTauLeapingAct;
+	QAction *setEdgeLoopSequentialAct;
+	QAction *setEdgeLoopLockFreeAct;
+	QAction *setEdgeLoopBySubdomainsAct;
+	QAction *setSteadyStateActionIgnoreAct;
+	QAction *setSteadyStateActionContinueAct;
+	QAction *setSteadyStateActionRecordLessOftenAct;
+	QAction *setSteadyStateActionStopAct;
+	QAction *saveProfileTraceAct;
 	
 	// view menu
     QAction *zoomInAct;
@@ -225,6 +289,10 @@ private:
     QAction *recentFileActs[MaxRecentFiles];
 	
 	QLCDNumber *lcdNumber;
+	QSlider *timelineSlider;
+	QLabel *timelineLabel;
+	QProgressBar *loadingProgressBar;
+	QPushButton *cancelLoadingButton;
 
 	GraphWidget *w;
 	ParameterDialog *parameterDialog;
@@ -233,15 +301,22 @@ private:
 	
 	QString curFileName;
 	// simulation parameters
-	int currentSimulationTime;
+	int currentSimulationTime; // in steps
+	double currentSimulatedTime; // the sum of the deltaT of the steps, which can change with the adaptive step
 	int totRunningTime;
 	int recordingTimeInterval;
+	QString steadyStateAction; // what happens when the run reaches the steady state: "continue", "record less often" or "stop"
+	bool isSteadyStateReported;
 	QString recordFileName;
 	
 	
 	int myTimerID;
 	bool isRunningSimulation;
 	bool isRecordingSimulation;
+	QElapsedTimer profileBreakdownTimer; // when the breakdown in the status bar was last refreshed
+	
+	NetworkLoader *networkLoader; // NULL when no network is being read
+	QFuture<void> loadingFuture;
 };
 
 #endif
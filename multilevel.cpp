@@ -0,0 +1,554 @@
+/***************************************************************************
+ copyright            : (C) 2011 by Andrea Perna
+ email                : perna@math.uu.se
+ ***************************************************************************/
+
+/*******************************************************************************
+ *     This program is free software: you can redistribute it and/or modify     *
+ *     it under the terms of the GNU General Public License as published by     *
+ *     the Free Software Foundation, either version 3 of the License, or        *
+ *     (at your option) any later version.                                      *
+ *                                                                              *
+ *     This program is distributed in the hope that it will be useful,          *
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the            *
+ *     GNU General Public License for more details.                             *
+ *                                                                              *
+ *     You can find a copy of the GNU General Public License at the             *
+ *     following address: <http://www.gnu.org/licenses/>.                       *
+ ********************************************************************************/
+
+#include "multilevel.h"
+
+#include <QHash>
+#include <QDataStream>
+#include <QPair>
+
+#include <algorithm>
+#include <cmath>
+
+
+static const int maximumCoarsestRows = 200; // solved by a dense Cholesky factorization
+static const int smoothingSweeps = 2;
+static const double jacobiDamping = 2.0 / 3.0;
+
+
+
+
+static double medianEdgeLength(const GraphLevel &graphLevel)
+{
+	QVector<double> lengths;
+	lengths.reserve(graphLevel.edgeSource.size());
+	for (int i = 0; i < graphLevel.edgeSource.size(); i++)
+	{
+		QPointF difference = graphLevel.positions[graphLevel.edgeSource[i]] - graphLevel.positions[graphLevel.edgeDest[i]];
+		lengths.append(sqrt(difference.x() * difference.x() + difference.y() * difference.y()));
+	}
+	if (lengths.isEmpty())
+		return 0;
+	std::nth_element(lengths.begin(), lengths.begin() + lengths.size() / 2, lengths.end());
+	return lengths[lengths.size() / 2];
+}
+
+
+/* Heavy edge matching: the nodes are visited in order, and each free node is
+ merged with its free neighbour through the heaviest edge. Fills fineToCoarse
+ and edgeToCoarse of fine, and returns the coarser level. */
+
+static GraphLevel coarsen(GraphLevel &fine)
+{
+	int nNodes = fine.nNodes;
+	
+	QVector<int> firstNeighbour(nNodes + 1, 0);
+	for (int i = 0; i < fine.edgeSource.size(); i++)
+	{
+		firstNeighbour[fine.edgeSource[i] + 1]++;
+		firstNeighbour[fine.edgeDest[i] + 1]++;
+	}
+	for (int node = 0; node < nNodes; node++)
+	{
+		firstNeighbour[node + 1] += firstNeighbour[node];
+	}
+	QVector<int> neighbourEdges(firstNeighbour[nNodes]);
+	QVector<int> cursor = firstNeighbour;
+	for (int i = 0; i < fine.edgeSource.size(); i++)
+	{
+		neighbourEdges[cursor[fine.edgeSource[i]]++] = i;
+		neighbourEdges[cursor[fine.edgeDest[i]]++] = i;
+	}
+	
+	fine.fineToCoarse.fill(-1, nNodes);
+	int nCoarseNodes = 0;
+	for (int node = 0; node < nNodes; node++)
+	{
+		if (fine.fineToCoarse[node] >= 0)
+			continue;
+		int partner = -1;
+		double heaviest = -1;
+		for (int k = firstNeighbour[node]; k < firstNeighbour[node + 1]; k++)
+		{
+			int edge = neighbourEdges[k];
+			int other = fine.edgeSource[edge] == node ? fine.edgeDest[edge] : fine.edgeSource[edge];
+			if (other != node && fine.fineToCoarse[other] < 0 && fine.edgeWeight[edge] > heaviest)
+			{
+				heaviest = fine.edgeWeight[edge];
+				partner = other;
+			}
+		}
+		fine.fineToCoarse[node] = nCoarseNodes;
+		if (partner >= 0)
+			fine.fineToCoarse[partner] = nCoarseNodes;
+		nCoarseNodes++;
+	}
+	
+	GraphLevel coarse;
+	coarse.nNodes = nCoarseNodes;
+	coarse.positions.fill(QPointF(0, 0), nCoarseNodes);
+	QVector<int> nMerged(nCoarseNodes, 0);
+	for (int node = 0; node < nNodes; node++)
+	{
+		coarse.positions[fine.fineToCoarse[node]] += fine.positions[node];
+		nMerged[fine.fineToCoarse[node]]++;
+	}
+	for (int node = 0; node < nCoarseNodes; node++)
+	{
+		coarse.positions[node] /= nMerged[node];
+	}
+	
+	// parallel edges between two merged nodes become one edge
+	QHash<QPair<int, int>, int> coarseEdge;
+	fine.edgeToCoarse.fill(-1, fine.edgeSource.size());
+	for (int i = 0; i < fine.edgeSource.size(); i++)
+	{
+		int a = fine.fineToCoarse[fine.edgeSource[i]];
+		int b = fine.fineToCoarse[fine.edgeDest[i]];
+		if (a == b)
+			continue;
+		QPair<int, int> ends = qMakePair(qMin(a, b), qMax(a, b));
+		int edge = coarseEdge.value(ends, -1);
+		if (edge < 0)
+		{
+			edge = coarse.edgeSource.size();
+			coarseEdge.insert(ends, edge);
+			coarse.edgeSource.append(ends.first);
+			coarse.edgeDest.append(ends.second);
+			coarse.edgeWeight.append(0);
+		}
+		coarse.edgeWeight[edge] += fine.edgeWeight[i];
+		fine.edgeToCoarse[i] = edge;
+	}
+	coarse.typicalEdgeLength = medianEdgeLength(coarse);
+	return coarse;
+}
+
+
+// coarsens until there are at most minimumNodes nodes, or a level hardly shrinks (isolated nodes, stars)
+void GraphHierarchy::build(const QVector<QPointF> &positions, const QVector<int> &edgeSource, const QVector<int> &edgeDest, const QVector<double> &edgeWeight, int minimumNodes)
+{
+	levels.clear();
+	GraphLevel finest;
+	finest.nNodes = positions.size();
+	finest.positions = positions;
+	finest.edgeSource = edgeSource;
+	finest.edgeDest = edgeDest;
+	finest.edgeWeight = edgeWeight;
+	finest.typicalEdgeLength = medianEdgeLength(finest);
+	levels.append(finest);
+	
+	while (levels.last().nNodes > minimumNodes)
+	{
+		GraphLevel coarse = coarsen(levels.last());
+		if (coarse.nNodes > 0.9 * levels.last().nNodes)
+		{
+			levels.last().fineToCoarse.clear();
+			levels.last().edgeToCoarse.clear();
+			break;
+		}
+		levels.append(coarse);
+	}
+}
+
+
+void GraphHierarchy::clear()
+{
+	levels.clear();
+}
+
+
+void GraphHierarchy::save(QDataStream &out) const
+{
+	out << qint32(levels.size());
+	foreach (const GraphLevel &graphLevel, levels)
+	{
+		out << qint32(graphLevel.nNodes) << graphLevel.positions << graphLevel.edgeSource << graphLevel.edgeDest
+			<< graphLevel.edgeWeight << graphLevel.fineToCoarse << graphLevel.edgeToCoarse << graphLevel.typicalEdgeLength;
+	}
+}
+
+
+// every index between 0 and size - 1, or -1 when allowed
+static bool areIndicesValid(const QVector<int> &indices, int size, bool isMinusOneAllowed)
+{
+	foreach (int index, indices)
+	{
+		if (index >= size || index < (isMinusOneAllowed ? -1 : 0))
+			return false;
+	}
+	return true;
+}
+
+
+/* False, and an empty hierarchy, unless the levels read fit each other and the
+ nNodes nodes of the network: the edges join nodes of their level, and the
+ nodes and edges of a level point to those of the next one. */
+
+bool GraphHierarchy::load(QDataStream &in, int nNodes)
+{
+	clear();
+	qint32 nLevels;
+	in >> nLevels;
+	if (in.status() != QDataStream::Ok || nLevels <= 0 || nLevels > qMax(nNodes, 1)) // every level has fewer nodes than the one before
+		return false;
+	levels.resize(nLevels);
+	int expectedNodes = nNodes;
+	for (int l = 0; l < nLevels; l++)
+	{
+		GraphLevel &graphLevel = levels[l];
+		qint32 levelNodes;
+		in >> levelNodes >> graphLevel.positions >> graphLevel.edgeSource >> graphLevel.edgeDest
+			>> graphLevel.edgeWeight >> graphLevel.fineToCoarse >> graphLevel.edgeToCoarse >> graphLevel.typicalEdgeLength;
+		graphLevel.nNodes = levelNodes;
+		bool isLast = l == nLevels - 1;
+		if (in.status() != QDataStream::Ok || levelNodes != expectedNodes || graphLevel.positions.size() != levelNodes
+			|| graphLevel.edgeDest.size() != graphLevel.edgeSource.size() || graphLevel.edgeWeight.size() != graphLevel.edgeSource.size()
+			|| graphLevel.fineToCoarse.size() != (isLast ? 0 : levelNodes)
+			|| graphLevel.edgeToCoarse.size() != (isLast ? 0 : graphLevel.edgeSource.size())
+			|| !areIndicesValid(graphLevel.edgeSource, levelNodes, false) || !areIndicesValid(graphLevel.edgeDest, levelNodes, false))
+		{
+			clear();
+			return false;
+		}
+		if (!isLast && levelNodes > 0)
+			expectedNodes = *std::max_element(graphLevel.fineToCoarse.begin(), graphLevel.fineToCoarse.end()) + 1;
+	}
+	
+	// the coarse indices read with a level are only checked once the next level gives its sizes
+	for (int l = 0; l + 1 < nLevels; l++)
+	{
+		if (!areIndicesValid(levels[l].fineToCoarse, levels[l + 1].nNodes, false)
+			|| !areIndicesValid(levels[l].edgeToCoarse, levels[l + 1].edgeSource.size(), true))
+		{
+			clear();
+			return false;
+		}
+	}
+	return true;
+}
+
+
+int GraphHierarchy::getNumberOfLevels() const
+{
+	return levels.size();
+}
+
+
+const GraphLevel &GraphHierarchy::level(int levelNumber) const
+{
+	return levels[levelNumber];
+}
+
+
+QVector<int> GraphHierarchy::edgesAtLevel(int levelNumber) const
+{
+	QVector<int> edges;
+	if (levels.isEmpty())
+		return edges;
+	edges.resize(levels[0].edgeSource.size());
+	for (int i = 0; i < edges.size(); i++)
+	{
+		edges[i] = i;
+	}
+	for (int l = 0; l < levelNumber; l++)
+	{
+		for (int i = 0; i < edges.size(); i++)
+		{
+			if (edges[i] >= 0)
+				edges[i] = levels[l].edgeToCoarse[edges[i]];
+		}
+	}
+	return edges;
+}
+
+
+
+
+void SparseMatrix::multiply(const QVector<double> &x, QVector<double> &y) const
+{
+	y.resize(nRows);
+	for (int row = 0; row < nRows; row++)
+	{
+		double sum = 0;
+		for (int k = rowStart[row]; k < rowStart[row + 1]; k++)
+		{
+			sum += value[k] * x[column[k]];
+		}
+		y[row] = sum;
+	}
+}
+
+
+// the Galerkin product P^T A P, where P takes each fine row to its aggregate
+static SparseMatrix aggregateMatrix(const SparseMatrix &fine, const QVector<int> &aggregate, int nCoarseRows)
+{
+	QVector<QPair<QPair<int, int>, double> > entries;
+	entries.reserve(fine.value.size());
+	for (int row = 0; row < fine.nRows; row++)
+	{
+		for (int k = fine.rowStart[row]; k < fine.rowStart[row + 1]; k++)
+		{
+			entries.append(qMakePair(qMakePair(aggregate[row], aggregate[fine.column[k]]), fine.value[k]));
+		}
+	}
+	std::sort(entries.begin(), entries.end());
+	
+	SparseMatrix coarse;
+	coarse.nRows = nCoarseRows;
+	coarse.rowStart.fill(0, nCoarseRows + 1);
+	for (int i = 0; i < entries.size(); i++)
+	{
+		if (i > 0 && entries[i].first == entries[i - 1].first)
+		{
+			coarse.value.last() += entries[i].second;
+			continue;
+		}
+		coarse.column.append(entries[i].first.second);
+		coarse.value.append(entries[i].second);
+		coarse.rowStart[entries[i].first.first + 1]++;
+	}
+	for (int row = 0; row < nCoarseRows; row++)
+	{
+		coarse.rowStart[row + 1] += coarse.rowStart[row];
+	}
+	return coarse;
+}
+
+
+static QVector<double> inverseDiagonal(const SparseMatrix &matrix)
+{
+	QVector<double> inverse(matrix.nRows, 0);
+	for (int row = 0; row < matrix.nRows; row++)
+	{
+		for (int k = matrix.rowStart[row]; k < matrix.rowStart[row + 1]; k++)
+		{
+			if (matrix.column[k] == row && matrix.value[k] != 0)
+				inverse[row] = 1.0 / matrix.value[k];
+		}
+	}
+	return inverse;
+}
+
+
+void MultigridSolver::setup(const SparseMatrix &matrix, const GraphHierarchy &hierarchy)
+{
+	matrices.clear();
+	inverseDiagonals.clear();
+	aggregates.clear();
+	matrices.append(matrix);
+	inverseDiagonals.append(inverseDiagonal(matrix));
+	
+	for (int l = 0; l + 1 < hierarchy.getNumberOfLevels() && matrices.last().nRows > maximumCoarsestRows; l++)
+	{
+		const GraphLevel &fine = hierarchy.level(l);
+		aggregates.append(fine.fineToCoarse);
+		matrices.append(aggregateMatrix(matrices.last(), fine.fineToCoarse, hierarchy.level(l + 1).nNodes));
+		inverseDiagonals.append(inverseDiagonal(matrices.last()));
+	}
+	
+	// dense Cholesky factor of the coarsest matrix, if it is small enough
+	coarsestFactor.clear();
+	const SparseMatrix &coarsest = matrices.last();
+	int n = coarsest.nRows;
+	if (n > maximumCoarsestRows)
+		return;
+	QVector<double> dense(n * n, 0);
+	for (int row = 0; row < n; row++)
+	{
+		for (int k = coarsest.rowStart[row]; k < coarsest.rowStart[row + 1]; k++)
+		{
+			dense[row * n + coarsest.column[k]] += coarsest.value[k];
+		}
+	}
+	for (int j = 0; j < n; j++)
+	{
+		double diagonal = dense[j * n + j];
+		for (int k = 0; k < j; k++)
+		{
+			diagonal -= dense[j * n + k] * dense[j * n + k];
+		}
+		// a singular block (a part of the network with neither sources nor sinks) is left at zero
+		diagonal = diagonal > 1e-12 * (fabs(dense[j * n + j]) + 1e-300) ? sqrt(diagonal) : 0;
+		dense[j * n + j] = diagonal;
+		for (int i = j + 1; i < n; i++)
+		{
+			double sum = dense[i * n + j];
+			for (int k = 0; k < j; k++)
+			{
+				sum -= dense[i * n + k] * dense[j * n + k];
+			}
+			dense[i * n + j] = diagonal > 0 ? sum / diagonal : 0;
+		}
+	}
+	for (int i = 0; i < n; i++)
+	{
+		for (int j = i + 1; j < n; j++)
+		{
+			dense[i * n + j] = 0;
+		}
+	}
+	coarsestFactor = dense;
+}
+
+
+void MultigridSolver::smooth(int levelNumber, const QVector<double> &rightHandSide, QVector<double> &x)
+{
+	const SparseMatrix &matrix = matrices[levelNumber];
+	const QVector<double> &inverse = inverseDiagonals[levelNumber];
+	QVector<double> product;
+	for (int sweep = 0; sweep < smoothingSweeps; sweep++)
+	{
+		matrix.multiply(x, product);
+		for (int row = 0; row < matrix.nRows; row++)
+		{
+			x[row] += jacobiDamping * inverse[row] * (rightHandSide[row] - product[row]);
+		}
+	}
+}
+
+
+void MultigridSolver::solveCoarsest(const QVector<double> &rightHandSide, QVector<double> &x)
+{
+	int n = matrices.last().nRows;
+	if (coarsestFactor.isEmpty())
+	{
+		// too large to factorize, the hierarchy could not be coarsened further
+		for (int i = 0; i < 10; i++)
+		{
+			smooth(matrices.size() - 1, rightHandSide, x);
+		}
+		return;
+	}
+	const QVector<double> &factor = coarsestFactor;
+	QVector<double> y(n, 0);
+	for (int i = 0; i < n; i++)
+	{
+		double sum = rightHandSide[i];
+		for (int k = 0; k < i; k++)
+		{
+			sum -= factor[i * n + k] * y[k];
+		}
+		y[i] = factor[i * n + i] > 0 ? sum / factor[i * n + i] : 0;
+	}
+	for (int i = n - 1; i >= 0; i--)
+	{
+		double sum = y[i];
+		for (int k = i + 1; k < n; k++)
+		{
+			sum -= factor[k * n + i] * x[k];
+		}
+		x[i] = factor[i * n + i] > 0 ? sum / factor[i * n + i] : 0;
+	}
+}
+
+
+// one V-cycle from a zero initial guess, symmetric so that it can precondition conjugate gradients
+void MultigridSolver::vCycle(int levelNumber, const QVector<double> &residual, QVector<double> &correction)
+{
+	const SparseMatrix &matrix = matrices[levelNumber];
+	correction.fill(0, matrix.nRows);
+	if (levelNumber == matrices.size() - 1)
+	{
+		solveCoarsest(residual, correction);
+		return;
+	}
+	
+	smooth(levelNumber, residual, correction);
+	
+	QVector<double> product;
+	matrix.multiply(correction, product);
+	const QVector<int> &aggregate = aggregates[levelNumber];
+	QVector<double> coarseResidual(matrices[levelNumber + 1].nRows, 0);
+	for (int row = 0; row < matrix.nRows; row++)
+	{
+		coarseResidual[aggregate[row]] += residual[row] - product[row];
+	}
+	QVector<double> coarseCorrection;
+	vCycle(levelNumber + 1, coarseResidual, coarseCorrection);
+	for (int row = 0; row < matrix.nRows; row++)
+	{
+		correction[row] += coarseCorrection[aggregate[row]];
+	}
+	
+	smooth(levelNumber, residual, correction);
+}
+
+
+static double dot(const QVector<double> &a, const QVector<double> &b)
+{
+	double sum = 0;
+	for (int i = 0; i < a.size(); i++)
+	{
+		sum += a[i] * b[i];
+	}
+	return sum;
+}
+
+
+// returns the number of iterations, or -1 if the tolerance on the relative residual was not reached
+int MultigridSolver::solve(const QVector<double> &b, QVector<double> &x, double tolerance, int maxIterations)
+{
+	const SparseMatrix &matrix = matrices[0];
+	int n = matrix.nRows;
+	if (x.size() != n)
+		x.fill(0, n);
+	
+	QVector<double> residual;
+	matrix.multiply(x, residual);
+	for (int i = 0; i < n; i++)
+	{
+		residual[i] = b[i] - residual[i];
+	}
+	double bNorm = sqrt(dot(b, b));
+	if (bNorm == 0)
+		bNorm = 1;
+	if (sqrt(dot(residual, residual)) <= tolerance * bNorm)
+		return 0;
+	
+	QVector<double> z;
+	vCycle(0, residual, z);
+	QVector<double> direction = z;
+	double rz = dot(residual, z);
+	QVector<double> product;
+	for (int iteration = 1; iteration <= maxIterations; iteration++)
+	{
+		matrix.multiply(direction, product);
+		double curvature = dot(direction, product);
+		if (curvature <= 0)
+			return -1;
+		double step = rz / curvature;
+		for (int i = 0; i < n; i++)
+		{
+			x[i] += step * direction[i];
+			residual[i] -= step * product[i];
+		}
+		if (sqrt(dot(residual, residual)) <= tolerance * bNorm)
+			return iteration;
+		vCycle(0, residual, z);
+		double newRz = dot(residual, z);
+		for (int i = 0; i < n; i++)
+		{
+			direction[i] = z[i] + (newRz / rz) * direction[i];
+		}
+		rz = newRz;
+	}
+	return -1;
+}
@@ -0,0 +1,112 @@
+/***************************************************************************
+ copyright            : (C) 2011 by Andrea Perna
+ email                : perna@math.uu.se
+ ***************************************************************************/
+
+/*******************************************************************************
+ *     This program is free software: you can redistribute it and/or modify     *
+ *     it under the terms of the GNU General Public License as published by     *
+ *     the Free Software Foundation, either version 3 of the License, or        *
+ *     (at your option) any later version.                                      *
+ *                                                                              *
+ *     This program is distributed in the hope that it will be useful,          *
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the            *
+ *     GNU General Public License for more details.                             *
+ *                                                                              *
+ *     You can find a copy of the GNU General Public License at the             *
+ *     following address: <http://www.gnu.org/licenses/>.                       *
+ ********************************************************************************/
+
+#ifndef MULTILEVEL_H
+#define MULTILEVEL_H
+
+#include <QVector>
+#include <QPointF>
+
+class QDataStream;
+
+
+/* A hierarchy of smaller and smaller versions of the network. Each level is
+ made from the one below by heavy edge matching: every node is merged with the
+ neighbour it is most strongly connected to, if that neighbour is still free,
+ so each level has a little more than half the nodes of the one below.
+ 
+ The hierarchy is used in two ways: the view draws a coarse level instead of
+ the edges when they are too small to be seen one by one, and the aggregates
+ give the prolongation and restriction of the multigrid preconditioner that
+ solves for the steady state of the flow.
+ 
+ As in networkordering.h, nodes are indices from zero and edges are given by
+ the indices of their two ends. */
+
+
+struct GraphLevel
+{
+	int nNodes;
+	QVector<QPointF> positions; // mean position of the nodes merged into each node
+	QVector<int> edgeSource;
+	QVector<int> edgeDest;
+	QVector<double> edgeWeight; // sum of the weights of the edges merged into each edge
+	QVector<int> fineToCoarse; // node of the next coarser level containing each node, empty for the coarsest level
+	QVector<int> edgeToCoarse; // edge of the next coarser level containing each edge, -1 inside a merged node
+	double typicalEdgeLength; // median length of the edges
+};
+
+
+class GraphHierarchy
+{
+public:
+	void build(const QVector<QPointF> &positions, const QVector<int> &edgeSource, const QVector<int> &edgeDest, const QVector<double> &edgeWeight, int minimumNodes = 64);
+	void clear();
+	
+	// for the sidecar of the network file, see networksidecar.h
+	void save(QDataStream &out) const;
+	bool load(QDataStream &in, int nNodes);
+	
+	int getNumberOfLevels() const;
+	const GraphLevel &level(int levelNumber) const;
+	QVector<int> edgesAtLevel(int levelNumber) const; // the edge of the given level containing each edge of level 0, or -1
+	
+private:
+	QVector<GraphLevel> levels;
+};
+
+
+
+
+// compressed rows: the entries of row i are column[rowStart[i]] to column[rowStart[i+1]-1]
+struct SparseMatrix
+{
+	int nRows;
+	QVector<int> rowStart;
+	QVector<int> column;
+	QVector<double> value;
+	
+	void multiply(const QVector<double> &x, QVector<double> &y) const;
+};
+
+
+/* Conjugate gradients preconditioned by a multigrid V-cycle, for a symmetric
+ positive definite matrix whose rows are the nodes of level 0 of the hierarchy.
+ The coarse matrices are the Galerkin products of the aggregation, the smoother
+ is damped Jacobi and the coarsest level is solved exactly. */
+
+class MultigridSolver
+{
+public:
+	void setup(const SparseMatrix &matrix, const GraphHierarchy &hierarchy);
+	int solve(const QVector<double> &b, QVector<double> &x, double tolerance = 1e-8, int maxIterations = 500);
+	
+private:
+	void vCycle(int levelNumber, const QVector<double> &residual, QVector<double> &correction);
+	void smooth(int levelNumber, const QVector<double> &rightHandSide, QVector<double> &x);
+	void solveCoarsest(const QVector<double> &rightHandSide, QVector<double> &x);
+	
+	QVector<SparseMatrix> matrices;
+	QVector<QVector<double> > inverseDiagonals;
+	QVector<QVector<int> > aggregates; // aggregates[l] maps the rows of level l to those of level l+1
+	QVector<double> coarsestFactor; // Cholesky factor of the coarsest matrix, row by row
+};
+
+#endif
@@ -7,26 +7,74 @@ TARGET = my_electric_leaf
 INCLUDEPATH += .
 QT += widgets
 QT += svg
+QT += concurrent
+QT += network
+
+# qmake CONFIG+=profiling times the phases of the simulation, see profiler.h
+CONFIG(profiling) {
+	DEFINES += ELECTRIC_LEAF_PROFILING
+}
 
 
 # Input
-HEADERS += dialogrecordingparameters.h \
+HEADERS += benchmark.h \
+           convergencemonitor.h \
+           dialogrecordingparameters.h \
+           domaindecomposition.h \
            edge.h \
+           ensemble.h \
+           fixedstep.h \
+           glyphatlas.h \
            graphwidget.h \
            mainwindow.h \
+           multilevel.h \
+           networkloader.h \
+           networkordering.h \
+           networksidecar.h \
            node.h \
+           paralleledgeloop.h \
            parameterdialog.h \
+           perfcounters.h \
+           profiler.h \
            randomnumbers.h \
+           resultscache.h \
+           runtrace.h \
+           samplerbenchmark.h \
+           seriesreduction.h \
+           sharedtopology.h \
            sigmaequationdialog.h \
-           stoma.h
-SOURCES += dialogrecordingparameters.cpp \
+           spatialindex.h \
+           stochasticengines.h \
+           stoma.h \
+           textwriter.h
+SOURCES += benchmark.cpp \
+           convergencemonitor.cpp \
+           dialogrecordingparameters.cpp \
+           domaindecomposition.cpp \
            edge.cpp \
+           ensemble.cpp \
+           glyphatlas.cpp \
            graphwidget.cpp \
            main.cpp \
            mainwindow.cpp \
+           multilevel.cpp \
+           networkloader.cpp \
+           networkordering.cpp \
+           networksidecar.cpp \
            node.cpp \
+           paralleledgeloop.cpp \
            parameterdialog.cpp \
+           perfcounters.cpp \
+           profiler.cpp \
            randomnumbers.cpp \
+           resultscache.cpp \
+           runtrace.cpp \
+           samplerbenchmark.cpp \
+           seriesreduction.cpp \
+           sharedtopology.cpp \
            sigmaequationdialog.cpp \
-           stoma.cpp
+           spatialindex.cpp \
+           stochasticengines.cpp \
+           stoma.cpp \
+           textwriter.cpp
 RESOURCES += my_electric_leaf.qrc
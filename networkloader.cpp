@@ -0,0 +1,225 @@
+/***************************************************************************
+ copyright            : (C) 2011 by Andrea Perna
+ email                : perna@math.uu.se
+ ***************************************************************************/
+
+/*******************************************************************************
+ *     This program is free software: you can redistribute it and/or modify     *
+ *     it under the terms of the GNU General Public License as published by     *
+ *     the Free Software Foundation, either version 3 of the License, or        *
+ *     (at your option) any later version.                                      *
+ *                                                                              *
+ *     This program is distributed in the hope that it will be useful,          *
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the            *
+ *     GNU General Public License for more details.                             *
+ *                                                                              *
+ *     You can find a copy of the GNU General Public License at the             *
+ *     following address: <http://www.gnu.org/licenses/>.                       *
+ ********************************************************************************/
+
+#include "networkloader.h"
+
+#include <QFile>
+#include <QTextStream>
+#include <QStringList>
+#include <QMetaType>
+
+
+static const int linesPerChunk = 1000; // between two checks of the cancel and two reports
+
+
+NetworkFileData::NetworkFileData()
+{
+	isValid = false;
+	numberOfNodes = 0;
+}
+
+
+
+// the same fields as drawGraph always accepted, see GraphWidget::buildGraph for their meaning
+bool readNetworkFile(QString fileName, NetworkFileData &data, NetworkLoader *loader)
+{
+	data = NetworkFileData();
+	QFile file(fileName);
+	if (!file.open(QIODevice::ReadOnly | QIODevice::Text))
+		return false;
+	
+	QTextStream in(&file);
+	QString line = in.readLine();
+	QStringList fields = line.split(' ', QString::SkipEmptyParts);
+	if (fields.size() != 2)
+		return false;
+	fields.takeFirst(); // the name of the network
+	data.numberOfNodes = fields.takeFirst().toInt();
+	if (data.numberOfNodes < 0)
+		return false;
+	data.nodes.reserve(data.numberOfNodes);
+	
+	bool isReadingEdges = false; // First it will be reading the list of nodes, then the list of edges
+	double edgeSigma = -1; // as in drawGraph, the sigma of a five field line stays for the lines after it
+	QVector<QPointF> chunk;
+	int linesInChunk = 0;
+	
+	while (!in.atEnd())
+	{
+		line = in.readLine();
+		if (line.startsWith(QChar('*')))
+		{
+			isReadingEdges = true;
+		}
+		else if (!isReadingEdges)
+		{
+			fields = line.split(' ', QString::SkipEmptyParts);
+			if (fields.size() >= 4) // I accept that the nodes could have more than four fields
+			{
+				NodeRecord node;
+				node.number = fields.takeFirst().toInt();
+				node.label = fields.takeFirst();
+				node.x = fields.takeFirst().toFloat();
+				node.y = fields.takeFirst().toFloat();
+				node.nParticles = -1;
+				node.stomaticSigma = -1;
+				if (fields.size() >= 2) // if there are additional fields with nParticles, sourceAndSink
+				{
+					node.nParticles = fields.takeFirst().toInt();
+					node.sourceOrSink = fields.takeFirst();
+					if (node.sourceOrSink == "Sink" && fields.size() >= 1) // and the stomatic sigma
+						node.stomaticSigma = fields.takeFirst().toDouble();
+				}
+				data.nodes.append(node);
+				if (loader)
+					chunk.append(QPointF(node.x, node.y));
+			}
+		}
+		else
+		{
+			fields = line.split(' ', QString::SkipEmptyParts);
+			EdgeRecord edge;
+			edge.sourceNumber = fields.value(0).toInt();
+			edge.destNumber = fields.value(1).toInt();
+			switch (fields.size())
+			{
+				case 2:
+					edge.length = 1.0;
+					edge.width = 1.0;
+					break;
+				case 3:
+					edge.length = fields[2].toDouble();
+					edge.width = 1.0;
+					break;
+				case 14: // this is the number of fields in my files
+					edge.length = fields[2].toDouble();
+					edge.width = fields[12].toDouble();
+					break;
+				case 5:
+					edge.length = fields[2].toDouble();
+					edge.width = fields[3].toDouble();
+					edgeSigma = fields[4].toDouble();
+					break;
+				case 4:
+				default: // I accept that the edges can have more than four fields
+					edge.length = fields.value(2).toDouble();
+					edge.width = fields.value(3).toDouble();
+					break;
+			}
+			edge.sigma = edgeSigma;
+			data.edges.append(edge);
+		}
+		
+		if (loader && ++linesInChunk == linesPerChunk)
+		{
+			linesInChunk = 0;
+			if (!chunk.isEmpty())
+			{
+				loader->reportNodes(chunk);
+				chunk.clear();
+			}
+			loader->reportProgress(file.pos(), file.size());
+			if (loader->isCancelled())
+				return false;
+		}
+	}
+	
+	if (loader && !chunk.isEmpty())
+		loader->reportNodes(chunk);
+	data.isValid = true;
+	return true;
+}
+
+
+
+
+NetworkLoader::NetworkLoader(QString fileName)
+: fileName(fileName)
+{
+	isLoadedCompletely = false;
+	isCancelRequested.store(0);
+	lastPercent = -1;
+	qRegisterMetaType<QVector<QPointF> >("QVector<QPointF>"); // queued to the main window
+}
+
+
+
+QString NetworkLoader::getFileName()
+{
+	return fileName;
+}
+
+
+
+const NetworkFileData &NetworkLoader::getData()
+{
+	return data;
+}
+
+
+
+bool NetworkLoader::isLoaded()
+{
+	return isLoadedCompletely;
+}
+
+
+
+void NetworkLoader::cancel()
+{
+	isCancelRequested.store(1);
+}
+
+
+
+bool NetworkLoader::isCancelled()
+{
+	return isCancelRequested.load() != 0;
+}
+
+
+
+void NetworkLoader::reportProgress(qint64 bytesRead, qint64 fileSize)
+{
+	int percent = fileSize > 0 ? int(100 * bytesRead / fileSize) : 0;
+	if (percent != lastPercent)
+	{
+		lastPercent = percent;
+		emit progressChanged(percent);
+	}
+}
+
+
+
+void NetworkLoader::reportNodes(const QVector<QPointF> &positions)
+{
+	emit nodesRead(positions);
+}
+
+
+
+// runs on the loading thread, the data is read by the main thread only after finished
+void NetworkLoader::load()
+{
+	isLoadedCompletely = readNetworkFile(fileName, data, this) && !isCancelled();
+	if (isLoadedCompletely)
+		reportProgress(1, 1);
+	emit finished();
+}
@@ -0,0 +1,116 @@
+/***************************************************************************
+ copyright            : (C) 2011 by Andrea Perna
+ email                : perna@math.uu.se
+ ***************************************************************************/
+
+/*******************************************************************************
+ *     This program is free software: you can redistribute it and/or modify     *
+ *     it under the terms of the GNU General Public License as published by     *
+ *     the Free Software Foundation, either version 3 of the License, or        *
+ *     (at your option) any later version.                                      *
+ *                                                                              *
+ *     This program is distributed in the hope that it will be useful,          *
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the            *
+ *     GNU General Public License for more details.                             *
+ *                                                                              *
+ *     You can find a copy of the GNU General Public License at the             *
+ *     following address: <http://www.gnu.org/licenses/>.                       *
+ ********************************************************************************/
+
+
+#ifndef NETWORKLOADER_H
+#define NETWORKLOADER_H
+
+#include <QObject>
+#include <QString>
+#include <QVector>
+#include <QPointF>
+#include <QAtomicInt>
+
+
+/* Loading a network in the main window without freezing it: a NetworkLoader
+ reads the file on a thread of the pool into plain records, sending the
+ positions of the nodes as they are read so that the window can draw a preview,
+ and GraphWidget::buildGraph makes the items from the records afterwards.
+ Reading is the slow part of opening a large network, the records are what
+ drawGraph used to build item by item while reading. The loading can be
+ cancelled at any moment, it stops at the next chunk of lines. */
+
+
+// a node line of a network file: number label x y [nParticles Source|Sink|Neither [stomaticSigma]]
+struct NodeRecord
+{
+	int number;
+	QString label;
+	float x, y; // as in the file, before the scale factor
+	int nParticles; // -1 when the line has no particles, the node is then a sink with the initial particles
+	QString sourceOrSink;
+	double stomaticSigma; // -1 when the line has none
+};
+
+
+// an edge line: source destination [length [width [sigma]]], or the fourteen fields of the leaf files
+struct EdgeRecord
+{
+	int sourceNumber;
+	int destNumber;
+	double length;
+	double width;
+	double sigma; // -1 to compute it from the width and the length
+};
+
+
+struct NetworkFileData
+{
+	NetworkFileData();
+	
+	bool isValid; // the header "name numberOfNodes" was read
+	int numberOfNodes;
+	QVector<NodeRecord> nodes;
+	QVector<EdgeRecord> edges;
+};
+
+
+class NetworkLoader;
+
+/* Reads a network file into data, false if it cannot be read. With a loader,
+ it reports the progress and the nodes read to it, and gives up as soon as the
+ loader is cancelled. */
+bool readNetworkFile(QString fileName, NetworkFileData &data, NetworkLoader *loader = NULL);
+
+
+class NetworkLoader : public QObject
+{
+	Q_OBJECT
+	
+public:
+	NetworkLoader(QString fileName);
+	
+	QString getFileName();
+	const NetworkFileData &getData();
+	bool isLoaded(); // read completely, not cancelled
+	
+	void cancel(); // from any thread
+	bool isCancelled();
+	
+	void reportProgress(qint64 bytesRead, qint64 fileSize);
+	void reportNodes(const QVector<QPointF> &positions);
+	
+public slots:
+	void load();
+	
+signals:
+	void progressChanged(int percent);
+	void nodesRead(QVector<QPointF> positions); // a chunk of nodes, in the coordinates of the file
+	void finished();
+	
+private:
+	QString fileName;
+	NetworkFileData data;
+	bool isLoadedCompletely;
+	QAtomicInt isCancelRequested;
+	int lastPercent;
+};
+
+#endif
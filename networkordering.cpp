@@ -0,0 +1,255 @@
+/***************************************************************************
+ copyright            : (C) 2011 by Andrea Perna
+ email                : perna@math.uu.se
+ ***************************************************************************/
+
+/*******************************************************************************
+ *     This program is free software: you can redistribute it and/or modify     *
+ *     it under the terms of the GNU General Public License as published by     *
+ *     the Free Software Foundation, either version 3 of the License, or        *
+ *     (at your option) any later version.                                      *
+ *                                                                              *
+ *     This program is distributed in the hope that it will be useful,          *
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the            *
+ *     GNU General Public License for more details.                             *
+ *                                                                              *
+ *     You can find a copy of the GNU General Public License at the             *
+ *     following address: <http://www.gnu.org/licenses/>.                       *
+ ********************************************************************************/
+
+#include "networkordering.h"
+
+#include <QPair>
+
+#include <algorithm>
+
+
+
+
+// neighbours of each node in compressed rows: the neighbours of i are neighbours[first[i]] to neighbours[first[i+1]-1]
+struct Adjacency
+{
+	QVector<int> first;
+	QVector<int> neighbours;
+	
+	int degree(int node) const { return first[node + 1] - first[node]; }
+};
+
+
+static Adjacency buildAdjacency(int nNodes, const QVector<int> &edgeSource, const QVector<int> &edgeDest)
+{
+	Adjacency adjacency;
+	adjacency.first.fill(0, nNodes + 1);
+	for (int i = 0; i < edgeSource.size(); i++)
+	{
+		adjacency.first[edgeSource[i] + 1]++;
+		adjacency.first[edgeDest[i] + 1]++;
+	}
+	for (int node = 0; node < nNodes; node++)
+	{
+		adjacency.first[node + 1] += adjacency.first[node];
+	}
+	adjacency.neighbours.resize(adjacency.first[nNodes]);
+	QVector<int> cursor = adjacency.first;
+	for (int i = 0; i < edgeSource.size(); i++)
+	{
+		adjacency.neighbours[cursor[edgeSource[i]]++] = edgeDest[i];
+		adjacency.neighbours[cursor[edgeDest[i]]++] = edgeSource[i];
+	}
+	return adjacency;
+}
+
+
+/* Breadth first search from start over the nodes not yet placed, neighbours in
+ order of increasing degree, appending the nodes to order. Returns the position
+ in order where the last level of the search begins, and the number of levels. */
+
+static int breadthFirstByDegree(const Adjacency &adjacency, int start, QVector<bool> &isPlaced, QVector<int> &order, int &nLevels)
+{
+	int head = order.size();
+	order.append(start);
+	isPlaced[start] = true;
+	int lastLevelBegin = head;
+	int levelEnd = head + 1;
+	nLevels = 1;
+	QVector<QPair<int, int> > candidates; // (degree, node), to sort the neighbours
+	while (head < order.size())
+	{
+		if (head == levelEnd)
+		{
+			lastLevelBegin = head;
+			levelEnd = order.size();
+			nLevels++;
+		}
+		int node = order[head++];
+		candidates.clear();
+		for (int i = adjacency.first[node]; i < adjacency.first[node + 1]; i++)
+		{
+			int neighbour = adjacency.neighbours[i];
+			if (isPlaced[neighbour])
+				continue;
+			isPlaced[neighbour] = true;
+			candidates.append(qMakePair(adjacency.degree(neighbour), neighbour));
+		}
+		std::sort(candidates.begin(), candidates.end());
+		for (int i = 0; i < candidates.size(); i++)
+		{
+			order.append(candidates[i].second);
+		}
+	}
+	return lastLevelBegin;
+}
+
+
+/* A node at the end of a long path through its component, found as in George
+ and Liu: search from a node of the component, and restart from the node of
+ lowest degree of the last level as long as that makes the search deeper.
+ isVisited is all false on entry and is left so, only the nodes of the
+ component are cleared after each search, so that a network of many small
+ components is not cleared once per component. */
+
+static int peripheralNode(const Adjacency &adjacency, int start, QVector<bool> &isVisited, QVector<int> &order)
+{
+	int depth = 0;
+	for (int iteration = 0; iteration < 5; iteration++)
+	{
+		order.clear();
+		int nLevels;
+		int lastLevelBegin = breadthFirstByDegree(adjacency, start, isVisited, order, nLevels);
+		foreach (int node, order)
+		{
+			isVisited[node] = false;
+		}
+		if (nLevels <= depth)
+			break;
+		depth = nLevels;
+		
+		int next = order[lastLevelBegin];
+		for (int k = lastLevelBegin; k < order.size(); k++)
+		{
+			if (adjacency.degree(order[k]) < adjacency.degree(next))
+				next = order[k];
+		}
+		if (next == start)
+			break;
+		start = next;
+	}
+	return start;
+}
+
+
+QVector<int> reverseCuthillMcKeeOrder(int nNodes, const QVector<int> &edgeSource, const QVector<int> &edgeDest)
+{
+	Adjacency adjacency = buildAdjacency(nNodes, edgeSource, edgeDest);
+	QVector<bool> isPlaced(nNodes, false);
+	QVector<int> order;
+	order.reserve(nNodes);
+	QVector<bool> isVisited(nNodes, false); // the scratch of peripheralNode
+	QVector<int> componentOrder;
+	
+	// one search per connected component, the isolated nodes are simply placed where they are found
+	for (int node = 0; node < nNodes; node++)
+	{
+		if (isPlaced[node])
+			continue;
+		int nLevels;
+		breadthFirstByDegree(adjacency, peripheralNode(adjacency, node, isVisited, componentOrder), isPlaced, order, nLevels);
+	}
+	std::reverse(order.begin(), order.end());
+	return order;
+}
+
+
+
+
+// distance along the Hilbert curve filling a square of side n (a power of two) of the cell (x, y)
+static quint64 hilbertDistance(quint32 n, quint32 x, quint32 y)
+{
+	quint64 distance = 0;
+	for (quint32 s = n / 2; s > 0; s /= 2)
+	{
+		quint32 rx = (x & s) > 0;
+		quint32 ry = (y & s) > 0;
+		distance += quint64(s) * s * ((3 * rx) ^ ry);
+		// rotate the quadrant so that the curve inside it starts and ends in the right corners
+		if (ry == 0)
+		{
+			if (rx == 1)
+			{
+				x = n - 1 - x;
+				y = n - 1 - y;
+			}
+			quint32 t = x;
+			x = y;
+			y = t;
+		}
+	}
+	return distance;
+}
+
+
+QVector<int> hilbertCurveOrder(const QVector<QPointF> &positions)
+{
+	QVector<int> order;
+	if (positions.isEmpty())
+		return order;
+	
+	double minX = positions[0].x();
+	double maxX = minX;
+	double minY = positions[0].y();
+	double maxY = minY;
+	for (int i = 1; i < positions.size(); i++)
+	{
+		minX = qMin(minX, positions[i].x());
+		maxX = qMax(maxX, positions[i].x());
+		minY = qMin(minY, positions[i].y());
+		maxY = qMax(maxY, positions[i].y());
+	}
+	const quint32 side = 1 << 16;
+	double extent = qMax(maxX - minX, maxY - minY);
+	double scale = extent > 0 ? (side - 1) / extent : 0;
+	
+	// sorting the pairs keeps the nodes of the same cell in their original order
+	QVector<QPair<quint64, int> > keys(positions.size());
+	for (int i = 0; i < positions.size(); i++)
+	{
+		quint32 x = quint32((positions[i].x() - minX) * scale);
+		quint32 y = quint32((positions[i].y() - minY) * scale);
+		keys[i] = qMakePair(hilbertDistance(side, x, y), i);
+	}
+	std::sort(keys.begin(), keys.end());
+	order.resize(positions.size());
+	for (int i = 0; i < keys.size(); i++)
+	{
+		order[i] = keys[i].second;
+	}
+	return order;
+}
+
+
+
+
+QVector<int> edgeOrderByLowerEndpoint(const QVector<int> &nodeOrder, const QVector<int> &edgeSource, const QVector<int> &edgeDest)
+{
+	QVector<int> nodePosition(nodeOrder.size());
+	for (int k = 0; k < nodeOrder.size(); k++)
+	{
+		nodePosition[nodeOrder[k]] = k;
+	}
+	
+	QVector<QPair<QPair<int, int>, int> > keys(edgeSource.size());
+	for (int i = 0; i < edgeSource.size(); i++)
+	{
+		int a = nodePosition[edgeSource[i]];
+		int b = nodePosition[edgeDest[i]];
+		keys[i] = qMakePair(qMakePair(qMin(a, b), qMax(a, b)), i);
+	}
+	std::sort(keys.begin(), keys.end());
+	QVector<int> order(keys.size());
+	for (int i = 0; i < keys.size(); i++)
+	{
+		order[i] = keys[i].second;
+	}
+	return order;
+}
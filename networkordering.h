@@ -0,0 +1,47 @@
+/***************************************************************************
+ copyright            : (C) 2011 by Andrea Perna
+ email                : perna@math.uu.se
+ ***************************************************************************/
+
+/*******************************************************************************
+ *     This program is free software: you can redistribute it and/or modify     *
+ *     it under the terms of the GNU General Public License as published by     *
+ *     the Free Software Foundation, either version 3 of the License, or        *
+ *     (at your option) any later version.                                      *
+ *                                                                              *
+ *     This program is distributed in the hope that it will be useful,          *
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the            *
+ *     GNU General Public License for more details.                             *
+ *                                                                              *
+ *     You can find a copy of the GNU General Public License at the             *
+ *     following address: <http://www.gnu.org/licenses/>.                       *
+ ********************************************************************************/
+
+#ifndef NETWORKORDERING_H
+#define NETWORKORDERING_H
+
+#include <QVector>
+#include <QPointF>
+
+
+/* Orderings of the nodes and edges of a network that keep neighbours close in
+ memory. The node numbers of the network files follow the image processing that
+ extracted the veins, so two ends of the same vein segment can be far apart in
+ the lists that the simulation and the painting walk through.
+ 
+ All the functions return a permutation: order[k] is the index of the node
+ (or edge) that goes to position k. The nodes are given by their indices from
+ zero, and the edges by the indices of their two ends. */
+
+
+// Reverse Cuthill-McKee: breadth first from a peripheral node, so that the ends of each edge get close positions
+QVector<int> reverseCuthillMcKeeOrder(int nNodes, const QVector<int> &edgeSource, const QVector<int> &edgeDest);
+
+// position of the nodes along a Hilbert curve covering their bounding box
+QVector<int> hilbertCurveOrder(const QVector<QPointF> &positions);
+
+// edges sorted by the position of their lower end, then of their higher end
+QVector<int> edgeOrderByLowerEndpoint(const QVector<int> &nodeOrder, const QVector<int> &edgeSource, const QVector<int> &edgeDest);
+
+#endif
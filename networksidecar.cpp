@@ -0,0 +1,164 @@
+/***************************************************************************
+ copyright            : (C) 2011 by Andrea Perna
+ email                : perna@math.uu.se
+ ***************************************************************************/
+
+/*******************************************************************************
+ *     This program is free software: you can redistribute it and/or modify     *
+ *     it under the terms of the GNU General Public License as published by     *
+ *     the Free Software Foundation, either version 3 of the License, or        *
+ *     (at your option) any later version.                                      *
+ *                                                                              *
+ *     This program is distributed in the hope that it will be useful,          *
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the            *
+ *     GNU General Public License for more details.                             *
+ *                                                                              *
+ *     You can find a copy of the GNU General Public License at the             *
+ *     following address: <http://www.gnu.org/licenses/>.                       *
+ ********************************************************************************/
+
+#include "networksidecar.h"
+
+#include <QFile>
+#include <QSaveFile>
+#include <QDataStream>
+#include <QCryptographicHash>
+
+
+static const quint32 sidecarMagic = 0x454c5343; // "ELSC"
+static const qint32 sidecarVersion = 2; // 2 appends the entries one by one
+
+
+
+
+NetworkSidecar::NetworkSidecar()
+{
+	nRecords = 0;
+	isRewriteNeeded = true;
+}
+
+
+// reads the sidecar of the file if it was made from its current content
+bool NetworkSidecar::open(QString networkFileName)
+{
+	close();
+	QFile networkFile(networkFileName);
+	if (!networkFile.open(QIODevice::ReadOnly))
+		return false;
+	QCryptographicHash hash(QCryptographicHash::Sha1);
+	if (!hash.addData(&networkFile))
+		return false;
+	contentHash = hash.result();
+	fileName = networkFileName + ".elcache";
+	
+	QFile file(fileName);
+	if (!file.open(QIODevice::ReadOnly))
+		return true;
+	QDataStream in(&file);
+	in.setVersion(QDataStream::Qt_5_2);
+	quint32 magic;
+	qint32 version;
+	QByteArray storedHash;
+	in >> magic >> version;
+	if (magic != sidecarMagic || version != sidecarVersion)
+		return true;
+	in >> storedHash;
+	if (in.status() != QDataStream::Ok || storedHash != contentHash)
+		return true;
+	while (!in.atEnd())
+	{
+		QString key;
+		QByteArray data;
+		in >> key >> data;
+		if (in.status() != QDataStream::Ok)
+			return true; // cut short, the complete records are kept
+		entries.insert(key, data);
+		nRecords++;
+	}
+	isRewriteNeeded = false;
+	return true;
+}
+
+
+void NetworkSidecar::close()
+{
+	fileName.clear();
+	contentHash.clear();
+	entries.clear();
+	nRecords = 0;
+	isRewriteNeeded = true;
+}
+
+
+bool NetworkSidecar::isOpen()
+{
+	return !fileName.isEmpty();
+}
+
+
+bool NetworkSidecar::contains(QString key)
+{
+	return entries.contains(key);
+}
+
+
+QByteArray NetworkSidecar::value(QString key)
+{
+	return entries.value(key);
+}
+
+
+void NetworkSidecar::insert(QString key, const QByteArray &data)
+{
+	if (!isOpen())
+		return;
+	entries.insert(key, data);
+	if (isRewriteNeeded || nRecords + 1 > 2 * entries.size())
+	{
+		rewrite();
+	}
+	else if (!append(key, data))
+	{
+		isRewriteNeeded = true; // the next structure tries again with the whole file
+	}
+}
+
+
+// the header and all the entries, under a temporary name until the file is complete
+bool NetworkSidecar::rewrite()
+{
+	QSaveFile file(fileName);
+	if (!file.open(QIODevice::WriteOnly))
+		return false;
+	QDataStream out(&file);
+	out.setVersion(QDataStream::Qt_5_2);
+	out << sidecarMagic << sidecarVersion << contentHash;
+	QHash<QString, QByteArray>::const_iterator i;
+	for (i = entries.constBegin(); i != entries.constEnd(); ++i)
+	{
+		out << i.key() << i.value();
+	}
+	if (!file.commit())
+		return false;
+	nRecords = entries.size();
+	isRewriteNeeded = false;
+	return true;
+}
+
+
+// a record cut short by a crash is dropped when the file is opened again
+bool NetworkSidecar::append(QString key, const QByteArray &data)
+{
+	QFile file(fileName);
+	if (!file.open(QIODevice::WriteOnly | QIODevice::Append))
+		return false;
+	QDataStream out(&file);
+	out.setVersion(QDataStream::Qt_5_2);
+	out << key << data;
+	file.close();
+	if (out.status() != QDataStream::Ok || file.error() != QFile::NoError)
+		return false;
+	nRecords++;
+	return true;
+}
@@ -0,0 +1,73 @@
+/***************************************************************************
+ copyright            : (C) 2011 by Andrea Perna
+ email                : perna@math.uu.se
+ ***************************************************************************/
+
+/*******************************************************************************
+ *     This program is free software: you can redistribute it and/or modify     *
+ *     it under the terms of the GNU General Public License as published by     *
+ *     the Free Software Foundation, either version 3 of the License, or        *
+ *     (at your option) any later version.                                      *
+ *                                                                              *
+ *     This program is distributed in the hope that it will be useful,          *
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the            *
+ *     GNU General Public License for more details.                             *
+ *                                                                              *
+ *     You can find a copy of the GNU General Public License at the             *
+ *     following address: <http://www.gnu.org/licenses/>.                       *
+ ********************************************************************************/
+
+#ifndef NETWORKSIDECAR_H
+#define NETWORKSIDECAR_H
+
+#include <QString>
+#include <QByteArray>
+#include <QHash>
+
+
+/* The structures derived from a network file, kept in a file next to it with
+ the suffix .elcache, so that opening the same network again does not compute
+ them again: the orders of the nodes and edges, the spatial index and the
+ hierarchy. Each structure is stored under a key naming it and what it depends
+ on, besides the network, such as the node ordering.
+ 
+ The sidecar belongs to the content of the network file, whose SHA-1 it
+ stores, and to sidecarVersion, to be bumped when the algorithms or the layout
+ of a structure change: a sidecar of another content or version is ignored,
+ and replaced at the first structure stored. The sidecar must be closed as
+ soon as the network is edited, since the structures then describe another
+ network. When the directory cannot be written the structures are simply
+ computed every time.
+ 
+ The entries are appended to the file one at a time, after a header with the
+ hash, so storing a structure does not write the others again. A key stored
+ again is read from its last record. The file is written again from scratch,
+ under a temporary name, when it belongs to another network, when its last
+ record was cut short, or when half of its records have been replaced. */
+
+class NetworkSidecar
+{
+public:
+	NetworkSidecar();
+	
+	bool open(QString networkFileName);
+	void close();
+	bool isOpen();
+	
+	bool contains(QString key);
+	QByteArray value(QString key);
+	void insert(QString key, const QByteArray &data);
+	
+private:
+	bool rewrite();
+	bool append(QString key, const QByteArray &data);
+	
+	QString fileName; // empty while closed
+	QByteArray contentHash;
+	QHash<QString, QByteArray> entries;
+	int nRecords; // in the file, the entries replaced included
+	bool isRewriteNeeded;
+};
+
+#endif
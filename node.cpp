@@ -37,16 +37,18 @@
 #include "node.h"
 #include "stoma.h"
 #include "graphwidget.h"
+#include "glyphatlas.h"
 
 #include <iostream>
 #include <cmath>
 
+
 Node::Node(GraphWidget *graphWidget)
-: pGraph(graphWidget)
+: pGraph(graphWidget), nParticles(0)
 {
 	setFlag(ItemIsMovable);
 	setFlag(ItemSendsGeometryChanges);
-    setCacheMode(DeviceCoordinateCache);    
+	setFlag(ItemHasNoContents); // the glyphs of all the nodes are drawn at once by GraphWidget::drawForeground
 	setZValue(1);
 	setVisible(pGraph->getNodesVisible());
 	pStoma = NULL;
@@ -116,22 +118,31 @@ QString Node::getLabel()
 
 void Node::setNParticles(int newNParticles)
 {
+	if (newNParticles == nParticles)
+		return;
 	nParticles = newNParticles;
+	pGraph->activateEdgesOf(this);
 }
 
 
 void Node::addParticles(int nParticlesAdded)
 {
+	int previousNParticles = nParticles;
 	nParticles += nParticlesAdded;
 	if (nParticles < 0) // this is to allow adding negative numbers of particles
 		nParticles = 0;
+	if (nParticles != previousNParticles)
+		pGraph->activateEdgesOf(this);
 }
 
 void Node::subtractParticles(int nParticlesSubtracted)
 {
+	int previousNParticles = nParticles;
 	nParticles -= nParticlesSubtracted;
 	if (nParticles < 0)
 		nParticles = 0;
+	if (nParticles != previousNParticles)
+		pGraph->activateEdgesOf(this);
 }
 
 
@@ -150,7 +161,7 @@ void Node::setAsSource()
 	isSink = false;
 	isSource = true;
 	reColour(pGraph->getColouringNodesParameter(), pGraph->getNodesColourScale());
-	update();
+	updateGlyph();
 }
 
 
@@ -165,7 +176,7 @@ void Node::setAsNeitherSourceNorSink()
 	isSink = false;
 	isSource = false;
 	reColour(pGraph->getColouringNodesParameter(), pGraph->getNodesColourScale());
-	update();
+	updateGlyph();
 }
 
 
@@ -181,7 +192,7 @@ void Node::setAsSink()
 	isSink = true;
 	isSource = false;
 	reColour(pGraph->getColouringNodesParameter(), pGraph->getNodesColourScale());
-	update();
+	updateGlyph();
 }
 
 bool Node::isSinkNode()
@@ -258,23 +269,30 @@ void Node::paintPicture(QPainter &painter)
 
 
 
-void Node::paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *)
+QColor Node::getColourLight()
 {
-	bool drawNodes = true; // do we really want to draw the nodes or not?
-	if (drawNodes)
-	{
-		painter->setPen(Qt::NoPen);
-		painter->setBrush(Qt::darkGray);
-		painter->drawEllipse(-1, -1, 3, 3);
-		
-		QRadialGradient gradient(-0.5, -0.5, 1.5);
-		gradient.setColorAt(0, colourLight);
-		gradient.setColorAt(1, colourDark);
+	return colourLight;
+}
 
-		painter->setBrush(gradient);
-		painter->setPen(QPen(Qt::black, 0));
-		painter->drawEllipse(-1.5, -1.5, 3, 3);
-	}
+
+QColor Node::getColourDark()
+{
+	return colourDark;
+}
+
+
+// the item has no contents of its own, so the area of its glyph is repainted explicitly
+void Node::updateGlyph()
+{
+	if (scene())
+		scene()->update(sceneBoundingRect());
+}
+
+
+// only used if the item is drawn by Qt, the graph widget normally draws the glyphs itself
+void Node::paint(QPainter *painter, const QStyleOptionGraphicsItem *, QWidget *)
+{
+	paintGlyph(painter, colourLight, colourDark);
 }
 
 
@@ -383,7 +401,7 @@ void Node::reColour(QString colouringNodesParameter, QString nodesColourScale)
 		colourLight = Qt::cyan;
 		colourDark = Qt::darkCyan;
 	}
-	update();
+	updateGlyph();
 }
 
 
@@ -399,6 +417,11 @@ QVariant Node::itemChange(GraphicsItemChange change, const QVariant &value)
 		case ItemPositionChange:
 			foreach (Edge *edge, edgeList)
             edge->adjust();
+			pGraph->invalidateSpatialIndex();
+			updateGlyph(); // the area the glyph is leaving
+			break;
+		case ItemPositionHasChanged:
+			updateGlyph(); // and the area it moved to, Qt repaints neither for an item without contents
 			break;
 		default:
 			break;
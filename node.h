@@ -58,6 +58,9 @@ public:
 	bool isSinkNode();
 	void setLabel(QString newLabel);
 	QString getLabel();
+	QColor getColourLight();
+	QColor getColourDark();
+	void updateGlyph();
 	void reColour(QString colouringNodesParameter, QString nodesColourScale);
 	Stoma *getStoma();
 	
@@ -0,0 +1,162 @@
+/***************************************************************************
+ copyright            : (C) 2011 by Andrea Perna
+ email                : perna@math.uu.se
+ ***************************************************************************/
+
+/*******************************************************************************
+ *     This program is free software: you can redistribute it and/or modify     *
+ *     it under the terms of the GNU General Public License as published by     *
+ *     the Free Software Foundation, either version 3 of the License, or        *
+ *     (at your option) any later version.                                      *
+ *                                                                              *
+ *     This program is distributed in the hope that it will be useful,          *
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the            *
+ *     GNU General Public License for more details.                             *
+ *                                                                              *
+ *     You can find a copy of the GNU General Public License at the             *
+ *     following address: <http://www.gnu.org/licenses/>.                       *
+ ********************************************************************************/
+
+#include "paralleledgeloop.h"
+#include "randomnumbers.h"
+
+#include <QtConcurrent/QtConcurrentRun>
+#include <QFuture>
+#include <QList>
+
+#include <cstdlib>
+
+
+ParallelEdgeLoop::ParallelEdgeLoop()
+{
+	nNodes = 0;
+	particles = NULL;
+}
+
+
+ParallelEdgeLoop::~ParallelEdgeLoop()
+{
+	delete [] particles;
+}
+
+
+void ParallelEdgeLoop::setNetwork(int nNodesInNetwork, const QVector<int> &newEdgeSource, const QVector<int> &newEdgeDest, int nThreads)
+{
+	delete [] particles;
+	nNodes = nNodesInNetwork;
+	particles = new QAtomicInt[nNodes];
+	edgeSource = newEdgeSource;
+	edgeDest = newEdgeDest;
+	
+	QVector<int> order(edgeSource.size());
+	for (int i = 0; i < order.size(); i++)
+	{
+		order[i] = i;
+	}
+	std::random_shuffle(order.begin(), order.end());
+	nThreads = qMax(1, nThreads);
+	parts.fill(QVector<int>(), nThreads);
+	for (int i = 0; i < order.size(); i++)
+	{
+		parts[i % nThreads].append(order[i]);
+	}
+}
+
+
+int ParallelEdgeLoop::getNumberOfThreads()
+{
+	return parts.size();
+}
+
+
+void ParallelEdgeLoop::setParticles(int node, int nParticles)
+{
+	particles[node].store(nParticles);
+}
+
+
+int ParallelEdgeLoop::getParticles(int node)
+{
+	return particles[node].load();
+}
+
+
+/* qrand keeps one seed per thread, so each part seeds its own thread with a
+ number drawn in the calling thread: the runs can be repeated as long as the
+ number of threads is the same. The pointers to the edges of the parts are
+ taken here too, so that the threads call no QVector member that may detach. */
+
+void ParallelEdgeLoop::run(const QVector<double> &transferProbability, QVector<int> &flow)
+{
+	flow.resize(edgeSource.size());
+	const double *probability = transferProbability.constData();
+	int *flows = flow.data(); // detached here, before the threads write into it
+	
+	QVector<uint> seeds(parts.size());
+	for (int part = 0; part < parts.size(); part++)
+	{
+		seeds[part] = qrand();
+	}
+	QVector<int *> partEdges(parts.size());
+	for (int part = 0; part < parts.size(); part++)
+	{
+		partEdges[part] = parts[part].data();
+	}
+	QList<QFuture<void> > futures;
+	for (int part = 1; part < parts.size(); part++)
+	{
+		futures.append(QtConcurrent::run(this, &ParallelEdgeLoop::runPart, partEdges[part], parts.at(part).size(), seeds[part], probability, flows));
+	}
+	if (!parts.isEmpty())
+		runPart(partEdges[0], parts.at(0).size(), seeds[0], probability, flows);
+	for (int i = 0; i < futures.size(); i++)
+	{
+		futures[i].waitForFinished();
+	}
+}
+
+
+// the edges of the part are shuffled in place, each thread writes only its own
+void ParallelEdgeLoop::runPart(int *edges, int nEdges, uint seed, const double *transferProbability, int *flow)
+{
+	qsrand(seed);
+	for (int i = nEdges - 1; i > 0; i--) // a new order at every step
+	{
+		int j = qrand() % (i + 1);
+		int edge = edges[i];
+		edges[i] = edges[j];
+		edges[j] = edge;
+	}
+	
+	const int *edgeSources = edgeSource.constData();
+	const int *edgeDests = edgeDest.constData();
+	for (int i = 0; i < nEdges; i++)
+	{
+		int edge = edges[i];
+		int source = edgeSources[edge];
+		int dest = edgeDests[edge];
+		int difference = particles[dest].load() - particles[source].load();
+		if (difference == 0)
+		{
+			flow[edge] = 0;
+			continue;
+		}
+		int from = difference > 0 ? dest : source;
+		int to = difference > 0 ? source : dest;
+		int nMoving = binomDist(abs(difference), transferProbability[edge]);
+		
+		// the other threads may have emptied the node since it was read
+		int taken = 0;
+		for (;;)
+		{
+			int available = particles[from].load();
+			taken = qMin(nMoving, qMax(available, 0));
+			if (taken == 0 || particles[from].testAndSetRelaxed(available, available - taken))
+				break;
+		}
+		if (taken > 0)
+			particles[to].fetchAndAddRelaxed(taken);
+		flow[edge] = difference > 0 ? -taken : taken;
+	}
+}
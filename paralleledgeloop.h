@@ -0,0 +1,65 @@
+/***************************************************************************
+ copyright            : (C) 2011 by Andrea Perna
+ email                : perna@math.uu.se
+ ***************************************************************************/
+
+/*******************************************************************************
+ *     This program is free software: you can redistribute it and/or modify     *
+ *     it under the terms of the GNU General Public License as published by     *
+ *     the Free Software Foundation, either version 3 of the License, or        *
+ *     (at your option) any later version.                                      *
+ *                                                                              *
+ *     This program is distributed in the hope that it will be useful,          *
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the            *
+ *     GNU General Public License for more details.                             *
+ *                                                                              *
+ *     You can find a copy of the GNU General Public License at the             *
+ *     following address: <http://www.gnu.org/licenses/>.                       *
+ ********************************************************************************/
+
+#ifndef PARALLELEDGELOOP_H
+#define PARALLELEDGELOOP_H
+
+#include <QVector>
+#include <QAtomicInt>
+
+
+/* The edge loop of the fixed step run by several threads without locks, in
+ the manner of Hogwild. The edges are split once, at random, in one part per
+ thread, and each thread visits its part in a new random order at every step.
+ The numbers of particles are atomic counters: an edge reads the two ends
+ without synchronisation, draws how many particles move, takes them from the
+ fuller end with a compare and swap that never lets it go below zero, and adds
+ what it took to the other end. Two edges sharing a node may then see each
+ other's moves only partly, which is a small change of the statistics of the
+ sequential random order, but no particle is ever created or lost.
+ 
+ The nodes and edges are indices from zero, as in networkordering.h. */
+
+class ParallelEdgeLoop
+{
+public:
+	ParallelEdgeLoop();
+	~ParallelEdgeLoop();
+	
+	void setNetwork(int nNodes, const QVector<int> &newEdgeSource, const QVector<int> &newEdgeDest, int nThreads);
+	int getNumberOfThreads();
+	
+	void setParticles(int node, int nParticles);
+	int getParticles(int node);
+	
+	// one step: each edge moves Binom(|difference|, transferProbability) particles; flow as in Edge::getFlow
+	void run(const QVector<double> &transferProbability, QVector<int> &flow);
+	
+private:
+	void runPart(int *edges, int nEdges, uint seed, const double *transferProbability, int *flow);
+	
+	int nNodes;
+	QAtomicInt *particles;
+	QVector<int> edgeSource;
+	QVector<int> edgeDest;
+	QVector<QVector<int> > parts; // the edges of each thread
+};
+
+#endif
@@ -0,0 +1,233 @@
+/***************************************************************************
+ copyright            : (C) 2011 by Andrea Perna
+ email                : perna@math.uu.se
+ ***************************************************************************/
+
+/*******************************************************************************
+ *     This program is free software: you can redistribute it and/or modify     *
+ *     it under the terms of the GNU General Public License as published by     *
+ *     the Free Software Foundation, either version 3 of the License, or        *
+ *     (at your option) any later version.                                      *
+ *                                                                              *
+ *     This program is distributed in the hope that it will be useful,          *
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the            *
+ *     GNU General Public License for more details.                             *
+ *                                                                              *
+ *     You can find a copy of the GNU General Public License at the             *
+ *     following address: <http://www.gnu.org/licenses/>.                       *
+ ********************************************************************************/
+
+#include "perfcounters.h"
+
+#ifdef Q_OS_LINUX
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cstring>
+#endif
+
+
+
+
+PerfCounterGroup::PerfCounterGroup()
+{
+	for (int counter = 0; counter < NumberOfCounters; counter++)
+	{
+		fileDescriptors[counter] = -1;
+		groupPosition[counter] = -1;
+	}
+	groupLeader = -1;
+	nGroupCounters = 0;
+	reset();
+}
+
+
+PerfCounterGroup::~PerfCounterGroup()
+{
+	close();
+}
+
+
+QString PerfCounterGroup::counterName(int counter)
+{
+	switch (counter)
+	{
+		case Cycles:
+			return "cycles";
+		case Instructions:
+			return "instructions";
+		case CacheMisses:
+			return "llc_misses";
+		case BranchMisses:
+			return "branch_misses";
+	}
+	return "";
+}
+
+
+#ifdef Q_OS_LINUX
+
+// with groupLeader -1 the counter starts a new group
+static int openCounter(quint32 type, quint64 config, int groupLeader)
+{
+	struct perf_event_attr attributes;
+	memset(&attributes, 0, sizeof(attributes));
+	attributes.size = sizeof(attributes);
+	attributes.type = type;
+	attributes.config = config;
+	attributes.exclude_kernel = 1;
+	attributes.exclude_hv = 1;
+	attributes.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+	// pid 0 and cpu -1: this thread, on whatever processor it runs
+	return syscall(__NR_perf_event_open, &attributes, 0, -1, groupLeader, 0);
+}
+
+
+// true if at least one of the counters could be opened; the first one leads the group
+bool PerfCounterGroup::open()
+{
+	close();
+	quint32 types[NumberOfCounters] = { PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE, PERF_TYPE_HARDWARE };
+	quint64 configs[NumberOfCounters] = {
+		PERF_COUNT_HW_CPU_CYCLES,
+		PERF_COUNT_HW_INSTRUCTIONS,
+		PERF_COUNT_HW_CACHE_LL | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+		PERF_COUNT_HW_BRANCH_MISSES };
+	for (int counter = 0; counter < NumberOfCounters; counter++)
+	{
+		fileDescriptors[counter] = openCounter(types[counter], configs[counter], groupLeader);
+		if (fileDescriptors[counter] < 0)
+			continue;
+		if (groupLeader < 0)
+			groupLeader = fileDescriptors[counter];
+		groupPosition[counter] = nGroupCounters++;
+	}
+	reset();
+	return isOpen();
+}
+
+
+void PerfCounterGroup::close()
+{
+	for (int counter = 0; counter < NumberOfCounters; counter++)
+	{
+		if (fileDescriptors[counter] >= 0)
+			::close(fileDescriptors[counter]);
+		fileDescriptors[counter] = -1;
+		groupPosition[counter] = -1;
+	}
+	groupLeader = -1;
+	nGroupCounters = 0;
+}
+
+
+// one read of the leader gives the times of the group and then the values of its counters, in the order they were opened
+bool PerfCounterGroup::readGroup(quint64 *values, quint64 &timeEnabled, quint64 &timeRunning)
+{
+	if (groupLeader < 0)
+		return false;
+	quint64 buffer[3 + NumberOfCounters];
+	ssize_t bytes = sizeof(quint64) * (3 + nGroupCounters);
+	if (read(groupLeader, buffer, bytes) != bytes || buffer[0] != quint64(nGroupCounters))
+		return false;
+	timeEnabled = buffer[1];
+	timeRunning = buffer[2];
+	for (int counter = 0; counter < NumberOfCounters; counter++)
+	{
+		if (groupPosition[counter] >= 0)
+			values[counter] = buffer[3 + groupPosition[counter]];
+	}
+	return true;
+}
+
+#else
+
+bool PerfCounterGroup::open()
+{
+	return false;
+}
+
+
+void PerfCounterGroup::close()
+{
+}
+
+
+bool PerfCounterGroup::readGroup(quint64 *, quint64 &, quint64 &)
+{
+	return false;
+}
+
+#endif
+
+
+bool PerfCounterGroup::isOpen()
+{
+	for (int counter = 0; counter < NumberOfCounters; counter++)
+	{
+		if (fileDescriptors[counter] >= 0)
+			return true;
+	}
+	return false;
+}
+
+
+bool PerfCounterGroup::isAvailable(int counter)
+{
+	return fileDescriptors[counter] >= 0;
+}
+
+
+/* The counters run all the time once opened, start and stop only read them:
+ one read of the group is cheaper than enabling and disabling it with an
+ ioctl. An interval in which the group did not run adds nothing. */
+
+void PerfCounterGroup::start()
+{
+	isStarted = readGroup(startValues, startTimeEnabled, startTimeRunning);
+}
+
+
+void PerfCounterGroup::stop()
+{
+	quint64 values[NumberOfCounters];
+	quint64 timeEnabled, timeRunning;
+	if (isStarted && readGroup(values, timeEnabled, timeRunning) && timeRunning > startTimeRunning)
+	{
+		double scale = double(timeEnabled - startTimeEnabled) / (timeRunning - startTimeRunning);
+		for (int counter = 0; counter < NumberOfCounters; counter++)
+		{
+			if (groupPosition[counter] >= 0)
+				totals[counter] += quint64((values[counter] - startValues[counter]) * scale + 0.5);
+		}
+	}
+	isStarted = false;
+	nIntervals++;
+}
+
+
+void PerfCounterGroup::reset()
+{
+	for (int counter = 0; counter < NumberOfCounters; counter++)
+	{
+		startValues[counter] = 0;
+		totals[counter] = 0;
+	}
+	startTimeEnabled = 0;
+	startTimeRunning = 0;
+	isStarted = false;
+	nIntervals = 0;
+}
+
+
+quint64 PerfCounterGroup::getValue(int counter)
+{
+	return totals[counter];
+}
+
+
+int PerfCounterGroup::getNumberOfIntervals()
+{
+	return nIntervals;
+}
@@ -0,0 +1,82 @@
+/***************************************************************************
+ copyright            : (C) 2011 by Andrea Perna
+ email                : perna@math.uu.se
+ ***************************************************************************/
+
+/*******************************************************************************
+ *     This program is free software: you can redistribute it and/or modify     *
+ *     it under the terms of the GNU General Public License as published by     *
+ *     the Free Software Foundation, either version 3 of the License, or        *
+ *     (at your option) any later version.                                      *
+ *                                                                              *
+ *     This program is distributed in the hope that it will be useful,          *
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the            *
+ *     GNU General Public License for more details.                             *
+ *                                                                              *
+ *     You can find a copy of the GNU General Public License at the             *
+ *     following address: <http://www.gnu.org/licenses/>.                       *
+ ********************************************************************************/
+
+#ifndef PERFCOUNTERS_H
+#define PERFCOUNTERS_H
+
+#include <QtGlobal>
+#include <QString>
+
+
+/* Hardware performance counters of the processor, read through perf_event_open
+ on Linux. A group counts only between start() and stop(), and adds up all the
+ intervals until reset(). The counters count the thread that opened them only,
+ in user mode, so that a group can be opened without special privileges when
+ /proc/sys/kernel/perf_event_paranoid is at most 2: the threads of the
+ parallel edge loop, see paralleledgeloop.h, are not counted, only the part
+ of the loop that runs in the calling thread.
+ 
+ The counters are opened as one kernel group, so that they are scheduled on the
+ processor together and read at once. When there are more counters than the
+ processor can hold, the kernel multiplexes the groups: the values of an
+ interval are scaled by the time the group was enabled over the time it ran.
+ 
+ On other systems, or when the kernel refuses a counter (for instance the
+ last level cache events inside most virtual machines), the counter is simply
+ not available and its value is zero. */
+
+
+class PerfCounterGroup
+{
+public:
+	enum Counter { Cycles, Instructions, CacheMisses, BranchMisses, NumberOfCounters };
+	
+	PerfCounterGroup();
+	~PerfCounterGroup();
+	
+	bool open();
+	void close();
+	bool isOpen();
+	bool isAvailable(int counter);
+	
+	void start();
+	void stop();
+	void reset();
+	
+	quint64 getValue(int counter);
+	int getNumberOfIntervals();
+	static QString counterName(int counter);
+	
+private:
+	bool readGroup(quint64 *values, quint64 &timeEnabled, quint64 &timeRunning);
+	
+	int fileDescriptors[NumberOfCounters]; // -1 for the counters that could not be opened
+	int groupLeader; // the file descriptor of the first counter opened, read for the whole group
+	int groupPosition[NumberOfCounters]; // of the value of each counter in a read of the group
+	int nGroupCounters;
+	quint64 startValues[NumberOfCounters];
+	quint64 startTimeEnabled;
+	quint64 startTimeRunning;
+	bool isStarted; // the read at start succeeded
+	quint64 totals[NumberOfCounters];
+	int nIntervals;
+};
+
+#endif
@@ -0,0 +1,234 @@
+/***************************************************************************
+ copyright            : (C) 2011 by Andrea Perna
+ email                : perna@math.uu.se
+ ***************************************************************************/
+
+/*******************************************************************************
+ *     This program is free software: you can redistribute it and/or modify     *
+ *     it under the terms of the GNU General Public License as published by     *
+ *     the Free Software Foundation, either version 3 of the License, or        *
+ *     (at your option) any later version.                                      *
+ *                                                                              *
+ *     This program is distributed in the hope that it will be useful,          *
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the            *
+ *     GNU General Public License for more details.                             *
+ *                                                                              *
+ *     You can find a copy of the GNU General Public License at the             *
+ *     following address: <http://www.gnu.org/licenses/>.                       *
+ ********************************************************************************/
+
+#include "profiler.h"
+
+#include <QElapsedTimer>
+#include <QThreadStorage>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QList>
+#include <QHash>
+#include <QFile>
+#include <QStringList>
+
+
+static const int eventsPerThread = 1 << 16; // must be a power of two
+
+
+// the buffers are never deleted, so that the events of finished threads can still be saved
+static QMutex buffersMutex;
+static QList<ProfileRingBuffer *> buffers;
+
+// QThreadStorage deletes the pointers it holds when the thread ends, so the buffer is wrapped
+struct ThreadBuffer
+{
+	ThreadBuffer() : buffer(NULL) {}
+	ProfileRingBuffer *buffer;
+};
+static QThreadStorage<ThreadBuffer> threadBuffer;
+
+// read positions of profileBreakdown, one per buffer
+static QVector<int> breakdownReadIndices;
+static qint64 lastBreakdownTime = 0;
+
+
+
+
+// started with the program, before any thread can ask for the time
+struct ProfileClock
+{
+	ProfileClock() { timer.start(); }
+	QElapsedTimer timer;
+};
+static ProfileClock programClock;
+
+
+qint64 profileClock()
+{
+	return programClock.timer.nsecsElapsed();
+}
+
+
+static ProfileRingBuffer *currentThreadBuffer()
+{
+	ThreadBuffer &current = threadBuffer.localData();
+	if (!current.buffer)
+	{
+		// only the first event of each thread takes the lock
+		QMutexLocker locker(&buffersMutex);
+		current.buffer = new ProfileRingBuffer(buffers.size());
+		buffers.append(current.buffer);
+	}
+	return current.buffer;
+}
+
+
+
+
+ProfileRingBuffer::ProfileRingBuffer(int newThreadNumber)
+: events(eventsPerThread), written(0), threadNumber(newThreadNumber)
+{
+}
+
+
+// only called by the thread owning the buffer
+void ProfileRingBuffer::record(const char *name, qint64 start, qint64 duration)
+{
+	int index = written.load();
+	ProfileEvent &event = events[index & (eventsPerThread - 1)];
+	event.name = name;
+	event.start = start;
+	event.duration = duration;
+	written.storeRelease(index + 1);
+}
+
+
+/* Copies the events written since readIndex, and moves readIndex after them.
+ Events that the writer may have overwritten during the copy are dropped. */
+
+QVector<ProfileEvent> ProfileRingBuffer::eventsSince(int &readIndex)
+{
+	QVector<ProfileEvent> copied;
+	int end = written.loadAcquire();
+	int begin = qMax(readIndex, end - eventsPerThread);
+	copied.reserve(end - begin);
+	for (int i = begin; i < end; i++)
+	{
+		copied.append(events[i & (eventsPerThread - 1)]);
+	}
+	// the writer may be filling the slot of index written, which held written - eventsPerThread
+	int oldestIntact = written.loadAcquire() - eventsPerThread + 1;
+	if (oldestIntact > begin)
+	{
+		copied.remove(0, qMin(oldestIntact - begin, copied.size()));
+	}
+	readIndex = end;
+	return copied;
+}
+
+
+int ProfileRingBuffer::getThreadNumber()
+{
+	return threadNumber;
+}
+
+
+
+
+ScopedProfile::ScopedProfile(const char *scopeName)
+{
+	name = scopeName;
+	start = profileClock();
+}
+
+
+ScopedProfile::~ScopedProfile()
+{
+	qint64 end = profileClock();
+	currentThreadBuffer()->record(name, start, end - start);
+}
+
+
+
+
+static QList<ProfileRingBuffer *> allBuffers()
+{
+	QMutexLocker locker(&buffersMutex);
+	return buffers;
+}
+
+
+// complete events ("ph":"X") of the Chrome trace format, times in microseconds
+bool writeChromeTrace(QString fileName)
+{
+	QFile file(fileName);
+	if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text))
+		return false;
+	
+	file.write("{\"traceEvents\":[\n");
+	bool isFirstEvent = true;
+	foreach (ProfileRingBuffer *buffer, allBuffers())
+	{
+		int readIndex = 0;
+		QVector<ProfileEvent> events = buffer->eventsSince(readIndex);
+		foreach (const ProfileEvent &event, events)
+		{
+			QByteArray line;
+			if (!isFirstEvent)
+				line += ",\n";
+			line += "{\"name\":\"";
+			line += event.name;
+			line += "\",\"ph\":\"X\",\"pid\":1,\"tid\":";
+			line += QByteArray::number(buffer->getThreadNumber());
+			line += ",\"ts\":";
+			line += QByteArray::number(event.start / 1000.0, 'f', 3);
+			line += ",\"dur\":";
+			line += QByteArray::number(event.duration / 1000.0, 'f', 3);
+			line += "}";
+			file.write(line);
+			isFirstEvent = false;
+		}
+	}
+	file.write("\n]}\n");
+	file.close();
+	return true;
+}
+
+
+/* Total time per phase since the previous call, as a line for the status bar.
+ Phases nested in others are listed with them, so the shares do not add up to
+ the total. */
+
+QString profileBreakdown()
+{
+	QList<ProfileRingBuffer *> currentBuffers = allBuffers();
+	breakdownReadIndices.resize(currentBuffers.size());
+	
+	QStringList names;
+	QHash<QString, qint64> totals;
+	QHash<QString, int> counts;
+	for (int i = 0; i < currentBuffers.size(); i++)
+	{
+		foreach (const ProfileEvent &event, currentBuffers[i]->eventsSince(breakdownReadIndices[i]))
+		{
+			QString name = QString::fromLatin1(event.name);
+			if (!totals.contains(name))
+				names.append(name);
+			totals[name] += event.duration;
+			counts[name] += 1;
+		}
+	}
+	
+	qint64 now = profileClock();
+	double elapsed = qMax(qint64(1), now - lastBreakdownTime);
+	lastBreakdownTime = now;
+	
+	QStringList parts;
+	foreach (QString name, names)
+	{
+		parts.append(QString("%1 %2 ms (%3%, %4x)")
+					 .arg(name)
+					 .arg(totals.value(name) / 1e6, 0, 'f', 1)
+					 .arg(100.0 * totals.value(name) / elapsed, 0, 'f', 0)
+					 .arg(counts.value(name)));
+	}
+	return parts.join("; ");
+}
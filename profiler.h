@@ -0,0 +1,95 @@
+/***************************************************************************
+ copyright            : (C) 2011 by Andrea Perna
+ email                : perna@math.uu.se
+ ***************************************************************************/
+
+/*******************************************************************************
+ *     This program is free software: you can redistribute it and/or modify     *
+ *     it under the terms of the GNU General Public License as published by     *
+ *     the Free Software Foundation, either version 3 of the License, or        *
+ *     (at your option) any later version.                                      *
+ *                                                                              *
+ *     This program is distributed in the hope that it will be useful,          *
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the            *
+ *     GNU General Public License for more details.                             *
+ *                                                                              *
+ *     You can find a copy of the GNU General Public License at the             *
+ *     following address: <http://www.gnu.org/licenses/>.                       *
+ ********************************************************************************/
+
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <QString>
+#include <QVector>
+#include <QAtomicInt>
+#include <QtGlobal>
+
+
+/* Scoped timers for the phases of the simulation. A scope marked with
+ 
+ EL_PROFILE_SCOPE("phase name");
+ 
+ is timed from the macro to the end of the enclosing block. The macro expands to
+ nothing unless the program is built with ELECTRIC_LEAF_PROFILING defined, which
+ qmake does with CONFIG+=profiling, so the simulation pays nothing by default.
+ 
+ Every thread writes its timings into its own ring buffer, without locks, and
+ the GUI thread reads them to save a trace in the Chrome trace format (open it
+ in chrome://tracing or https://ui.perfetto.dev) or to show a breakdown of the
+ time spent in each phase. The names must be string literals, only the pointer
+ is kept. */
+
+
+struct ProfileEvent
+{
+	const char *name;
+	qint64 start; // nanoseconds since the start of the program
+	qint64 duration;
+};
+
+
+class ProfileRingBuffer
+{
+public:
+	ProfileRingBuffer(int newThreadNumber);
+	
+	void record(const char *name, qint64 start, qint64 duration);
+	QVector<ProfileEvent> eventsSince(int &readIndex);
+	int getThreadNumber();
+	
+private:
+	QVector<ProfileEvent> events;
+	QAtomicInt written; // number of events ever written, the last events.size() of them are kept
+	int threadNumber;
+};
+
+
+class ScopedProfile
+{
+public:
+	ScopedProfile(const char *scopeName);
+	~ScopedProfile();
+	
+private:
+	const char *name;
+	qint64 start;
+};
+
+
+qint64 profileClock();
+bool writeChromeTrace(QString fileName);
+QString profileBreakdown();
+
+
+#define EL_PROFILE_CONCATENATE_(a, b) a ## b
+#define EL_PROFILE_CONCATENATE(a, b) EL_PROFILE_CONCATENATE_(a, b)
+
+#ifdef ELECTRIC_LEAF_PROFILING
+#define EL_PROFILE_SCOPE(name) ScopedProfile EL_PROFILE_CONCATENATE(profileScope, __LINE__)(name)
+#else
+#define EL_PROFILE_SCOPE(name)
+#endif
+
+#endif
@@ -78,6 +78,31 @@ const int poissonRandomNumber(const double lambda)
 
 
 
+// in (0, 1], so that its logarithm is always finite
+const double uniformRandomNumber()
+{
+	return (qrand() + 1.0)/((double)RAND_MAX + 1.0);
+}
+
+
+
+
+// exact, one uniform random number per trial
+const int binomDistBySum(const int N, const double p)
+{
+	int r=0;
+	for (int j=0; j<N; j++)
+	{
+		if (qrand()/((double)RAND_MAX) <= p)
+		{
+			r+=1;
+		}
+	}
+	return r;
+}
+
+
+
 const int binomDist(const int N, const double p)
 {
 	int r=0;
@@ -89,13 +114,7 @@ const int binomDist(const int N, const double p)
 	}
 	else
 	{
-		for (int j=0; j<N; j++)
-		{
-			if (qrand()/((double)RAND_MAX) <= p)
-			{
-				r+=1;
-			}
-		}
+		r = binomDistBySum(N, p);
 //		printf("without poisson approximation: N=%d, p=%f, r=%d\n", N, p, r);
 	}
 	return r;
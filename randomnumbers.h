@@ -23,3 +23,5 @@ const int poissonRandomNumber(const double lambda);
 const int poissonRandomNumber1(const double lambda);
 const int poissonRandomNumber2(const double lambda);
 const int binomDist(const int N, const double p);
+const int binomDistBySum(const int N, const double p);
+const double uniformRandomNumber();
@@ -0,0 +1,120 @@
+/***************************************************************************
+ copyright            : (C) 2011 by Andrea Perna
+ email                : perna@math.uu.se
+ ***************************************************************************/
+
+/*******************************************************************************
+ *     This program is free software: you can redistribute it and/or modify     *
+ *     it under the terms of the GNU General Public License as published by     *
+ *     the Free Software Foundation, either version 3 of the License, or        *
+ *     (at your option) any later version.                                      *
+ *                                                                              *
+ *     This program is distributed in the hope that it will be useful,          *
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the            *
+ *     GNU General Public License for more details.                             *
+ *                                                                              *
+ *     You can find a copy of the GNU General Public License at the             *
+ *     following address: <http://www.gnu.org/licenses/>.                       *
+ ********************************************************************************/
+
+#include "resultscache.h"
+
+#include <QCoreApplication>
+#include <QCryptographicHash>
+#include <QJsonDocument>
+#include <QFile>
+#include <QDir>
+
+
+ResultsCache::ResultsCache(QString cacheDirectory)
+: directory(cacheDirectory)
+{
+}
+
+
+QString ResultsCache::key(const QByteArray &networkText, const QJsonObject &parameters, int seed, int nSteps, QString executionPath)
+{
+	QJsonObject run;
+	run.insert("simulationVersion", simulationVersion);
+	run.insert("executionPath", executionPath);
+	run.insert("parameters", parameters); // the keys of a QJsonObject are sorted, the text does not depend on their order
+	run.insert("seed", seed);
+	run.insert("steps", nSteps);
+	QCryptographicHash hash(QCryptographicHash::Sha1);
+	hash.addData(networkText);
+	hash.addData(QJsonDocument(run).toJson(QJsonDocument::Compact));
+	return QString(hash.result().toHex());
+}
+
+
+// true when the fingerprint is the one of the version, or the first one written for it
+bool ResultsCache::checkFingerprint(const QByteArray &fingerprint)
+{
+	QString fingerprintFileName = directory + QString("/simulation-%1.fingerprint").arg(simulationVersion);
+	QFile file(fingerprintFileName);
+	if (file.open(QIODevice::ReadOnly))
+		return file.readAll() == fingerprint;
+	
+	if (!QDir().mkpath(directory))
+		return false;
+	QString temporaryFileName = fingerprintFileName + QString(".%1.tmp").arg(QCoreApplication::applicationPid());
+	QFile temporaryFile(temporaryFileName);
+	if (!temporaryFile.open(QIODevice::WriteOnly | QIODevice::Truncate))
+		return false;
+	bool isWritten = temporaryFile.write(fingerprint) == fingerprint.size();
+	temporaryFile.close();
+	if (!isWritten || !QFile::rename(temporaryFileName, fingerprintFileName))
+	{
+		QFile::remove(temporaryFileName);
+		return file.open(QIODevice::ReadOnly) && file.readAll() == fingerprint; // another coordinator wrote it first
+	}
+	return true;
+}
+
+
+QString ResultsCache::fileName(QString key)
+{
+	return directory + "/" + key.left(2) + "/" + key + ".json";
+}
+
+
+bool ResultsCache::contains(QString key)
+{
+	return QFile::exists(fileName(key));
+}
+
+
+bool ResultsCache::load(QString key, QJsonObject &result)
+{
+	QFile file(fileName(key));
+	if (!file.open(QIODevice::ReadOnly))
+		return false;
+	QJsonObject entry = QJsonDocument::fromJson(file.readAll()).object();
+	if (entry.value("simulationVersion").toInt() != simulationVersion || !entry.contains("result"))
+		return false;
+	result = entry.value("result").toObject();
+	return true;
+}
+
+
+bool ResultsCache::store(QString key, const QJsonObject &result)
+{
+	if (!QDir().mkpath(directory + "/" + key.left(2)))
+		return false;
+	QJsonObject entry;
+	entry.insert("simulationVersion", simulationVersion);
+	entry.insert("result", result);
+	QString temporaryFileName = fileName(key) + QString(".%1.tmp").arg(QCoreApplication::applicationPid());
+	QFile file(temporaryFileName);
+	if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+		return false;
+	bool isWritten = file.write(QJsonDocument(entry).toJson(QJsonDocument::Compact)) > 0;
+	file.close();
+	if (!isWritten || !QFile::rename(temporaryFileName, fileName(key)))
+	{
+		QFile::remove(temporaryFileName);
+		return contains(key);
+	}
+	return true;
+}
@@ -0,0 +1,72 @@
+/***************************************************************************
+ copyright            : (C) 2011 by Andrea Perna
+ email                : perna@math.uu.se
+ ***************************************************************************/
+
+/*******************************************************************************
+ *     This program is free software: you can redistribute it and/or modify     *
+ *     it under the terms of the GNU General Public License as published by     *
+ *     the Free Software Foundation, either version 3 of the License, or        *
+ *     (at your option) any later version.                                      *
+ *                                                                              *
+ *     This program is distributed in the hope that it will be useful,          *
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the            *
+ *     GNU General Public License for more details.                             *
+ *                                                                              *
+ *     You can find a copy of the GNU General Public License at the             *
+ *     following address: <http://www.gnu.org/licenses/>.                       *
+ ********************************************************************************/
+
+#ifndef RESULTSCACHE_H
+#define RESULTSCACHE_H
+
+#include <QString>
+#include <QByteArray>
+#include <QJsonObject>
+
+
+/* Bumped by every change of the simulation that changes the results of a run
+ with a given seed, so that the results computed before are not used again.
+ Version 2: the topology replicas run the fixed step of GraphWidget. Version
+ 3: the fingerprint also covers the runs on GraphWidget. A bump that was
+ forgotten is caught by checkFingerprint. */
+static const int simulationVersion = 3;
+
+
+/* Results of runs stored by content: the key is the SHA-1 of the simulation
+ version, the text of the network, every parameter of the run, the seed and the
+ execution path, GraphWidget or TopologyReplica, so that the same run is never
+ simulated twice, whatever the name of the network file or the sweep it
+ belongs to. Each result is a JSON file in a
+ subdirectory named after the first two digits of its key, written under a
+ temporary name and renamed, so that several coordinators can share the cache.
+ 
+ The parameters must be complete, with the default values written out, so that
+ a parameter left out and the same parameter given with its default value make
+ the same key.
+ 
+ The fingerprint is a digest of the results of a few short reference runs. The
+ first coordinator of a simulation version writes it in the cache, and a later
+ one whose runs give another fingerprint with the same version must not use
+ the cache: the simulation changed without a new simulationVersion. */
+
+class ResultsCache
+{
+public:
+	ResultsCache(QString cacheDirectory);
+	
+	static QString key(const QByteArray &networkText, const QJsonObject &parameters, int seed, int nSteps, QString executionPath);
+	
+	bool checkFingerprint(const QByteArray &fingerprint);
+	bool contains(QString key);
+	bool load(QString key, QJsonObject &result);
+	bool store(QString key, const QJsonObject &result);
+	
+private:
+	QString fileName(QString key);
+	
+	QString directory;
+};
+
+#endif
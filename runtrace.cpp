@@ -0,0 +1,732 @@
+/***************************************************************************
+ copyright            : (C) 2011 by Andrea Perna
+ email                : perna@math.uu.se
+ ***************************************************************************/
+
+/*******************************************************************************
+ *     This program is free software: you can redistribute it and/or modify     *
+ *     it under the terms of the GNU General Public License as published by     *
+ *     the Free Software Foundation, either version 3 of the License, or        *
+ *     (at your option) any later version.                                      *
+ *                                                                              *
+ *     This program is distributed in the hope that it will be useful,          *
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the            *
+ *     GNU General Public License for more details.                             *
+ *                                                                              *
+ *     You can find a copy of the GNU General Public License at the             *
+ *     following address: <http://www.gnu.org/licenses/>.                       *
+ ********************************************************************************/
+
+#include "runtrace.h"
+
+#include <QtEndian>
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+using namespace std;
+
+
+static const char traceMagic[8] = {'E', 'L', 'T', 'R', 'A', 'C', 'E', '1'};
+static const char traceIndexMagic[8] = {'E', 'L', 'T', 'R', 'I', 'D', 'X', '1'};
+static const quint32 traceVersion = 3; // 2 adds the node numbers, version 1 numbered the nodes by column, 3 the time of the frames
+static const int maxBufferedBytes = 1 << 20; // write to disk once a megabyte is ready
+
+
+
+
+quint16 floatToHalf(float value)
+{
+	quint32 bits;
+	memcpy(&bits, &value, sizeof(bits));
+	quint16 sign = (bits >> 16) & 0x8000;
+	int exponent = int((bits >> 23) & 0xff) - 127 + 15;
+	quint32 mantissa = bits & 0x007fffff;
+	
+	if (((bits >> 23) & 0xff) == 0xff) // infinity or NaN
+	{
+		return sign | 0x7c00 | (mantissa ? 0x200 : 0);
+	}
+	if (exponent >= 31) // too large, saturate to infinity
+	{
+		return sign | 0x7c00;
+	}
+	if (exponent <= 0) // subnormal half, or zero
+	{
+		if (exponent < -10)
+			return sign;
+		mantissa |= 0x00800000;
+		int shift = 14 - exponent;
+		quint16 half = quint16(mantissa >> shift);
+		if ((mantissa >> (shift - 1)) & 1) // round to nearest
+			half += 1;
+		return sign | half;
+	}
+	quint16 half = quint16(sign | (exponent << 10) | (mantissa >> 13));
+	if (mantissa & 0x00001000) // round to nearest, the carry may correctly overflow into the exponent
+		half += 1;
+	return half;
+}
+
+
+float halfToFloat(quint16 half)
+{
+	quint32 sign = quint32(half & 0x8000) << 16;
+	int exponent = (half >> 10) & 0x1f;
+	quint32 mantissa = half & 0x3ff;
+	quint32 bits;
+	
+	if (exponent == 0)
+	{
+		if (mantissa == 0)
+		{
+			bits = sign;
+		}
+		else // subnormal half, normalise it
+		{
+			exponent = 1;
+			while (!(mantissa & 0x400))
+			{
+				mantissa <<= 1;
+				exponent -= 1;
+			}
+			mantissa &= 0x3ff;
+			bits = sign | (quint32(exponent - 15 + 127) << 23) | (mantissa << 13);
+		}
+	}
+	else if (exponent == 31)
+	{
+		bits = sign | 0x7f800000 | (mantissa << 13);
+	}
+	else
+	{
+		bits = sign | (quint32(exponent - 15 + 127) << 23) | (mantissa << 13);
+	}
+	float value;
+	memcpy(&value, &bits, sizeof(value));
+	return value;
+}
+
+
+
+
+void putVarint(QByteArray &buffer, quint64 value)
+{
+	while (value >= 0x80)
+	{
+		buffer.append(char((value & 0x7f) | 0x80));
+		value >>= 7;
+	}
+	buffer.append(char(value));
+}
+
+
+void putSignedVarint(QByteArray &buffer, qint64 value)
+{
+	// zig-zag encoding, so that small negative numbers also take few bytes
+	putVarint(buffer, (quint64(value) << 1) ^ quint64(value >> 63));
+}
+
+
+void putUInt16(QByteArray &buffer, quint16 value)
+{
+	uchar bytes[2];
+	qToLittleEndian(value, bytes);
+	buffer.append((const char *)bytes, 2);
+}
+
+
+void putUInt32(QByteArray &buffer, quint32 value)
+{
+	uchar bytes[4];
+	qToLittleEndian(value, bytes);
+	buffer.append((const char *)bytes, 4);
+}
+
+
+void putUInt64(QByteArray &buffer, quint64 value)
+{
+	uchar bytes[8];
+	qToLittleEndian(value, bytes);
+	buffer.append((const char *)bytes, 8);
+}
+
+
+void putDouble(QByteArray &buffer, double value)
+{
+	quint64 bits;
+	memcpy(&bits, &value, sizeof(bits));
+	putUInt64(buffer, bits);
+}
+
+
+
+
+
+
+
+RunTraceWriter::RunTraceWriter(int framesBetweenKeyFrames)
+{
+	keyFrameInterval = qMax(1, framesBetweenKeyFrames);
+	nNodes = 0;
+	nEdges = 0;
+	nStomata = 0;
+}
+
+
+RunTraceWriter::~RunTraceWriter()
+{
+	close();
+}
+
+
+bool RunTraceWriter::isOpen()
+{
+	return file.isOpen();
+}
+
+
+int RunTraceWriter::getNumberOfNodes()
+{
+	return nNodes;
+}
+
+int RunTraceWriter::getNumberOfEdges()
+{
+	return nEdges;
+}
+
+int RunTraceWriter::getNumberOfStomata()
+{
+	return nStomata;
+}
+
+
+
+bool RunTraceWriter::open(QString fileName, const RunTraceTopology &traceTopology)
+{
+	close();
+	file.setFileName(fileName);
+	if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+		return false;
+	
+	nNodes = traceTopology.nodeX.size();
+	nEdges = traceTopology.edgeSource.size();
+	nStomata = traceTopology.stomaNode.size();
+	frameSteps.clear();
+	frameOffsets.clear();
+	buffer.resize(0);
+	buffer.reserve(maxBufferedBytes + 64 * 1024);
+	
+	buffer.append(traceMagic, 8);
+	putUInt32(buffer, traceVersion);
+	putUInt32(buffer, keyFrameInterval);
+	putUInt32(buffer, nNodes);
+	putUInt32(buffer, nEdges);
+	putUInt32(buffer, nStomata);
+	
+	for (int i = 0; i < nNodes; i++)
+	{
+		putDouble(buffer, traceTopology.nodeX[i]);
+		putDouble(buffer, traceTopology.nodeY[i]);
+		buffer.append(traceTopology.nodeKind[i]);
+		putVarint(buffer, i < traceTopology.nodeNumber.size() ? traceTopology.nodeNumber[i] : i + 1);
+		QByteArray label = traceTopology.nodeLabel[i].toUtf8();
+		putVarint(buffer, label.size());
+		buffer.append(label);
+	}
+	for (int i = 0; i < nEdges; i++)
+	{
+		putVarint(buffer, traceTopology.edgeSource[i]);
+		putVarint(buffer, traceTopology.edgeDest[i]);
+		putDouble(buffer, traceTopology.edgeLength[i]);
+		putDouble(buffer, traceTopology.edgeWidth[i]);
+	}
+	for (int i = 0; i < nStomata; i++)
+	{
+		putVarint(buffer, traceTopology.stomaNode[i]);
+		putDouble(buffer, traceTopology.stomaSigma[i]);
+	}
+	flushBuffer();
+	return true;
+}
+
+
+
+
+bool RunTraceWriter::appendFrame(const RunTraceFrame &frame)
+{
+	if (!file.isOpen())
+		return false;
+	if (frame.nParticles.size() != nNodes || frame.edgeFlow.size() != nEdges
+		|| frame.edgeSigma.size() != nEdges || frame.stomaFlow.size() != nStomata)
+	{
+		cout << "the network changed since the trace was opened, frame not recorded" << endl;
+		return false;
+	}
+	
+	bool isKeyFrame = (frameSteps.size() % keyFrameInterval == 0);
+	frameSteps.append(frame.step);
+	frameOffsets.append(file.pos() + buffer.size());
+	
+	// the payload length is filled in once the frame is complete
+	int lengthPosition = buffer.size();
+	putUInt32(buffer, 0);
+	int payloadStart = buffer.size();
+	buffer.append(char(isKeyFrame ? 1 : 0));
+	putVarint(buffer, frame.step);
+	putDouble(buffer, frame.time);
+	
+	for (int i = 0; i < nNodes; i++)
+	{
+		int previous = isKeyFrame ? 0 : previousFrame.nParticles[i];
+		putSignedVarint(buffer, qint64(frame.nParticles[i]) - previous);
+	}
+	for (int i = 0; i < nEdges; i++)
+	{
+		int previous = isKeyFrame ? 0 : previousFrame.edgeFlow[i];
+		putSignedVarint(buffer, qint64(frame.edgeFlow[i]) - previous);
+	}
+	for (int i = 0; i < nEdges; i++)
+	{
+		putUInt16(buffer, floatToHalf(frame.edgeSigma[i]));
+	}
+	for (int i = 0; i < nStomata; i++)
+	{
+		int previous = isKeyFrame ? 0 : previousFrame.stomaFlow[i];
+		putSignedVarint(buffer, qint64(frame.stomaFlow[i]) - previous);
+	}
+	
+	quint32 payloadLength = buffer.size() - payloadStart;
+	qToLittleEndian(payloadLength, (uchar *)buffer.data() + lengthPosition);
+	
+	previousFrame = frame;
+	if (buffer.size() > maxBufferedBytes)
+		flushBuffer();
+	return true;
+}
+
+
+
+
+void RunTraceWriter::close()
+{
+	if (!file.isOpen())
+		return;
+	
+	qint64 indexOffset = file.pos() + buffer.size();
+	for (int i = 0; i < frameSteps.size(); i++)
+	{
+		putUInt64(buffer, frameSteps[i]);
+		putUInt64(buffer, frameOffsets[i]);
+	}
+	putUInt64(buffer, indexOffset);
+	putUInt32(buffer, frameSteps.size());
+	buffer.append(traceIndexMagic, 8);
+	flushBuffer();
+	file.close();
+	
+	previousFrame = RunTraceFrame();
+	frameSteps.clear();
+	frameOffsets.clear();
+}
+
+
+
+void RunTraceWriter::flushBuffer()
+{
+	if (buffer.isEmpty())
+		return;
+	file.write(buffer);
+	buffer.resize(0); // keeps the reserved capacity
+}
+
+
+
+
+
+
+// reads little endian values and varints from the mapped trace without ever going past its end
+class TraceCursor
+{
+public:
+	TraceCursor(const uchar *begin, const uchar *end)
+	: p(begin), last(end), ok(true)
+	{
+	}
+	
+	bool isOk()
+	{
+		return ok;
+	}
+	
+	const uchar *position()
+	{
+		return p;
+	}
+	
+	bool hasBytes(qint64 n)
+	{
+		if (!ok || last - p < n)
+		{
+			ok = false;
+			return false;
+		}
+		return true;
+	}
+	
+	quint8 readUInt8()
+	{
+		if (!hasBytes(1))
+			return 0;
+		return *p++;
+	}
+	
+	quint16 readUInt16()
+	{
+		if (!hasBytes(2))
+			return 0;
+		quint16 value = qFromLittleEndian<quint16>(p);
+		p += 2;
+		return value;
+	}
+	
+	quint32 readUInt32()
+	{
+		if (!hasBytes(4))
+			return 0;
+		quint32 value = qFromLittleEndian<quint32>(p);
+		p += 4;
+		return value;
+	}
+	
+	quint64 readUInt64()
+	{
+		if (!hasBytes(8))
+			return 0;
+		quint64 value = qFromLittleEndian<quint64>(p);
+		p += 8;
+		return value;
+	}
+	
+	double readDouble()
+	{
+		quint64 bits = readUInt64();
+		double value;
+		memcpy(&value, &bits, sizeof(value));
+		return value;
+	}
+	
+	quint64 readVarint()
+	{
+		quint64 value = 0;
+		int shift = 0;
+		while (ok && shift < 64)
+		{
+			if (!hasBytes(1))
+				return 0;
+			uchar byte = *p++;
+			value |= quint64(byte & 0x7f) << shift;
+			if (!(byte & 0x80))
+				return value;
+			shift += 7;
+		}
+		ok = false;
+		return 0;
+	}
+	
+	qint64 readSignedVarint()
+	{
+		quint64 value = readVarint();
+		return qint64(value >> 1) ^ -qint64(value & 1);
+	}
+	
+	QByteArray readBytes(int n)
+	{
+		if (n < 0 || !hasBytes(n))
+			return QByteArray();
+		QByteArray bytes((const char *)p, n);
+		p += n;
+		return bytes;
+	}
+	
+private:
+	const uchar *p;
+	const uchar *last;
+	bool ok;
+};
+
+
+
+
+RunTraceReader::RunTraceReader()
+{
+	data = NULL;
+	dataSize = 0;
+	firstFrameOffset = 0;
+	keyFrameInterval = 1;
+	version = traceVersion;
+	lastFrameNumber = -1;
+}
+
+
+RunTraceReader::~RunTraceReader()
+{
+	close();
+}
+
+
+bool RunTraceReader::isOpen()
+{
+	return data != NULL;
+}
+
+
+void RunTraceReader::close()
+{
+	if (data)
+	{
+		file.unmap((uchar *)data);
+		data = NULL;
+	}
+	if (file.isOpen())
+		file.close();
+	dataSize = 0;
+	topology = RunTraceTopology();
+	frameSteps.clear();
+	frameOffsets.clear();
+	lastFrame = RunTraceFrame();
+	lastFrameNumber = -1;
+}
+
+
+
+bool RunTraceReader::open(QString fileName)
+{
+	close();
+	file.setFileName(fileName);
+	if (!file.open(QIODevice::ReadOnly))
+		return false;
+	dataSize = file.size();
+	data = file.map(0, dataSize);
+	if (!data || !readHeader())
+	{
+		close();
+		return false;
+	}
+	if (!readIndex())
+	{
+		cout << "the trace has no index, reading all the frames" << endl;
+		scanFrames();
+	}
+	return true;
+}
+
+
+
+bool RunTraceReader::readHeader()
+{
+	TraceCursor cursor(data, data + dataSize);
+	if (!cursor.hasBytes(8) || memcmp(cursor.position(), traceMagic, 8) != 0)
+		return false;
+	cursor.readBytes(8);
+	version = cursor.readUInt32();
+	if (version < 1 || version > traceVersion)
+		return false;
+	keyFrameInterval = cursor.readUInt32();
+	int nNodes = cursor.readUInt32();
+	int nEdges = cursor.readUInt32();
+	int nStomata = cursor.readUInt32();
+	if (!cursor.isOk() || keyFrameInterval <= 0 || nNodes < 0 || nEdges < 0 || nStomata < 0)
+		return false;
+	
+	for (int i = 0; i < nNodes && cursor.isOk(); i++)
+	{
+		topology.nodeX.append(cursor.readDouble());
+		topology.nodeY.append(cursor.readDouble());
+		topology.nodeKind.append(char(cursor.readUInt8()));
+		topology.nodeNumber.append(version == 1 ? i + 1 : int(cursor.readVarint()));
+		int labelLength = cursor.readVarint();
+		topology.nodeLabel.append(QString::fromUtf8(cursor.readBytes(labelLength)));
+	}
+	for (int i = 0; i < nEdges && cursor.isOk(); i++)
+	{
+		int source = cursor.readVarint();
+		int dest = cursor.readVarint();
+		if (source < 0 || source >= nNodes || dest < 0 || dest >= nNodes)
+			return false;
+		topology.edgeSource.append(source);
+		topology.edgeDest.append(dest);
+		topology.edgeLength.append(cursor.readDouble());
+		topology.edgeWidth.append(cursor.readDouble());
+	}
+	for (int i = 0; i < nStomata && cursor.isOk(); i++)
+	{
+		int node = cursor.readVarint();
+		if (node < 0 || node >= nNodes)
+			return false;
+		topology.stomaNode.append(node);
+		topology.stomaSigma.append(cursor.readDouble());
+	}
+	firstFrameOffset = cursor.position() - data;
+	return cursor.isOk();
+}
+
+
+
+bool RunTraceReader::readIndex()
+{
+	const int trailerSize = 8 + 4 + 8;
+	if (dataSize - firstFrameOffset < trailerSize)
+		return false;
+	TraceCursor cursor(data + dataSize - trailerSize, data + dataSize);
+	qint64 indexOffset = cursor.readUInt64();
+	qint64 nFrames = cursor.readUInt32();
+	if (memcmp(cursor.position(), traceIndexMagic, 8) != 0)
+		return false;
+	if (indexOffset < firstFrameOffset || indexOffset + nFrames * 16 != dataSize - trailerSize)
+		return false;
+	
+	TraceCursor indexCursor(data + indexOffset, data + dataSize - trailerSize);
+	frameSteps.resize(nFrames);
+	frameOffsets.resize(nFrames);
+	for (int i = 0; i < nFrames; i++)
+	{
+		frameSteps[i] = indexCursor.readUInt64();
+		frameOffsets[i] = indexCursor.readUInt64();
+		if (frameOffsets[i] < firstFrameOffset || frameOffsets[i] >= indexOffset)
+		{
+			frameSteps.clear();
+			frameOffsets.clear();
+			return false;
+		}
+	}
+	return indexCursor.isOk();
+}
+
+
+
+void RunTraceReader::scanFrames()
+{
+	frameSteps.clear();
+	frameOffsets.clear();
+	qint64 offset = firstFrameOffset;
+	while (offset + 4 < dataSize)
+	{
+		TraceCursor cursor(data + offset, data + dataSize);
+		qint64 payloadLength = cursor.readUInt32();
+		if (!cursor.hasBytes(payloadLength) || payloadLength < 2)
+			break; // the last frame was only partly written
+		cursor.readUInt8();
+		qint64 step = cursor.readVarint();
+		if (!cursor.isOk())
+			break;
+		frameSteps.append(step);
+		frameOffsets.append(offset);
+		offset += 4 + payloadLength;
+	}
+}
+
+
+
+const RunTraceTopology &RunTraceReader::getTopology()
+{
+	return topology;
+}
+
+
+int RunTraceReader::getNumberOfFrames()
+{
+	return frameSteps.size();
+}
+
+
+int RunTraceReader::getFrameStep(int frameNumber)
+{
+	if (frameNumber < 0 || frameNumber >= frameSteps.size())
+		return -1;
+	return frameSteps[frameNumber];
+}
+
+
+// the last frame recorded at or before the given step
+int RunTraceReader::findFrame(int step)
+{
+	QVector<qint64>::const_iterator it = std::upper_bound(frameSteps.constBegin(), frameSteps.constEnd(), qint64(step));
+	return int(it - frameSteps.constBegin()) - 1;
+}
+
+
+
+bool RunTraceReader::readFrame(int frameNumber, RunTraceFrame &frame)
+{
+	if (frameNumber < 0 || frameNumber >= frameSteps.size())
+		return false;
+	
+	int keyFrameNumber = frameNumber - frameNumber % keyFrameInterval;
+	int firstToDecode = keyFrameNumber;
+	if (lastFrameNumber >= keyFrameNumber && lastFrameNumber <= frameNumber)
+	{
+		firstToDecode = lastFrameNumber + 1; // going forward, only the new differences are needed
+	}
+	for (int i = firstToDecode; i <= frameNumber; i++)
+	{
+		RunTraceFrame decodedFrame;
+		const RunTraceFrame *previous = (i == keyFrameNumber) ? NULL : &lastFrame;
+		if (!decodeFrame(i, previous, decodedFrame))
+		{
+			lastFrameNumber = -1;
+			return false;
+		}
+		lastFrame = decodedFrame;
+		lastFrameNumber = i;
+	}
+	frame = lastFrame;
+	return true;
+}
+
+
+
+bool RunTraceReader::decodeFrame(int frameNumber, const RunTraceFrame *previous, RunTraceFrame &frame)
+{
+	int nNodes = topology.nodeX.size();
+	int nEdges = topology.edgeSource.size();
+	int nStomata = topology.stomaNode.size();
+	
+	TraceCursor cursor(data + frameOffsets[frameNumber], data + dataSize);
+	qint64 payloadLength = cursor.readUInt32();
+	if (!cursor.hasBytes(payloadLength))
+		return false;
+	TraceCursor payload(cursor.position(), cursor.position() + payloadLength);
+	bool isKeyFrame = payload.readUInt8();
+	if (!isKeyFrame && !previous)
+		return false;
+	if (isKeyFrame)
+		previous = NULL;
+	frame.step = payload.readVarint();
+	frame.time = version >= 3 ? payload.readDouble() : -1;
+	
+	frame.nParticles.resize(nNodes);
+	for (int i = 0; i < nNodes; i++)
+	{
+		frame.nParticles[i] = (previous ? previous->nParticles[i] : 0) + payload.readSignedVarint();
+	}
+	frame.edgeFlow.resize(nEdges);
+	for (int i = 0; i < nEdges; i++)
+	{
+		frame.edgeFlow[i] = (previous ? previous->edgeFlow[i] : 0) + payload.readSignedVarint();
+	}
+	frame.edgeSigma.resize(nEdges);
+	for (int i = 0; i < nEdges; i++)
+	{
+		frame.edgeSigma[i] = halfToFloat(payload.readUInt16());
+	}
+	frame.stomaFlow.resize(nStomata);
+	for (int i = 0; i < nStomata; i++)
+	{
+		frame.stomaFlow[i] = (previous ? previous->stomaFlow[i] : 0) + payload.readSignedVarint();
+	}
+	return payload.isOk();
+}
@@ -0,0 +1,156 @@
+/***************************************************************************
+ copyright            : (C) 2011 by Andrea Perna
+ email                : perna@math.uu.se
+ ***************************************************************************/
+
+/*******************************************************************************
+ *     This program is free software: you can redistribute it and/or modify     *
+ *     it under the terms of the GNU General Public License as published by     *
+ *     the Free Software Foundation, either version 3 of the License, or        *
+ *     (at your option) any later version.                                      *
+ *                                                                              *
+ *     This program is distributed in the hope that it will be useful,          *
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the            *
+ *     GNU General Public License for more details.                             *
+ *                                                                              *
+ *     You can find a copy of the GNU General Public License at the             *
+ *     following address: <http://www.gnu.org/licenses/>.                       *
+ ********************************************************************************/
+
+#ifndef RUNTRACE_H
+#define RUNTRACE_H
+
+#include <QFile>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include <QByteArray>
+
+
+/* A run trace keeps the static topology of the network once, at the beginning
+ of the file, followed by one frame per recorded step. Besides the step and the
+ simulated time, a frame only contains the columns that change during a run:
+ particles per node, flow and sigma per edge and flow per stoma. Integer columns are written as zig-zag varints of the difference
+ with the previous frame, sigma as half precision floats. Every keyFrameInterval
+ frames the differences restart from zero, and the index written when the trace
+ is closed gives the offset of each frame, so that any step can be reached by
+ decoding at most keyFrameInterval frames. */
+
+
+// the order of nodes, edges and stomata is the order of the columns in each frame
+struct RunTraceTopology
+{
+	QVector<double> nodeX;
+	QVector<double> nodeY;
+	QStringList nodeLabel;
+	QVector<char> nodeKind; // 0 neither source nor sink, 1 source, 2 sink
+	QVector<int> nodeNumber; // in the network file, the columns follow the node ordering instead
+	QVector<int> edgeSource; // position of the source node in the node columns
+	QVector<int> edgeDest;
+	QVector<double> edgeLength;
+	QVector<double> edgeWidth;
+	QVector<int> stomaNode; // position of the node carrying the stoma
+	QVector<double> stomaSigma;
+};
+
+
+struct RunTraceFrame
+{
+	int step;
+	double time; // simulated, not step * deltaT when the step is adaptive. -1 in the traces of version 1 and 2
+	QVector<int> nParticles;
+	QVector<int> edgeFlow;
+	QVector<float> edgeSigma;
+	QVector<int> stomaFlow;
+};
+
+
+enum RunTraceNodeKind { TraceNeither = 0, TraceSource = 1, TraceSink = 2 };
+
+
+class RunTraceWriter
+{
+public:
+	RunTraceWriter(int framesBetweenKeyFrames = 64);
+	~RunTraceWriter();
+	
+	bool open(QString fileName, const RunTraceTopology &traceTopology);
+	bool appendFrame(const RunTraceFrame &frame);
+	void close();
+	bool isOpen();
+	
+	int getNumberOfNodes();
+	int getNumberOfEdges();
+	int getNumberOfStomata();
+	
+private:
+	void flushBuffer();
+	
+	QFile file;
+	QByteArray buffer;
+	int keyFrameInterval;
+	int nNodes;
+	int nEdges;
+	int nStomata;
+	RunTraceFrame previousFrame;
+	QVector<qint64> frameSteps;
+	QVector<qint64> frameOffsets;
+};
+
+
+/* The reader maps the whole trace in memory and decodes frames on request. Reading
+ the frames in increasing order only decodes the differences with the last frame
+ that was read, jumping elsewhere starts again from the closest key frame. A trace
+ whose index was never written, for instance because the program was killed while
+ recording, is read by walking through the frames once when it is opened. */
+
+class RunTraceReader
+{
+public:
+	RunTraceReader();
+	~RunTraceReader();
+	
+	bool open(QString fileName);
+	void close();
+	bool isOpen();
+	
+	const RunTraceTopology &getTopology();
+	int getNumberOfFrames();
+	int getFrameStep(int frameNumber);
+	int findFrame(int step);
+	bool readFrame(int frameNumber, RunTraceFrame &frame);
+	
+private:
+	bool readHeader();
+	bool readIndex();
+	void scanFrames();
+	bool decodeFrame(int frameNumber, const RunTraceFrame *previous, RunTraceFrame &frame);
+	
+	QFile file;
+	const uchar *data;
+	qint64 dataSize;
+	qint64 firstFrameOffset;
+	int keyFrameInterval;
+	quint32 version;
+	RunTraceTopology topology;
+	QVector<qint64> frameSteps;
+	QVector<qint64> frameOffsets;
+	RunTraceFrame lastFrame;
+	int lastFrameNumber;
+};
+
+
+
+
+// low level encoding, shared by the writer and the reader
+quint16 floatToHalf(float value);
+float halfToFloat(quint16 half);
+void putVarint(QByteArray &buffer, quint64 value);
+void putSignedVarint(QByteArray &buffer, qint64 value);
+void putUInt16(QByteArray &buffer, quint16 value);
+void putUInt32(QByteArray &buffer, quint32 value);
+void putUInt64(QByteArray &buffer, quint64 value);
+void putDouble(QByteArray &buffer, double value);
+
+#endif
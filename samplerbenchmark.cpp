@@ -0,0 +1,379 @@
+/***************************************************************************
+ copyright            : (C) 2011 by Andrea Perna
+ email                : perna@math.uu.se
+ ***************************************************************************/
+
+/*******************************************************************************
+ *     This program is free software: you can redistribute it and/or modify     *
+ *     it under the terms of the GNU General Public License as published by     *
+ *     the Free Software Foundation, either version 3 of the License, or        *
+ *     (at your option) any later version.                                      *
+ *                                                                              *
+ *     This program is distributed in the hope that it will be useful,          *
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the            *
+ *     GNU General Public License for more details.                             *
+ *                                                                              *
+ *     You can find a copy of the GNU General Public License at the             *
+ *     following address: <http://www.gnu.org/licenses/>.                       *
+ ********************************************************************************/
+
+#include "samplerbenchmark.h"
+#include "benchmark.h"
+#include "randomnumbers.h"
+
+#include <QFile>
+#include <QElapsedTimer>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonArray>
+#include <QDateTime>
+#include <QCommandLineParser>
+
+#include <cmath>
+#include <iostream>
+
+using namespace std;
+
+
+static const int nBatches = 5; // the time per sample is the median over the batches
+static const double minimumExpectedCount = 5; // chi-square bins are merged until they expect this many samples
+static const double acceptedPValue = 0.001;
+
+
+
+
+// regularized upper incomplete gamma function Q(a, x), series below a+1 and continued fraction above
+static double regularizedGammaQ(double a, double x)
+{
+	if (x <= 0)
+		return 1;
+	double logPrefactor = -x + a * log(x) - lgamma(a);
+	if (x < a + 1)
+	{
+		double term = 1.0 / a;
+		double sum = term;
+		double denominator = a;
+		for (int n = 0; n < 10000; n++)
+		{
+			denominator += 1;
+			term *= x / denominator;
+			sum += term;
+			if (fabs(term) < fabs(sum) * 1e-15)
+				break;
+		}
+		return qMax(0.0, 1 - sum * exp(logPrefactor));
+	}
+	
+	const double tiny = 1e-300;
+	double b = x + 1 - a;
+	double c = 1 / tiny;
+	double d = 1 / b;
+	double h = d;
+	for (int i = 1; i < 10000; i++)
+	{
+		double an = -i * (i - a);
+		b += 2;
+		d = an * d + b;
+		if (fabs(d) < tiny)
+			d = tiny;
+		c = b + an / c;
+		if (fabs(c) < tiny)
+			c = tiny;
+		d = 1 / d;
+		double delta = d * c;
+		h *= delta;
+		if (fabs(delta - 1) < 1e-15)
+			break;
+	}
+	return exp(logPrefactor) * h;
+}
+
+
+double chiSquarePValue(double statistic, int degreesOfFreedom)
+{
+	if (degreesOfFreedom <= 0)
+		return 1;
+	return regularizedGammaQ(0.5 * degreesOfFreedom, 0.5 * statistic);
+}
+
+
+/* The histogram counts the samples equal to k, the probabilities give the
+ expected frequency of k. Values beyond the end of the probabilities all fall in
+ a last bin, whose probability is what remains. Neighbouring bins are merged
+ from the left until they expect at least minimumExpectedCount samples, and a
+ remaining bin too small is merged into the last one. */
+
+double chiSquareStatistic(const QVector<int> &histogram, int nSamples, const QVector<double> &probabilities, int &degreesOfFreedom)
+{
+	QVector<double> observedGroups;
+	QVector<double> expectedGroups;
+	double observed = 0;
+	double expected = 0;
+	double cumulatedProbability = 0;
+	int nValues = qMax(histogram.size(), probabilities.size() + 1);
+	
+	for (int k = 0; k < nValues; k++)
+	{
+		bool isTail = k == probabilities.size();
+		if (k < probabilities.size())
+		{
+			expected += nSamples * probabilities[k];
+			cumulatedProbability += probabilities[k];
+		}
+		else if (isTail)
+		{
+			expected += nSamples * qMax(0.0, 1 - cumulatedProbability);
+		}
+		if (k < histogram.size())
+		{
+			observed += histogram[k];
+		}
+		if (expected >= minimumExpectedCount && k < probabilities.size())
+		{
+			observedGroups.append(observed);
+			expectedGroups.append(expected);
+			observed = 0;
+			expected = 0;
+		}
+	}
+	if (observed > 0 || expected > 0)
+	{
+		if (expectedGroups.isEmpty() || expected >= minimumExpectedCount)
+		{
+			observedGroups.append(observed);
+			expectedGroups.append(expected);
+		}
+		else
+		{
+			observedGroups.last() += observed;
+			expectedGroups.last() += expected;
+		}
+	}
+	
+	double statistic = 0;
+	for (int i = 0; i < observedGroups.size(); i++)
+	{
+		double difference = observedGroups[i] - expectedGroups[i];
+		if (expectedGroups[i] > 0)
+		{
+			statistic += difference * difference / expectedGroups[i];
+		}
+		else if (observedGroups[i] > 0)
+		{
+			statistic = HUGE_VAL; // values that cannot occur were drawn
+		}
+	}
+	degreesOfFreedom = observedGroups.size() - 1;
+	return statistic;
+}
+
+
+QVector<double> binomialProbabilities(int N, double p)
+{
+	QVector<double> probabilities(N + 1, 0.0);
+	if (p <= 0)
+	{
+		probabilities[0] = 1;
+		return probabilities;
+	}
+	if (p >= 1)
+	{
+		probabilities[N] = 1;
+		return probabilities;
+	}
+	for (int k = 0; k <= N; k++)
+	{
+		probabilities[k] = exp(lgamma(N + 1.0) - lgamma(k + 1.0) - lgamma(N - k + 1.0) + k * log(p) + (N - k) * log(1 - p));
+	}
+	return probabilities;
+}
+
+
+QVector<double> poissonProbabilities(double lambda, int kMax)
+{
+	QVector<double> probabilities(kMax + 1, 0.0);
+	for (int k = 0; k <= kMax; k++)
+	{
+		probabilities[k] = exp(-lambda + k * log(lambda) - lgamma(k + 1.0));
+	}
+	return probabilities;
+}
+
+
+
+
+// all the samplers draw the number of particles crossing an edge out of N, each with probability p
+typedef int (*EdgeSampler)(int N, double p);
+
+static int sampleBinomDist(int N, double p)
+{
+	return binomDist(N, p);
+}
+
+static int sampleBySum(int N, double p)
+{
+	return binomDistBySum(N, p);
+}
+
+static int samplePoisson1(int N, double p)
+{
+	return poissonRandomNumber1(N * p);
+}
+
+static int samplePoisson2(int N, double p)
+{
+	return poissonRandomNumber2(N * p);
+}
+
+
+static QJsonObject benchmarkSampler(EdgeSampler sampler, bool isPoisson, int N, double p, int nSamples)
+{
+	QVector<int> samples(nSamples);
+	QVector<double> nanosecondsPerSample;
+	int batchSize = nSamples / nBatches;
+	QElapsedTimer timer;
+	for (int batch = 0; batch < nBatches; batch++)
+	{
+		int first = batch * batchSize;
+		int last = (batch == nBatches - 1) ? nSamples : first + batchSize;
+		timer.start();
+		for (int i = first; i < last; i++)
+		{
+			samples[i] = sampler(N, p);
+		}
+		nanosecondsPerSample.append(double(timer.nsecsElapsed()) / qMax(1, last - first));
+	}
+	
+	double sum = 0;
+	double sumOfSquares = 0;
+	int maxSample = 0;
+	foreach (int sample, samples)
+	{
+		sum += sample;
+		sumOfSquares += double(sample) * sample;
+		maxSample = qMax(maxSample, sample);
+	}
+	double mean = sum / nSamples;
+	double variance = (sumOfSquares - nSamples * mean * mean) / (nSamples - 1);
+	QVector<int> histogram(maxSample + 1, 0);
+	foreach (int sample, samples)
+	{
+		histogram[sample]++;
+	}
+	
+	QJsonObject result;
+	result.insert("nsPerSample", statisticsToJson(nanosecondsPerSample));
+	result.insert("mean", mean);
+	result.insert("variance", variance);
+	result.insert("maximum", maxSample);
+	
+	int degreesOfFreedom;
+	double statistic = chiSquareStatistic(histogram, nSamples, binomialProbabilities(N, p), degreesOfFreedom);
+	result.insert("chiSquare", statistic);
+	result.insert("degreesOfFreedom", degreesOfFreedom);
+	result.insert("pValue", chiSquarePValue(statistic, degreesOfFreedom));
+	
+	if (isPoisson)
+	{
+		double lambda = N * p;
+		int kMax = qMax(maxSample, int(lambda + 10 * sqrt(lambda) + 10));
+		statistic = chiSquareStatistic(histogram, nSamples, poissonProbabilities(lambda, kMax), degreesOfFreedom);
+		result.insert("chiSquarePoisson", statistic);
+		result.insert("degreesOfFreedomPoisson", degreesOfFreedom);
+		result.insert("pValuePoisson", chiSquarePValue(statistic, degreesOfFreedom));
+	}
+	return result;
+}
+
+
+
+
+int runSamplerBenchmarks(const QStringList &arguments)
+{
+	QCommandLineParser parser;
+	parser.setApplicationDescription("Electric Leaf random number samplers benchmarks");
+	parser.addHelpOption();
+	QCommandLineOption samplersOption("benchmark-samplers", "Time and validate the samplers of the number of particles crossing an edge.");
+	QCommandLineOption outputOption("output", "File where the results are written.", "file", "samplers.json");
+	QCommandLineOption samplesOption("samples", "Samples drawn for each sampler and each (N, p).", "n", "100000");
+	QCommandLineOption seedOption("seed", "Seed of the random numbers.", "n", "12345");
+	parser.addOption(samplersOption);
+	parser.addOption(outputOption);
+	parser.addOption(samplesOption);
+	parser.addOption(seedOption);
+	parser.process(arguments);
+	
+	int nSamples = qMax(10 * nBatches, parser.value(samplesOption).toInt());
+	qsrand(parser.value(seedOption).toUInt());
+	
+	// around the thresholds of binomDist, N = 20 and p = 0.05, and the values met in the simulations
+	const int Ns[] = {1, 5, 10, 19, 20, 50, 100, 500, 1000};
+	const double ps[] = {0.0001, 0.001, 0.01, 0.05, 0.051, 0.1, 0.3, 0.5};
+	const int nNs = sizeof(Ns) / sizeof(Ns[0]);
+	const int nPs = sizeof(ps) / sizeof(ps[0]);
+	const char *samplerNames[] = {"binomDist", "binomDistBySum", "poissonRandomNumber1", "poissonRandomNumber2"};
+	EdgeSampler samplers[] = {sampleBinomDist, sampleBySum, samplePoisson1, samplePoisson2};
+	const bool isPoisson[] = {false, false, true, true};
+	const int nSamplers = 4;
+	
+	cout << "N\tp\tsampler\tns/sample\tmean (exact)\tvariance (exact)\tchi2/df\tp-value" << endl;
+	QJsonArray cells;
+	for (int i = 0; i < nNs; i++)
+	{
+		for (int j = 0; j < nPs; j++)
+		{
+			int N = Ns[i];
+			double p = ps[j];
+			QJsonObject cell;
+			cell.insert("N", N);
+			cell.insert("p", p);
+			cell.insert("exactMean", N * p);
+			cell.insert("exactVariance", N * p * (1 - p));
+			
+			QJsonObject results;
+			QString fastestAccurate;
+			double fastestTime = HUGE_VAL;
+			for (int s = 0; s < nSamplers; s++)
+			{
+				QJsonObject result = benchmarkSampler(samplers[s], isPoisson[s], N, p, nSamples);
+				results.insert(samplerNames[s], result);
+				double nanoseconds = result.value("nsPerSample").toObject().value("median").toDouble();
+				double pValue = result.value("pValue").toDouble();
+				if (pValue >= acceptedPValue && nanoseconds < fastestTime)
+				{
+					fastestTime = nanoseconds;
+					fastestAccurate = samplerNames[s];
+				}
+				cout << N << "\t" << p << "\t" << samplerNames[s] << "\t" << nanoseconds
+				<< "\t" << result.value("mean").toDouble() << " (" << N * p << ")"
+				<< "\t" << result.value("variance").toDouble() << " (" << N * p * (1 - p) << ")"
+				<< "\t" << result.value("chiSquare").toDouble() << "/" << result.value("degreesOfFreedom").toInt()
+				<< "\t" << pValue << endl;
+			}
+			cell.insert("samplers", results);
+			// the fastest sampler whose samples are compatible with the binomial distribution
+			cell.insert("fastestAccurate", fastestAccurate);
+			cells.append(cell);
+		}
+	}
+	
+	QJsonObject output;
+	output.insert("format", 1);
+	output.insert("date", QDateTime::currentDateTime().toString(Qt::ISODate));
+	output.insert("samples", nSamples);
+	output.insert("seed", parser.value(seedOption).toInt());
+	output.insert("acceptedPValue", acceptedPValue);
+	output.insert("cells", cells);
+	
+	QFile outputFile(parser.value(outputOption));
+	if (!outputFile.open(QIODevice::WriteOnly | QIODevice::Truncate))
+	{
+		cerr << "cannot write " << outputFile.fileName().toStdString() << endl;
+		return 2;
+	}
+	outputFile.write(QJsonDocument(output).toJson());
+	outputFile.close();
+	cout << "results written to " << outputFile.fileName().toStdString() << endl;
+	return 0;
+}
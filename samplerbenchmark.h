@@ -0,0 +1,49 @@
+/***************************************************************************
+ copyright            : (C) 2011 by Andrea Perna
+ email                : perna@math.uu.se
+ ***************************************************************************/
+
+/*******************************************************************************
+ *     This program is free software: you can redistribute it and/or modify     *
+ *     it under the terms of the GNU General Public License as published by     *
+ *     the Free Software Foundation, either version 3 of the License, or        *
+ *     (at your option) any later version.                                      *
+ *                                                                              *
+ *     This program is distributed in the hope that it will be useful,          *
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the            *
+ *     GNU General Public License for more details.                             *
+ *                                                                              *
+ *     You can find a copy of the GNU General Public License at the             *
+ *     following address: <http://www.gnu.org/licenses/>.                       *
+ ********************************************************************************/
+
+#ifndef SAMPLERBENCHMARK_H
+#define SAMPLERBENCHMARK_H
+
+#include <QStringList>
+#include <QVector>
+
+
+/* Microbenchmarks of the samplers of randomnumbers.cpp:
+ 
+ my_electric_leaf --benchmark-samplers [--output file.json] [--samples n] [--seed n]
+ 
+ For every (N, p) of a grid, each sampler draws the number of particles that
+ cross an edge, binomDist as used by the simulation, the sum of N Bernoulli
+ trials, and the two Poisson samplers with lambda = N p. The time per sample is
+ reported with the median of several batches, and the samples are checked
+ against the exact binomial distribution: mean, variance and a chi-square test.
+ The Poisson samplers are also tested against the Poisson distribution they are
+ meant to draw from, so that a failure of the approximation is not mistaken for
+ a bug of the sampler. */
+
+
+double chiSquarePValue(double statistic, int degreesOfFreedom);
+double chiSquareStatistic(const QVector<int> &histogram, int nSamples, const QVector<double> &probabilities, int &degreesOfFreedom);
+QVector<double> binomialProbabilities(int N, double p);
+QVector<double> poissonProbabilities(double lambda, int kMax);
+
+int runSamplerBenchmarks(const QStringList &arguments);
+
+#endif
@@ -0,0 +1,135 @@
+/***************************************************************************
+ copyright            : (C) 2011 by Andrea Perna
+ email                : perna@math.uu.se
+ ***************************************************************************/
+
+/*******************************************************************************
+ *     This program is free software: you can redistribute it and/or modify     *
+ *     it under the terms of the GNU General Public License as published by     *
+ *     the Free Software Foundation, either version 3 of the License, or        *
+ *     (at your option) any later version.                                      *
+ *                                                                              *
+ *     This program is distributed in the hope that it will be useful,          *
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the            *
+ *     GNU General Public License for more details.                             *
+ *                                                                              *
+ *     You can find a copy of the GNU General Public License at the             *
+ *     following address: <http://www.gnu.org/licenses/>.                       *
+ ********************************************************************************/
+
+#include "seriesreduction.h"
+
+
+
+
+QVector<SeriesChainIndices> findSeriesChains(int nNodes, const QVector<int> &edgeSource, const QVector<int> &edgeDest, const QVector<bool> &isTerminal)
+{
+	QVector<SeriesChainIndices> chains;
+	
+	// the edges of each node; only the first two are needed for the inner nodes of a chain
+	QVector<int> degree(nNodes, 0);
+	QVector<int> firstEdge(nNodes, -1);
+	QVector<int> secondEdge(nNodes, -1);
+	for (int i = 0; i < edgeSource.size(); i++)
+	{
+		int ends[2] = { edgeSource[i], edgeDest[i] };
+		for (int j = 0; j < 2; j++)
+		{
+			int node = ends[j];
+			if (degree[node] == 0)
+				firstEdge[node] = i;
+			else if (degree[node] == 1)
+				secondEdge[node] = i;
+			degree[node]++;
+		}
+	}
+	
+	QVector<bool> isInner(nNodes, false);
+	for (int node = 0; node < nNodes; node++)
+	{
+		// an edge from the node to itself counts twice, and does not make the node a link of a chain
+		isInner[node] = degree[node] == 2 && !isTerminal[node] && firstEdge[node] != secondEdge[node];
+	}
+	
+	// each chain is walked from its end with the lowest index, through the edge that leaves it
+	QVector<bool> isEdgeUsed(edgeSource.size(), false);
+	for (int i = 0; i < edgeSource.size(); i++)
+	{
+		if (isEdgeUsed[i])
+			continue;
+		int start;
+		int next;
+		if (!isInner[edgeSource[i]])
+		{
+			start = edgeSource[i];
+			next = edgeDest[i];
+		}
+		else if (!isInner[edgeDest[i]])
+		{
+			start = edgeDest[i];
+			next = edgeSource[i];
+		}
+		else
+		{
+			continue; // an edge in the middle of a chain, reached from the end of the chain
+		}
+		if (!isInner[next])
+			continue; // an edge between two ends, nothing to reduce
+		
+		SeriesChainIndices chain;
+		chain.nodes.append(start);
+		chain.edges.append(i);
+		int edge = i;
+		int node = next;
+		while (isInner[node])
+		{
+			chain.nodes.append(node);
+			edge = (firstEdge[node] == edge) ? secondEdge[node] : firstEdge[node];
+			chain.edges.append(edge);
+			node = (edgeSource[edge] == node) ? edgeDest[edge] : edgeSource[edge];
+		}
+		chain.nodes.append(node);
+		
+		foreach (int chainEdge, chain.edges)
+		{
+			isEdgeUsed[chainEdge] = true;
+		}
+		if (node != start)
+			chains.append(chain);
+	}
+	return chains;
+}
+
+
+double seriesConductance(const QVector<double> &conductances)
+{
+	double resistance = 0;
+	foreach (double conductance, conductances)
+	{
+		if (conductance <= 0)
+			return 0;
+		resistance += 1.0 / conductance;
+	}
+	return resistance > 0 ? 1.0 / resistance : 0;
+}
+
+
+QVector<double> interpolateAlongChain(const QVector<double> &conductances, double firstValue, double lastValue)
+{
+	QVector<double> values(conductances.size() + 1);
+	double totalResistance = 0;
+	foreach (double conductance, conductances)
+	{
+		totalResistance += conductance > 0 ? 1.0 / conductance : 0;
+	}
+	double resistance = 0;
+	values[0] = firstValue;
+	for (int i = 0; i < conductances.size(); i++)
+	{
+		resistance += conductances[i] > 0 ? 1.0 / conductances[i] : 0;
+		double fraction = totalResistance > 0 ? resistance / totalResistance : double(i + 1) / conductances.size();
+		values[i + 1] = firstValue + (lastValue - firstValue) * fraction;
+	}
+	return values;
+}
@@ -0,0 +1,59 @@
+/***************************************************************************
+ copyright            : (C) 2011 by Andrea Perna
+ email                : perna@math.uu.se
+ ***************************************************************************/
+
+/*******************************************************************************
+ *     This program is free software: you can redistribute it and/or modify     *
+ *     it under the terms of the GNU General Public License as published by     *
+ *     the Free Software Foundation, either version 3 of the License, or        *
+ *     (at your option) any later version.                                      *
+ *                                                                              *
+ *     This program is distributed in the hope that it will be useful,          *
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the            *
+ *     GNU General Public License for more details.                             *
+ *                                                                              *
+ *     You can find a copy of the GNU General Public License at the             *
+ *     following address: <http://www.gnu.org/licenses/>.                       *
+ ********************************************************************************/
+
+#ifndef SERIESREDUCTION_H
+#define SERIESREDUCTION_H
+
+#include <QVector>
+
+
+/* Series reduction of the network. Most nodes of a leaf have two edges, and
+ only pass the particles along the vein. A maximal path of such nodes, between
+ two nodes that have another degree or are sources or sinks, behaves in the
+ steady state as a single edge whose resistance is the sum of the resistances
+ of its segments. The simulation can then move particles along one effective
+ edge per chain, and rebuild the values of the segments when they are shown or
+ saved.
+ 
+ The nodes are given by their indices from zero, and the edges by the indices
+ of their two ends, as in networkordering.h. */
+
+
+struct SeriesChainIndices
+{
+	QVector<int> nodes; // from one end to the other, the ends included
+	QVector<int> edges; // edges[i] joins nodes[i] and nodes[i+1]
+};
+
+
+/* The chains of at least two edges. A chain whose two ends are the same node,
+ and a closed ring of nodes of degree two, are not reduced. isTerminal marks the
+ nodes that cannot be inside a chain, besides those of degree other than two. */
+QVector<SeriesChainIndices> findSeriesChains(int nNodes, const QVector<int> &edgeSource, const QVector<int> &edgeDest, const QVector<bool> &isTerminal);
+
+// conductance of conductances in series, zero if any of them is zero
+double seriesConductance(const QVector<double> &conductances);
+
+/* Values at the nodes of a chain that fall linearly with the resistance met from
+ the first end, from firstValue to lastValue, as the potential does in the
+ steady state. The result has one value per node of the chain, ends included. */
+QVector<double> interpolateAlongChain(const QVector<double> &conductances, double firstValue, double lastValue);
+
+#endif
@@ -0,0 +1,524 @@
+/***************************************************************************
+ copyright            : (C) 2011 by Andrea Perna
+ email                : perna@math.uu.se
+ ***************************************************************************/
+
+/*******************************************************************************
+ *     This program is free software: you can redistribute it and/or modify     *
+ *     it under the terms of the GNU General Public License as published by     *
+ *     the Free Software Foundation, either version 3 of the License, or        *
+ *     (at your option) any later version.                                      *
+ *                                                                              *
+ *     This program is distributed in the hope that it will be useful,          *
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the            *
+ *     GNU General Public License for more details.                             *
+ *                                                                              *
+ *     You can find a copy of the GNU General Public License at the             *
+ *     following address: <http://www.gnu.org/licenses/>.                       *
+ ********************************************************************************/
+
+#include "sharedtopology.h"
+#include "randomnumbers.h"
+
+#include <QTemporaryFile>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+using namespace std;
+
+
+static const char topologyMagic[8] = { 'E', 'L', 'T', 'O', 'P', 'O', '0', '1' };
+static const int headerSize = 32; // the magic, the three sizes and some room, a multiple of 8
+static const int numberOfArrays = 11;
+static const int elementSizes[numberOfArrays] = { 8, 8, 4, 4, 4, 4, 8, 8, 8, 4, 8 };
+
+
+
+
+// elements of each array, in the order of NetworkTopology
+static int arrayLength(int array, int nNodes, int nEdges, int nStomata)
+{
+	if (array < 4)
+		return nNodes;
+	if (array < 9)
+		return nEdges;
+	return nStomata;
+}
+
+
+// every array starts at a multiple of 8, where its doubles can be read in place
+static qint64 paddedSize(qint64 bytes)
+{
+	return (bytes + 7) / 8 * 8;
+}
+
+
+static bool writePadded(QFile &file, const void *array, qint64 bytes)
+{
+	static const char zeros[8] = { 0, 0, 0, 0, 0, 0, 0, 0 };
+	if (bytes > 0 && file.write(static_cast<const char *>(array), bytes) != bytes)
+		return false;
+	qint64 padding = paddedSize(bytes) - bytes;
+	return padding == 0 || file.write(zeros, padding) == padding;
+}
+
+
+bool writeSharedTopology(QString fileName, const NetworkTopology &topology)
+{
+	QTemporaryFile file(fileName + ".XXXXXX.tmp"); // a name that cannot be guessed, readable by the user only
+	if (!file.open())
+		return false;
+	file.setAutoRemove(false); // it would remove the renamed file
+	QString temporaryFileName = file.fileName();
+	
+	char header[headerSize];
+	memset(header, 0, headerSize);
+	memcpy(header, topologyMagic, sizeof(topologyMagic));
+	qint32 sizes[3] = { qint32(topology.nodeX.size()), qint32(topology.edgeSource.size()), qint32(topology.stomaNode.size()) };
+	memcpy(header + sizeof(topologyMagic), sizes, sizeof(sizes));
+	const void *arrays[numberOfArrays] = {
+		topology.nodeX.constData(), topology.nodeY.constData(), topology.isSource.constData(), topology.initialParticles.constData(),
+		topology.edgeSource.constData(), topology.edgeDest.constData(), topology.edgeWidth.constData(), topology.edgeLength.constData(),
+		topology.initialSigma.constData(), topology.stomaNode.constData(), topology.stomaSigma.constData() };
+	
+	bool isWritten = file.write(header, headerSize) == headerSize;
+	for (int array = 0; array < numberOfArrays && isWritten; array++)
+	{
+		qint64 bytes = qint64(elementSizes[array]) * arrayLength(array, sizes[0], sizes[1], sizes[2]);
+		isWritten = writePadded(file, arrays[array], bytes);
+	}
+	file.close();
+	if (!isWritten || !QFile::rename(temporaryFileName, fileName))
+	{
+		QFile::remove(temporaryFileName);
+		return QFile::exists(fileName);
+	}
+	return true;
+}
+
+
+
+
+SharedTopology::SharedTopology()
+{
+	data = NULL;
+	nNodes = 0;
+	nEdges = 0;
+	nStomata = 0;
+}
+
+
+SharedTopology::~SharedTopology()
+{
+	detach();
+}
+
+
+bool SharedTopology::attach(QString fileName)
+{
+	detach();
+	file.setFileName(fileName);
+	if (!file.open(QIODevice::ReadOnly))
+		return false;
+	if (file.size() < headerSize)
+	{
+		file.close();
+		return false;
+	}
+	data = file.map(0, file.size());
+	if (data == NULL || memcmp(data, topologyMagic, sizeof(topologyMagic)) != 0)
+	{
+		detach();
+		return false;
+	}
+	qint32 sizes[3];
+	memcpy(sizes, data + sizeof(topologyMagic), sizeof(sizes));
+	nNodes = sizes[0];
+	nEdges = sizes[1];
+	nStomata = sizes[2];
+	if (nNodes < 0 || nEdges < 0 || nStomata < 0)
+	{
+		detach();
+		return false;
+	}
+	
+	offsets.resize(numberOfArrays);
+	qint64 offset = headerSize;
+	for (int array = 0; array < numberOfArrays; array++)
+	{
+		offsets[array] = offset;
+		offset += paddedSize(qint64(elementSizes[array]) * arrayLength(array, nNodes, nEdges, nStomata));
+	}
+	if (offset != file.size()) // truncated, or not a topology
+	{
+		detach();
+		return false;
+	}
+	
+	// the replicas index their arrays with these without checking
+	const int *edgeSource = getEdgeSource();
+	const int *edgeDest = getEdgeDest();
+	const int *stomaNode = getStomaNode();
+	bool areIndicesValid = true;
+	for (int i = 0; i < nEdges && areIndicesValid; i++)
+	{
+		areIndicesValid = edgeSource[i] >= 0 && edgeSource[i] < nNodes && edgeDest[i] >= 0 && edgeDest[i] < nNodes;
+	}
+	for (int i = 0; i < nStomata && areIndicesValid; i++)
+	{
+		areIndicesValid = stomaNode[i] >= 0 && stomaNode[i] < nNodes;
+	}
+	if (!areIndicesValid)
+	{
+		detach();
+		return false;
+	}
+	return true;
+}
+
+
+void SharedTopology::detach()
+{
+	if (data != NULL)
+		file.unmap(data);
+	data = NULL;
+	if (file.isOpen())
+		file.close();
+	nNodes = 0;
+	nEdges = 0;
+	nStomata = 0;
+}
+
+
+bool SharedTopology::isAttached()
+{
+	return data != NULL;
+}
+
+
+int SharedTopology::getNumberOfNodes()
+{
+	return nNodes;
+}
+
+int SharedTopology::getNumberOfEdges()
+{
+	return nEdges;
+}
+
+int SharedTopology::getNumberOfStomata()
+{
+	return nStomata;
+}
+
+
+const double *SharedTopology::getNodeX()
+{
+	return reinterpret_cast<const double *>(data + offsets[0]);
+}
+
+const double *SharedTopology::getNodeY()
+{
+	return reinterpret_cast<const double *>(data + offsets[1]);
+}
+
+const int *SharedTopology::getIsSource()
+{
+	return reinterpret_cast<const int *>(data + offsets[2]);
+}
+
+const int *SharedTopology::getInitialParticles()
+{
+	return reinterpret_cast<const int *>(data + offsets[3]);
+}
+
+const int *SharedTopology::getEdgeSource()
+{
+	return reinterpret_cast<const int *>(data + offsets[4]);
+}
+
+const int *SharedTopology::getEdgeDest()
+{
+	return reinterpret_cast<const int *>(data + offsets[5]);
+}
+
+const double *SharedTopology::getEdgeWidth()
+{
+	return reinterpret_cast<const double *>(data + offsets[6]);
+}
+
+const double *SharedTopology::getEdgeLength()
+{
+	return reinterpret_cast<const double *>(data + offsets[7]);
+}
+
+const double *SharedTopology::getInitialSigma()
+{
+	return reinterpret_cast<const double *>(data + offsets[8]);
+}
+
+const int *SharedTopology::getStomaNode()
+{
+	return reinterpret_cast<const int *>(data + offsets[9]);
+}
+
+const double *SharedTopology::getStomaSigma()
+{
+	return reinterpret_cast<const double *>(data + offsets[10]);
+}
+
+
+
+
+TopologyReplica::TopologyReplica(SharedTopology *sharedTopology)
+: topology(sharedTopology), arrayNetwork(this)
+{
+	deltaT = 0.001;
+	chargePerParticle = 0.05;
+	minSigma = 0.001;
+	particlesAtSource = 10;
+	isUpdatingSigma = false;
+	reset();
+}
+
+
+void TopologyReplica::setParameters(double newDeltaT, double newChargePerParticle, double newMinSigma, int newParticlesAtSource, bool shouldUpdateSigma)
+{
+	deltaT = newDeltaT;
+	chargePerParticle = newChargePerParticle;
+	minSigma = newMinSigma;
+	particlesAtSource = newParticlesAtSource;
+	isUpdatingSigma = shouldUpdateSigma;
+}
+
+
+// back to the particles and conductivities of the loaded network
+void TopologyReplica::reset()
+{
+	int nNodes = topology->getNumberOfNodes();
+	int nEdges = topology->getNumberOfEdges();
+	int nStomata = topology->getNumberOfStomata();
+	nParticles.resize(nNodes);
+	if (nNodes > 0)
+		std::copy(topology->getInitialParticles(), topology->getInitialParticles() + nNodes, nParticles.begin());
+	sigma.resize(nEdges);
+	if (nEdges > 0)
+		std::copy(topology->getInitialSigma(), topology->getInitialSigma() + nEdges, sigma.begin());
+	edgeIdleSigmaDecay.fill(0, nEdges);
+	idleSigmaDecay = 0;
+	flow.fill(0, nEdges);
+	stomaFlow.fill(0, nStomata);
+	
+	stomaOfNode.fill(-1, nNodes);
+	for (int i = 0; i < nStomata; i++)
+	{
+		stomaOfNode[topology->getStomaNode()[i]] = i;
+	}
+	edgesOfNode.clear();
+	edgesOfNode.resize(nNodes);
+	for (int i = 0; i < nEdges; i++)
+	{
+		edgesOfNode[topology->getEdgeSource()[i]].append(i);
+		edgesOfNode[topology->getEdgeDest()[i]].append(i);
+	}
+	isEdgeActive.fill(0, nEdges);
+	activeEdges.invalidate();
+	convergenceMonitor.reset();
+}
+
+
+void TopologyReplica::performOneSimulationStep()
+{
+	refillSourcesAndDrainStomata(arrayNetwork, particlesAtSource, deltaT);
+	activeEdges.update(arrayNetwork);
+	
+	// the idle edges decay when they are next read, see GraphWidget::performFixedStep
+	double stepSigmaDecay = isUpdatingSigma ? -log(1.0 - deltaT) : 0;
+	activeEdges.visit(arrayNetwork, deltaT, idleSigmaDecay + stepSigmaDecay);
+	idleSigmaDecay += stepSigmaDecay;
+	
+	// as GraphWidget::monitorConvergence
+	int nNodes = topology->getNumberOfNodes();
+	const int *isSource = topology->getIsSource();
+	double outflow = 0;
+	double particlesInNetwork = 0;
+	for (int i = 0; i < nNodes; i++)
+	{
+		if (isSource[i])
+			continue;
+		particlesInNetwork += nParticles[i];
+		if (stomaOfNode[i] >= 0)
+			outflow += stomaFlow[stomaOfNode[i]];
+	}
+	if (convergenceMonitor.addStep(deltaT, outflow, particlesInNetwork))
+		convergenceMonitor.endWindow(getSigmaPerEdge());
+}
+
+
+// the conductivity with the decay of the steps in which the edge was idle, as Edge::getSigma
+double TopologyReplica::getSigma(int edge)
+{
+	double decay = idleSigmaDecay - edgeIdleSigmaDecay[edge];
+	if (decay > 0)
+	{
+		sigma[edge] = qMax(sigma[edge] * exp(-decay), minSigma);
+		edgeIdleSigmaDecay[edge] += decay;
+	}
+	return sigma[edge];
+}
+
+
+void TopologyReplica::applyIdleSigmaDecay()
+{
+	for (int i = 0; i < sigma.size(); i++)
+	{
+		getSigma(i);
+	}
+}
+
+
+const QVector<int> &TopologyReplica::getParticlesPerNode()
+{
+	return nParticles;
+}
+
+const QVector<double> &TopologyReplica::getSigmaPerEdge()
+{
+	applyIdleSigmaDecay();
+	return sigma;
+}
+
+bool TopologyReplica::hasConverged()
+{
+	return convergenceMonitor.hasConverged();
+}
+
+double TopologyReplica::getConvergenceTime()
+{
+	return convergenceMonitor.getConvergenceTime();
+}
+
+
+
+
+TopologyReplica::ArrayNetwork::ArrayNetwork(TopologyReplica *topologyReplica)
+: replica(topologyReplica)
+{
+}
+
+int TopologyReplica::ArrayNetwork::getNumberOfNodes()
+{
+	return replica->nParticles.size();
+}
+
+int TopologyReplica::ArrayNetwork::getNode(int i)
+{
+	return i;
+}
+
+bool TopologyReplica::ArrayNetwork::isSourceNode(int node)
+{
+	return replica->topology->getIsSource()[node] != 0;
+}
+
+bool TopologyReplica::ArrayNetwork::hasStoma(int node)
+{
+	return replica->stomaOfNode[node] >= 0;
+}
+
+double TopologyReplica::ArrayNetwork::getStomaSigma(int node)
+{
+	return replica->topology->getStomaSigma()[replica->stomaOfNode[node]];
+}
+
+void TopologyReplica::ArrayNetwork::setStomaFlow(int node, int flow)
+{
+	replica->stomaFlow[replica->stomaOfNode[node]] = flow;
+}
+
+int TopologyReplica::ArrayNetwork::getNParticles(int node)
+{
+	return replica->nParticles[node];
+}
+
+// the particles change as in Node, which activates the edges
+void TopologyReplica::ArrayNetwork::setNParticles(int node, int nParticles)
+{
+	if (nParticles == replica->nParticles[node])
+		return;
+	replica->nParticles[node] = nParticles;
+	replica->activeEdges.activateEdgesOf(*this, node);
+}
+
+void TopologyReplica::ArrayNetwork::addParticles(int node, int nParticles)
+{
+	setNParticles(node, max(replica->nParticles[node] + nParticles, 0));
+}
+
+void TopologyReplica::ArrayNetwork::subtractParticles(int node, int nParticles)
+{
+	setNParticles(node, max(replica->nParticles[node] - nParticles, 0));
+}
+
+QVector<int> TopologyReplica::ArrayNetwork::getEdgesOf(int node)
+{
+	return replica->edgesOfNode[node];
+}
+
+int TopologyReplica::ArrayNetwork::getNumberOfEdges()
+{
+	return replica->sigma.size();
+}
+
+int TopologyReplica::ArrayNetwork::getEdge(int i)
+{
+	return i;
+}
+
+int TopologyReplica::ArrayNetwork::getSourceNode(int edge)
+{
+	return replica->topology->getEdgeSource()[edge];
+}
+
+int TopologyReplica::ArrayNetwork::getDestNode(int edge)
+{
+	return replica->topology->getEdgeDest()[edge];
+}
+
+double TopologyReplica::ArrayNetwork::getSigma(int edge)
+{
+	return replica->getSigma(edge);
+}
+
+void TopologyReplica::ArrayNetwork::setFlow(int edge, int flow)
+{
+	replica->flow[edge] = flow;
+}
+
+// as GraphWidget::updateEdgeSigma and Edge::setSigma
+void TopologyReplica::ArrayNetwork::updateSigma(int edge)
+{
+	if (!replica->isUpdatingSigma)
+		return;
+	replica->sigma[edge] = max(replica->getSigma(edge) * (1.0 - replica->deltaT) + abs(replica->flow[edge]) * replica->chargePerParticle, replica->minSigma);
+	replica->edgeIdleSigmaDecay[edge] = replica->idleSigmaDecay;
+}
+
+void TopologyReplica::ArrayNetwork::setIdleSigmaDecay(int edge, double idleSigmaDecay)
+{
+	replica->edgeIdleSigmaDecay[edge] = idleSigmaDecay;
+}
+
+bool TopologyReplica::ArrayNetwork::isInActiveSet(int edge)
+{
+	return replica->isEdgeActive[edge] != 0;
+}
+
+void TopologyReplica::ArrayNetwork::setInActiveSet(int edge, bool shouldBeInActiveSet)
+{
+	replica->isEdgeActive[edge] = shouldBeInActiveSet ? 1 : 0;
+}
@@ -0,0 +1,186 @@
+/***************************************************************************
+ copyright            : (C) 2011 by Andrea Perna
+ email                : perna@math.uu.se
+ ***************************************************************************/
+
+/*******************************************************************************
+ *     This program is free software: you can redistribute it and/or modify     *
+ *     it under the terms of the GNU General Public License as published by     *
+ *     the Free Software Foundation, either version 3 of the License, or        *
+ *     (at your option) any later version.                                      *
+ *                                                                              *
+ *     This program is distributed in the hope that it will be useful,          *
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the            *
+ *     GNU General Public License for more details.                             *
+ *                                                                              *
+ *     You can find a copy of the GNU General Public License at the             *
+ *     following address: <http://www.gnu.org/licenses/>.                       *
+ ********************************************************************************/
+
+#ifndef SHAREDTOPOLOGY_H
+#define SHAREDTOPOLOGY_H
+
+#include <QVector>
+#include <QString>
+#include <QFile>
+
+#include "convergencemonitor.h"
+#include "fixedstep.h"
+
+
+/* The part of a loaded network that never changes during a run: positions,
+ edges with their widths and lengths, sources and stomata, and the particles
+ and conductivities at the start. The nodes and edges are indices from zero,
+ as in networkordering.h. */
+
+struct NetworkTopology
+{
+	QVector<double> nodeX;
+	QVector<double> nodeY;
+	QVector<int> isSource;
+	QVector<int> initialParticles;
+	QVector<int> edgeSource;
+	QVector<int> edgeDest;
+	QVector<double> edgeWidth;
+	QVector<double> edgeLength;
+	QVector<double> initialSigma;
+	QVector<int> stomaNode;
+	QVector<double> stomaSigma;
+};
+
+
+/* Writes the topology in the binary layout read by SharedTopology. It is
+ written under a random temporary name, readable by the user only, and
+ renamed, so that a process never maps a file still being written; when two processes write the same topology at the
+ same time, the second rename fails and its copy is thrown away. */
+
+bool writeSharedTopology(QString fileName, const NetworkTopology &topology);
+
+
+/* A topology file mapped read-only in memory. Every process that maps the same
+ file shares its pages, so forty workers on replicas of the same leaf keep
+ one copy of it instead of forty. */
+
+class SharedTopology
+{
+public:
+	SharedTopology();
+	~SharedTopology();
+	
+	bool attach(QString fileName);
+	void detach();
+	bool isAttached();
+	
+	int getNumberOfNodes();
+	int getNumberOfEdges();
+	int getNumberOfStomata();
+	
+	const double *getNodeX();
+	const double *getNodeY();
+	const int *getIsSource();
+	const int *getInitialParticles();
+	const int *getEdgeSource();
+	const int *getEdgeDest();
+	const double *getEdgeWidth();
+	const double *getEdgeLength();
+	const double *getInitialSigma();
+	const int *getStomaNode();
+	const double *getStomaSigma();
+	
+private:
+	QFile file;
+	uchar *data;
+	int nNodes;
+	int nEdges;
+	int nStomata;
+	QVector<qint64> offsets; // of the arrays, in the order of NetworkTopology
+};
+
+
+/* One run of the fixed step on a shared topology, for the ensemble workers.
+ Only the particles, the conductivities and the flows belong to the replica.
+ It is the sequential GraphWidget::performFixedStep without the drawing, with
+ the same code of fixedstep.h, and the conductivities of the idle edges decay
+ lazily in the same way as in Edge::getSigma, so that a seed gives the same run
+ as GraphWidget. The multirate update, the adaptive step, the series reduction,
+ the parallel edge loops and the continuous time engines are left to
+ GraphWidget. */
+
+class TopologyReplica
+{
+public:
+	TopologyReplica(SharedTopology *sharedTopology);
+	
+	void setParameters(double newDeltaT, double newChargePerParticle, double newMinSigma, int newParticlesAtSource, bool shouldUpdateSigma);
+	void reset();
+	void performOneSimulationStep();
+	
+	const QVector<int> &getParticlesPerNode();
+	const QVector<double> &getSigmaPerEdge();
+	bool hasConverged();
+	double getConvergenceTime();
+	
+private:
+	// the arrays as the fixed step of fixedstep.h sees them, nodes and edges are indices
+	class ArrayNetwork
+	{
+	public:
+		typedef int NodeHandle;
+		typedef int EdgeHandle;
+		typedef QVector<int> EdgeList;
+		
+		ArrayNetwork(TopologyReplica *topologyReplica);
+		
+		int getNumberOfNodes();
+		int getNode(int i);
+		bool isSourceNode(int node);
+		bool hasStoma(int node);
+		double getStomaSigma(int node);
+		void setStomaFlow(int node, int flow);
+		int getNParticles(int node);
+		void setNParticles(int node, int nParticles);
+		void addParticles(int node, int nParticles);
+		void subtractParticles(int node, int nParticles);
+		QVector<int> getEdgesOf(int node);
+		
+		int getNumberOfEdges();
+		int getEdge(int i);
+		int getSourceNode(int edge);
+		int getDestNode(int edge);
+		double getSigma(int edge);
+		void setFlow(int edge, int flow);
+		void updateSigma(int edge);
+		void setIdleSigmaDecay(int edge, double idleSigmaDecay);
+		bool isInActiveSet(int edge);
+		void setInActiveSet(int edge, bool shouldBeInActiveSet);
+		
+	private:
+		TopologyReplica *replica;
+	};
+	
+	double getSigma(int edge);
+	void applyIdleSigmaDecay();
+	
+	SharedTopology *topology;
+	double deltaT;
+	double chargePerParticle;
+	double minSigma;
+	int particlesAtSource;
+	bool isUpdatingSigma;
+	
+	QVector<int> nParticles;
+	QVector<double> sigma;
+	QVector<double> edgeIdleSigmaDecay; // the part of idleSigmaDecay already applied to sigma, as in Edge
+	double idleSigmaDecay; // as in GraphWidget::getIdleSigmaDecay
+	QVector<int> flow;
+	QVector<int> stomaFlow;
+	QVector<int> stomaOfNode; // -1 for the nodes without stoma
+	QVector<QVector<int> > edgesOfNode; // in the order of the edges, as Node::edges
+	QVector<char> isEdgeActive;
+	ArrayNetwork arrayNetwork;
+	ActiveEdgeSet<ArrayNetwork> activeEdges;
+	ConvergenceMonitor convergenceMonitor;
+};
+
+#endif
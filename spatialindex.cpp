@@ -0,0 +1,381 @@
+/***************************************************************************
+ copyright            : (C) 2011 by Andrea Perna
+ email                : perna@math.uu.se
+ ***************************************************************************/
+
+/*******************************************************************************
+ *     This program is free software: you can redistribute it and/or modify     *
+ *     it under the terms of the GNU General Public License as published by     *
+ *     the Free Software Foundation, either version 3 of the License, or        *
+ *     (at your option) any later version.                                      *
+ *                                                                              *
+ *     This program is distributed in the hope that it will be useful,          *
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the            *
+ *     GNU General Public License for more details.                             *
+ *                                                                              *
+ *     You can find a copy of the GNU General Public License at the             *
+ *     following address: <http://www.gnu.org/licenses/>.                       *
+ ********************************************************************************/
+
+#include "spatialindex.h"
+#include "node.h"
+#include "edge.h"
+#include "stoma.h"
+
+#include <QDataStream>
+
+#include <cmath>
+
+
+static const double nodeRadius = 1.5; // as in Node::shape() and Stoma::shape()
+static const int maxCellsPerSide = 2048;
+
+
+
+
+// Liang-Barsky clipping of the segment against the rectangle
+bool segmentIntersectsRect(QPointF p1, QPointF p2, const QRectF &rect)
+{
+	double t0 = 0;
+	double t1 = 1;
+	double dx = p2.x() - p1.x();
+	double dy = p2.y() - p1.y();
+	double p[4] = {-dx, dx, -dy, dy};
+	double q[4] = {p1.x() - rect.left(), rect.right() - p1.x(), p1.y() - rect.top(), rect.bottom() - p1.y()};
+	
+	for (int i = 0; i < 4; i++)
+	{
+		if (p[i] == 0)
+		{
+			if (q[i] < 0) // parallel to this side and outside
+				return false;
+		}
+		else
+		{
+			double t = q[i] / p[i];
+			if (p[i] < 0)
+			{
+				if (t > t1)
+					return false;
+				if (t > t0)
+					t0 = t;
+			}
+			else
+			{
+				if (t < t0)
+					return false;
+				if (t < t1)
+					t1 = t;
+			}
+		}
+	}
+	return true;
+}
+
+
+bool circleIntersectsRect(QPointF centre, double radius, const QRectF &rect)
+{
+	double closestX = qBound(rect.left(), centre.x(), rect.right());
+	double closestY = qBound(rect.top(), centre.y(), rect.bottom());
+	double dx = centre.x() - closestX;
+	double dy = centre.y() - closestY;
+	return dx*dx + dy*dy <= radius*radius;
+}
+
+
+
+
+SpatialIndex::SpatialIndex()
+{
+	cellSize = 1;
+	nColumns = 0;
+	nRows = 0;
+	queryCounter = 0;
+}
+
+
+void SpatialIndex::clear()
+{
+	nColumns = 0;
+	nRows = 0;
+	indexedNodes.clear();
+	nodePositions.clear();
+	nodeCellStart.clear();
+	nodeCellItems.clear();
+	indexedEdges.clear();
+	edgeSourcePoints.clear();
+	edgeDestPoints.clear();
+	edgeCellStart.clear();
+	edgeCellItems.clear();
+	nodeLastQuery.clear();
+	edgeLastQuery.clear();
+}
+
+
+void SpatialIndex::cellRange(const QRectF &rect, int &firstColumn, int &firstRow, int &lastColumn, int &lastRow)
+{
+	firstColumn = qBound(0, int(floor((rect.left() - bounds.left()) / cellSize)), nColumns - 1);
+	lastColumn = qBound(0, int(floor((rect.right() - bounds.left()) / cellSize)), nColumns - 1);
+	firstRow = qBound(0, int(floor((rect.top() - bounds.top()) / cellSize)), nRows - 1);
+	lastRow = qBound(0, int(floor((rect.bottom() - bounds.top()) / cellSize)), nRows - 1);
+}
+
+
+/* The cells are filled in two passes, first counting the items of each cell and
+ then placing them, so that each cell is a contiguous range of one array. */
+
+void SpatialIndex::build(const QList<Node *> &nodes, const QList<Edge *> &edges)
+{
+	clear();
+	if (nodes.isEmpty())
+		return;
+	indexItems(nodes, edges);
+	
+	// edges end on nodes, so the bounding box of the nodes contains everything
+	double minX = nodePositions[0].x();
+	double maxX = minX;
+	double minY = nodePositions[0].y();
+	double maxY = minY;
+	for (int i = 1; i < nodePositions.size(); i++)
+	{
+		minX = qMin(minX, nodePositions[i].x());
+		maxX = qMax(maxX, nodePositions[i].x());
+		minY = qMin(minY, nodePositions[i].y());
+		maxY = qMax(maxY, nodePositions[i].y());
+	}
+	bounds = QRectF(minX, minY, maxX - minX, maxY - minY).adjusted(-nodeRadius, -nodeRadius, nodeRadius, nodeRadius);
+	
+	// about one node per cell, but not so many cells that the grid is mostly empty memory
+	cellSize = sqrt(bounds.width() * bounds.height() / nodes.size());
+	cellSize = qMax(cellSize, qMax(bounds.width(), bounds.height()) / maxCellsPerSide);
+	cellSize = qMax(cellSize, 2*nodeRadius);
+	nColumns = int(bounds.width() / cellSize) + 1;
+	nRows = int(bounds.height() / cellSize) + 1;
+	int nCells = nColumns * nRows;
+	
+	int firstColumn, firstRow, lastColumn, lastRow;
+	
+	QVector<int> cellCursor;
+	
+	nodeCellStart.fill(0, nCells + 1);
+	for (int pass = 0; pass < 2; pass++)
+	{
+		if (pass == 1)
+		{
+			for (int c = 0; c < nCells; c++)
+				nodeCellStart[c+1] += nodeCellStart[c];
+			nodeCellItems.resize(nodeCellStart[nCells]);
+			cellCursor = nodeCellStart;
+		}
+		for (int i = 0; i < nodePositions.size(); i++)
+		{
+			QRectF nodeRect(nodePositions[i].x() - nodeRadius, nodePositions[i].y() - nodeRadius, 2*nodeRadius, 2*nodeRadius);
+			cellRange(nodeRect, firstColumn, firstRow, lastColumn, lastRow);
+			for (int row = firstRow; row <= lastRow; row++)
+			{
+				for (int column = firstColumn; column <= lastColumn; column++)
+				{
+					int cell = row * nColumns + column;
+					if (pass == 0)
+						nodeCellStart[cell + 1]++;
+					else
+						nodeCellItems[cellCursor[cell]++] = i;
+				}
+			}
+		}
+	}
+	
+	edgeCellStart.fill(0, nCells + 1);
+	for (int pass = 0; pass < 2; pass++)
+	{
+		if (pass == 1)
+		{
+			for (int c = 0; c < nCells; c++)
+				edgeCellStart[c+1] += edgeCellStart[c];
+			edgeCellItems.resize(edgeCellStart[nCells]);
+			cellCursor = edgeCellStart;
+		}
+		for (int i = 0; i < indexedEdges.size(); i++)
+		{
+			QRectF edgeRect = QRectF(edgeSourcePoints[i], edgeDestPoints[i]).normalized();
+			cellRange(edgeRect, firstColumn, firstRow, lastColumn, lastRow);
+			for (int row = firstRow; row <= lastRow; row++)
+			{
+				for (int column = firstColumn; column <= lastColumn; column++)
+				{
+					// slightly enlarged, so that rounding cannot leave out an edge touching the border of the cell
+					QRectF cellRect(bounds.left() + column*cellSize, bounds.top() + row*cellSize, cellSize, cellSize);
+					cellRect.adjust(-1e-6*cellSize, -1e-6*cellSize, 1e-6*cellSize, 1e-6*cellSize);
+					// a long diagonal edge only goes through a few of the cells of its bounding box
+					if (!segmentIntersectsRect(edgeSourcePoints[i], edgeDestPoints[i], cellRect))
+						continue;
+					int cell = row * nColumns + column;
+					if (pass == 0)
+						edgeCellStart[cell + 1]++;
+					else
+						edgeCellItems[cellCursor[cell]++] = i;
+				}
+			}
+		}
+	}
+
+	nodeLastQuery.fill(-1, indexedNodes.size());
+	edgeLastQuery.fill(-1, indexedEdges.size());
+	queryCounter = 0;
+}
+
+
+void SpatialIndex::indexItems(const QList<Node *> &nodes, const QList<Edge *> &edges)
+{
+	indexedNodes.reserve(nodes.size());
+	nodePositions.reserve(nodes.size());
+	foreach (Node *pNode, nodes)
+	{
+		indexedNodes.append(pNode);
+		nodePositions.append(pNode->pos());
+	}
+	indexedEdges.reserve(edges.size());
+	edgeSourcePoints.reserve(edges.size());
+	edgeDestPoints.reserve(edges.size());
+	foreach (Edge *pEdge, edges)
+	{
+		indexedEdges.append(pEdge);
+		edgeSourcePoints.append(pEdge->getSourceNode()->pos());
+		edgeDestPoints.append(pEdge->getDestNode()->pos());
+	}
+}
+
+
+void SpatialIndex::save(QDataStream &out) const
+{
+	out << bounds << cellSize << qint32(nColumns) << qint32(nRows)
+		<< nodeCellStart << nodeCellItems << edgeCellStart << edgeCellItems;
+}
+
+
+// the starts of the cells go from 0 to nItems without ever decreasing
+static bool areCellStartsValid(const QVector<int> &cellStart, int nItems)
+{
+	if (cellStart.isEmpty() || cellStart.first() != 0 || cellStart.last() != nItems)
+		return false;
+	for (int cell = 1; cell < cellStart.size(); cell++)
+	{
+		if (cellStart[cell] < cellStart[cell - 1])
+			return false;
+	}
+	return true;
+}
+
+
+/* The cells are read back and checked against the items, so that a grid that
+ does not fit them is refused and built again instead of pointing outside:
+ the grid must have a positive size, the starts of the cells must be in order
+ and the items must be those of the network. */
+
+bool SpatialIndex::restore(const QList<Node *> &nodes, const QList<Edge *> &edges, QDataStream &in)
+{
+	clear();
+	qint32 storedColumns, storedRows;
+	in >> bounds >> cellSize >> storedColumns >> storedRows
+		>> nodeCellStart >> nodeCellItems >> edgeCellStart >> edgeCellItems;
+	nColumns = storedColumns;
+	nRows = storedRows;
+	qint64 nCells = qint64(nColumns) * nRows; // a damaged file can give any number of columns and rows
+	bool isValid = in.status() == QDataStream::Ok && !nodes.isEmpty() && nColumns > 0 && nRows > 0
+		&& cellSize > 0 && bounds.isValid()
+		&& nodeCellStart.size() == nCells + 1 && edgeCellStart.size() == nCells + 1
+		&& areCellStartsValid(nodeCellStart, nodeCellItems.size()) && areCellStartsValid(edgeCellStart, edgeCellItems.size());
+	for (int i = 0; isValid && i < nodeCellItems.size(); i++)
+	{
+		isValid = nodeCellItems[i] >= 0 && nodeCellItems[i] < nodes.size();
+	}
+	for (int i = 0; isValid && i < edgeCellItems.size(); i++)
+	{
+		isValid = edgeCellItems[i] >= 0 && edgeCellItems[i] < edges.size();
+	}
+	if (!isValid)
+	{
+		clear();
+		return false;
+	}
+	
+	indexItems(nodes, edges);
+	nodeLastQuery.fill(-1, indexedNodes.size());
+	edgeLastQuery.fill(-1, indexedEdges.size());
+	queryCounter = 0;
+	return true;
+}
+
+
+
+// returns the nodes whose shape intersects the rectangle, visible or not
+QList<Node *> SpatialIndex::nodes(const QRectF &rect)
+{
+	QList<Node *> foundNodes;
+	if (nColumns == 0)
+		return foundNodes;
+	
+	queryCounter++;
+	int firstColumn, firstRow, lastColumn, lastRow;
+	
+	cellRange(rect.adjusted(-nodeRadius, -nodeRadius, nodeRadius, nodeRadius), firstColumn, firstRow, lastColumn, lastRow);
+	for (int row = firstRow; row <= lastRow; row++)
+	{
+		for (int column = firstColumn; column <= lastColumn; column++)
+		{
+			int cell = row * nColumns + column;
+			for (int k = nodeCellStart[cell]; k < nodeCellStart[cell + 1]; k++)
+			{
+				int i = nodeCellItems[k];
+				if (nodeLastQuery[i] == queryCounter)
+					continue;
+				nodeLastQuery[i] = queryCounter;
+				if (circleIntersectsRect(nodePositions[i], nodeRadius, rect))
+					foundNodes.append(indexedNodes[i]);
+			}
+		}
+	}
+	return foundNodes;
+}
+
+
+
+// returns the visible nodes, stomata and edges whose shape intersects the rectangle
+QList<QGraphicsItem *> SpatialIndex::items(const QRectF &rect)
+{
+	QList<QGraphicsItem *> foundItems;
+	if (nColumns == 0)
+		return foundItems;
+	
+	foreach (Node *pNode, nodes(rect))
+	{
+		if (pNode->isVisible())
+			foundItems.append(pNode);
+		if (pNode->getStoma() != NULL && pNode->getStoma()->isVisible())
+			foundItems.append(pNode->getStoma());
+	}
+	
+	queryCounter++;
+	int firstColumn, firstRow, lastColumn, lastRow;
+	
+	cellRange(rect, firstColumn, firstRow, lastColumn, lastRow);
+	for (int row = firstRow; row <= lastRow; row++)
+	{
+		for (int column = firstColumn; column <= lastColumn; column++)
+		{
+			int cell = row * nColumns + column;
+			for (int k = edgeCellStart[cell]; k < edgeCellStart[cell + 1]; k++)
+			{
+				int i = edgeCellItems[k];
+				if (edgeLastQuery[i] == queryCounter)
+					continue;
+				edgeLastQuery[i] = queryCounter;
+				if (indexedEdges[i]->isVisible() && segmentIntersectsRect(edgeSourcePoints[i], edgeDestPoints[i], rect))
+					foundItems.append(indexedEdges[i]);
+			}
+		}
+	}
+	
+	return foundItems;
+}
@@ -0,0 +1,86 @@
+/***************************************************************************
+ copyright            : (C) 2011 by Andrea Perna
+ email                : perna@math.uu.se
+ ***************************************************************************/
+
+/*******************************************************************************
+ *     This program is free software: you can redistribute it and/or modify     *
+ *     it under the terms of the GNU General Public License as published by     *
+ *     the Free Software Foundation, either version 3 of the License, or        *
+ *     (at your option) any later version.                                      *
+ *                                                                              *
+ *     This program is distributed in the hope that it will be useful,          *
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the            *
+ *     GNU General Public License for more details.                             *
+ *                                                                              *
+ *     You can find a copy of the GNU General Public License at the             *
+ *     following address: <http://www.gnu.org/licenses/>.                       *
+ ********************************************************************************/
+
+#ifndef SPATIALINDEX_H
+#define SPATIALINDEX_H
+
+#include <QList>
+#include <QVector>
+#include <QPointF>
+#include <QRectF>
+
+class Node;
+class Edge;
+class QGraphicsItem;
+class QDataStream;
+
+
+/* A uniform grid over the nodes and the edges of the network, used to find the
+ items under the mouse and inside the selection rectangle without testing every
+ item of the scene. Stomata are found through the node that carries them, since
+ they sit at the position of their node. The grid does not follow the items: it
+ must be rebuilt whenever a node moves or an edge is added or removed. */
+
+class SpatialIndex
+{
+public:
+	SpatialIndex();
+	
+	void build(const QList<Node *> &nodes, const QList<Edge *> &edges);
+	void clear();
+	
+	// the grid of the same nodes and edges, in the same order, as when it was saved, see networksidecar.h
+	void save(QDataStream &out) const;
+	bool restore(const QList<Node *> &nodes, const QList<Edge *> &edges, QDataStream &in);
+	
+	QList<Node *> nodes(const QRectF &rect);
+	QList<QGraphicsItem *> items(const QRectF &rect);
+	
+private:
+	void indexItems(const QList<Node *> &nodes, const QList<Edge *> &edges);
+	void cellRange(const QRectF &rect, int &firstColumn, int &firstRow, int &lastColumn, int &lastRow);
+	
+	QRectF bounds;
+	double cellSize;
+	int nColumns;
+	int nRows;
+	
+	QVector<Node *> indexedNodes;
+	QVector<QPointF> nodePositions;
+	QVector<int> nodeCellStart; // the nodes in cell c are nodeCellItems[nodeCellStart[c]] to nodeCellItems[nodeCellStart[c+1]-1]
+	QVector<int> nodeCellItems;
+	
+	QVector<Edge *> indexedEdges;
+	QVector<QPointF> edgeSourcePoints;
+	QVector<QPointF> edgeDestPoints;
+	QVector<int> edgeCellStart;
+	QVector<int> edgeCellItems;
+	
+	// an item found in several cells is only reported once per query
+	QVector<int> nodeLastQuery;
+	QVector<int> edgeLastQuery;
+	int queryCounter;
+};
+
+
+bool segmentIntersectsRect(QPointF p1, QPointF p2, const QRectF &rect);
+bool circleIntersectsRect(QPointF centre, double radius, const QRectF &rect);
+
+#endif
@@ -0,0 +1,438 @@
+/***************************************************************************
+ copyright            : (C) 2011 by Andrea Perna
+ email                : perna@math.uu.se
+ ***************************************************************************/
+
+/*******************************************************************************
+ *     This program is free software: you can redistribute it and/or modify     *
+ *     it under the terms of the GNU General Public License as published by     *
+ *     the Free Software Foundation, either version 3 of the License, or        *
+ *     (at your option) any later version.                                      *
+ *                                                                              *
+ *     This program is distributed in the hope that it will be useful,          *
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the            *
+ *     GNU General Public License for more details.                             *
+ *                                                                              *
+ *     You can find a copy of the GNU General Public License at the             *
+ *     following address: <http://www.gnu.org/licenses/>.                       *
+ ********************************************************************************/
+
+#include "stochasticengines.h"
+#include "randomnumbers.h"
+
+#include <cmath>
+#include <limits>
+
+
+static const double never = std::numeric_limits<double>::infinity();
+static const int exactEventsPerFallback = 100; // exact events simulated when a leap would be too short
+static const double minimumEventsPerLeap = 10; // below this expected number of events per leap, exact events are cheaper
+
+
+
+
+static int numberOfReactions(const ReactionNetwork &network)
+{
+	return network.edgeSource.size() + network.stomaNode.size();
+}
+
+
+static double propensity(const ReactionNetwork &network, int reaction)
+{
+	int nEdges = network.edgeSource.size();
+	if (reaction < nEdges)
+		return network.edgeSigma[reaction] * abs(network.nParticles[network.edgeDest[reaction]] - network.nParticles[network.edgeSource[reaction]]);
+	int stoma = reaction - nEdges;
+	return network.stomaSigma[stoma] * network.nParticles[network.stomaNode[stoma]];
+}
+
+
+static void moveParticles(ReactionNetwork &network, int from, int to, int count)
+{
+	if (from >= 0 && !network.isSource[from])
+		network.nParticles[from] -= count;
+	if (to >= 0 && !network.isSource[to])
+		network.nParticles[to] += count;
+}
+
+
+/* Fires the reaction count times. The direction of an edge is given, because
+ in a leap all the reactions are drawn from the state at the start of the leap:
+ positive from source to dest. */
+
+static void fire(ReactionNetwork &network, int reaction, int direction, int count)
+{
+	int nEdges = network.edgeSource.size();
+	if (reaction < nEdges)
+	{
+		if (direction > 0)
+			moveParticles(network, network.edgeSource[reaction], network.edgeDest[reaction], count);
+		else
+			moveParticles(network, network.edgeDest[reaction], network.edgeSource[reaction], count);
+		network.edgeFlow[reaction] += direction * count;
+	}
+	else
+	{
+		int stoma = reaction - nEdges;
+		moveParticles(network, network.stomaNode[stoma], -1, count);
+		network.stomaFlow[stoma] += count;
+	}
+}
+
+
+// towards the node with fewer particles, 0 for a stoma or an edge without difference
+static int direction(const ReactionNetwork &network, int reaction)
+{
+	if (reaction >= network.edgeSource.size())
+		return 1;
+	int difference = network.nParticles[network.edgeSource[reaction]] - network.nParticles[network.edgeDest[reaction]];
+	return difference > 0 ? 1 : (difference < 0 ? -1 : 0);
+}
+
+
+static void resetFlows(ReactionNetwork &network)
+{
+	network.edgeFlow.fill(0, network.edgeSource.size());
+	network.stomaFlow.fill(0, network.stomaNode.size());
+}
+
+
+
+
+// binary heap of the reactions by their next time, that knows where each reaction is
+class ReactionQueue
+{
+public:
+	ReactionQueue(const QVector<double> &initialTimes) : times(initialTimes)
+	{
+		heap.resize(times.size());
+		position.resize(times.size());
+		for (int i = 0; i < times.size(); i++)
+		{
+			heap[i] = i;
+			position[i] = i;
+		}
+		for (int i = heap.size() / 2 - 1; i >= 0; i--)
+		{
+			siftDown(i);
+		}
+	}
+	
+	int first() const { return heap[0]; }
+	double time(int reaction) const { return times[reaction]; }
+	
+	void update(int reaction, double newTime)
+	{
+		double oldTime = times[reaction];
+		times[reaction] = newTime;
+		if (newTime < oldTime)
+			siftUp(position[reaction]);
+		else
+			siftDown(position[reaction]);
+	}
+	
+private:
+	void swap(int i, int j)
+	{
+		int reaction = heap[i];
+		heap[i] = heap[j];
+		heap[j] = reaction;
+		position[heap[i]] = i;
+		position[heap[j]] = j;
+	}
+	
+	void siftUp(int i)
+	{
+		while (i > 0 && times[heap[(i - 1) / 2]] > times[heap[i]])
+		{
+			swap(i, (i - 1) / 2);
+			i = (i - 1) / 2;
+		}
+	}
+	
+	void siftDown(int i)
+	{
+		for (;;)
+		{
+			int smallest = i;
+			int left = 2 * i + 1;
+			int right = left + 1;
+			if (left < heap.size() && times[heap[left]] < times[heap[smallest]])
+				smallest = left;
+			if (right < heap.size() && times[heap[right]] < times[heap[smallest]])
+				smallest = right;
+			if (smallest == i)
+				return;
+			swap(i, smallest);
+			i = smallest;
+		}
+	}
+	
+	QVector<double> times;
+	QVector<int> heap;
+	QVector<int> position;
+};
+
+
+// the reactions that involve each node, in compressed rows
+static void reactionsOfNodes(const ReactionNetwork &network, QVector<int> &first, QVector<int> &reactions)
+{
+	int nNodes = network.nParticles.size();
+	int nEdges = network.edgeSource.size();
+	first.fill(0, nNodes + 1);
+	for (int i = 0; i < nEdges; i++)
+	{
+		first[network.edgeSource[i] + 1]++;
+		first[network.edgeDest[i] + 1]++;
+	}
+	for (int i = 0; i < network.stomaNode.size(); i++)
+	{
+		first[network.stomaNode[i] + 1]++;
+	}
+	for (int node = 0; node < nNodes; node++)
+	{
+		first[node + 1] += first[node];
+	}
+	reactions.resize(first[nNodes]);
+	QVector<int> cursor = first;
+	for (int i = 0; i < nEdges; i++)
+	{
+		reactions[cursor[network.edgeSource[i]]++] = i;
+		reactions[cursor[network.edgeDest[i]]++] = i;
+	}
+	for (int i = 0; i < network.stomaNode.size(); i++)
+	{
+		reactions[cursor[network.stomaNode[i]]++] = nEdges + i;
+	}
+}
+
+
+static double nextTime(double now, double rate)
+{
+	return rate > 0 ? now - log(uniformRandomNumber()) / rate : never;
+}
+
+
+/* Gibson and Bruck: every reaction keeps the absolute time of its next firing.
+ After an event only the reactions that share a node with it change their
+ propensity, and their times are rescaled without drawing new random numbers. */
+
+int simulateGillespie(ReactionNetwork &network, double duration)
+{
+	resetFlows(network);
+	int nReactions = numberOfReactions(network);
+	if (nReactions == 0)
+		return 0;
+	int nEdges = network.edgeSource.size();
+	
+	QVector<int> firstReaction;
+	QVector<int> nodeReactions;
+	reactionsOfNodes(network, firstReaction, nodeReactions);
+	
+	QVector<double> rates(nReactions);
+	QVector<double> times(nReactions);
+	for (int reaction = 0; reaction < nReactions; reaction++)
+	{
+		rates[reaction] = propensity(network, reaction);
+		times[reaction] = nextTime(0, rates[reaction]);
+	}
+	ReactionQueue queue(times);
+	QVector<int> lastSeen(nReactions, -1); // event in which each reaction was last updated
+	
+	int nEvents = 0;
+	for (;;)
+	{
+		int reaction = queue.first();
+		double now = queue.time(reaction);
+		if (now > duration)
+			break;
+		fire(network, reaction, direction(network, reaction), 1);
+		
+		int nodes[2];
+		int nNodes = 0;
+		if (reaction < nEdges)
+		{
+			nodes[nNodes++] = network.edgeSource[reaction];
+			nodes[nNodes++] = network.edgeDest[reaction];
+		}
+		else
+		{
+			nodes[nNodes++] = network.stomaNode[reaction - nEdges];
+		}
+		for (int k = 0; k < nNodes; k++)
+		{
+			for (int i = firstReaction[nodes[k]]; i < firstReaction[nodes[k] + 1]; i++)
+			{
+				int other = nodeReactions[i];
+				if (lastSeen[other] == nEvents)
+					continue;
+				lastSeen[other] = nEvents;
+				double rate = propensity(network, other);
+				double time;
+				if (other == reaction || rates[other] <= 0)
+					time = nextTime(now, rate);
+				else if (rate > 0)
+					time = now + (rates[other] / rate) * (queue.time(other) - now);
+				else
+					time = never;
+				rates[other] = rate;
+				queue.update(other, time);
+			}
+		}
+		nEvents++;
+	}
+	return nEvents;
+}
+
+
+
+
+// exact events with the direct method, until maxEvents events or the end of the interval; returns the events
+static int directMethod(ReactionNetwork &network, double &now, double end, int maxEvents)
+{
+	int nReactions = numberOfReactions(network);
+	QVector<double> rates(nReactions);
+	for (int nEvents = 0; nEvents < maxEvents; nEvents++)
+	{
+		double total = 0;
+		for (int reaction = 0; reaction < nReactions; reaction++)
+		{
+			rates[reaction] = propensity(network, reaction);
+			total += rates[reaction];
+		}
+		double next = nextTime(now, total);
+		if (next > end)
+		{
+			now = end;
+			return nEvents;
+		}
+		now = next;
+		double target = uniformRandomNumber() * total;
+		int reaction = 0;
+		while (reaction < nReactions - 1 && (target -= rates[reaction]) > 0)
+		{
+			reaction++;
+		}
+		fire(network, reaction, direction(network, reaction), 1);
+	}
+	return maxEvents;
+}
+
+
+int simulateTauLeaping(ReactionNetwork &network, double duration, double epsilon)
+{
+	resetFlows(network);
+	int nReactions = numberOfReactions(network);
+	int nNodes = network.nParticles.size();
+	int nEdges = network.edgeSource.size();
+	QVector<double> rates(nReactions);
+	QVector<int> directions(nReactions);
+	QVector<double> drift(nNodes);
+	QVector<double> variance(nNodes);
+	QVector<int> counts(nReactions);
+	
+	int nSteps = 0;
+	double now = 0;
+	while (now < duration)
+	{
+		double total = 0;
+		double maxSigma = 0;
+		drift.fill(0);
+		variance.fill(0);
+		for (int reaction = 0; reaction < nReactions; reaction++)
+		{
+			rates[reaction] = propensity(network, reaction);
+			directions[reaction] = direction(network, reaction);
+			total += rates[reaction];
+			int from, to;
+			if (reaction < nEdges)
+			{
+				maxSigma = qMax(maxSigma, network.edgeSigma[reaction]);
+				from = directions[reaction] > 0 ? network.edgeSource[reaction] : network.edgeDest[reaction];
+				to = directions[reaction] > 0 ? network.edgeDest[reaction] : network.edgeSource[reaction];
+			}
+			else
+			{
+				maxSigma = qMax(maxSigma, network.stomaSigma[reaction - nEdges]);
+				from = network.stomaNode[reaction - nEdges];
+				to = -1;
+			}
+			drift[from] -= rates[reaction];
+			variance[from] += rates[reaction];
+			if (to >= 0)
+			{
+				drift[to] += rates[reaction];
+				variance[to] += rates[reaction];
+			}
+		}
+		if (total <= 0)
+			break; // nothing can happen any more
+		
+		// the bound of Cao, Gillespie and Petzold on the relative change of every node
+		double tau = duration - now;
+		if (maxSigma > 0)
+			tau = qMin(tau, 1.0 / maxSigma); // the probability of the binomial draws stays below one
+		for (int node = 0; node < nNodes; node++)
+		{
+			if (network.isSource[node] || variance[node] <= 0)
+				continue;
+			double allowedChange = qMax(epsilon * network.nParticles[node], 1.0);
+			if (drift[node] != 0)
+				tau = qMin(tau, allowedChange / fabs(drift[node]));
+			tau = qMin(tau, allowedChange * allowedChange / variance[node]);
+		}
+		
+		if (tau * total < minimumEventsPerLeap && tau < duration - now)
+		{
+			nSteps += directMethod(network, now, duration, exactEventsPerFallback);
+			continue;
+		}
+		
+		// the leap is drawn from the state at its start, and taken again shorter if a node would become negative
+		for (;;)
+		{
+			QVector<int> before = network.nParticles;
+			QVector<int> edgeFlowBefore = network.edgeFlow;
+			QVector<int> stomaFlowBefore = network.stomaFlow;
+			bool isNegative = false;
+			for (int reaction = 0; reaction < nReactions; reaction++)
+			{
+				if (rates[reaction] <= 0)
+					continue;
+				int nExcess;
+				double sigma;
+				if (reaction < nEdges)
+				{
+					nExcess = abs(network.nParticles[network.edgeSource[reaction]] - network.nParticles[network.edgeDest[reaction]]);
+					sigma = network.edgeSigma[reaction];
+				}
+				else
+				{
+					nExcess = network.nParticles[network.stomaNode[reaction - nEdges]];
+					sigma = network.stomaSigma[reaction - nEdges];
+				}
+				counts[reaction] = binomDist(nExcess, qMin(1.0, sigma * tau));
+			}
+			for (int reaction = 0; reaction < nReactions; reaction++)
+			{
+				if (rates[reaction] > 0 && counts[reaction] > 0)
+					fire(network, reaction, directions[reaction], counts[reaction]);
+			}
+			for (int node = 0; node < nNodes; node++)
+			{
+				if (network.nParticles[node] < 0)
+					isNegative = true;
+			}
+			if (!isNegative)
+				break;
+			network.nParticles = before;
+			network.edgeFlow = edgeFlowBefore;
+			network.stomaFlow = stomaFlowBefore;
+			tau /= 2;
+		}
+		now += tau;
+		nSteps++;
+	}
+	return nSteps;
+}
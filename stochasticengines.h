@@ -0,0 +1,64 @@
+/***************************************************************************
+ copyright            : (C) 2011 by Andrea Perna
+ email                : perna@math.uu.se
+ ***************************************************************************/
+
+/*******************************************************************************
+ *     This program is free software: you can redistribute it and/or modify     *
+ *     it under the terms of the GNU General Public License as published by     *
+ *     the Free Software Foundation, either version 3 of the License, or        *
+ *     (at your option) any later version.                                      *
+ *                                                                              *
+ *     This program is distributed in the hope that it will be useful,          *
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the            *
+ *     GNU General Public License for more details.                             *
+ *                                                                              *
+ *     You can find a copy of the GNU General Public License at the             *
+ *     following address: <http://www.gnu.org/licenses/>.                       *
+ ********************************************************************************/
+
+#ifndef STOCHASTICENGINES_H
+#define STOCHASTICENGINES_H
+
+#include <QVector>
+
+
+/* Continuous time alternatives to the fixed step of GraphWidget. The network is
+ seen as a set of reactions: along each edge a particle in excess on one side
+ moves to the other side with rate sigma, so the edge fires with propensity
+ sigma * |n_source - n_dest| towards the node with fewer particles, and each
+ stoma lets a particle out with propensity sigma * n. These are the rates whose
+ fixed step discretisation is the binomial draw of performOneSimulationStep.
+ Sources keep their number of particles.
+ 
+ Both engines advance the network by a given duration and add the particles
+ moved to edgeFlow and stomaFlow, so that the caller can update the
+ conductivities once per interval as the fixed step does. */
+
+
+struct ReactionNetwork
+{
+	QVector<int> nParticles;
+	QVector<bool> isSource;
+	QVector<int> edgeSource;
+	QVector<int> edgeDest;
+	QVector<double> edgeSigma;
+	QVector<int> edgeFlow; // particles moved from source to dest, negative the other way
+	QVector<int> stomaNode;
+	QVector<double> stomaSigma;
+	QVector<int> stomaFlow;
+};
+
+
+// exact, one event at a time, with the next reaction method of Gibson and Bruck; returns the number of events
+int simulateGillespie(ReactionNetwork &network, double duration);
+
+/* Binomial tau leaping: each leap is the longest for which the expected change
+ of the particles at every node stays within a fraction epsilon of their
+ number, and sigma * tau stays below one. When the leap would be shorter than a
+ few exact events, exact events are simulated instead. Returns the number of
+ leaps and exact events. */
+int simulateTauLeaping(ReactionNetwork &network, double duration, double epsilon = 0.03);
+
+#endif
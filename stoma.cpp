@@ -20,13 +20,16 @@
 
 
 #include <QPainter>
+#include <QGraphicsScene>
 #include <QGraphicsSceneMouseEvent>
+#include <QStyleOptionGraphicsItem>
 
 
 
 #include "stoma.h"
 #include "node.h"
 #include "graphwidget.h"
+#include "glyphatlas.h"
 
 
 
@@ -35,12 +38,14 @@
 
 
 
+
 Stoma::Stoma(GraphWidget *graphWidget, Node *sourceNode)
 : pGraph(graphWidget)
 {
 //	setFlag(ItemIsMovable);
 //	setFlag(ItemSendsGeometryChanges);
 //    setCacheMode(DeviceCoordinateCache);    
+	setFlag(ItemHasNoContents); // drawn by GraphWidget::drawForeground, as the nodes
 	setZValue(2);
 	
 	source = sourceNode;
@@ -182,7 +187,7 @@ void Stoma::reColour(QString colouringStomataParameter, QString stomataColourSca
 		colourLight = Qt::cyan;
 		colourDark = Qt::darkCyan;
 	}
-	update();
+	updateGlyph();
 }
 
 
@@ -218,23 +223,30 @@ QPainterPath Stoma::shape() const
 
 
 
-void Stoma::paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *)
+QColor Stoma::getColourLight()
 {
-	bool drawStomata = true; // do we really want to draw the stomata or not?
-	if (drawStomata)
-	{
-		painter->setPen(Qt::NoPen);
-		painter->setBrush(Qt::darkGray);
-		painter->drawEllipse(-1, -1, 3, 3);
-		
-		QRadialGradient gradient(-0.5, -0.5, 1.5);
-		gradient.setColorAt(0, colourLight);
-		gradient.setColorAt(1, colourDark);
-		
-		painter->setBrush(gradient);
-		painter->setPen(QPen(Qt::black, 0));
-		painter->drawEllipse(-1.5, -1.5, 3, 3);
-	}
+	return colourLight;
+}
+
+
+QColor Stoma::getColourDark()
+{
+	return colourDark;
+}
+
+
+// the item has no contents of its own, so the area of its glyph is repainted explicitly
+void Stoma::updateGlyph()
+{
+	if (scene())
+		scene()->update(sceneBoundingRect());
+}
+
+
+// only used if the item is drawn by Qt, the graph widget normally draws the glyphs itself
+void Stoma::paint(QPainter *painter, const QStyleOptionGraphicsItem *, QWidget *)
+{
+	paintGlyph(painter, colourLight, colourDark);
 }
 
 
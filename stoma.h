@@ -44,6 +44,9 @@ public:
 	void setSourceNode(Node *node);
 	
 
+	QColor getColourLight();
+	QColor getColourDark();
+	void updateGlyph();
 	void reColour(QString colouringStomataParameter, QString stomataColourScale);
 	void paintPicture(QPainter &painter);
 //	
@@ -0,0 +1,234 @@
+/***************************************************************************
+ copyright            : (C) 2011 by Andrea Perna
+ email                : perna@math.uu.se
+ ***************************************************************************/
+
+/*******************************************************************************
+ *     This program is free software: you can redistribute it and/or modify     *
+ *     it under the terms of the GNU General Public License as published by     *
+ *     the Free Software Foundation, either version 3 of the License, or        *
+ *     (at your option) any later version.                                      *
+ *                                                                              *
+ *     This program is distributed in the hope that it will be useful,          *
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the            *
+ *     GNU General Public License for more details.                             *
+ *                                                                              *
+ *     You can find a copy of the GNU General Public License at the             *
+ *     following address: <http://www.gnu.org/licenses/>.                       *
+ ********************************************************************************/
+
+#include "textwriter.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+
+static const int bufferSize = 1 << 20;
+
+
+TextWriter::TextWriter()
+{
+	used = 0;
+	hasFailed = false;
+}
+
+
+TextWriter::~TextWriter()
+{
+	close();
+}
+
+
+bool TextWriter::open(QString fileName)
+{
+	close();
+	file.setFileName(fileName);
+	if (!file.open(QIODevice::WriteOnly | QIODevice::Text))
+		return false;
+	buffer.resize(bufferSize);
+	used = 0;
+	hasFailed = false;
+	return true;
+}
+
+
+// returns false if any of the writes failed
+bool TextWriter::close()
+{
+	if (!file.isOpen())
+		return !hasFailed;
+	flushBuffer();
+	file.close();
+	return !hasFailed;
+}
+
+
+void TextWriter::flushBuffer()
+{
+	if (used > 0 && file.write(buffer.constData(), used) != used)
+	{
+		hasFailed = true;
+	}
+	used = 0;
+}
+
+
+void TextWriter::reserve(int nBytes)
+{
+	if (used + nBytes > buffer.size())
+	{
+		flushBuffer();
+		if (nBytes > buffer.size())
+		{
+			buffer.resize(nBytes);
+		}
+	}
+}
+
+
+TextWriter &TextWriter::operator<<(int value)
+{
+	reserve(12);
+	char digits[12];
+	int nDigits = 0;
+	// work on the unsigned value, so that INT_MIN has no positive counterpart problem
+	unsigned int magnitude = value < 0 ? 0u - (unsigned int)value : (unsigned int)value;
+	do
+	{
+		digits[nDigits++] = char('0' + magnitude % 10);
+		magnitude /= 10;
+	} while (magnitude > 0);
+	
+	char *out = buffer.data() + used;
+	if (value < 0)
+	{
+		*out++ = '-';
+	}
+	while (nDigits > 0)
+	{
+		*out++ = digits[--nDigits];
+	}
+	used = out - buffer.constData();
+	return *this;
+}
+
+
+/* printf("%g") is the slow part of writing a network. Here the value is scaled
+ to an integer with six digits, which is exact for all the numbers that %g does
+ not write in scientific notation. Values in scientific notation, and values
+ falling so close to half a unit in the last digit that the rounding could
+ differ from printf, still go through snprintf. */
+
+static const double powersOfTen[] = {1e-4, 1e-3, 1e-2, 1e-1, 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9};
+
+TextWriter &TextWriter::operator<<(double value)
+{
+	reserve(32);
+	char *out = buffer.data() + used;
+	double magnitude = fabs(value);
+	
+	if (value == 0)
+	{
+		*out++ = '0';
+		used = out - buffer.constData();
+		return *this;
+	}
+	
+	if (magnitude >= 1e-4 && magnitude < 999999.0)
+	{
+		int exponent = -4; // the position of the first significant digit
+		while (exponent < 5 && magnitude >= powersOfTen[exponent + 5])
+		{
+			exponent++;
+		}
+		double scaled = magnitude * powersOfTen[9 - exponent]; // between 1e5 and 1e6
+		double fraction = scaled - floor(scaled);
+		if (fabs(fraction - 0.5) > 1e-6)
+		{
+			int significand = int(floor(scaled + 0.5));
+			if (significand >= 1000000) // rounded up to the next power of ten
+			{
+				significand = 100000;
+				exponent++;
+			}
+			if (exponent < 6)
+			{
+				char digits[6];
+				for (int i = 5; i >= 0; i--)
+				{
+					digits[i] = char('0' + significand % 10);
+					significand /= 10;
+				}
+				int nDigits = 6;
+				while (nDigits > exponent + 1 && digits[nDigits - 1] == '0')
+				{
+					nDigits--;
+				}
+				
+				if (value < 0)
+				{
+					*out++ = '-';
+				}
+				if (exponent >= 0)
+				{
+					for (int i = 0; i < nDigits; i++)
+					{
+						if (i == exponent + 1)
+						{
+							*out++ = '.';
+						}
+						*out++ = digits[i];
+					}
+				}
+				else
+				{
+					*out++ = '0';
+					*out++ = '.';
+					for (int i = 0; i < -exponent - 1; i++)
+					{
+						*out++ = '0';
+					}
+					for (int i = 0; i < nDigits; i++)
+					{
+						*out++ = digits[i];
+					}
+				}
+				used = out - buffer.constData();
+				return *this;
+			}
+		}
+	}
+	
+	used += snprintf(out, 32, "%g", value);
+	return *this;
+}
+
+
+TextWriter &TextWriter::operator<<(char c)
+{
+	reserve(1);
+	buffer.data()[used++] = c;
+	return *this;
+}
+
+
+TextWriter &TextWriter::operator<<(const char *text)
+{
+	int length = int(strlen(text));
+	reserve(length);
+	memcpy(buffer.data() + used, text, length);
+	used += length;
+	return *this;
+}
+
+
+TextWriter &TextWriter::operator<<(const QString &text)
+{
+	QByteArray utf8 = text.toUtf8();
+	reserve(utf8.size());
+	memcpy(buffer.data() + used, utf8.constData(), utf8.size());
+	used += utf8.size();
+	return *this;
+}
@@ -0,0 +1,59 @@
+/***************************************************************************
+ copyright            : (C) 2011 by Andrea Perna
+ email                : perna@math.uu.se
+ ***************************************************************************/
+
+/*******************************************************************************
+ *     This program is free software: you can redistribute it and/or modify     *
+ *     it under the terms of the GNU General Public License as published by     *
+ *     the Free Software Foundation, either version 3 of the License, or        *
+ *     (at your option) any later version.                                      *
+ *                                                                              *
+ *     This program is distributed in the hope that it will be useful,          *
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the            *
+ *     GNU General Public License for more details.                             *
+ *                                                                              *
+ *     You can find a copy of the GNU General Public License at the             *
+ *     following address: <http://www.gnu.org/licenses/>.                       *
+ ********************************************************************************/
+
+#ifndef TEXTWRITER_H
+#define TEXTWRITER_H
+
+#include <QFile>
+#include <QString>
+#include <QByteArray>
+
+
+/* Writes text files through a large buffer, formatting the numbers directly
+ into the buffer. Doubles are written as QTextStream writes them, with six
+ significant digits, so the files are identical to the ones that were written
+ through QTextStream. */
+
+class TextWriter
+{
+public:
+	TextWriter();
+	~TextWriter();
+	
+	bool open(QString fileName);
+	bool close();
+	
+	TextWriter &operator<<(int value);
+	TextWriter &operator<<(double value);
+	TextWriter &operator<<(char c);
+	TextWriter &operator<<(const char *text);
+	TextWriter &operator<<(const QString &text);
+	
+private:
+	void reserve(int nBytes);
+	void flushBuffer();
+	
+	QFile file;
+	QByteArray buffer;
+	int used; // the buffer is allocated once, only the first used bytes are meaningful
+	bool hasFailed;
+};
+
+#endif